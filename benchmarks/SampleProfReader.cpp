@@ -0,0 +1,94 @@
+#include "benchmark/benchmark.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/ProfileData/SampleProf.h"
+#include "llvm/ProfileData/SampleProfReader.h"
+#include "llvm/ProfileData/SampleProfWriter.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/raw_ostream.h"
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace sampleprof;
+
+// Fill FS with NumRecords body records, whose counts span one to four ULEB128
+// bytes like in real profiles, and some call targets.
+static void addSamples(FunctionSamples &FS, unsigned NumRecords,
+                       ArrayRef<std::string> Names, std::mt19937 &Rand) {
+  for (unsigned I = 0; I < NumRecords; ++I) {
+    uint64_t Count = Rand() >> (Rand() % 32);
+    FS.addBodySamples(I, I % 3 == 0 ? I % 7 : 0, Count);
+    FS.addTotalSamples(Count);
+    if (I % 8 == 0)
+      FS.addCalledTargetSamples(I, 0, Names[Rand() % Names.size()], Count);
+  }
+}
+
+// Write a profile of NumFuncs functions with inlined callees in Format to a
+// temporary file and return its contents.
+static std::unique_ptr<MemoryBuffer> createProfile(SampleProfileFormat Format,
+                                                   unsigned NumFuncs) {
+  std::mt19937 Rand(0);
+  std::vector<std::string> Names;
+  for (unsigned I = 0; I < NumFuncs; ++I)
+    Names.push_back("_Z8functionILi" + std::to_string(I) + "EEvv");
+
+  StringMap<FunctionSamples> Profiles;
+  for (const std::string &Name : Names) {
+    FunctionSamples &FS = Profiles[Name];
+    FS.setName(Name);
+    FS.addHeadSamples(Rand() % 1000);
+    addSamples(FS, 40, Names, Rand);
+    for (unsigned I = 0; I < 4; ++I) {
+      const std::string &CalleeName = Names[Rand() % Names.size()];
+      FunctionSamples &Callee =
+          FS.functionSamplesAt(LineLocation(100 + I, 0))[CalleeName];
+      Callee.setName(CalleeName);
+      addSamples(Callee, 10, Names, Rand);
+      FS.addTotalSamples(Callee.getTotalSamples());
+    }
+  }
+
+  SmallString<128> Path;
+  int FD;
+  if (sys::fs::createTemporaryFile("sample-prof-reader", "prof", FD, Path))
+    report_fatal_error("cannot create the profile");
+  sys::Process::SafelyCloseFileDescriptor(FD);
+  {
+    auto WriterOrErr = SampleProfileWriter::create(Path, Format);
+    if (!WriterOrErr || WriterOrErr.get()->write(Profiles))
+      report_fatal_error("cannot write the profile");
+  }
+  auto BufferOrErr = MemoryBuffer::getFile(Path);
+  sys::fs::remove(Path);
+  if (!BufferOrErr)
+    report_fatal_error("cannot read the profile");
+  return std::move(BufferOrErr.get());
+}
+
+static void BM_ReadSampleProfile(benchmark::State &State) {
+  std::unique_ptr<MemoryBuffer> Profile =
+      createProfile(SampleProfileFormat(State.range(0)), 4000);
+  LLVMContext Context;
+  for (auto _ : State) {
+    std::unique_ptr<MemoryBuffer> Buffer = MemoryBuffer::getMemBuffer(
+        Profile->getBuffer(), Profile->getBufferIdentifier(), false);
+    auto ReaderOrErr = SampleProfileReader::create(Buffer, Context);
+    if (!ReaderOrErr || ReaderOrErr.get()->read())
+      report_fatal_error("cannot read the profile");
+    benchmark::DoNotOptimize(ReaderOrErr.get()->getProfiles().size());
+  }
+  State.SetBytesProcessed(int64_t(State.iterations()) *
+                          Profile->getBufferSize());
+}
+BENCHMARK(BM_ReadSampleProfile)
+    ->Arg(SPF_Binary)
+    ->Arg(SPF_Compact_Binary)
+    ->Arg(SPF_Ext_Binary)
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -642,6 +642,7 @@ public:
   const TypeIdInfo *getTypeIdInfo() const { return TIdInfo.get(); };
 
   friend struct GraphTraits<ValueInfo>;
+  friend class ModuleSummaryIndex;
 };
 
 template <> struct DenseMapInfo<FunctionSummary::VFuncId> {
@@ -1142,6 +1143,13 @@ public:
     return &*ModulePathStringTable.insert({ModPath, {ModId, Hash}}).first;
   }
 
+  /// Move the summaries of \p Other, the index of a single module read from
+  /// bitcode, into this index as the module \p ModPath with ID \p ModId. This
+  /// leaves this index as reading the summary of the module into it directly
+  /// would, so that the summaries of several modules can be read concurrently
+  /// into their own index, then merged in order.
+  void mergeFrom(ModuleSummaryIndex &Other, StringRef ModPath, uint64_t ModId);
+
   /// Return module entry for module with the given \p ModPath.
   ModuleInfo *getModule(StringRef ModPath) {
     auto It = ModulePathStringTable.find(ModPath);
@@ -30,8 +30,16 @@ typedef std::function<void(unsigned Task, std::unique_ptr<MemoryBuffer> MB)>
 /// Create a local file system cache which uses the given cache directory and
 /// file callback. This function also creates the cache directory if it does not
 /// already exist.
+///
+/// If \p UseIndex is true, the entries of the cache are recorded in the index
+/// of the directory (see addCacheIndexEntry() in
+/// llvm/Support/CachePruning.h), which lets pruneCache() prune the directory
+/// without scanning it, and the entries with identical contents are hard links
+/// to a same file named after the hash of their contents where the file system
+/// supports hard links.
 Expected<NativeObjectCache> localCache(StringRef CacheDirectoryPath,
-                                       AddBufferFn AddBuffer);
+                                       AddBufferFn AddBuffer,
+                                       bool UseIndex = false);
 
 } // namespace lto
 } // namespace llvm
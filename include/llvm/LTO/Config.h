@@ -108,6 +108,16 @@ struct Config {
   /// Statistics output file path.
   std::string StatsFile;
 
+  /// If this field is set, the wall time of each ThinLTO backend job run in
+  /// process is written to this file, in the Chrome trace event format that
+  /// -ftime-trace also uses.
+  std::string ThinLTOJobTraceFile;
+
+  /// The number of threads computing the cross-module imports of the ThinLTO
+  /// modules and internalizing the combined index. The result of the thin link
+  /// does not depend on it.
+  unsigned ThinLinkThreads = 1;
+
   bool ShouldDiscardValueNames = true;
   DiagnosticHandlerFunction DiagHandler;
 
@@ -55,9 +55,12 @@ void thinLTOResolvePrevailingInIndex(
 /// Update the linkages in the given \p Index to mark exported values
 /// as external and non-exported values as internal. The ThinLTO backends
 /// must apply the changes to the Module via thinLTOInternalizeModule.
+/// The GUIDs are processed on up to \p ThreadCount threads, which then call
+/// \p isExported concurrently.
 void thinLTOInternalizeAndPromoteInIndex(
     ModuleSummaryIndex &Index,
-    function_ref<bool(StringRef, GlobalValue::GUID)> isExported);
+    function_ref<bool(StringRef, GlobalValue::GUID)> isExported,
+    unsigned ThreadCount = 1);
 
 /// Computes a unique hash for the Module considering the current list of
 /// export/import and other global analysis results.
@@ -118,6 +121,12 @@ public:
   /// Create an InputFile.
   static Expected<std::unique_ptr<InputFile>> create(MemoryBufferRef Object);
 
+  /// Create the InputFiles of \p Objects, reading their symbol tables on up to
+  /// \p ThreadCount threads. The result for each object is in the same order
+  /// as \p Objects.
+  static std::vector<Expected<std::unique_ptr<InputFile>>>
+  create(ArrayRef<MemoryBufferRef> Objects, unsigned ThreadCount);
+
   /// The purpose of this class is to only expose the symbol information that an
   /// LTO client should need in order to do symbol resolution.
   class Symbol : irsymtab::Symbol {
@@ -214,6 +223,35 @@ typedef std::function<std::unique_ptr<ThinBackendProc>(
 /// This ThinBackend runs the individual backend jobs in-process.
 ThinBackend createInProcessThinBackend(unsigned ParallelismLevel);
 
+/// This ThinBackend runs each backend job in a worker process on the local
+/// machine, so that the memory of the jobs is not held by the linker and a
+/// crash of the code generator fails the link with an error instead of
+/// killing it. For each job, the backend writes the index of the module to a
+/// temporary file along with a list of the module and the modules it imports
+/// from, and runs
+///
+///   WorkerPath WorkerArgs... -thinlto-index=<index> -thinlto-task=<task>
+///       -o <object> <modules>
+///
+/// which is expected to call runThinBackendWorker() and write the native
+/// object to <object>. WorkerArgs must configure the worker like Conf, since
+/// the worker builds its own Config. At most ParallelismLevel workers run at
+/// the same time, and, if MemoryLimit is not zero, new workers wait while the
+/// estimated memory use of the running ones, in bytes, would exceed
+/// MemoryLimit. The memory use of a worker is estimated from the size of the
+/// bitcode of its module and of the modules it imports from. The native object
+/// cache is not used by this backend.
+ThinBackend createOutOfProcessThinBackend(std::string WorkerPath,
+                                          std::vector<std::string> WorkerArgs,
+                                          unsigned ParallelismLevel,
+                                          uint64_t MemoryLimit);
+
+/// Run the backend job of a worker process of the out-of-process ThinBackend,
+/// given its task number and the paths of its index and of its list of
+/// modules, and write the native object to \p AddStream.
+Error runThinBackendWorker(Config &Conf, unsigned Task, StringRef IndexPath,
+                           StringRef ModulesPath, AddStreamFn AddStream);
+
 /// This ThinBackend writes individual module indexes to files, instead of
 /// running the individual backend jobs. This backend is for distributed builds
 /// where separate processes will invoke the real backends.
@@ -268,6 +306,14 @@ public:
   /// InputFile::symbols().
   Error add(std::unique_ptr<InputFile> Obj, ArrayRef<SymbolResolution> Res);
 
+  /// Add the input files \p Objs to the LTO link, with the symbol resolutions
+  /// \p Res of each, as calling add() for each in turn would. The summaries of
+  /// their modules are read on up to \p ThreadCount threads, then merged into
+  /// the combined index in the order of \p Objs, so the result does not depend
+  /// on \p ThreadCount. An error is prefixed with the name of its input file.
+  Error add(std::vector<std::unique_ptr<InputFile>> Objs,
+            ArrayRef<std::vector<SymbolResolution>> Res, unsigned ThreadCount);
+
   /// Returns an upper bound on the number of tasks that the client may expect.
   /// This may only be called after all IR object files have been added. For a
   /// full description of tasks see LTOBackend.h.
@@ -385,8 +431,17 @@ private:
   // the resolutions used by a single input module by incrementing ResI. After
   // these functions return, [ResI, ResE) will refer to the resolution range for
   // the remaining modules in the InputFile.
+  // If the summaries of the modules of an input file were read ahead of time,
+  // Summaries holds them, or null for the summaries to read when adding it.
+  Error
+  addInput(InputFile &Input, ArrayRef<SymbolResolution> Res,
+           MutableArrayRef<std::unique_ptr<ModuleSummaryIndex>> Summaries);
   Error addModule(InputFile &Input, unsigned ModI,
-                  const SymbolResolution *&ResI, const SymbolResolution *ResE);
+                  const SymbolResolution *&ResI, const SymbolResolution *ResE,
+                  std::unique_ptr<ModuleSummaryIndex> Summary);
+  Error readSummary(BitcodeModule BM,
+                    std::unique_ptr<ModuleSummaryIndex> Summary,
+                    StringRef ModulePath, uint64_t ModuleId);
 
   Expected<RegularLTOState::AddedModule>
   addRegularLTO(BitcodeModule BM, ArrayRef<InputFile::Symbol> Syms,
@@ -395,7 +450,8 @@ private:
                        bool LivenessFromIndex);
 
   Error addThinLTO(BitcodeModule BM, ArrayRef<InputFile::Symbol> Syms,
-                   const SymbolResolution *&ResI, const SymbolResolution *ResE);
+                   const SymbolResolution *&ResI, const SymbolResolution *ResE,
+                   std::unique_ptr<ModuleSummaryIndex> Summary);
 
   Error runRegularLTO(AddStreamFn AddStream);
   Error runThinLTO(AddStreamFn AddStream, NativeObjectCache Cache);
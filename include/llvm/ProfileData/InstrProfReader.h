@@ -15,6 +15,7 @@
 #define LLVM_PROFILEDATA_INSTRPROFREADER_H
 
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/ProfileSummary.h"
 #include "llvm/ProfileData/InstrProf.h"
@@ -284,6 +285,49 @@ enum class HashT : uint32_t;
 
 } // end namespace IndexedInstrProf
 
+/// A record of an indexed profile, read in place from the profile buffer,
+/// which is usually mapped from the profile file. The counters are decoded as
+/// they are accessed and the value profile data only by getRecord, so that
+/// looking up the records of a function does not allocate memory nor touch
+/// the data of the records that are not used.
+class InstrProfRecordView {
+public:
+  InstrProfRecordView() = default;
+  InstrProfRecordView(uint64_t Hash, const unsigned char *Counts,
+                      uint64_t NumCounts, const unsigned char *ValueData,
+                      const unsigned char *ValueDataEnd,
+                      support::endianness ValueProfDataEndianness)
+      : Hash(Hash), Counts(Counts), NumCounts(NumCounts),
+        ValueData(ValueData), ValueDataEnd(ValueDataEnd),
+        ValueProfDataEndianness(ValueProfDataEndianness) {}
+
+  uint64_t getHash() const { return Hash; }
+  uint64_t getNumCounts() const { return NumCounts; }
+
+  uint64_t getCount(uint64_t I) const {
+    assert(I < NumCounts && "Counter index out of range");
+    return support::endian::read<uint64_t, support::little, support::unaligned>(
+        Counts + I * sizeof(uint64_t));
+  }
+
+  /// Decode the counters into \p Result.
+  void getCounts(std::vector<uint64_t> &Result) const;
+
+  /// Return true if the record has value profile data, which may be empty.
+  bool hasValueProfData() const { return ValueData != nullptr; }
+
+  /// Decode the counters and the value profile data into \p Record.
+  Error getRecord(InstrProfRecord &Record) const;
+
+private:
+  uint64_t Hash = 0;
+  const unsigned char *Counts = nullptr;
+  uint64_t NumCounts = 0;
+  const unsigned char *ValueData = nullptr;
+  const unsigned char *ValueDataEnd = nullptr;
+  support::endianness ValueProfDataEndianness = support::little;
+};
+
 /// Trait for lookups into the on-disk hash table for the binary instrprof
 /// format.
 class InstrProfLookupTrait {
@@ -329,6 +373,11 @@ public:
                               const unsigned char *const End);
   data_type ReadData(StringRef K, const unsigned char *D, offset_type N);
 
+  /// Append views of the records in [\p D, \p D + \p N) to \p Views,
+  /// without decoding them. \returns false if the data is corrupt.
+  bool readRecordViews(const unsigned char *D, offset_type N,
+                       SmallVectorImpl<InstrProfRecordView> &Views);
+
   // Used for testing purpose only.
   void setValueProfDataEndianness(support::endianness Endianness) {
     ValueProfDataEndianness = Endianness;
@@ -345,6 +394,10 @@ struct InstrProfReaderIndexBase {
   // Read all the profile records with the key equal to FuncName
   virtual Error getRecords(StringRef FuncName,
                                      ArrayRef<NamedInstrProfRecord> &Data) = 0;
+
+  // Append views of all the profile records with the key equal to FuncName.
+  virtual Error getRecordViews(StringRef FuncName,
+                               SmallVectorImpl<InstrProfRecordView> &Views) = 0;
   virtual void advanceToNextKey() = 0;
   virtual bool atEnd() const = 0;
   virtual void setValueProfDataEndianness(support::endianness Endianness) = 0;
@@ -379,6 +432,8 @@ public:
   Error getRecords(ArrayRef<NamedInstrProfRecord> &Data) override;
   Error getRecords(StringRef FuncName,
                    ArrayRef<NamedInstrProfRecord> &Data) override;
+  Error getRecordViews(StringRef FuncName,
+                       SmallVectorImpl<InstrProfRecordView> &Views) override;
   void advanceToNextKey() override { RecordIterator++; }
 
   bool atEnd() const override {
@@ -411,6 +466,8 @@ public:
   virtual Error populateRemappings() { return Error::success(); }
   virtual Error getRecords(StringRef FuncName,
                            ArrayRef<NamedInstrProfRecord> &Data) = 0;
+  virtual Error getRecordViews(StringRef FuncName,
+                               SmallVectorImpl<InstrProfRecordView> &Views) = 0;
 };
 
 /// Reader for the indexed binary instrprof format.
@@ -465,6 +522,12 @@ public:
   Expected<InstrProfRecord> getInstrProfRecord(StringRef FuncName,
                                                uint64_t FuncHash);
 
+  /// Set \p View to the record associated with FuncName and FuncHash. The
+  /// view is valid as long as the reader, and nothing is decoded until it is
+  /// accessed.
+  Error getRecordView(StringRef FuncName, uint64_t FuncHash,
+                      InstrProfRecordView &View);
+
   /// Fill Counts with the profile data for the given function name.
   Error getFunctionCounts(StringRef FuncName, uint64_t FuncHash,
                           std::vector<uint64_t> &Counts);
@@ -38,6 +38,7 @@ public:
 
 private:
   bool Sparse;
+  unsigned NumThreads = 1;
   StringMap<ProfilingData> FunctionData;
   ProfKind ProfileKind = PF_Unknown;
   // Use raw pointer here for the incomplete type object.
@@ -60,6 +61,10 @@ public:
   void mergeRecordsFromWriter(InstrProfWriter &&IPW,
                               function_ref<void(Error)> Warn);
 
+  /// Serialize the records and build the hash table of the indexed profile
+  /// on \p NumThreads threads. The output does not depend on it.
+  void setNumThreads(unsigned N) { NumThreads = N; }
+
   /// Write the profile to \c OS
   void write(raw_fd_ostream &OS);
 
@@ -38,13 +38,13 @@ inline const char *getUnlikelySectionPrefix() { return ".unlikely"; }
 
 class ProfileSummaryBuilder {
 private:
+  std::vector<uint32_t> DetailedSummaryCutoffs;
+
+protected:
   /// We keep track of the number of times a count (block count or samples)
   /// appears in the profile. The map is kept sorted in the descending order of
   /// counts.
   std::map<uint64_t, uint32_t, std::greater<uint64_t>> CountFrequencies;
-  std::vector<uint32_t> DetailedSummaryCutoffs;
-
-protected:
   SummaryEntryVector DetailedSummary;
   uint64_t TotalCount = 0;
   uint64_t MaxCount = 0;
@@ -57,11 +57,23 @@ protected:
   ~ProfileSummaryBuilder() = default;
 
   inline void addCount(uint64_t Count);
+  inline void removeCount(uint64_t Count);
   void computeDetailedSummary();
 
 public:
   /// A vector of useful cutoff values for detailed summary.
   static const ArrayRef<uint32_t> DefaultCutoffs;
+
+  /// Find the summary entry for a desired percentile of counts.
+  static const ProfileSummaryEntry &
+  getEntryForPercentile(SummaryEntryVector &DS, uint64_t Percentile);
+
+  /// Return how many times each count appears in the profile, in the
+  /// descending order of counts.
+  const std::map<uint64_t, uint32_t, std::greater<uint64_t>> &
+  getCountFrequencies() const {
+    return CountFrequencies;
+  }
 };
 
 class InstrProfSummaryBuilder final : public ProfileSummaryBuilder {
@@ -76,6 +88,9 @@ public:
 
   void addRecord(const InstrProfRecord &);
   std::unique_ptr<ProfileSummary> getSummary();
+
+  /// Add the records added to \p Other, e.g. on another thread.
+  void merge(const InstrProfSummaryBuilder &Other);
 };
 
 class SampleProfileSummaryBuilder final : public ProfileSummaryBuilder {
@@ -85,6 +100,17 @@ public:
 
   void addRecord(const sampleprof::FunctionSamples &FS);
   std::unique_ptr<ProfileSummary> getSummary();
+
+  /// Start from a profile summarized by \p Summary, whose counts appear as
+  /// often as \p Frequencies tells, so that it can be updated with
+  /// addRecord and removeRecord without visiting the whole profile again.
+  void addSummary(ProfileSummary &Summary,
+                  ArrayRef<std::pair<uint64_t, uint32_t>> Frequencies);
+
+  /// Take the counts of \p FS out of the summary. The maximum function count
+  /// is left as it is, so it stays exact only if \p FS is replaced by a
+  /// profile with no fewer head samples.
+  void removeRecord(const sampleprof::FunctionSamples &FS);
 };
 
 /// This is called when a count is seen in the profile.
@@ -96,6 +122,17 @@ void ProfileSummaryBuilder::addCount(uint64_t Count) {
   CountFrequencies[Count]++;
 }
 
+/// This is called when a count that was seen in the profile goes away.
+void ProfileSummaryBuilder::removeCount(uint64_t Count) {
+  auto I = CountFrequencies.find(Count);
+  assert(I != CountFrequencies.end() && "Removing a count never added");
+  TotalCount -= Count;
+  NumCounts--;
+  if (--I->second == 0)
+    CountFrequencies.erase(I);
+  MaxCount = CountFrequencies.empty() ? 0 : CountFrequencies.begin()->first;
+}
+
 } // end namespace llvm
 
 #endif // LLVM_PROFILEDATA_PROFILECOMMON_H
@@ -14,6 +14,8 @@
 #ifndef LLVM_PROFILEDATA_SAMPLEPROF_H
 #define LLVM_PROFILEDATA_SAMPLEPROF_H
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
@@ -21,9 +23,11 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/GlobalValue.h"
 #include "llvm/IR/Module.h"
+#include "llvm/Support/Allocator.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/ErrorOr.h"
 #include "llvm/Support/MathExtras.h"
+#include "llvm/Support/StringSaver.h"
 #include <algorithm>
 #include <cstdint>
 #include <map>
@@ -49,7 +53,10 @@ enum class sampleprof_error {
   truncated_name_table,
   not_implemented,
   counter_overflow,
-  ostream_seek_unsupported
+  ostream_seek_unsupported,
+  compress_failed,
+  uncompress_failed,
+  zlib_unavailable
 };
 
 inline std::error_code make_error_code(sampleprof_error E) {
@@ -83,6 +90,7 @@ enum SampleProfileFormat {
   SPF_Text = 0x1,
   SPF_Compact_Binary = 0x2,
   SPF_GCC = 0x3,
+  SPF_Ext_Binary = 0x4,
   SPF_Binary = 0xff
 };
 
@@ -103,7 +111,72 @@ static inline StringRef getRepInFormat(StringRef Name,
   return (Format == SPF_Compact_Binary) ? StringRef(GUIDBuf) : Name;
 }
 
-static inline uint64_t SPVersion() { return 103; }
+static inline uint64_t SPVersion() { return 104; }
+
+/// The last binary format version without a function offset table in the raw
+/// binary format. Profiles of this version can still be read.
+static inline uint64_t SPVersionNoFuncOffsetTable() { return 103; }
+
+/// The types of the sections in the SPF_Ext_Binary format. Readers skip
+/// sections of a type they do not know, so new types can be added without
+/// breaking existing readers.
+enum SecType {
+  SecInValid = 0,
+  SecProfSummary = 1,
+  SecNameTable = 2,
+  SecProfileSymbolList = 3,
+  SecFuncOffsetTable = 4,
+  SecCountHistogram = 5,
+  SecDecayEpoch = 6,
+  // Marker for the first type of function profile.
+  SecFuncProfileFirst = 32,
+  SecLBRProfile = SecFuncProfileFirst
+};
+
+static inline std::string getSecName(SecType Type) {
+  switch (Type) {
+  case SecInValid:
+    return "InvalidSection";
+  case SecProfSummary:
+    return "ProfileSummarySection";
+  case SecNameTable:
+    return "NameTableSection";
+  case SecProfileSymbolList:
+    return "ProfileSymbolListSection";
+  case SecFuncOffsetTable:
+    return "FuncOffsetTableSection";
+  case SecCountHistogram:
+    return "CountHistogramSection";
+  case SecDecayEpoch:
+    return "DecayEpochSection";
+  case SecLBRProfile:
+    return "LBRProfileSection";
+  }
+  return "UnknownSection";
+}
+
+/// Flags describing how a section is stored. A reader must not interpret a
+/// section carrying a flag it does not know.
+enum SecFlags {
+  SecFlagInValid = 0,
+  /// The section is compressed with zlib. Its contents are the uncompressed
+  /// size and the compressed size (ULEB128), followed by the compressed data.
+  SecFlagCompress = (1 << 0),
+  /// The entries of the section are preceded by a table of fixed width
+  /// offsets, so that they can be used in place and looked up in constant
+  /// time. Only used by the name table.
+  SecFlagIndexed = (1 << 1)
+};
+
+/// An entry of the section header table of the SPF_Ext_Binary format.
+struct SecHdrTableEntry {
+  SecType Type;
+  uint64_t Flags;
+  /// Offset of the section from the start of the profile.
+  uint64_t Offset;
+  /// Size of the section in bytes.
+  uint64_t Size;
+};
 
 /// Represents the relative location of an instruction.
 ///
@@ -125,12 +198,60 @@ struct LineLocation {
            (LineOffset == O.LineOffset && Discriminator < O.Discriminator);
   }
 
+  bool operator==(const LineLocation &O) const {
+    return LineOffset == O.LineOffset && Discriminator == O.Discriminator;
+  }
+
+  bool operator!=(const LineLocation &O) const { return !(*this == O); }
+
   uint32_t LineOffset;
   uint32_t Discriminator;
 };
 
 raw_ostream &operator<<(raw_ostream &OS, const LineLocation &Loc);
 
+/// A frame of the calling context of a context-sensitive profile.
+struct SampleContextFrame {
+  SampleContextFrame(StringRef FuncName, LineLocation CallSite)
+      : FuncName(FuncName), CallSite(CallSite) {}
+
+  /// Name of the function.
+  StringRef FuncName;
+  /// Location in the function of the call to the next frame. Unused in the
+  /// last frame.
+  LineLocation CallSite;
+};
+
+/// Names of context-sensitive profiles.
+///
+/// A context-sensitive profile holds the samples of a function when it is
+/// called through a given chain of callsites, and is named after that chain,
+/// from the outermost caller to the function:
+///
+///   [main:3 @ foo:2.1 @ bar]
+///
+/// is the profile of bar when it is called at line offset 2, discriminator 1
+/// of foo, itself called at line offset 3 of main. Unlike an inlined instance
+/// in FunctionSamples, such a profile does not hold the samples of its
+/// callees, which have profiles for the longer contexts, e.g.
+/// [main:3 @ foo:2.1 @ bar:1 @ baz]. Profiles whose name is not bracketed
+/// are context-insensitive.
+class SampleContext {
+public:
+  /// Return true if \p Name is the name of a context-sensitive profile.
+  static bool isContext(StringRef Name) {
+    return Name.size() >= 2 && Name.front() == '[' && Name.back() == ']';
+  }
+
+  /// Split the context \p Name into its frames, from the outermost caller.
+  /// \returns false if \p Name is malformed.
+  static bool parse(StringRef Name,
+                    SmallVectorImpl<SampleContextFrame> &Frames);
+
+  /// Return the name of the context made of \p Frames.
+  static std::string getName(ArrayRef<SampleContextFrame> Frames);
+};
+
 /// Representation of a single sample record.
 ///
 /// A sample record is represented by a positive integer value, which
@@ -228,6 +349,12 @@ public:
                       : sampleprof_error::success;
   }
 
+  /// Take \p Num samples out of the total, e.g. when an inlined callee is
+  /// removed.
+  void removeTotalSamples(uint64_t Num) {
+    TotalSamples = Num < TotalSamples ? TotalSamples - Num : 0;
+  }
+
   sampleprof_error addHeadSamples(uint64_t Num, uint64_t Weight = 1) {
     bool Overflowed;
     TotalHeadSamples =
@@ -353,6 +480,7 @@ public:
   const CallsiteSampleMap &getCallsiteSamples() const {
     return CallsiteSamples;
   }
+  CallsiteSampleMap &getCallsiteSamples() { return CallsiteSamples; }
 
   /// Merge the samples in \p Other into this one.
   /// Optionally scale samples by \p Weight.
@@ -444,7 +572,7 @@ public:
   /// is actually GUID of the original function name. getNameInModule will
   /// translate \p Name in current FunctionSamples into its original name.
   /// If the original name doesn't exist in \p M, return empty StringRef.
-  StringRef getNameInModule(StringRef Name, const Module *M) const {
+  static StringRef getNameInModule(StringRef Name, const Module *M) {
     if (Format != SPF_Compact_Binary)
       return Name;
     // Expect CurrentModule to be initialized by GUIDToFuncNameMapper.
@@ -460,6 +588,12 @@ public:
   /// We assume that a single function will not exceed 65535 LOC.
   static unsigned getOffset(const DILocation *DIL);
 
+  /// Put in \p Stack the callsites \p DIL is inlined at, innermost first,
+  /// each with the linkage name of the function inlined there.
+  static void
+  getInlineStack(const DILocation *DIL,
+                 SmallVectorImpl<std::pair<LineLocation, StringRef>> &Stack);
+
   /// Get the FunctionSamples of the inline instance where DIL originates
   /// from.
   ///
@@ -560,6 +694,243 @@ private:
 
 raw_ostream &operator<<(raw_ostream &OS, const FunctionSamples &FS);
 
+class FlatFunctionSamples;
+
+/// A call target recorded at a line of a FlatFunctionSamples.
+struct FlatCallTarget {
+  StringRef Name;
+  uint64_t Samples;
+};
+
+/// The samples recorded at a line of a FlatFunctionSamples. This is the
+/// read-only counterpart of an entry of BodySampleMap.
+struct FlatBodySample {
+  LineLocation Loc;
+  uint64_t NumSamples;
+  /// Call targets at this line, sorted by name.
+  ArrayRef<FlatCallTarget> CallTargets;
+};
+
+/// An inlined callee at a callsite of a FlatFunctionSamples. This is the
+/// read-only counterpart of an entry of CallsiteSampleMap.
+struct FlatCallsiteSample {
+  LineLocation Loc;
+  /// Name the callee is recorded under in the profile.
+  StringRef Name;
+  const FlatFunctionSamples *Callee;
+};
+
+/// Compact, read-only representation of the samples collected for a
+/// function.
+///
+/// This holds the same information as FunctionSamples, but every map is
+/// replaced by an array sorted by location, and all the nodes, arrays and
+/// names are allocated in the arena of the owning FlatSampleProfileMap.
+/// Lookups are binary searches over contiguous memory instead of walks over
+/// std::map and StringMap nodes, and loading a profile does not perform a
+/// heap allocation per sample record. It is intended for consumers that
+/// only query the profile, like the sample profile loader; profiles that
+/// are merged or written still need FunctionSamples.
+class FlatFunctionSamples {
+public:
+  /// Return the function name.
+  StringRef getName() const { return Name; }
+
+  /// Return the original function name if it exists in Module \p M.
+  StringRef getFuncNameInModule(const Module *M) const {
+    return FunctionSamples::getNameInModule(Name, M);
+  }
+
+  bool empty() const { return TotalSamples == 0; }
+
+  /// Return the total number of samples collected inside the function.
+  uint64_t getTotalSamples() const { return TotalSamples; }
+
+  /// Return the total number of branch samples that have the function as the
+  /// branch target.
+  uint64_t getHeadSamples() const { return TotalHeadSamples; }
+
+  /// Return the sample count of the first instruction of the function.
+  /// See FunctionSamples::getEntrySamples.
+  uint64_t getEntrySamples() const;
+
+  /// Return all the samples collected in the body of the function, sorted by
+  /// location.
+  ArrayRef<FlatBodySample> getBodySamples() const { return BodySamples; }
+
+  /// Return all the callsite samples collected in the body of the function,
+  /// sorted by location and callee name.
+  ArrayRef<FlatCallsiteSample> getCallsiteSamples() const {
+    return CallsiteSamples;
+  }
+
+  /// Return the number of samples collected at the given location.
+  /// If the location is not found in profile, return error.
+  ErrorOr<uint64_t> findSamplesAt(uint32_t LineOffset,
+                                  uint32_t Discriminator) const {
+    const FlatBodySample *BS = findBodySampleAt(LineOffset, Discriminator);
+    if (!BS)
+      return std::error_code();
+    return BS->NumSamples;
+  }
+
+  /// Return the call targets collected at the given location.
+  /// If the location is not found in profile, return error.
+  ErrorOr<ArrayRef<FlatCallTarget>>
+  findCallTargetsAt(uint32_t LineOffset, uint32_t Discriminator) const {
+    const FlatBodySample *BS = findBodySampleAt(LineOffset, Discriminator);
+    if (!BS)
+      return std::error_code();
+    return BS->CallTargets;
+  }
+
+  /// Return the inlined callees at the callsite location \p Loc.
+  ArrayRef<FlatCallsiteSample>
+  findCallsiteSamplesAt(const LineLocation &Loc) const;
+
+  /// Return the inlined callee \p CalleeName at the callsite location
+  /// \p Loc. If there is no such callee, return the one with the maximum
+  /// total sample count at \p Loc, like FunctionSamples::findFunctionSamplesAt.
+  const FlatFunctionSamples *findFunctionSamplesAt(const LineLocation &Loc,
+                                                   StringRef CalleeName) const;
+
+  /// Get the FlatFunctionSamples of the inline instance where DIL originates
+  /// from. See FunctionSamples::findFunctionSamples.
+  const FlatFunctionSamples *findFunctionSamples(const DILocation *DIL) const;
+
+  /// Add to \p S the GUIDs of the functions inlined into this one whose total
+  /// sample count is above \p Threshold. See
+  /// FunctionSamples::findInlinedFunctions.
+  void findInlinedFunctions(DenseSet<GlobalValue::GUID> &S, const Module *M,
+                            uint64_t Threshold) const;
+
+private:
+  friend class FlatSampleProfileMap;
+
+  const FlatBodySample *findBodySampleAt(uint32_t LineOffset,
+                                         uint32_t Discriminator) const;
+
+  /// Mangled name of the function.
+  StringRef Name;
+
+  /// Total number of samples collected inside this function.
+  uint64_t TotalSamples = 0;
+
+  /// Total number of samples collected at the head of the function.
+  uint64_t TotalHeadSamples = 0;
+
+  /// Samples collected at each line of the function.
+  ArrayRef<FlatBodySample> BodySamples;
+
+  /// Samples collected for the functions inlined at each callsite.
+  ArrayRef<FlatCallsiteSample> CallsiteSamples;
+};
+
+/// Owner of the FlatFunctionSamples of a set of functions.
+///
+/// Profiles are converted one function at a time with add(), after which the
+/// corresponding FunctionSamples can be released. Names are interned, so a
+/// callee that appears at many callsites is stored only once.
+class FlatSampleProfileMap {
+public:
+  using ProfileMap = DenseMap<StringRef, const FlatFunctionSamples *>;
+  using const_iterator = ProfileMap::const_iterator;
+
+  FlatSampleProfileMap() : Names(Alloc) {}
+  FlatSampleProfileMap(const FlatSampleProfileMap &) = delete;
+  FlatSampleProfileMap &operator=(const FlatSampleProfileMap &) = delete;
+
+  /// Convert \p FS and make it available under \p Name. If there already
+  /// is a profile for \p Name it is replaced.
+  const FlatFunctionSamples *add(StringRef Name, const FunctionSamples &FS);
+
+  /// Return the profile stored under \p Name, or null if there is none.
+  const FlatFunctionSamples *find(StringRef Name) const {
+    return Profiles.lookup(Name);
+  }
+
+  bool empty() const { return Profiles.empty(); }
+  size_t size() const { return Profiles.size(); }
+  const_iterator begin() const { return Profiles.begin(); }
+  const_iterator end() const { return Profiles.end(); }
+
+  /// Return the number of bytes allocated for the flattened profiles.
+  size_t getMemorySize() const { return Alloc.getTotalMemory(); }
+
+private:
+  const FlatFunctionSamples *flatten(const FunctionSamples &FS);
+
+  BumpPtrAllocator Alloc;
+  UniqueStringSaver Names;
+  ProfileMap Profiles;
+};
+
+/// The symbols of the functions in the profiled binary.
+///
+/// A function without samples is either cold or new, i.e. it did not exist
+/// when the profile was collected. The list tells the two apart: the
+/// functions it contains were in the binary, so if they have no samples they
+/// were cold. It is stored in the SecProfileSymbolList section of the
+/// SPF_Ext_Binary format as a sequence of NUL-terminated names.
+class ProfileSymbolList {
+public:
+  ProfileSymbolList() : Names(Alloc) {}
+  ProfileSymbolList(const ProfileSymbolList &) = delete;
+  ProfileSymbolList &operator=(const ProfileSymbolList &) = delete;
+
+  void add(StringRef Name) { Syms.insert(Names.save(Name)); }
+
+  bool contains(StringRef Name) const { return Syms.count(Name); }
+
+  void merge(const ProfileSymbolList &List) {
+    for (StringRef Sym : List.Syms)
+      add(Sym);
+  }
+
+  unsigned size() const { return Syms.size(); }
+
+  /// Add the names of the section contents in [\p Data, \p Data + \p Size).
+  std::error_code read(const uint8_t *Data, uint64_t Size);
+
+  /// Write the names, sorted so that the output is deterministic.
+  std::error_code write(raw_ostream &OS) const;
+
+  /// Print the names, one per line, on stream \p OS.
+  void dump(raw_ostream &OS = dbgs()) const;
+
+private:
+  BumpPtrAllocator Alloc;
+  UniqueStringSaver Names;
+  DenseSet<StringRef> Syms;
+};
+
+/// Takes the cold parts out of a set of profiles.
+///
+/// A function or an inlined callee is cold when its total samples are no
+/// more than a cold count threshold, usually derived from the profile
+/// summary like ProfileSummaryInfo does. The compiler optimizes cold code for
+/// size whatever its exact counts, so such samples mostly make the profile
+/// bigger and slower to load.
+class SampleProfileTrimmer {
+public:
+  SampleProfileTrimmer(StringMap<FunctionSamples> &Profiles)
+      : Profiles(Profiles) {}
+
+  /// Turn the cold inlined callees back into calls and merge their samples
+  /// into the profiles of the callees, which are created when missing. The
+  /// count of the call is the entry count of the callee. Cold
+  /// context-sensitive profiles are likewise merged into the
+  /// context-insensitive profile of their function, which is the base
+  /// profile SampleContextTracker falls back to.
+  sampleprof_error flattenColdCallsites(uint64_t ColdCountThreshold);
+
+  /// Remove the cold profiles.
+  void trimColdProfiles(uint64_t ColdCountThreshold);
+
+private:
+  StringMap<FunctionSamples> &Profiles;
+};
+
 /// Sort a LocationT->SampleT map by LocationT.
 ///
 /// It produces a sorted list of <LocationT, SampleT> records by ascending
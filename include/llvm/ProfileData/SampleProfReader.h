@@ -114,6 +114,20 @@
 //    total number of samples collected for the inlined instance at this
 //    callsite
 //
+// Context-sensitive profiles
+//
+// The name in the function header may also be a calling context in
+// brackets, which makes the section the profile of the last function of the
+// context when it is called through that chain of callsites:
+//
+//     [main:3 @ foo:2.1 @ bar]:total_samples:total_head_samples
+//
+// is the profile of bar called at line offset 2, discriminator 1 of foo,
+// itself called at line offset 3 of main. The samples of the callees of bar
+// in this context are in the sections of the longer contexts, such as
+// [main:3 @ foo:2.1 @ bar:1 @ baz]. The binary formats store such sections
+// the same way, under their bracketed names. See SampleContext.
+//
 //
 // Binary format
 // -------------
@@ -203,11 +217,30 @@
 //          in the text format documentation above).
 //        FUNCTION BODY
 //          A FUNCTION BODY entry describing the inlined function.
+//
+// FUNCTION OFFSET TABLE [only since version 104]
+//    SIZE (uint64_t)
+//        Number of entries in the table.
+//    ENTRIES
+//        A list of SIZE entries, one for each FUNCTION BODY. Each entry
+//        contains:
+//          NAME_IDX (uint32_t)
+//            Index into the name table with the function name.
+//          OFFSET (uint64_t)
+//            Offset of the FUNCTION BODY from the start of the file.
+//
+// FUNCTION OFFSET TABLE OFFSET (uint64_t, unencoded little endian)
+//    [only since version 104] Offset of the FUNCTION OFFSET TABLE from the
+//    start of the file. It is stored at the very end of the file so that the
+//    writer does not need to seek, and lets the reader decode only the
+//    function bodies it needs.
 //===----------------------------------------------------------------------===//
 
 #ifndef LLVM_PROFILEDATA_SAMPLEPROFREADER_H
 #define LLVM_PROFILEDATA_SAMPLEPROFREADER_H
 
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/None.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
@@ -284,6 +317,10 @@ public:
   /// Print all the profiles on stream \p OS.
   void dump(raw_ostream &OS = dbgs());
 
+  /// Print the offset, size and flags of the sections of the profile on
+  /// stream \p OS. Returns false if the format is not made of sections.
+  virtual bool dumpSectionInfo(raw_ostream &OS = dbgs()) { return false; }
+
   /// Return the samples collected for function \p F.
   FunctionSamples *getSamplesFor(const Function &F) {
     // The function name may have been updated by adding suffix. Call
@@ -306,6 +343,32 @@ public:
   /// Return all the profiles.
   StringMap<FunctionSamples> &getProfiles() { return Profiles; }
 
+  /// Convert the profiles that have been read into the compact, read-only
+  /// FlatFunctionSamples representation. Each FunctionSamples is released as
+  /// soon as it has been converted, so the two representations of the whole
+  /// profile are never held at the same time. Consumers that only query the
+  /// profile may call this after read(); the others keep the FunctionSamples
+  /// by not calling it. Afterwards getSamplesFor() and getProfiles() find
+  /// nothing, and the profiles are only available through getFlatSamplesFor()
+  /// and getFlatProfiles().
+  virtual void flattenProfiles();
+
+  /// Return the flattened samples collected for function \p F.
+  const FlatFunctionSamples *getFlatSamplesFor(const Function &F) {
+    StringRef CanonName = FunctionSamples::getCanonicalFnName(F);
+    return getFlatSamplesFor(CanonName);
+  }
+
+  /// Return the flattened samples collected for function \p Fname.
+  virtual const FlatFunctionSamples *getFlatSamplesFor(StringRef Fname) {
+    std::string FGUID;
+    Fname = getRepInFormat(Fname, getFormat(), FGUID);
+    return FlatProfiles.find(Fname);
+  }
+
+  /// Return all the flattened profiles.
+  const FlatSampleProfileMap &getFlatProfiles() const { return FlatProfiles; }
+
   /// Report a parse error message.
   void reportError(int64_t LineNumber, Twine Msg) const {
     Ctx.diagnose(DiagnosticInfoSampleProfile(Buffer->getBufferIdentifier(),
@@ -326,6 +389,27 @@ public:
   /// \brief Return the profile format.
   SampleProfileFormat getFormat() { return Format; }
 
+  /// Return true if the profiles that have been read include
+  /// context-sensitive ones. See SampleContext.
+  bool profileIsCS() const { return ProfileIsCS; }
+
+  /// Take the list of the symbols of the profiled binary, or return null if
+  /// the profile has none.
+  virtual std::unique_ptr<ProfileSymbolList> getProfileSymbolList() {
+    return nullptr;
+  }
+
+  /// Return the original names of the functions of a profile that only
+  /// stores their MD5 hashes, if the profile carries them, or an empty list.
+  virtual ArrayRef<StringRef> getOriginalNames() const { return None; }
+
+  /// Put in \p Names every name the profile uses, including those of the
+  /// profiles that read() skipped because of collectFuncsToUse. Returns false
+  /// if the reader only knows the names of the profiles it has read.
+  virtual bool getNamesInProfile(std::vector<StringRef> &Names) {
+    return false;
+  }
+
 protected:
   /// Map every function to its associated profile.
   ///
@@ -334,6 +418,9 @@ protected:
   /// to their corresponding profiles.
   StringMap<FunctionSamples> Profiles;
 
+  /// The profiles in Profiles, once they have been flattened.
+  FlatSampleProfileMap FlatProfiles;
+
   /// LLVM context used to emit diagnostics.
   LLVMContext &Ctx;
 
@@ -354,6 +441,9 @@ protected:
 
   /// \brief The format of sample.
   SampleProfileFormat Format = SPF_None;
+
+  /// True if some profiles are context-sensitive.
+  bool ProfileIsCS = false;
 };
 
 class SampleProfileReaderText : public SampleProfileReader {
@@ -381,8 +471,18 @@ public:
   virtual std::error_code readHeader() override;
 
   /// Read sample profiles from the associated file.
+  ///
+  /// If collectFuncsToUse has been called and the profile has a function
+  /// offset table, only the profiles of the collected functions are read.
   std::error_code read() override;
 
+  /// Collect functions to be used when compiling Module \p M.
+  void collectFuncsToUse(const Module &M) override;
+
+  /// Only read the profiles of the functions \p Names, and of the contexts
+  /// that involve any of them.
+  void setFuncsToUse(ArrayRef<StringRef> Names);
+
 protected:
   /// Read a numeric value of type T from the profile.
   ///
@@ -392,6 +492,11 @@ protected:
   /// \returns the read value.
   template <typename T> ErrorOr<T> readNumber();
 
+  /// Read the \p N numbers of a record into \p Vals, like readNumber. When
+  /// the profile holds enough bytes for any N numbers, the end of the profile
+  /// is checked once for the whole record rather than for every byte.
+  template <size_t N> std::error_code readNumbers(uint64_t (&Vals)[N]);
+
   /// Read a numeric value of type T from the profile. The value is saved
   /// without encoded.
   template <typename T> ErrorOr<T> readUnencodedNumber();
@@ -413,22 +518,54 @@ protected:
   /// Read the next function profile instance.
   std::error_code readFuncProfile();
 
+  /// Read the function profiles in the range [Data, End). If only some
+  /// functions are to be used, they are looked up in FuncOffsetTable, whose
+  /// offsets are relative to \p Base, along with the contexts that involve
+  /// any of them.
+  std::error_code readFuncProfiles(const uint8_t *Base);
+
   /// Read the contents of the given profile instance.
   std::error_code readProfile(FunctionSamples &FProfile);
 
+  /// Read the function offset table starting at \p TableStart. Function
+  /// profiles end where the table starts. If \p TableEnd is not null, it is
+  /// set to the end of the table.
+  std::error_code readFuncOffsetTable(const uint8_t *TableStart,
+                                      const uint8_t **TableEnd = nullptr);
+
   /// Points to the current location in the buffer.
   const uint8_t *Data = nullptr;
 
   /// Points to the end of the buffer.
   const uint8_t *End = nullptr;
 
-private:
-  std::error_code readSummaryEntry(std::vector<ProfileSummaryEntry> &Entries);
-  virtual std::error_code verifySPMagic(uint64_t Magic) = 0;
+  /// The version of the profile being read.
+  uint64_t Version = 0;
+
+  /// The table mapping from function name (in the representation used by the
+  /// name table) to the offset of its FunctionSample towards file start.
+  DenseMap<StringRef, uint64_t> FuncOffsetTable;
+
+  /// The offsets, taken from FuncOffsetTable, of the profiles of the contexts
+  /// that involve each function.
+  DenseMap<StringRef, SmallVector<uint64_t, 2>> FuncContextOffsets;
+
+  /// True if the profile has a function offset table.
+  bool HasFuncOffsetTable = false;
+
+  /// The set containing the functions to use when compiling a module.
+  DenseSet<StringRef> FuncsToUse;
+
+  /// If true, read every function profile regardless of FuncsToUse.
+  bool UseAllFuncs = true;
 
   /// Read profile summary.
   std::error_code readSummary();
 
+private:
+  std::error_code readSummaryEntry(std::vector<ProfileSummaryEntry> &Entries);
+  virtual std::error_code verifySPMagic(uint64_t Magic) = 0;
+
   /// Read the whole name table.
   virtual std::error_code readNameTable() = 0;
 
@@ -437,37 +574,153 @@ private:
 };
 
 class SampleProfileReaderRawBinary : public SampleProfileReaderBinary {
-private:
+protected:
   /// Function name table.
   std::vector<StringRef> NameTable;
   virtual std::error_code verifySPMagic(uint64_t Magic) override;
   virtual std::error_code readNameTable() override;
   /// Read a string indirectly via the name table.
   virtual ErrorOr<StringRef> readStringFromTable() override;
+  virtual std::error_code readHeader() override;
+
+public:
+  SampleProfileReaderRawBinary(std::unique_ptr<MemoryBuffer> B, LLVMContext &C,
+                               SampleProfileFormat Format = SPF_Binary)
+      : SampleProfileReaderBinary(std::move(B), C, Format) {}
+
+  /// \brief Return true if \p Buffer is in the format supported by this class.
+  static bool hasFormat(const MemoryBuffer &Buffer);
+};
+
+/// Reader for the section based SPF_Ext_Binary format. The name table and
+/// the function profiles are encoded the same way as in the raw binary
+/// format, but every part of the profile lives in its own section, which
+/// is located through the section header table.
+class SampleProfileReaderExtBinary : public SampleProfileReaderRawBinary {
+private:
+  /// The section header table of the profile.
+  std::vector<SecHdrTableEntry> SecHdrTable;
+  /// The range of the section holding the function profiles.
+  const uint8_t *ProfileSecStart = nullptr;
+  const uint8_t *ProfileSecEnd = nullptr;
+  /// True if the function profile section is compressed. It is only
+  /// decompressed when the profiles are read.
+  bool ProfileSecCompressed = false;
+  /// The buffers holding the decompressed sections.
+  std::vector<std::unique_ptr<uint8_t[]>> DecompressBufs;
+  /// The offset table of an indexed name table, which has
+  /// IndexedNameTableSize + 1 entries, and the names it indexes. The names
+  /// are used in place, without copying them into NameTable.
+  const uint8_t *IndexedNameTableOffsets = nullptr;
+  const char *IndexedNameTableNames = nullptr;
+  uint64_t IndexedNameTableSize = 0;
+  uint64_t IndexedNameTableNamesSize = 0;
+
+  virtual std::error_code verifySPMagic(uint64_t Magic) override;
+  virtual std::error_code readHeader() override;
+  std::error_code readSecHdrTableEntry();
+  std::error_code readSecHdrTable();
+  /// Read the section described by \p Entry.
+  std::error_code readOneSection(const SecHdrTableEntry &Entry);
+  /// Decompress the section in [Data, End), and point Data and End at the
+  /// decompressed contents.
+  std::error_code decompressSection();
+  /// Read a name table carrying SecFlagIndexed.
+  std::error_code readIndexedNameTable();
+  /// Return the name at index \p Idx of a name table carrying SecFlagIndexed.
+  ErrorOr<StringRef> getIndexedName(uint64_t Idx);
+  /// Decompress the function profile section if it is compressed.
+  std::error_code decompressProfileSection();
+  /// Read the SecCountHistogram section.
+  std::error_code readCountHistogram();
+  /// How many times each count appears in the profile, in the descending
+  /// order of counts, if the profile has a SecCountHistogram section.
+  std::vector<std::pair<uint64_t, uint32_t>> CountHistogram;
+  bool HasCountHistogram = false;
+  /// Read the SecDecayEpoch section.
+  std::error_code readDecayEpoch();
+  /// The decay factor and epoch of the profile, from its SecDecayEpoch
+  /// section.
+  uint64_t Decay = 1;
+  uint64_t Epoch = 0;
+  /// The symbols of the profiled binary, if the profile has a
+  /// SecProfileSymbolList section.
+  std::unique_ptr<ProfileSymbolList> ProfSymList;
+  /// Read a string indirectly via the name table.
+  virtual ErrorOr<StringRef> readStringFromTable() override;
 
 public:
-  SampleProfileReaderRawBinary(std::unique_ptr<MemoryBuffer> B, LLVMContext &C)
-      : SampleProfileReaderBinary(std::move(B), C, SPF_Binary) {}
+  SampleProfileReaderExtBinary(std::unique_ptr<MemoryBuffer> B, LLVMContext &C)
+      : SampleProfileReaderRawBinary(std::move(B), C, SPF_Ext_Binary) {}
 
   /// \brief Return true if \p Buffer is in the format supported by this class.
   static bool hasFormat(const MemoryBuffer &Buffer);
+
+  /// Read sample profiles in the function profile section.
+  std::error_code read() override;
+
+  bool dumpSectionInfo(raw_ostream &OS = dbgs()) override;
+
+  std::unique_ptr<ProfileSymbolList> getProfileSymbolList() override {
+    return std::move(ProfSymList);
+  }
+
+  bool getNamesInProfile(std::vector<StringRef> &Names) override {
+    return !getNameTable(Names);
+  }
+
+  /// Return the section header table of the profile.
+  const std::vector<SecHdrTableEntry> &getSecHdrTable() const {
+    return SecHdrTable;
+  }
+
+  /// A function profile as it is encoded in the function profile section.
+  struct EncodedFuncProfile {
+    StringRef Name;
+    StringRef Data;
+  };
+
+  /// Return the encoded function profiles in \p FuncProfiles, in the order
+  /// of the function profile section. Their name indices refer to the name
+  /// table returned by getNameTable.
+  std::error_code
+  getEncodedFuncProfiles(std::vector<EncodedFuncProfile> &FuncProfiles);
+
+  /// Return the names of the name table in \p Names, in the order of their
+  /// indices.
+  std::error_code getNameTable(std::vector<StringRef> &Names);
+
+  /// Return true if the profile records how often each count appears in it.
+  bool hasCountHistogram() const { return HasCountHistogram; }
+
+  /// Return how many times each count appears in the profile, in the
+  /// descending order of counts.
+  ArrayRef<std::pair<uint64_t, uint32_t>> getCountHistogram() const {
+    return CountHistogram;
+  }
+
+  /// Return the decay factor and the epoch of the profile (see
+  /// SampleProfileWriter::setDecayEpoch), or 1 and 0 if its samples do not
+  /// fade.
+  std::pair<uint64_t, uint64_t> getDecayEpoch() const {
+    return {Decay, Epoch};
+  }
 };
 
 class SampleProfileReaderCompactBinary : public SampleProfileReaderBinary {
 private:
   /// Function name table.
   std::vector<std::string> NameTable;
-  /// The table mapping from function name to the offset of its FunctionSample
-  /// towards file start.
-  DenseMap<StringRef, uint64_t> FuncOffsetTable;
-  /// The set containing the functions to use when compiling a module.
-  DenseSet<StringRef> FuncsToUse;
+  /// The original names of the functions, if the profile has them.
+  std::vector<StringRef> OriginalNames;
+  /// Read the original names following the function offset table, in
+  /// [Data, End).
+  std::error_code readOriginalNames();
   virtual std::error_code verifySPMagic(uint64_t Magic) override;
   virtual std::error_code readNameTable() override;
   /// Read a string indirectly via the name table.
   virtual ErrorOr<StringRef> readStringFromTable() override;
   virtual std::error_code readHeader() override;
-  std::error_code readFuncOffsetTable();
 
 public:
   SampleProfileReaderCompactBinary(std::unique_ptr<MemoryBuffer> B,
@@ -477,11 +730,9 @@ public:
   /// \brief Return true if \p Buffer is in the format supported by this class.
   static bool hasFormat(const MemoryBuffer &Buffer);
 
-  /// Read samples only for functions to use.
-  std::error_code read() override;
-
-  /// Collect functions to be used when compiling Module \p M.
-  void collectFuncsToUse(const Module &M) override;
+  ArrayRef<StringRef> getOriginalNames() const override {
+    return OriginalNames;
+  }
 };
 
 using InlineCallStack = SmallVector<FunctionSamples *, 10>;
@@ -540,6 +791,16 @@ protected:
 /// A profile data reader proxy that remaps the profile data from another
 /// sample profile data reader, by applying a provided set of equivalences
 /// between components of the symbol names in the profile.
+///
+/// Names are remapped on demand: a name that is in the profile is found
+/// directly, and only the names that are not are canonicalized and matched
+/// against the names of the profile, the results being cached. When
+/// collectFuncsToUse has been called, read() matches all the functions of
+/// the module in one pass over the names of the profile, which the
+/// canonicalizer only has to parse up to their first unknown component.
+/// Otherwise every name of the profile is canonicalized once, the first
+/// time a name is not found. Profiles that only store the MD5 hashes of the
+/// names can be remapped if they carry their original names.
 class SampleProfileReaderItaniumRemapper : public SampleProfileReader {
 public:
   SampleProfileReaderItaniumRemapper(
@@ -548,6 +809,7 @@ public:
       : SampleProfileReader(std::move(B), C, Underlying->getFormat()) {
     Profiles = std::move(Underlying->getProfiles());
     Summary = takeSummary(*Underlying);
+    ProfileIsCS = Underlying->profileIsCS();
     // Keep the underlying reader alive; the profile data may contain
     // StringRefs referencing names in its name table.
     UnderlyingReader = std::move(Underlying);
@@ -562,16 +824,62 @@ public:
   /// Read and validate the file header.
   std::error_code readHeader() override { return sampleprof_error::success; }
 
-  /// Read remapping file and apply it to the sample profile.
+  /// Read remapping file and remap the names of the functions collected by
+  /// collectFuncsToUse, if any.
   std::error_code read() override;
 
+  /// Collect the functions of Module \p M, whose names read() remaps.
+  void collectFuncsToUse(const Module &M) override;
+
   /// Return the samples collected for function \p F.
   FunctionSamples *getSamplesFor(StringRef FunctionName) override;
   using SampleProfileReader::getSamplesFor;
 
+  /// Return the flattened samples collected for function \p F.
+  const FlatFunctionSamples *
+  getFlatSamplesFor(StringRef FunctionName) override;
+  using SampleProfileReader::getFlatSamplesFor;
+
+  std::unique_ptr<ProfileSymbolList> getProfileSymbolList() override {
+    return UnderlyingReader->getProfileSymbolList();
+  }
+
+  bool getNamesInProfile(std::vector<StringRef> &Names) override {
+    return UnderlyingReader->getNamesInProfile(Names);
+  }
+
 private:
+  /// Return the name in the profile equivalent to \p FunctionName, or an
+  /// empty name if there is none.
+  StringRef lookUpNameInProfile(StringRef FunctionName);
+
+  /// Return true if the profile has samples for \p FunctionName itself.
+  bool isInProfile(StringRef FunctionName);
+
+  /// Find the names in the profile equivalent to those of \p Names that are
+  /// not in the profile themselves, and cache them.
+  void remapNames(ArrayRef<StringRef> Names);
+
+  /// Canonicalize every name of the profile into ProfileNameMap.
+  void canonicalizeProfileNames();
+
   SymbolRemappingReader Remappings;
-  DenseMap<SymbolRemappingReader::Key, FunctionSamples*> SampleMap;
+
+  /// The names of the profile, i.e. the names of its functions or, if it only
+  /// stores their hashes, their original names. Contexts are not remapped.
+  std::vector<StringRef> ProfileNames;
+
+  /// The functions collected by collectFuncsToUse.
+  std::vector<StringRef> FuncsToRemap;
+
+  /// The name in the profile equivalent to each name looked up so far that
+  /// is not in the profile itself, or an empty name if there is none.
+  StringMap<StringRef> RemappedNames;
+
+  /// The names of the profile by key, once canonicalizeProfileNames has run.
+  DenseMap<SymbolRemappingReader::Key, StringRef> ProfileNameMap;
+  bool ProfileNamesCanonicalized = false;
+
   std::unique_ptr<SampleProfileReader> UnderlyingReader;
 };
 
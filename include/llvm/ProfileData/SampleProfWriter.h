@@ -13,6 +13,9 @@
 #define LLVM_PROFILEDATA_SAMPLEPROFWRITER_H
 
 #include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/ProfileSummary.h"
@@ -24,10 +27,17 @@
 #include <memory>
 #include <set>
 #include <system_error>
+#include <utility>
+#include <vector>
 
 namespace llvm {
+
+class SampleProfileSummaryBuilder;
+
 namespace sampleprof {
 
+class SampleProfileReader;
+
 /// Sample-based profile writer. Base class.
 class SampleProfileWriter {
 public:
@@ -45,6 +55,40 @@ public:
 
   raw_ostream &getOutputStream() { return *OutputStream; }
 
+  /// Compress the sections of type \p Type when writing the profile. This
+  /// only has an effect for formats made of sections.
+  virtual void setToCompressSection(SecType Type) {}
+
+  /// Compress every section when writing the profile. This only has an effect
+  /// for formats made of sections.
+  virtual void setToCompressAllSections() {}
+
+  /// Write the symbol list \p PSL along with the profile. This only has an
+  /// effect for formats made of sections. The writer does not own \p PSL.
+  virtual void setProfileSymbolList(ProfileSymbolList *PSL) {}
+
+  /// Also write the original names of the functions, for the formats that
+  /// only store their MD5 hashes, so that the profile can be remapped.
+  virtual void setToWriteOriginalNames() {}
+
+  /// Record that the counts of the profile are weighted by \p Decay to the
+  /// power of \p Epoch for the latest samples, and by lower powers of it for
+  /// the older ones. This only has an effect for formats made of sections.
+  virtual void setDecayEpoch(uint64_t Decay, uint64_t Epoch) {}
+
+  /// Write the profile read by \p Base, in the same format, with the function
+  /// profiles of \p ProfileMap replacing its own or added to it. Only the
+  /// profiles of \p ProfileMap are encoded; the others are copied from
+  /// \p Base as they are, so the cost does not depend on the size of \p Base.
+  /// \p Base must have read its profiles of the functions of \p ProfileMap,
+  /// which are taken out of the summary. This is only supported for formats
+  /// made of sections.
+  virtual std::error_code
+  append(SampleProfileReader &Base,
+         const StringMap<FunctionSamples> &ProfileMap) {
+    return sampleprof_error::unsupported_writing_format;
+  }
+
   /// Profile writer factory.
   ///
   /// Create a new file writer based on the value of \p Format.
@@ -64,14 +108,25 @@ protected:
   virtual std::error_code
   writeHeader(const StringMap<FunctionSamples> &ProfileMap) = 0;
 
+  /// Write all the function profiles in \p ProfileMap, hottest first.
+  std::error_code
+  writeFuncProfiles(const StringMap<FunctionSamples> &ProfileMap);
+
   /// Output stream where to emit the profile to.
   std::unique_ptr<raw_ostream> OutputStream;
 
   /// Profile summary.
   std::unique_ptr<ProfileSummary> Summary;
 
+  /// How many times each count appears in the profile, in the descending
+  /// order of counts, as found when computing the summary.
+  std::vector<std::pair<uint64_t, uint32_t>> CountHistogram;
+
   /// Compute summary for this profile.
   void computeSummary(const StringMap<FunctionSamples> &ProfileMap);
+
+  /// Take the summary and the count histogram from \p Builder.
+  void setSummary(SampleProfileSummaryBuilder &Builder);
 };
 
 /// Sample-based profile writer (text format).
@@ -116,25 +171,159 @@ protected:
   std::error_code writeBody(const FunctionSamples &S);
   inline void stablizeNameTable(std::set<StringRef> &V);
 
-  MapVector<StringRef, uint32_t> NameTable;
+  /// Write the function offset table collected while writing the profiles.
+  std::error_code writeFuncOffsetTable();
 
-private:
   void addName(StringRef FName);
   void addNames(const FunctionSamples &S);
 
+  MapVector<StringRef, uint32_t> NameTable;
+
+  /// The table mapping from function name to the offset of its FunctionSample
+  /// towards profile start.
+  MapVector<StringRef, uint64_t> FuncOffsetTable;
+
+private:
+
   friend ErrorOr<std::unique_ptr<SampleProfileWriter>>
   SampleProfileWriter::create(std::unique_ptr<raw_ostream> &OS,
                               SampleProfileFormat Format);
 };
 
+// The raw binary format ends with a function offset table, which maps the
+// name index of every function to the offset of its function profile, and a
+// fixed size footer holding the offset of that table. The footer is written
+// last so that the profile can be emitted to a stream that does not support
+// seeking.
 class SampleProfileWriterRawBinary : public SampleProfileWriterBinary {
   using SampleProfileWriterBinary::SampleProfileWriterBinary;
 
+public:
+  using SampleProfileWriterBinary::write;
+  virtual std::error_code
+  write(const StringMap<FunctionSamples> &ProfileMap) override;
+
 protected:
   virtual std::error_code writeNameTable() override;
   virtual std::error_code writeMagicIdent() override;
 };
 
+// ExtBinary is a section based format. It shares the encoding of the name
+// table and of the function profiles with the raw binary format, but every
+// part of the profile is stored in its own section, and a section header
+// table describing the sections follows the magic number and version:
+//
+//    MAGIC (uint64_t, ULEB128)
+//    VERSION (uint64_t, ULEB128)
+//    SECTION HEADER TABLE
+//      NUM_ENTRIES (uint64_t)
+//      ENTRIES: TYPE, FLAGS, OFFSET, SIZE (4 x uint64_t)
+//    SECTIONS
+//      ProfileSummarySection
+//      NameTableSection
+//      LBRProfileSection
+//      FuncOffsetTableSection
+//      CountHistogramSection
+//      DecayEpochSection (optional)
+//      ProfileSymbolListSection (optional)
+//
+// The name table is indexed (SecFlagIndexed): it holds the number of names
+// N, N + 1 offsets of the names from the end of the offsets, and the
+// NUL-terminated names, all stored unencoded in little endian order. This
+// lets the reader look names up in constant time, directly in the profile
+// buffer.
+//
+// The section header table entries are stored unencoded in little endian
+// order; OFFSET is relative to the start of the profile. The function
+// offsets in FuncOffsetTableSection are relative to the start of
+// LBRProfileSection. Readers skip the sections they do not know, so new
+// sections can be added without breaking them, and they can decode the
+// function profiles lazily.
+//
+// CountHistogramSection holds the number of distinct body sample counts,
+// then every count with the number of times it appears in the profile
+// (ULEB128), in the descending order of counts. It lets append() update the
+// summary exactly without decoding the function profiles it copies.
+//
+// DecayEpochSection holds the decay factor and the epoch (ULEB128) of a
+// profile whose older samples fade: the samples of the latest append were
+// weighted by DECAY^EPOCH, those of the append before it by DECAY^(EPOCH-1),
+// and so on. Weighting the new samples up instead of the old ones down lets
+// append() leave the functions it does not touch as they are.
+//
+// Each section is first written to a memory buffer, so the profile can be
+// emitted to a stream that does not support seeking. Sections can be
+// compressed individually, in which case they carry SecFlagCompress.
+class SampleProfileWriterExtBinary : public SampleProfileWriterRawBinary {
+  using SampleProfileWriterRawBinary::SampleProfileWriterRawBinary;
+
+public:
+  using SampleProfileWriterBinary::write;
+  virtual std::error_code
+  write(const StringMap<FunctionSamples> &ProfileMap) override;
+
+  virtual void setToCompressSection(SecType Type) override {
+    SecsToCompress.insert(Type);
+  }
+  virtual void setToCompressAllSections() override;
+
+  virtual void setProfileSymbolList(ProfileSymbolList *PSL) override {
+    ProfSymList = PSL;
+  }
+
+  virtual void setDecayEpoch(uint64_t Decay, uint64_t Epoch) override {
+    this->Decay = Decay;
+    this->Epoch = Epoch;
+  }
+
+  /// The name table of \p Base is kept in its order, with the new names
+  /// after it, so that its function profiles can be copied as they are.
+  virtual std::error_code
+  append(SampleProfileReader &Base,
+         const StringMap<FunctionSamples> &ProfileMap) override;
+
+protected:
+  virtual std::error_code writeMagicIdent() override;
+  /// Write an indexed name table, which the reader uses in place.
+  virtual std::error_code writeNameTable() override;
+
+private:
+  /// Write every section, with the function profiles written by
+  /// \p WriteFuncProfiles, followed by the header and the section header
+  /// table. The summary and the name table must be ready.
+  std::error_code
+  writeSections(function_ref<std::error_code()> WriteFuncProfiles);
+
+  /// Write the count histogram computed along with the summary.
+  std::error_code writeCountHistogram();
+
+  /// The decay epoch of the profile, only written if Epoch is not zero.
+  uint64_t Decay = 1;
+  uint64_t Epoch = 0;
+
+  /// If true, the names are written in the order of NameTable rather than
+  /// sorted, as the indices of NameTable are already in use.
+  bool KeepNameTableOrder = false;
+
+  /// Write a section of type \p Type with flags \p Flags whose contents are
+  /// produced by \p WriteContents writing to OutputStream.
+  std::error_code writeSection(SecType Type, uint64_t Flags,
+                               function_ref<std::error_code()> WriteContents);
+
+  /// Replace the contents of \p Buf by their compressed form.
+  std::error_code compressSection(SmallString<0> &Buf);
+
+  /// The sections written so far and their contents.
+  SmallVector<SecHdrTableEntry, 8> SecHdrTable;
+  SmallVector<SmallString<0>, 8> SecBuffers;
+
+  /// The types of the sections to compress.
+  std::set<SecType> SecsToCompress;
+
+  /// The symbol list written to SecProfileSymbolList, if any.
+  ProfileSymbolList *ProfSymList = nullptr;
+};
+
 // CompactBinary is a compact format of binary profile which both reduces
 // the profile size and the load time needed when compiling. It has two
 // major difference with Binary format.
@@ -162,29 +351,38 @@ protected:
 //             function1 name index --> function1 profile start
 //             function2 name index --> function2 profile start
 //             function3 name index --> function3 profile start
+//    Part5: Original names (optional)
+//             number of names, then the NUL-terminated original names of
+//             all the names hashed in the name table, sorted
 //
 // We need Part2 because profile reader can use it to find out and read
-// function offset table without reading Part3 first.
+// function offset table without reading Part3 first. Part5 lets the reader
+// remap the names of the profile, which it cannot do from their hashes, and
+// lets the profile be merged again without losing its names; readers that
+// do not need it stop at the end of Part4.
 class SampleProfileWriterCompactBinary : public SampleProfileWriterBinary {
   using SampleProfileWriterBinary::SampleProfileWriterBinary;
 
 public:
-  virtual std::error_code write(const FunctionSamples &S) override;
+  using SampleProfileWriterBinary::write;
   virtual std::error_code
   write(const StringMap<FunctionSamples> &ProfileMap) override;
 
+  virtual void setToWriteOriginalNames() override {
+    WriteOriginalNames = true;
+  }
+
 protected:
-  /// The table mapping from function name to the offset of its FunctionSample
-  /// towards profile start.
-  MapVector<StringRef, uint64_t> FuncOffsetTable;
   /// The offset of the slot to be filled with the offset of FuncOffsetTable
   /// towards profile start.
   uint64_t TableOffset;
+  /// Whether to write the original names after the function offset table.
+  bool WriteOriginalNames = false;
+  std::error_code writeOriginalNames();
   virtual std::error_code writeNameTable() override;
   virtual std::error_code writeMagicIdent() override;
   virtual std::error_code
   writeHeader(const StringMap<FunctionSamples> &ProfileMap) override;
-  std::error_code writeFuncOffsetTable();
 };
 
 } // end namespace sampleprof
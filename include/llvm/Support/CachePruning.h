@@ -72,8 +72,33 @@ Expected<CachePruningPolicy> parseCachePruningPolicy(StringRef PolicyStr);
 /// As a safeguard against data loss if the user specifies the wrong directory
 /// as their cache directory, this function will ignore files not matching the
 /// pattern "llvmcache-*".
+///
+/// If the cache directory has an index (see addCacheIndexEntry()), the files
+/// are pruned according to the index, without scanning the directory. Every
+/// user of the directory should then record its files in the index, as the
+/// files the index does not know about are never pruned. Pruning is not
+/// incremental: it reads the whole index and sorts its entries by time, in
+/// O(N log N) for N entries, every time it runs.
 bool pruneCache(StringRef Path, CachePruningPolicy Policy);
 
+/// Record in the index of the cache directory \p Path that its file
+/// \p EntryName was added, with \p Size bytes of contents. The entries
+/// created as hard links to a same file have the same \p ContentName, the name
+/// of one of the links in the directory, which pruneCache() removes along with
+/// the last entry using it and counts only once in the size of the cache. An
+/// entry that is not shared is its own \p ContentName.
+///
+/// The index is a journal of one line per record, to which every process
+/// appends atomically, and a snapshot of the entries written by pruneCache():
+///   A <entry name> <content name> <size> <seconds since the epoch>
+///   U <entry name> <seconds since the epoch>
+void addCacheIndexEntry(StringRef Path, StringRef EntryName,
+                        StringRef ContentName, uint64_t Size);
+
+/// Record in the index of the cache directory \p Path that its file
+/// \p EntryName was used.
+void touchCacheIndexEntry(StringRef Path, StringRef EntryName);
+
 } // namespace llvm
 
 #endif
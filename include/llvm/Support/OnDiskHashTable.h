@@ -13,14 +13,18 @@
 #ifndef LLVM_SUPPORT_ONDISKHASHTABLE_H
 #define LLVM_SUPPORT_ONDISKHASHTABLE_H
 
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
 #include "llvm/Support/Allocator.h"
 #include "llvm/Support/DataTypes.h"
 #include "llvm/Support/EndianStream.h"
 #include "llvm/Support/Host.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/raw_ostream.h"
+#include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <vector>
 
 namespace llvm {
 
@@ -148,24 +152,7 @@ public:
   ///
   /// Uses the provided Info instead of a stack allocated one.
   offset_type Emit(raw_ostream &Out, Info &InfoObj) {
-    using namespace llvm::support;
-    endian::Writer LE(Out, little);
-
-    // Now we're done adding entries, resize the bucket list if it's
-    // significantly too large. (This only happens if the number of
-    // entries is small and we're within our initial allocation of
-    // 64 buckets.) We aim for an occupancy ratio in [3/8, 3/4).
-    //
-    // As a special case, if there are two or fewer entries, just
-    // form a single bucket. A linear scan is fine in that case, and
-    // this is very common in C++ class lookup tables. This also
-    // guarantees we produce at least one bucket for an empty table.
-    //
-    // FIXME: Try computing a perfect hash function at this point.
-    unsigned TargetNumBuckets =
-        NumEntries <= 2 ? 1 : NextPowerOf2(NumEntries * 4 / 3);
-    if (TargetNumBuckets != NumBuckets)
-      resize(TargetNumBuckets);
+    resizeForEmit();
 
     // Emit the payload of the table.
     for (offset_type I = 0; I < NumBuckets; ++I) {
@@ -176,34 +163,125 @@ public:
       // Store the offset for the data of this bucket.
       B.Off = Out.tell();
       assert(B.Off && "Cannot write a bucket at offset 0. Please add padding.");
+      emitBucket(Out, B, InfoObj);
+    }
+
+    return emitTable(Out);
+  }
+
+  /// Emit the table to Out, which must not be at offset 0, serializing the
+  /// payload of the buckets concurrently. The output is the same as Emit's.
+  ///
+  /// The buckets are serialized in ranges, each into its own buffer, by up
+  /// to \p NumTasks tasks at a time using the Info returned by \p GetInfo
+  /// for the index of the task. \p RunTasks must call its second argument
+  /// for every task index below its first argument, in any order and on any
+  /// thread, and return once all the calls have returned. The Info must not
+  /// depend on the offsets in Out of what it writes.
+  offset_type
+  Emit(raw_ostream &Out, unsigned NumTasks,
+       function_ref<Info &(unsigned)> GetInfo,
+       function_ref<void(unsigned, function_ref<void(unsigned)>)> RunTasks) {
+    resizeForEmit();
+
+    // Use enough ranges that only a fraction of the payload is buffered at
+    // a time, but not so many that the tasks are too small.
+    NumTasks = std::max(NumTasks, 1U);
+    offset_type RangeSize = std::max<offset_type>(
+        NumBuckets / (NumTasks * 16), std::min<offset_type>(NumBuckets, 256));
+    std::vector<SmallString<0>> Payloads(NumTasks);
+    for (offset_type Begin = 0; Begin < NumBuckets;
+         Begin += RangeSize * NumTasks) {
+      RunTasks(NumTasks, [&](unsigned Task) {
+        offset_type RangeBegin = Begin + RangeSize * Task;
+        offset_type RangeEnd = std::min(RangeBegin + RangeSize, NumBuckets);
+        raw_svector_ostream PayloadOut(Payloads[Task]);
+        Info &InfoObj = GetInfo(Task);
+        // The offsets are relative to the payload until it is written.
+        for (offset_type I = RangeBegin; I < RangeEnd; ++I) {
+          Bucket &B = Buckets[I];
+          if (!B.Head)
+            continue;
+          B.Off = PayloadOut.tell();
+          emitBucket(PayloadOut, B, InfoObj);
+        }
+      });
+
+      for (unsigned Task = 0; Task < NumTasks; ++Task) {
+        offset_type RangeBegin =
+            std::min(Begin + RangeSize * Task, NumBuckets);
+        offset_type RangeEnd = std::min(RangeBegin + RangeSize, NumBuckets);
+        offset_type PayloadOff = Out.tell();
+        assert(PayloadOff &&
+               "Cannot write a bucket at offset 0. Please add padding.");
+        for (offset_type I = RangeBegin; I < RangeEnd; ++I)
+          if (Buckets[I].Head)
+            Buckets[I].Off += PayloadOff;
+        Out << Payloads[Task];
+        Payloads[Task].clear();
+      }
+    }
+
+    return emitTable(Out);
+  }
+
+private:
+  /// Now we're done adding entries, resize the bucket list if it's
+  /// significantly too large. (This only happens if the number of
+  /// entries is small and we're within our initial allocation of
+  /// 64 buckets.) We aim for an occupancy ratio in [3/8, 3/4).
+  ///
+  /// As a special case, if there are two or fewer entries, just
+  /// form a single bucket. A linear scan is fine in that case, and
+  /// this is very common in C++ class lookup tables. This also
+  /// guarantees we produce at least one bucket for an empty table.
+  ///
+  /// FIXME: Try computing a perfect hash function at this point.
+  void resizeForEmit() {
+    unsigned TargetNumBuckets =
+        NumEntries <= 2 ? 1 : NextPowerOf2(NumEntries * 4 / 3);
+    if (TargetNumBuckets != NumBuckets)
+      resize(TargetNumBuckets);
+  }
 
-      // Write out the number of items in the bucket.
-      LE.write<uint16_t>(B.Length);
-      assert(B.Length != 0 && "Bucket has a head but zero length?");
+  /// Write out the payload of the non-empty bucket \p B.
+  void emitBucket(raw_ostream &Out, Bucket &B, Info &InfoObj) {
+    using namespace llvm::support;
+    endian::Writer LE(Out, little);
+
+    // Write out the number of items in the bucket.
+    LE.write<uint16_t>(B.Length);
+    assert(B.Length != 0 && "Bucket has a head but zero length?");
 
-      // Write out the entries in the bucket.
-      for (Item *I = B.Head; I; I = I->Next) {
-        LE.write<typename Info::hash_value_type>(I->Hash);
-        const std::pair<offset_type, offset_type> &Len =
-            InfoObj.EmitKeyDataLength(Out, I->Key, I->Data);
+    // Write out the entries in the bucket.
+    for (Item *I = B.Head; I; I = I->Next) {
+      LE.write<typename Info::hash_value_type>(I->Hash);
+      const std::pair<offset_type, offset_type> &Len =
+          InfoObj.EmitKeyDataLength(Out, I->Key, I->Data);
 #ifdef NDEBUG
-        InfoObj.EmitKey(Out, I->Key, Len.first);
-        InfoObj.EmitData(Out, I->Key, I->Data, Len.second);
+      InfoObj.EmitKey(Out, I->Key, Len.first);
+      InfoObj.EmitData(Out, I->Key, I->Data, Len.second);
 #else
-        // In asserts mode, check that the users length matches the data they
-        // wrote.
-        uint64_t KeyStart = Out.tell();
-        InfoObj.EmitKey(Out, I->Key, Len.first);
-        uint64_t DataStart = Out.tell();
-        InfoObj.EmitData(Out, I->Key, I->Data, Len.second);
-        uint64_t End = Out.tell();
-        assert(offset_type(DataStart - KeyStart) == Len.first &&
-               "key length does not match bytes written");
-        assert(offset_type(End - DataStart) == Len.second &&
-               "data length does not match bytes written");
+      // In asserts mode, check that the users length matches the data they
+      // wrote.
+      uint64_t KeyStart = Out.tell();
+      InfoObj.EmitKey(Out, I->Key, Len.first);
+      uint64_t DataStart = Out.tell();
+      InfoObj.EmitData(Out, I->Key, I->Data, Len.second);
+      uint64_t End = Out.tell();
+      assert(offset_type(DataStart - KeyStart) == Len.first &&
+             "key length does not match bytes written");
+      assert(offset_type(End - DataStart) == Len.second &&
+             "data length does not match bytes written");
 #endif
-      }
     }
+  }
+
+  /// Write out the bucket table once the payload is written, and return its
+  /// offset.
+  offset_type emitTable(raw_ostream &Out) {
+    using namespace llvm::support;
+    endian::Writer LE(Out, little);
 
     // Pad with zeros so that we can start the hashtable at an aligned address.
     offset_type TableOff = Out.tell();
@@ -221,6 +299,7 @@ public:
     return TableOff;
   }
 
+public:
   OnDiskChainedHashTableGenerator() {
     NumEntries = 0;
     NumBuckets = 64;
@@ -0,0 +1,153 @@
+//===- SampleContextTracker.h - Context-sensitive profile tracker -*- C++ -*-=//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// This file provides the tracker the sample profile loader uses to hand out
+/// the samples of context-sensitive profiles as functions get inlined.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_IPO_SAMPLECONTEXTTRACKER_H
+#define LLVM_TRANSFORMS_IPO_SAMPLECONTEXTTRACKER_H
+
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ProfileData/SampleProf.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace llvm {
+
+class DILocation;
+
+namespace sampleprof {
+
+/// A node of the context trie: a function called through the chain of
+/// callsites on the path from the root.
+class ContextTrieNode {
+public:
+  using ChildMap =
+      std::map<std::pair<LineLocation, StringRef>,
+               std::unique_ptr<ContextTrieNode>>;
+
+  ContextTrieNode(StringRef FuncName, LineLocation CallSite)
+      : FuncName(FuncName), CallSite(CallSite) {}
+
+  StringRef getFuncName() const { return FuncName; }
+
+  /// Location of the call to this function in its caller.
+  const LineLocation &getCallSite() const { return CallSite; }
+
+  /// Samples of the function in this context. The samples of its callees
+  /// are in the children.
+  FunctionSamples &getSamples() { return Samples; }
+  const FunctionSamples &getSamples() const { return Samples; }
+
+  /// Whether this context was inlined into its caller by the loader.
+  bool isInlined() const { return Inlined; }
+  void setInlined() { Inlined = true; }
+
+  ChildMap &getChildren() { return Children; }
+  const ChildMap &getChildren() const { return Children; }
+
+  /// Return the context of the call to \p CalleeName at \p CallSite, or
+  /// null if there is none.
+  ContextTrieNode *getChild(const LineLocation &CallSite,
+                            StringRef CalleeName) const;
+
+  /// Return the context of the call to \p CalleeName at \p CallSite,
+  /// creating it if needed.
+  ContextTrieNode &getOrCreateChild(const LineLocation &CallSite,
+                                    StringRef CalleeName);
+
+  /// Return the total samples of this context and of all the contexts
+  /// below it.
+  uint64_t getContextTotalSamples() const;
+
+private:
+  StringRef FuncName;
+  LineLocation CallSite;
+  FunctionSamples Samples;
+  bool Inlined = false;
+  ChildMap Children;
+};
+
+/// Tracker of the context-sensitive profiles used by the sample profile
+/// loader.
+///
+/// The profiles are organized in a trie of calling contexts, whose root has
+/// a child for every outermost caller. The loader annotates callers before
+/// their callees: it gets the profile of a function with startFunction,
+/// reports the callsites it inlines with markContextInlined, and calls
+/// finishFunction once it is done. The contexts that were not inlined are
+/// then promoted: their samples, and those of the contexts below them, are
+/// merged into the base profile of the callee, i.e. into the child of the
+/// root for the callee, which the callee gets when it is annotated. The
+/// samples of a helper called from many places thus stay precise where it is
+/// inlined, and only the contexts that were not inlined get merged together.
+class SampleContextTracker {
+public:
+  /// Build the trie out of \p Profiles, moving the profiles out of it.
+  /// Context-insensitive profiles are the base profiles of their function.
+  explicit SampleContextTracker(StringMap<FunctionSamples> &Profiles);
+
+  /// Return the total samples of all the contexts.
+  uint64_t getTotalSamples() const { return TotalSamples; }
+
+  /// Promote the contexts called by functions for which \p IsAvailable
+  /// returns false. The loader never annotates these functions, so their
+  /// callees would not get the samples of the contexts otherwise.
+  void promoteContextsOfUnavailableFunctions(
+      function_ref<bool(StringRef)> IsAvailable);
+
+  /// Start annotating function \p FuncName. \returns its base profile, with
+  /// the contexts of its callees as inlined callsites, or null if it has no
+  /// samples. The profile is valid until the next call to startFunction.
+  const FunctionSamples *startFunction(StringRef FuncName);
+
+  /// Record that the call to \p CalleeName at \p DIL, in the function being
+  /// annotated or in a context inlined into it, was inlined.
+  void markContextInlined(const DILocation *DIL, StringRef CalleeName);
+
+  /// Finish annotating the function passed to startFunction, promoting the
+  /// contexts it called that were not inlined.
+  void finishFunction();
+
+private:
+  ContextTrieNode *getContextFor(const DILocation *DIL);
+  ContextTrieNode &getBaseContext(StringRef FuncName);
+  void promoteNotInlinedContexts(ContextTrieNode &Node);
+  void promoteContext(ContextTrieNode &Node);
+  static void mergeContext(ContextTrieNode &To, ContextTrieNode &From);
+  static void buildProfile(const ContextTrieNode &Node,
+                           FunctionSamples &Profile);
+
+  BumpPtrAllocator Alloc;
+  /// Storage of the function names of the trie.
+  UniqueStringSaver Names{Alloc};
+
+  ContextTrieNode RootContext{StringRef(), LineLocation(0, 0)};
+
+  /// Name of the function being annotated, and the context holding its
+  /// base profile, if it has one.
+  StringRef CurrentFuncName;
+  ContextTrieNode *CurrentContext = nullptr;
+  FunctionSamples CurrentProfile;
+
+  uint64_t TotalSamples = 0;
+};
+
+} // end namespace sampleprof
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_IPO_SAMPLECONTEXTTRACKER_H
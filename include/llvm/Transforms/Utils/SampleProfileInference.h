@@ -0,0 +1,65 @@
+//===- SampleProfileInference.h - Infer block and edge counts ---*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+/// \file
+/// This file defines applyFlowInference, which assigns consistent counts to
+/// the blocks and edges of a control-flow graph given sampled counts for some
+/// of its blocks.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TRANSFORMS_UTILS_SAMPLEPROFILEINFERENCE_H
+#define LLVM_TRANSFORMS_UTILS_SAMPLEPROFILEINFERENCE_H
+
+#include <cstdint>
+#include <vector>
+
+namespace llvm {
+
+/// A basic block of a FlowFunction.
+struct FlowBlock {
+  /// Sampled count of the block. Only meaningful if HasWeight is set.
+  uint64_t Weight = 0;
+  /// Whether the block was sampled. A block with a zero weight is known to
+  /// be cold, while a block without a weight may have any count.
+  bool HasWeight = false;
+  /// Count of the block computed by applyFlowInference.
+  uint64_t Flow = 0;
+};
+
+/// A control-flow edge of a FlowFunction.
+struct FlowJump {
+  unsigned Source;
+  unsigned Target;
+  /// Count of the edge computed by applyFlowInference.
+  uint64_t Flow = 0;
+};
+
+/// The control-flow graph of a function, with its blocks numbered from 0.
+/// Blocks without successors are exits.
+struct FlowFunction {
+  std::vector<FlowBlock> Blocks;
+  std::vector<FlowJump> Jumps;
+  /// Index of the entry block.
+  unsigned Entry = 0;
+};
+
+/// Assign a count to every block and jump of \p Func.
+///
+/// The counts form a flow from the entry block to the exit blocks: the count
+/// of every block is the sum of the counts of its outgoing jumps unless it is
+/// an exit, and the sum of the counts of its incoming jumps unless it is the
+/// entry, which may also be entered from the caller. Among all such
+/// flows, this picks one of minimum cost, where increasing or decreasing the
+/// count of a sampled block away from its weight costs a few units per
+/// sample, and increasing the count of a block without samples is free.
+void applyFlowInference(FlowFunction &Func);
+
+} // end namespace llvm
+
+#endif // LLVM_TRANSFORMS_UTILS_SAMPLEPROFILEINFERENCE_H
@@ -163,6 +163,78 @@ void ModuleSummaryIndex::propagateConstants(
             ReadOnlyLiveGVars++;
 }
 
+void ModuleSummaryIndex::mergeFrom(ModuleSummaryIndex &Other,
+                                   StringRef ModPath, uint64_t ModId) {
+  assert(!HaveGVs && !Other.HaveGVs && "Expected summaries read from bitcode");
+  assert(Other.ModulePathStringTable.size() <= 1 &&
+         "Expected the index of a single module");
+  // Like the bitcode reader, keep the module ID as unsigned.
+  ModuleInfo *Module = addModule(ModPath, static_cast<unsigned>(ModId));
+  if (!Other.ModulePathStringTable.empty()) {
+    const ModuleHash &Hash = Other.ModulePathStringTable.begin()->second.second;
+    if (llvm::any_of(Hash, [](uint32_t Word) { return Word != 0; }))
+      Module->second.second = Hash;
+  }
+
+  // Map the values of Other to the values of this index, keeping the names
+  // the bitcode reader gave them. The names Other saved die with it.
+  DenseMap<const GlobalValueSummaryMapTy::value_type *,
+           GlobalValueSummaryMapTy::value_type *>
+      ValueMap;
+  for (auto &I : Other.GlobalValueMap) {
+    auto *VP = getOrInsertValuePtr(I.first);
+    StringRef Name = I.second.U.Name;
+    if (!Name.empty())
+      VP->second.U.Name =
+          Other.Alloc.identifyObject(Name.data()) ? saveString(Name) : Name;
+    ValueMap[&I] = VP;
+  }
+  auto Remap = [&](ValueInfo &VI) {
+    VI.RefAndFlags.setPointer(ValueMap.lookup(VI.getRef()));
+  };
+
+  std::vector<AliasSummary *> Aliases;
+  for (auto &I : Other.GlobalValueMap) {
+    ValueInfo VI(HaveGVs, ValueMap.lookup(&I));
+    for (std::unique_ptr<GlobalValueSummary> &S : I.second.SummaryList) {
+      S->setModulePath(Module->first());
+      for (ValueInfo &Ref : S->RefEdgeList)
+        Remap(Ref);
+      if (auto *FS = dyn_cast<FunctionSummary>(S.get()))
+        for (FunctionSummary::EdgeTy &Call : FS->CallGraphEdgeList)
+          Remap(Call.first);
+      else if (auto *AS = dyn_cast<AliasSummary>(S.get()))
+        Aliases.push_back(AS);
+      addGlobalValueSummary(VI, std::move(S));
+    }
+    I.second.SummaryList.clear();
+  }
+  // Like the bitcode reader, point each alias to the first summary of its
+  // aliasee in the module.
+  for (AliasSummary *AS : Aliases) {
+    ValueInfo AliaseeVI = AS->getAliaseeVI();
+    Remap(AliaseeVI);
+    AS->setAliasee(AliaseeVI, findSummaryInModule(AliaseeVI, ModPath));
+  }
+
+  for (auto &I : Other.TypeIdMap)
+    getOrInsertTypeIdSummary(I.second.first) = std::move(I.second.second);
+  CfiFunctionDefs.insert(Other.CfiFunctionDefs.begin(),
+                         Other.CfiFunctionDefs.end());
+  CfiFunctionDecls.insert(Other.CfiFunctionDecls.begin(),
+                          Other.CfiFunctionDecls.end());
+  if (Other.WithGlobalValueDeadStripping)
+    setWithGlobalValueDeadStripping();
+  if (Other.SkipModuleByDistributedBackend)
+    setSkipModuleByDistributedBackend();
+  if (Other.HasSyntheticEntryCounts)
+    setHasSyntheticEntryCounts();
+  if (Other.EnableSplitLTOUnit)
+    setEnableSplitLTOUnit();
+  if (Other.PartiallySplitLTOUnits)
+    setPartiallySplitLTOUnits();
+}
+
 // TODO: write a graphviz dumper for SCCs (see ModuleSummaryIndex::exportToDot)
 // then delete this function and update its tests
 LLVM_DUMP_METHOD
@@ -12,10 +12,12 @@
 
 #include "llvm/LTO/Caching.h"
 #include "llvm/ADT/StringExtras.h"
+#include "llvm/Support/CachePruning.h"
 #include "llvm/Support/Errc.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
 #include "llvm/Support/raw_ostream.h"
 
 #if !defined(_MSC_VER) && !defined(__MINGW32__)
@@ -27,8 +29,40 @@
 using namespace llvm;
 using namespace llvm::lto;
 
+// Make the cache entry at EntryPath a hard link to the file holding the same
+// Contents, or make it that file, and record it in the index of the cache.
+static void addIndexedCacheEntry(StringRef CacheDirectoryPath,
+                                 StringRef EntryPath, StringRef Contents) {
+  std::string ContentName =
+      "llvmcache-content-" +
+      toHex(SHA1::hash(arrayRefFromStringRef(Contents)), /*LowerCase=*/true);
+  SmallString<64> ContentPath;
+  sys::path::append(ContentPath, CacheDirectoryPath, ContentName);
+  std::error_code EC = sys::fs::create_hard_link(EntryPath, ContentPath);
+  if (EC == errc::file_exists) {
+    // Another entry holds the same contents. If it is pruned meanwhile, this
+    // entry keeps its own copy.
+    SmallString<64> LinkModel, LinkPath;
+    sys::path::append(LinkModel, CacheDirectoryPath, "Thin-%%%%%%.tmp.link");
+    sys::fs::createUniquePath(LinkModel, LinkPath, /*MakeAbsolute=*/false);
+    EC = sys::fs::create_hard_link(ContentPath, LinkPath);
+    if (!EC) {
+      EC = sys::fs::rename(LinkPath, EntryPath);
+      if (EC)
+        sys::fs::remove(LinkPath);
+    }
+  }
+  // An entry that could not be linked, e.g. on a file system without hard
+  // links, only shares its contents with itself.
+  if (EC)
+    ContentName = sys::path::filename(EntryPath);
+  addCacheIndexEntry(CacheDirectoryPath, sys::path::filename(EntryPath),
+                     ContentName, Contents.size());
+}
+
 Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
-                                            AddBufferFn AddBuffer) {
+                                            AddBufferFn AddBuffer,
+                                            bool UseIndex) {
   if (std::error_code EC = sys::fs::create_directories(CacheDirectoryPath))
     return errorCodeToError(EC);
 
@@ -50,6 +84,9 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
       close(FD);
       if (MBOrErr) {
         AddBuffer(Task, std::move(*MBOrErr));
+        if (UseIndex)
+          touchCacheIndexEntry(CacheDirectoryPath,
+                               sys::path::filename(EntryPath));
         return AddStreamFn();
       }
       EC = MBOrErr.getError();
@@ -72,13 +109,16 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
       sys::fs::TempFile TempFile;
       std::string EntryPath;
       unsigned Task;
+      // The cache directory, if the entry is recorded in its index.
+      std::string IndexedCacheDirectoryPath;
 
       CacheStream(std::unique_ptr<raw_pwrite_stream> OS, AddBufferFn AddBuffer,
                   sys::fs::TempFile TempFile, std::string EntryPath,
-                  unsigned Task)
+                  unsigned Task, std::string IndexedCacheDirectoryPath)
           : NativeObjectStream(std::move(OS)), AddBuffer(std::move(AddBuffer)),
             TempFile(std::move(TempFile)), EntryPath(std::move(EntryPath)),
-            Task(Task) {}
+            Task(Task),
+            IndexedCacheDirectoryPath(std::move(IndexedCacheDirectoryPath)) {}
 
       ~CacheStream() {
         // Make sure the stream is closed before committing it.
@@ -104,11 +144,14 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
         // instead of just using the existing file, because the pruner might
         // delete the file before we get a chance to use it.
         Error E = TempFile.keep(EntryPath);
+        bool Kept = true;
         E = handleErrors(std::move(E), [&](const ECError &E) -> Error {
           std::error_code EC = E.convertToErrorCode();
           if (EC != errc::permission_denied)
             return errorCodeToError(EC);
 
+          Kept = false;
+
           auto MBCopy = MemoryBuffer::getMemBufferCopy((*MBOrErr)->getBuffer(),
                                                        EntryPath);
           MBOrErr = std::move(MBCopy);
@@ -124,6 +167,10 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
                              TempFile.TmpName + " to " + EntryPath + ": " +
                              toString(std::move(E)) + "\n");
 
+        if (Kept && !IndexedCacheDirectoryPath.empty())
+          addIndexedCacheEntry(IndexedCacheDirectoryPath, EntryPath,
+                               (*MBOrErr)->getBuffer());
+
         AddBuffer(Task, std::move(*MBOrErr));
       }
     };
@@ -142,7 +189,8 @@ Expected<NativeObjectCache> lto::localCache(StringRef CacheDirectoryPath,
       // This CacheStream will move the temporary file into the cache when done.
       return llvm::make_unique<CacheStream>(
           llvm::make_unique<raw_fd_ostream>(Temp->FD, /* ShouldClose */ false),
-          AddBuffer, std::move(*Temp), EntryPath.str(), Task);
+          AddBuffer, std::move(*Temp), EntryPath.str(), Task,
+          UseIndex ? CacheDirectoryPath.str() : std::string());
     };
   };
 }
@@ -30,9 +30,12 @@
 #include "llvm/Linker/IRMover.h"
 #include "llvm/Object/IRObjectFile.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FormatVariadic.h"
+#include "llvm/Support/JSON.h"
 #include "llvm/Support/ManagedStatic.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
 #include "llvm/Support/SHA1.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/TargetRegistry.h"
@@ -47,6 +50,9 @@
 #include "llvm/Transforms/Utils/FunctionImportUtils.h"
 #include "llvm/Transforms/Utils/SplitModule.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <numeric>
 #include <set>
 
 using namespace llvm;
@@ -59,6 +65,11 @@ static cl::opt<bool>
     DumpThinCGSCCs("dump-thin-cg-sccs", cl::init(false), cl::Hidden,
                    cl::desc("Dump the SCCs in the ThinLTO index's callgraph"));
 
+static cl::opt<unsigned> ThinLinkInternalizeChunkSize(
+    "thinlto-internalize-chunk-size", cl::init(1024), cl::Hidden,
+    cl::desc("Minimum number of GUIDs each task of the thin link threads "
+             "internalizes and promotes"));
+
 /// Enable global value internalization in LTO.
 cl::opt<bool> EnableLTOInternalization(
     "enable-lto-internalization", cl::init(true), cl::Hidden,
@@ -380,9 +391,37 @@ static void thinLTOInternalizeAndPromoteGUID(
 // as external and non-exported values as internal.
 void llvm::thinLTOInternalizeAndPromoteInIndex(
     ModuleSummaryIndex &Index,
-    function_ref<bool(StringRef, GlobalValue::GUID)> isExported) {
+    function_ref<bool(StringRef, GlobalValue::GUID)> isExported,
+    unsigned ThreadCount) {
+  if (ThreadCount <= 1) {
+    for (auto &I : Index)
+      thinLTOInternalizeAndPromoteGUID(I.second.SummaryList, I.first,
+                                       isExported);
+    return;
+  }
+
+  // Each GUID only updates its own summaries, so the GUIDs are split into
+  // chunks, more than there are threads to balance the load.
+  std::vector<GlobalValueSummaryMapTy::value_type *> Entries;
   for (auto &I : Index)
-    thinLTOInternalizeAndPromoteGUID(I.second.SummaryList, I.first, isExported);
+    Entries.push_back(&I);
+  const size_t ChunkSize = std::max<size_t>(
+      std::max(1u, unsigned(ThinLinkInternalizeChunkSize)),
+      (Entries.size() + ThreadCount * 8 - 1) / (ThreadCount * 8));
+  auto ProcessChunk = [&](size_t Begin) {
+    size_t End = std::min(Begin + ChunkSize, Entries.size());
+    for (size_t I = Begin; I != End; ++I)
+      thinLTOInternalizeAndPromoteGUID(Entries[I]->second.SummaryList,
+                                       Entries[I]->first, isExported);
+  };
+  if (Entries.size() <= ChunkSize) {
+    ProcessChunk(0);
+    return;
+  }
+  ThreadPool Pool(ThreadCount);
+  for (size_t Begin = 0; Begin < Entries.size(); Begin += ChunkSize)
+    Pool.async(ProcessChunk, Begin);
+  Pool.wait();
 }
 
 // Requires a destructor for std::vector<InputModule>.
@@ -416,6 +455,36 @@ Expected<std::unique_ptr<InputFile>> InputFile::create(MemoryBufferRef Object) {
   return std::move(File);
 }
 
+std::vector<Expected<std::unique_ptr<InputFile>>>
+InputFile::create(ArrayRef<MemoryBufferRef> Objects, unsigned ThreadCount) {
+  std::vector<std::unique_ptr<InputFile>> Files(Objects.size());
+  std::vector<Optional<Error>> Errs(Objects.size());
+  auto CreateFile = [&](size_t I) {
+    Expected<std::unique_ptr<InputFile>> FileOrErr = create(Objects[I]);
+    if (FileOrErr)
+      Files[I] = std::move(*FileOrErr);
+    else
+      Errs[I] = FileOrErr.takeError();
+  };
+  if (ThreadCount <= 1) {
+    for (size_t I = 0; I != Objects.size(); ++I)
+      CreateFile(I);
+  } else {
+    ThreadPool Pool(ThreadCount);
+    for (size_t I = 0; I != Objects.size(); ++I)
+      Pool.async(CreateFile, I);
+  }
+
+  std::vector<Expected<std::unique_ptr<InputFile>>> Result;
+  for (size_t I = 0; I != Objects.size(); ++I) {
+    if (Errs[I])
+      Result.emplace_back(std::move(*Errs[I]));
+    else
+      Result.emplace_back(std::move(Files[I]));
+  }
+  return Result;
+}
+
 StringRef InputFile::getName() const {
   return Mods[0].getModuleIdentifier();
 }
@@ -523,17 +592,73 @@ static void writeToResolutionFile(raw_ostream &OS, InputFile *Input,
 
 Error LTO::add(std::unique_ptr<InputFile> Input,
                ArrayRef<SymbolResolution> Res) {
+  return addInput(*Input, Res, {});
+}
+
+Error LTO::add(std::vector<std::unique_ptr<InputFile>> Inputs,
+               ArrayRef<std::vector<SymbolResolution>> Res,
+               unsigned ThreadCount) {
+  assert(Inputs.size() == Res.size());
+
+  // Read the summaries of all modules concurrently, each into its own index.
+  // A summary that fails to read is read again when adding its module, to
+  // report the error in order.
+  std::vector<BitcodeModule> Mods;
+  for (std::unique_ptr<InputFile> &Input : Inputs)
+    Mods.insert(Mods.end(), Input->Mods.begin(), Input->Mods.end());
+  std::vector<std::unique_ptr<ModuleSummaryIndex>> Summaries(Mods.size());
+  auto ReadSummary = [&](size_t I) {
+    Expected<BitcodeLTOInfo> LTOInfo = Mods[I].getLTOInfo();
+    if (!LTOInfo) {
+      consumeError(LTOInfo.takeError());
+      return;
+    }
+    if (!LTOInfo->HasSummary)
+      return;
+    Expected<std::unique_ptr<ModuleSummaryIndex>> SummaryOrErr =
+        Mods[I].getSummary();
+    if (SummaryOrErr)
+      Summaries[I] = std::move(*SummaryOrErr);
+    else
+      consumeError(SummaryOrErr.takeError());
+  };
+  if (ThreadCount <= 1) {
+    for (size_t I = 0; I != Mods.size(); ++I)
+      ReadSummary(I);
+  } else {
+    ThreadPool Pool(ThreadCount);
+    for (size_t I = 0; I != Mods.size(); ++I)
+      Pool.async(ReadSummary, I);
+  }
+
+  MutableArrayRef<std::unique_ptr<ModuleSummaryIndex>> InputSummaries =
+      Summaries;
+  for (size_t I = 0; I != Inputs.size(); ++I) {
+    size_t NumMods = Inputs[I]->Mods.size();
+    if (Error Err = addInput(*Inputs[I], Res[I],
+                             InputSummaries.take_front(NumMods)))
+      return createFileError(Inputs[I]->getName(), std::move(Err));
+    InputSummaries = InputSummaries.drop_front(NumMods);
+  }
+  return Error::success();
+}
+
+Error LTO::addInput(
+    InputFile &Input, ArrayRef<SymbolResolution> Res,
+    MutableArrayRef<std::unique_ptr<ModuleSummaryIndex>> Summaries) {
   assert(!CalledGetMaxTasks);
 
   if (Conf.ResolutionFile)
-    writeToResolutionFile(*Conf.ResolutionFile, Input.get(), Res);
+    writeToResolutionFile(*Conf.ResolutionFile, &Input, Res);
 
   if (RegularLTO.CombinedModule->getTargetTriple().empty())
-    RegularLTO.CombinedModule->setTargetTriple(Input->getTargetTriple());
+    RegularLTO.CombinedModule->setTargetTriple(Input.getTargetTriple());
 
   const SymbolResolution *ResI = Res.begin();
-  for (unsigned I = 0; I != Input->Mods.size(); ++I)
-    if (Error Err = addModule(*Input, I, ResI, Res.end()))
+  for (unsigned I = 0; I != Input.Mods.size(); ++I)
+    if (Error Err = addModule(Input, I, ResI, Res.end(),
+                              Summaries.empty() ? nullptr
+                                                : std::move(Summaries[I])))
       return Err;
 
   assert(ResI == Res.end());
@@ -542,7 +667,8 @@ Error LTO::add(std::unique_ptr<InputFile> Input,
 
 Error LTO::addModule(InputFile &Input, unsigned ModI,
                      const SymbolResolution *&ResI,
-                     const SymbolResolution *ResE) {
+                     const SymbolResolution *ResE,
+                     std::unique_ptr<ModuleSummaryIndex> Summary) {
   Expected<BitcodeLTOInfo> LTOInfo = Input.Mods[ModI].getLTOInfo();
   if (!LTOInfo)
     return LTOInfo.takeError();
@@ -563,7 +689,7 @@ Error LTO::addModule(InputFile &Input, unsigned ModI,
                        LTOInfo->HasSummary);
 
   if (LTOInfo->IsThinLTO)
-    return addThinLTO(BM, ModSyms, ResI, ResE);
+    return addThinLTO(BM, ModSyms, ResI, ResE, std::move(Summary));
 
   Expected<RegularLTOState::AddedModule> ModOrErr =
       addRegularLTO(BM, ModSyms, ResI, ResE);
@@ -575,12 +701,23 @@ Error LTO::addModule(InputFile &Input, unsigned ModI,
 
   // Regular LTO module summaries are added to a dummy module that represents
   // the combined regular LTO module.
-  if (Error Err = BM.readSummary(ThinLTO.CombinedIndex, "", -1ull))
+  if (Error Err = readSummary(BM, std::move(Summary), "", -1ull))
     return Err;
   RegularLTO.ModsWithSummaries.push_back(std::move(*ModOrErr));
   return Error::success();
 }
 
+// Read the summary of the module BM into the combined index, unless it was
+// read ahead of time into Summary.
+Error LTO::readSummary(BitcodeModule BM,
+                       std::unique_ptr<ModuleSummaryIndex> Summary,
+                       StringRef ModulePath, uint64_t ModuleId) {
+  if (!Summary)
+    return BM.readSummary(ThinLTO.CombinedIndex, ModulePath, ModuleId);
+  ThinLTO.CombinedIndex.mergeFrom(*Summary, ModulePath, ModuleId);
+  return Error::success();
+}
+
 // Checks whether the given global value is in a non-prevailing comdat
 // (comdat containing values the linker indicated were not prevailing,
 // which we then dropped to available_externally), and if so, removes
@@ -760,10 +897,10 @@ Error LTO::linkRegularLTO(RegularLTOState::AddedModule Mod,
 // Add a ThinLTO module to the link.
 Error LTO::addThinLTO(BitcodeModule BM, ArrayRef<InputFile::Symbol> Syms,
                       const SymbolResolution *&ResI,
-                      const SymbolResolution *ResE) {
-  if (Error Err =
-          BM.readSummary(ThinLTO.CombinedIndex, BM.getModuleIdentifier(),
-                         ThinLTO.ModuleMap.size()))
+                      const SymbolResolution *ResE,
+                      std::unique_ptr<ModuleSummaryIndex> Summary) {
+  if (Error Err = readSummary(BM, std::move(Summary), BM.getModuleIdentifier(),
+                              ThinLTO.ModuleMap.size()))
     return Err;
 
   for (const InputFile::Symbol &Sym : Syms) {
@@ -995,8 +1132,33 @@ public:
       const std::map<GlobalValue::GUID, GlobalValue::LinkageTypes> &ResolvedODR,
       MapVector<StringRef, BitcodeModule> &ModuleMap) = 0;
   virtual Error wait() = 0;
+
+  /// Whether the backend jobs must be started in the order of the input
+  /// modules, rather than in the order of their estimated cost.
+  virtual bool isSensitiveToInputOrder() { return false; }
 };
 
+/// Estimate the cost of the backend job of a module from the number of
+/// instructions of the functions it defines and of the functions it imports.
+static uint64_t
+estimateBackendCost(const ModuleSummaryIndex &CombinedIndex,
+                    const GVSummaryMapTy &DefinedGlobals,
+                    const FunctionImporter::ImportMapTy &ImportList) {
+  auto GetInstCount = [](const GlobalValueSummary *S) -> uint64_t {
+    if (auto *FS = dyn_cast_or_null<FunctionSummary>(S))
+      return FS->instCount();
+    return 0;
+  };
+  uint64_t Cost = 0;
+  for (auto &Def : DefinedGlobals)
+    Cost += GetInstCount(Def.second);
+  for (auto &Import : ImportList)
+    for (GlobalValue::GUID GUID : Import.second)
+      Cost += GetInstCount(
+          CombinedIndex.findSummaryInModule(GUID, Import.first()));
+  return Cost;
+}
+
 namespace {
 class InProcessThinBackend : public ThinBackendProc {
   ThreadPool BackendThreadPool;
@@ -1008,6 +1170,21 @@ class InProcessThinBackend : public ThinBackendProc {
   Optional<Error> Err;
   std::mutex ErrMu;
 
+  /// The wall time of a backend job, recorded when
+  /// Config::ThinLTOJobTraceFile is set.
+  struct JobTiming {
+    unsigned Task;
+    std::string ModuleID;
+    uint64_t Cost;
+    uint64_t ThreadID;
+    std::chrono::steady_clock::time_point Begin;
+    std::chrono::steady_clock::time_point End;
+  };
+  std::vector<JobTiming> JobTimings;
+  std::mutex JobTimingsMu;
+  std::chrono::steady_clock::time_point TraceBegin =
+      std::chrono::steady_clock::now();
+
 public:
   InProcessThinBackend(
       Config &Conf, ModuleSummaryIndex &CombinedIndex,
@@ -1081,9 +1258,21 @@ public:
                 &ResolvedODR,
             const GVSummaryMapTy &DefinedGlobals,
             MapVector<StringRef, BitcodeModule> &ModuleMap) {
+          auto Begin = std::chrono::steady_clock::now();
           Error E = runThinLTOBackendThread(
               AddStream, Cache, Task, BM, CombinedIndex, ImportList, ExportList,
               ResolvedODR, DefinedGlobals, ModuleMap);
+          if (!Conf.ThinLTOJobTraceFile.empty()) {
+            JobTiming Timing = {
+                Task,
+                BM.getModuleIdentifier(),
+                estimateBackendCost(CombinedIndex, DefinedGlobals, ImportList),
+                get_threadid(),
+                Begin,
+                std::chrono::steady_clock::now()};
+            std::lock_guard<std::mutex> L(JobTimingsMu);
+            JobTimings.push_back(std::move(Timing));
+          }
           if (E) {
             std::unique_lock<std::mutex> L(ErrMu);
             if (Err)
@@ -1099,11 +1288,57 @@ public:
 
   Error wait() override {
     BackendThreadPool.wait();
+    if (!Conf.ThinLTOJobTraceFile.empty())
+      if (Error E = writeJobTrace()) {
+        if (Err)
+          Err = joinErrors(std::move(*Err), std::move(E));
+        else
+          Err = std::move(E);
+      }
     if (Err)
       return std::move(*Err);
     else
       return Error::success();
   }
+
+private:
+  /// Write the wall time of the backend jobs to Config::ThinLTOJobTraceFile,
+  /// with one complete event per job. The threads of the pool are numbered in
+  /// the order they started their first job.
+  Error writeJobTrace() {
+    llvm::sort(JobTimings, [](const JobTiming &L, const JobTiming &R) {
+      return std::tie(L.Begin, L.Task) < std::tie(R.Begin, R.Task);
+    });
+    auto Microseconds = [](std::chrono::steady_clock::duration D) {
+      return std::chrono::duration_cast<std::chrono::microseconds>(D).count();
+    };
+    DenseMap<uint64_t, unsigned> ThreadNumbers;
+    json::Array Events;
+    for (const JobTiming &Timing : JobTimings) {
+      unsigned ThreadNumber =
+          ThreadNumbers.try_emplace(Timing.ThreadID, ThreadNumbers.size())
+              .first->second;
+      Events.push_back(json::Object{
+          {"pid", 1},
+          {"tid", int64_t(ThreadNumber)},
+          {"ph", "X"},
+          {"ts", Microseconds(Timing.Begin - TraceBegin)},
+          {"dur", Microseconds(Timing.End - Timing.Begin)},
+          {"name", "ThinLTO backend"},
+          {"args", json::Object{{"detail", Timing.ModuleID},
+                                {"task", int64_t(Timing.Task)},
+                                {"cost", int64_t(Timing.Cost)}}}});
+    }
+
+    std::error_code EC;
+    raw_fd_ostream OS(Conf.ThinLTOJobTraceFile, EC, sys::fs::F_Text);
+    if (EC)
+      return errorCodeToError(EC);
+    OS << formatv("{0:2}", json::Value(json::Object{
+                               {"traceEvents", std::move(Events)}}))
+       << '\n';
+    return Error::success();
+  }
 };
 } // end anonymous namespace
 
@@ -1117,6 +1352,294 @@ ThinBackend lto::createInProcessThinBackend(unsigned ParallelismLevel) {
   };
 }
 
+namespace {
+class OutOfProcessThinBackend : public ThinBackendProc {
+  std::string WorkerPath;
+  std::vector<std::string> WorkerArgs;
+  ThreadPool BackendThreadPool;
+  AddStreamFn AddStream;
+
+  /// The directory of the files exchanged with the workers.
+  SmallString<128> TempDir;
+
+  /// The bitcode files written for the workers, by module identifier.
+  StringMap<std::string> ModuleFiles;
+  std::mutex ModuleFilesMu;
+
+  /// The estimated memory use of the running workers, in bytes.
+  uint64_t MemoryLimit;
+  uint64_t MemoryInUse = 0;
+  std::mutex MemoryMu;
+  std::condition_variable MemoryCV;
+
+  Optional<Error> Err;
+  std::mutex ErrMu;
+
+public:
+  OutOfProcessThinBackend(
+      Config &Conf, ModuleSummaryIndex &CombinedIndex,
+      const StringMap<GVSummaryMapTy> &ModuleToDefinedGVSummaries,
+      std::string WorkerPath, std::vector<std::string> WorkerArgs,
+      unsigned ParallelismLevel, uint64_t MemoryLimit, AddStreamFn AddStream)
+      : ThinBackendProc(Conf, CombinedIndex, ModuleToDefinedGVSummaries),
+        WorkerPath(std::move(WorkerPath)), WorkerArgs(std::move(WorkerArgs)),
+        BackendThreadPool(ParallelismLevel), AddStream(std::move(AddStream)),
+        MemoryLimit(MemoryLimit) {}
+
+  ~OutOfProcessThinBackend() override {
+    BackendThreadPool.wait();
+    if (!TempDir.empty())
+      sys::fs::remove_directories(TempDir);
+  }
+
+  Error start(
+      unsigned Task, BitcodeModule BM,
+      const FunctionImporter::ImportMapTy &ImportList,
+      const FunctionImporter::ExportSetTy &ExportList,
+      const std::map<GlobalValue::GUID, GlobalValue::LinkageTypes> &ResolvedODR,
+      MapVector<StringRef, BitcodeModule> &ModuleMap) override {
+    if (TempDir.empty())
+      if (std::error_code EC =
+              sys::fs::createUniqueDirectory("thinlto-backend", TempDir))
+        return errorCodeToError(EC);
+
+    BackendThreadPool.async(
+        [=](BitcodeModule BM, const FunctionImporter::ImportMapTy &ImportList,
+            MapVector<StringRef, BitcodeModule> &ModuleMap) {
+          Error E = runWorker(Task, BM, ImportList, ModuleMap);
+          if (E) {
+            std::unique_lock<std::mutex> L(ErrMu);
+            if (Err)
+              Err = joinErrors(std::move(*Err), std::move(E));
+            else
+              Err = std::move(E);
+          }
+        },
+        BM, std::ref(ImportList), std::ref(ModuleMap));
+    return Error::success();
+  }
+
+  Error wait() override {
+    BackendThreadPool.wait();
+    if (Err)
+      return std::move(*Err);
+    else
+      return Error::success();
+  }
+
+private:
+  /// Return the path of a bitcode file holding the module \p BM, which is
+  /// written the first time a worker needs it.
+  Expected<std::string> getModuleFile(BitcodeModule &BM) {
+    std::lock_guard<std::mutex> L(ModuleFilesMu);
+    auto I = ModuleFiles.find(BM.getModuleIdentifier());
+    if (I != ModuleFiles.end())
+      return I->second;
+
+    // The module blocks of BM only make a bitcode file along with their
+    // string table.
+    SmallVector<char, 0> Buffer;
+    BitcodeWriter Writer(Buffer);
+    Buffer.insert(Buffer.end(), BM.getBuffer().begin(), BM.getBuffer().end());
+    Writer.copyStrtab(BM.getStrtab());
+
+    std::string Path =
+        (TempDir + "/module" + Twine(ModuleFiles.size()) + ".bc").str();
+    std::error_code EC;
+    raw_fd_ostream OS(Path, EC, sys::fs::F_None);
+    if (EC)
+      return errorCodeToError(EC);
+    OS << Buffer;
+    ModuleFiles[BM.getModuleIdentifier()] = Path;
+    return Path;
+  }
+
+  /// Wait until a worker estimated to use \p Memory bytes fits in the memory
+  /// limit. A worker always fits when no other one is running.
+  void acquireMemory(uint64_t Memory) {
+    if (!MemoryLimit)
+      return;
+    std::unique_lock<std::mutex> L(MemoryMu);
+    MemoryCV.wait(L, [&] {
+      return MemoryInUse == 0 || MemoryInUse + Memory <= MemoryLimit;
+    });
+    MemoryInUse += Memory;
+  }
+
+  void releaseMemory(uint64_t Memory) {
+    if (!MemoryLimit)
+      return;
+    {
+      std::lock_guard<std::mutex> L(MemoryMu);
+      MemoryInUse -= Memory;
+    }
+    MemoryCV.notify_all();
+  }
+
+  Error runWorker(unsigned Task, BitcodeModule BM,
+                  const FunctionImporter::ImportMapTy &ImportList,
+                  MapVector<StringRef, BitcodeModule> &ModuleMap) {
+    StringRef ModulePath = BM.getModuleIdentifier();
+    std::string JobPath = (TempDir + "/" + Twine(Task)).str();
+    std::string IndexPath = JobPath + ".thinlto.bc";
+    std::string ModulesPath = JobPath + ".modules";
+    std::string ObjectPath = JobPath + ".o";
+
+    std::map<std::string, GVSummaryMapTy> ModuleToSummariesForIndex;
+    gatherImportedSummariesForModule(ModulePath, ModuleToDefinedGVSummaries,
+                                     ImportList, ModuleToSummariesForIndex);
+    std::error_code EC;
+    {
+      raw_fd_ostream OS(IndexPath, EC, sys::fs::F_None);
+      if (EC)
+        return errorCodeToError(EC);
+      WriteIndexToFile(CombinedIndex, OS, &ModuleToSummariesForIndex);
+    }
+
+    // List the identifier and the bitcode file of the module, then of each
+    // module it imports from. The IR of the module takes several times the
+    // size of its bitcode in memory, while the modules it imports from are
+    // only read lazily.
+    uint64_t Memory = 0;
+    {
+      raw_fd_ostream OS(ModulesPath, EC, sys::fs::F_Text);
+      if (EC)
+        return errorCodeToError(EC);
+      auto AddModule = [&](BitcodeModule &Mod, uint64_t Scale) -> Error {
+        Expected<std::string> FileOrErr = getModuleFile(Mod);
+        if (!FileOrErr)
+          return FileOrErr.takeError();
+        OS << Mod.getModuleIdentifier() << '\n' << *FileOrErr << '\n';
+        Memory += Scale * Mod.getBuffer().size();
+        return Error::success();
+      };
+      if (Error E = AddModule(BM, 16))
+        return E;
+      for (auto &Import : ImportList) {
+        auto I = ModuleMap.find(Import.first());
+        assert(I != ModuleMap.end() && "Import from a module not in the link");
+        if (Error E = AddModule(I->second, 1))
+          return E;
+      }
+    }
+
+    std::string IndexArg = "-thinlto-index=" + IndexPath;
+    std::string TaskArg = "-thinlto-task=" + llvm::utostr(Task);
+    SmallVector<StringRef, 16> Args;
+    Args.push_back(WorkerPath);
+    Args.append(WorkerArgs.begin(), WorkerArgs.end());
+    Args.push_back(IndexArg);
+    Args.push_back(TaskArg);
+    Args.push_back("-o");
+    Args.push_back(ObjectPath);
+    Args.push_back(ModulesPath);
+
+    acquireMemory(Memory);
+    std::string ErrMsg;
+    int Status = sys::ExecuteAndWait(WorkerPath, Args, /*Env=*/None,
+                                     /*Redirects=*/{}, /*SecondsToWait=*/0,
+                                     /*MemoryLimit=*/0, &ErrMsg);
+    releaseMemory(Memory);
+    if (Status == -1)
+      return make_error<StringError>("cannot run ThinLTO backend worker " +
+                                         WorkerPath + ": " + ErrMsg,
+                                     inconvertibleErrorCode());
+    if (Status != 0)
+      return make_error<StringError>(
+          "ThinLTO backend worker failed for " + ModulePath +
+              (Status < 0 ? ": " + ErrMsg
+                          : ": exit status " + std::to_string(Status)),
+          inconvertibleErrorCode());
+
+    ErrorOr<std::unique_ptr<MemoryBuffer>> ObjectOrErr =
+        MemoryBuffer::getFile(ObjectPath);
+    if (!ObjectOrErr)
+      return errorCodeToError(ObjectOrErr.getError());
+    *AddStream(Task)->OS << (*ObjectOrErr)->getBuffer();
+
+    sys::fs::remove(IndexPath);
+    sys::fs::remove(ModulesPath);
+    sys::fs::remove(ObjectPath);
+    return Error::success();
+  }
+};
+} // end anonymous namespace
+
+ThinBackend lto::createOutOfProcessThinBackend(
+    std::string WorkerPath, std::vector<std::string> WorkerArgs,
+    unsigned ParallelismLevel, uint64_t MemoryLimit) {
+  return [=](Config &Conf, ModuleSummaryIndex &CombinedIndex,
+             const StringMap<GVSummaryMapTy> &ModuleToDefinedGVSummaries,
+             AddStreamFn AddStream, NativeObjectCache Cache) {
+    return llvm::make_unique<OutOfProcessThinBackend>(
+        Conf, CombinedIndex, ModuleToDefinedGVSummaries, WorkerPath,
+        WorkerArgs, ParallelismLevel, MemoryLimit, AddStream);
+  };
+}
+
+Error lto::runThinBackendWorker(Config &Conf, unsigned Task,
+                                StringRef IndexPath, StringRef ModulesPath,
+                                AddStreamFn AddStream) {
+  Expected<std::unique_ptr<ModuleSummaryIndex>> IndexOrErr =
+      getModuleSummaryIndexForFile(IndexPath);
+  if (!IndexOrErr)
+    return IndexOrErr.takeError();
+  ModuleSummaryIndex &CombinedIndex = **IndexOrErr;
+
+  ErrorOr<std::unique_ptr<MemoryBuffer>> ModulesOrErr =
+      MemoryBuffer::getFile(ModulesPath);
+  if (!ModulesOrErr)
+    return errorCodeToError(ModulesOrErr.getError());
+  SmallVector<StringRef, 16> Lines;
+  (*ModulesOrErr)->getBuffer().split(Lines, '\n', -1, /*KeepEmpty=*/false);
+  if (Lines.empty() || Lines.size() % 2)
+    return make_error<StringError>("malformed module list " + ModulesPath,
+                                   inconvertibleErrorCode());
+
+  // Read each module under its identifier in the link, which is the one the
+  // index knows it by.
+  std::vector<std::unique_ptr<MemoryBuffer>> Buffers;
+  MapVector<StringRef, BitcodeModule> ModuleMap;
+  for (size_t I = 0; I < Lines.size(); I += 2) {
+    StringRef ModuleID = Lines[I];
+    ErrorOr<std::unique_ptr<MemoryBuffer>> MBOrErr =
+        MemoryBuffer::getFile(Lines[I + 1]);
+    if (!MBOrErr)
+      return errorCodeToError(MBOrErr.getError());
+    Expected<std::vector<BitcodeModule>> BMsOrErr = getBitcodeModuleList(
+        MemoryBufferRef((*MBOrErr)->getBuffer(), ModuleID));
+    if (!BMsOrErr)
+      return BMsOrErr.takeError();
+    if (BMsOrErr->size() != 1)
+      return make_error<StringError>("expected a single module in " +
+                                         Lines[I + 1],
+                                     inconvertibleErrorCode());
+    Buffers.push_back(std::move(*MBOrErr));
+    ModuleMap.insert({ModuleID, BMsOrErr->front()});
+  }
+  StringRef ModuleID = ModuleMap.front().first;
+
+  // The index of the module only holds the summaries of the values it
+  // imports from other modules.
+  FunctionImporter::ImportMapTy ImportList;
+  for (auto &GlobalList : CombinedIndex)
+    for (auto &Summary : GlobalList.second.SummaryList)
+      if (Summary->modulePath() != ModuleID)
+        ImportList[Summary->modulePath()].insert(GlobalList.first);
+
+  StringMap<GVSummaryMapTy> ModuleToDefinedGVSummaries;
+  CombinedIndex.collectDefinedGVSummariesPerModule(ModuleToDefinedGVSummaries);
+
+  LTOLLVMContext BackendContext(Conf);
+  Expected<std::unique_ptr<Module>> MOrErr =
+      ModuleMap.front().second.parseModule(BackendContext);
+  if (!MOrErr)
+    return MOrErr.takeError();
+  return thinBackend(Conf, Task, AddStream, **MOrErr, CombinedIndex,
+                     ImportList, ModuleToDefinedGVSummaries[ModuleID],
+                     ModuleMap);
+}
+
 // Given the original \p Path to an output file, replace any path
 // prefix matching \p OldPrefix with \p NewPrefix. Also, create the
 // resulting directory if it does not yet exist.
@@ -1192,6 +1715,9 @@ public:
   }
 
   Error wait() override { return Error::success(); }
+
+  // The modules are listed in LinkedObjectsFile in the order they are started.
+  bool isSensitiveToInputOrder() override { return true; }
 };
 } // end anonymous namespace
 
@@ -1245,7 +1771,7 @@ Error LTO::runThinLTO(AddStreamFn AddStream, NativeObjectCache Cache) {
 
   if (Conf.OptLevel > 0)
     ComputeCrossModuleImport(ThinLTO.CombinedIndex, ModuleToDefinedGVSummaries,
-                             ImportLists, ExportLists);
+                             ImportLists, ExportLists, Conf.ThinLinkThreads);
 
   // Figure out which symbols need to be internalized. This also needs to happen
   // at -O0 because summary-based DCE is implemented using internalization, and
@@ -1277,7 +1803,8 @@ Error LTO::runThinLTO(AddStreamFn AddStream, NativeObjectCache Cache) {
             ExportList->second.count(GUID)) ||
            ExportedGUIDs.count(GUID);
   };
-  thinLTOInternalizeAndPromoteInIndex(ThinLTO.CombinedIndex, isExported);
+  thinLTOInternalizeAndPromoteInIndex(ThinLTO.CombinedIndex, isExported,
+                                      Conf.ThinLinkThreads);
 
   auto isPrevailing = [&](GlobalValue::GUID GUID,
                           const GlobalValueSummary *S) {
@@ -1295,15 +1822,33 @@ Error LTO::runThinLTO(AddStreamFn AddStream, NativeObjectCache Cache) {
       ThinLTO.Backend(Conf, ThinLTO.CombinedIndex, ModuleToDefinedGVSummaries,
                       AddStream, Cache);
 
+  // Start the most expensive backend jobs first, so that a large module late
+  // in the inputs does not run alone once the other jobs have finished. The
+  // jobs keep the task numbers of their input order, so the outputs do not
+  // depend on the order they are run in.
+  std::vector<unsigned> Order(ThinLTO.ModuleMap.size());
+  std::iota(Order.begin(), Order.end(), 0);
+  if (!BackendProc->isSensitiveToInputOrder()) {
+    std::vector<uint64_t> Costs;
+    Costs.reserve(Order.size());
+    for (auto &Mod : ThinLTO.ModuleMap)
+      Costs.push_back(estimateBackendCost(ThinLTO.CombinedIndex,
+                                          ModuleToDefinedGVSummaries[Mod.first],
+                                          ImportLists[Mod.first]));
+    std::stable_sort(Order.begin(), Order.end(), [&](unsigned L, unsigned R) {
+      return Costs[L] > Costs[R];
+    });
+  }
+
   // Tasks 0 through ParallelCodeGenParallelismLevel-1 are reserved for combined
   // module and parallel code generation partitions.
-  unsigned Task = RegularLTO.ParallelCodeGenParallelismLevel;
-  for (auto &Mod : ThinLTO.ModuleMap) {
+  for (unsigned I : Order) {
+    auto &Mod = *(ThinLTO.ModuleMap.begin() + I);
+    unsigned Task = RegularLTO.ParallelCodeGenParallelismLevel + I;
     if (Error E = BackendProc->start(Task, Mod.second, ImportLists[Mod.first],
                                      ExportLists[Mod.first],
                                      ResolvedODR[Mod.first], ThinLTO.ModuleMap))
       return E;
-    ++Task;
   }
 
   return BackendProc->wait();
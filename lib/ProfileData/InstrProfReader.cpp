@@ -565,6 +565,88 @@ data_type InstrProfLookupTrait::ReadData(StringRef K, const unsigned char *D,
   return DataBuffer;
 }
 
+bool InstrProfLookupTrait::readRecordViews(
+    const unsigned char *D, offset_type N,
+    SmallVectorImpl<InstrProfRecordView> &Views) {
+  using namespace support;
+
+  // This follows ReadData, only skipping over what it decodes.
+  if (N % sizeof(uint64_t))
+    return false;
+
+  const unsigned char *End = D + N;
+  while (D < End) {
+    if (D + sizeof(uint64_t) >= End)
+      return false;
+    uint64_t Hash = endian::readNext<uint64_t, little, unaligned>(D);
+
+    uint64_t CountsSize = N / sizeof(uint64_t) - 1;
+    if (GET_VERSION(FormatVersion) != IndexedInstrProf::ProfVersion::Version1) {
+      if (D + sizeof(uint64_t) > End)
+        return false;
+      CountsSize = endian::readNext<uint64_t, little, unaligned>(D);
+    }
+    if (D + CountsSize * sizeof(uint64_t) > End)
+      return false;
+    const unsigned char *Counts = D;
+    D += CountsSize * sizeof(uint64_t);
+
+    const unsigned char *ValueData = nullptr;
+    if (GET_VERSION(FormatVersion) > IndexedInstrProf::ProfVersion::Version2) {
+      // The value profile data starts with its total size.
+      if (D + sizeof(ValueProfData) > End)
+        return false;
+      uint32_t TotalSize =
+          endian::read<uint32_t, unaligned>(D, ValueProfDataEndianness);
+      if (TotalSize < sizeof(ValueProfData) || D + TotalSize > End)
+        return false;
+      ValueData = D;
+      D += TotalSize;
+    }
+    Views.emplace_back(Hash, Counts, CountsSize, ValueData, D,
+                       ValueProfDataEndianness);
+  }
+  return true;
+}
+
+void InstrProfRecordView::getCounts(std::vector<uint64_t> &Result) const {
+  Result.resize(NumCounts);
+  for (uint64_t I = 0; I < NumCounts; ++I)
+    Result[I] = getCount(I);
+}
+
+Error InstrProfRecordView::getRecord(InstrProfRecord &Record) const {
+  getCounts(Record.Counts);
+  Record.clearValueData();
+  if (!ValueData)
+    return Error::success();
+  Expected<std::unique_ptr<ValueProfData>> VDataPtrOrErr =
+      ValueProfData::getValueProfData(ValueData, ValueDataEnd,
+                                      ValueProfDataEndianness);
+  if (Error E = VDataPtrOrErr.takeError())
+    return E;
+  VDataPtrOrErr.get()->deserializeTo(Record, nullptr);
+  return Error::success();
+}
+
+template <typename HashTableImpl>
+Error InstrProfReaderIndex<HashTableImpl>::getRecordViews(
+    StringRef FuncName, SmallVectorImpl<InstrProfRecordView> &Views) {
+  auto Iter = HashTable->find(FuncName);
+  if (Iter == HashTable->end())
+    return make_error<InstrProfError>(instrprof_error::unknown_function);
+
+  size_t NumViews = Views.size();
+  if (!HashTable->getInfoObj().readRecordViews(Iter.getDataPtr(),
+                                               Iter.getDataLen(), Views) ||
+      Views.size() == NumViews) {
+    Views.resize(NumViews);
+    return make_error<InstrProfError>(instrprof_error::malformed);
+  }
+
+  return Error::success();
+}
+
 template <typename HashTableImpl>
 Error InstrProfReaderIndex<HashTableImpl>::getRecords(
     StringRef FuncName, ArrayRef<NamedInstrProfRecord> &Data) {
@@ -618,6 +700,11 @@ public:
                    ArrayRef<NamedInstrProfRecord> &Data) override {
     return Underlying.getRecords(FuncName, Data);
   }
+
+  Error getRecordViews(StringRef FuncName,
+                       SmallVectorImpl<InstrProfRecordView> &Views) override {
+    return Underlying.getRecordViews(FuncName, Views);
+  }
 };
 }
 
@@ -675,6 +762,21 @@ public:
 
   Error getRecords(StringRef FuncName,
                    ArrayRef<NamedInstrProfRecord> &Data) override {
+    return lookup(FuncName, [&](StringRef Name) {
+      return Underlying.getRecords(Name, Data);
+    });
+  }
+
+  Error getRecordViews(StringRef FuncName,
+                       SmallVectorImpl<InstrProfRecordView> &Views) override {
+    return lookup(FuncName, [&](StringRef Name) {
+      return Underlying.getRecordViews(Name, Views);
+    });
+  }
+
+private:
+  /// Call \p Lookup with the name the profile data uses for \p FuncName.
+  Error lookup(StringRef FuncName, function_ref<Error(StringRef)> Lookup) {
     StringRef RealName = extractName(FuncName);
     if (auto Key = Remappings.lookup(RealName)) {
       StringRef Remapped = MappedNames.lookup(Key);
@@ -686,7 +788,7 @@ public:
           // Try rebuilding the name from the given remapping.
           SmallString<256> Reconstituted;
           reconstituteName(FuncName, RealName, Remapped, Reconstituted);
-          Error E = Underlying.getRecords(Reconstituted, Data);
+          Error E = Lookup(Reconstituted);
           if (!E)
             return E;
 
@@ -702,10 +804,9 @@ public:
         }
       }
     }
-    return Underlying.getRecords(FuncName, Data);
+    return Lookup(FuncName);
   }
 
-private:
   /// The memory buffer containing the remapping configuration. Remappings
   /// holds pointers into this buffer.
   std::unique_ptr<MemoryBuffer> RemapBuffer;
@@ -858,31 +959,43 @@ InstrProfSymtab &IndexedInstrProfReader::getSymtab() {
   return *Symtab.get();
 }
 
-Expected<InstrProfRecord>
-IndexedInstrProfReader::getInstrProfRecord(StringRef FuncName,
-                                           uint64_t FuncHash) {
-  ArrayRef<NamedInstrProfRecord> Data;
-  Error Err = Remapper->getRecords(FuncName, Data);
-  if (Err)
-    return std::move(Err);
+Error IndexedInstrProfReader::getRecordView(StringRef FuncName,
+                                            uint64_t FuncHash,
+                                            InstrProfRecordView &View) {
+  SmallVector<InstrProfRecordView, 4> Views;
+  if (Error Err = Remapper->getRecordViews(FuncName, Views))
+    return Err;
   // Found it. Look for counters with the right hash.
-  for (unsigned I = 0, E = Data.size(); I < E; ++I) {
-    // Check for a match and fill the vector if there is one.
-    if (Data[I].Hash == FuncHash) {
-      return std::move(Data[I]);
+  for (const InstrProfRecordView &V : Views) {
+    if (V.getHash() == FuncHash) {
+      View = V;
+      return Error::success();
     }
   }
   return error(instrprof_error::hash_mismatch);
 }
 
+Expected<InstrProfRecord>
+IndexedInstrProfReader::getInstrProfRecord(StringRef FuncName,
+                                           uint64_t FuncHash) {
+  // Only the record with the right hash is decoded.
+  InstrProfRecordView View;
+  if (Error Err = getRecordView(FuncName, FuncHash, View))
+    return std::move(Err);
+  InstrProfRecord Record;
+  if (Error Err = View.getRecord(Record))
+    return std::move(Err);
+  return std::move(Record);
+}
+
 Error IndexedInstrProfReader::getFunctionCounts(StringRef FuncName,
                                                 uint64_t FuncHash,
                                                 std::vector<uint64_t> &Counts) {
-  Expected<InstrProfRecord> Record = getInstrProfRecord(FuncName, FuncHash);
-  if (Error E = Record.takeError())
+  InstrProfRecordView View;
+  if (Error E = getRecordView(FuncName, FuncHash, View))
     return error(std::move(E));
 
-  Counts = Record.get().Counts;
+  View.getCounts(Counts);
   return success();
 }
 
@@ -22,6 +22,7 @@
 #include "llvm/Support/Error.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/OnDiskHashTable.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 #include <cstdint>
@@ -307,7 +308,39 @@ void InstrProfWriter::writeImpl(ProfOStream &OS) {
   }
 
   // Write the hash table.
-  uint64_t HashTableStart = Generator.Emit(OS.OS, *InfoObj);
+  uint64_t HashTableStart;
+  if (NumThreads <= 1) {
+    HashTableStart = Generator.Emit(OS.OS, *InfoObj);
+  } else {
+    // The records are serialized on every thread, each with its own trait
+    // object summing up its own share of the summaries.
+    std::vector<InstrProfRecordWriterTrait> Infos(NumThreads);
+    std::vector<InstrProfSummaryBuilder> Builders(
+        2 * NumThreads,
+        InstrProfSummaryBuilder(ProfileSummaryBuilder::DefaultCutoffs));
+    for (unsigned I = 0; I < NumThreads; ++I) {
+      Infos[I].ValueProfDataEndianness = InfoObj->ValueProfDataEndianness;
+      Infos[I].SummaryBuilder = &Builders[2 * I];
+      Infos[I].CSSummaryBuilder = &Builders[2 * I + 1];
+    }
+
+    ThreadPool Pool(NumThreads);
+    HashTableStart = Generator.Emit(
+        OS.OS, NumThreads,
+        [&](unsigned Task) -> InstrProfRecordWriterTrait & {
+          return Infos[Task];
+        },
+        [&](unsigned NumTasks, function_ref<void(unsigned)> Task) {
+          for (unsigned I = 0; I < NumTasks; ++I)
+            Pool.async([=] { Task(I); });
+          Pool.wait();
+        });
+
+    for (unsigned I = 0; I < NumThreads; ++I) {
+      ISB.merge(Builders[2 * I]);
+      CSISB.merge(Builders[2 * I + 1]);
+    }
+  }
 
   // Allocate space for data to be serialized out.
   std::unique_ptr<IndexedInstrProf::Summary> TheSummary =
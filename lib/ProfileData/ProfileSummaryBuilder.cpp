@@ -18,6 +18,7 @@
 #include "llvm/ProfileData/ProfileCommon.h"
 #include "llvm/ProfileData/SampleProf.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
 
 using namespace llvm;
 
@@ -31,6 +32,20 @@ static const uint32_t DefaultCutoffsData[] = {
 const ArrayRef<uint32_t> ProfileSummaryBuilder::DefaultCutoffs =
     DefaultCutoffsData;
 
+const ProfileSummaryEntry &
+ProfileSummaryBuilder::getEntryForPercentile(SummaryEntryVector &DS,
+                                             uint64_t Percentile) {
+  auto Compare = [](const ProfileSummaryEntry &Entry, uint64_t Percentile) {
+    return Entry.Cutoff < Percentile;
+  };
+  auto It = std::lower_bound(DS.begin(), DS.end(), Percentile, Compare);
+  // The required percentile has to be <= one of the percentiles in the
+  // detailed summary.
+  if (It == DS.end())
+    report_fatal_error("Desired percentile exceeds the maximum cutoff");
+  return *It;
+}
+
 void InstrProfSummaryBuilder::addRecord(const InstrProfRecord &R) {
   // The first counter is not necessarily an entry count for IR
   // instrumentation profiles.
@@ -41,6 +56,18 @@ void InstrProfSummaryBuilder::addRecord(const InstrProfRecord &R) {
     addInternalCount(R.Counts[I]);
 }
 
+void InstrProfSummaryBuilder::merge(const InstrProfSummaryBuilder &Other) {
+  for (const auto &I : Other.CountFrequencies)
+    CountFrequencies[I.first] += I.second;
+  TotalCount += Other.TotalCount;
+  MaxCount = std::max(MaxCount, Other.MaxCount);
+  MaxFunctionCount = std::max(MaxFunctionCount, Other.MaxFunctionCount);
+  MaxInternalBlockCount =
+      std::max(MaxInternalBlockCount, Other.MaxInternalBlockCount);
+  NumCounts += Other.NumCounts;
+  NumFunctions += Other.NumFunctions;
+}
+
 // To compute the detailed summary, we consider each line containing samples as
 // equivalent to a block with a count in the instrumented profile.
 void SampleProfileSummaryBuilder::addRecord(
@@ -52,6 +79,26 @@ void SampleProfileSummaryBuilder::addRecord(
     addCount(I.second.getSamples());
 }
 
+void SampleProfileSummaryBuilder::addSummary(
+    ProfileSummary &Summary,
+    ArrayRef<std::pair<uint64_t, uint32_t>> Frequencies) {
+  NumFunctions += Summary.getNumFunctions();
+  MaxFunctionCount = std::max(MaxFunctionCount, Summary.getMaxFunctionCount());
+  for (const auto &I : Frequencies) {
+    CountFrequencies[I.first] += I.second;
+    TotalCount += I.first * I.second;
+    NumCounts += I.second;
+    MaxCount = std::max(MaxCount, I.first);
+  }
+}
+
+void SampleProfileSummaryBuilder::removeRecord(
+    const sampleprof::FunctionSamples &FS) {
+  NumFunctions--;
+  for (const auto &I : FS.getBodySamples())
+    removeCount(I.second.getSamples());
+}
+
 // The argument to this method is a vector of cutoff percentages and the return
 // value is a vector of (Cutoff, MinCount, NumCounts) triplets.
 void ProfileSummaryBuilder::computeDetailedSummary() {
@@ -21,6 +21,7 @@
 #include "llvm/Support/raw_ostream.h"
 #include <string>
 #include <system_error>
+#include <tuple>
 
 using namespace llvm;
 using namespace sampleprof;
@@ -68,6 +69,12 @@ class SampleProfErrorCategoryType : public std::error_category {
       return "Counter overflow";
     case sampleprof_error::ostream_seek_unsupported:
       return "Ostream does not support seek";
+    case sampleprof_error::compress_failed:
+      return "Compress failure";
+    case sampleprof_error::uncompress_failed:
+      return "Uncompress failure";
+    case sampleprof_error::zlib_unavailable:
+      return "Zlib is unavailable";
     }
     llvm_unreachable("A value of sampleprof_error has no message.");
   }
@@ -97,6 +104,50 @@ raw_ostream &llvm::sampleprof::operator<<(raw_ostream &OS,
 LLVM_DUMP_METHOD void LineLocation::dump() const { print(dbgs()); }
 #endif
 
+bool SampleContext::parse(StringRef Name,
+                          SmallVectorImpl<SampleContextFrame> &Frames) {
+  if (!isContext(Name))
+    return false;
+  SmallVector<StringRef, 8> Parts;
+  Name.drop_front().drop_back().split(Parts, " @ ");
+  Frames.clear();
+  for (size_t I = 0; I < Parts.size(); ++I) {
+    StringRef FuncName = Parts[I];
+    LineLocation CallSite(0, 0);
+    if (I + 1 < Parts.size()) {
+      // The callsite of every caller is written as NUM[.NUM].
+      size_t Colon = FuncName.rfind(':');
+      if (Colon == StringRef::npos)
+        return false;
+      StringRef Offset, Discriminator;
+      std::tie(Offset, Discriminator) = FuncName.substr(Colon + 1).split('.');
+      if (Offset.getAsInteger(10, CallSite.LineOffset) ||
+          (CallSite.LineOffset & 0xffff) != CallSite.LineOffset ||
+          (!Discriminator.empty() &&
+           Discriminator.getAsInteger(10, CallSite.Discriminator)))
+        return false;
+      FuncName = FuncName.substr(0, Colon);
+    }
+    if (FuncName.empty())
+      return false;
+    Frames.emplace_back(FuncName, CallSite);
+  }
+  return true;
+}
+
+std::string SampleContext::getName(ArrayRef<SampleContextFrame> Frames) {
+  std::string Name;
+  raw_string_ostream OS(Name);
+  OS << "[";
+  for (size_t I = 0; I < Frames.size(); ++I) {
+    OS << Frames[I].FuncName;
+    if (I + 1 < Frames.size())
+      OS << ":" << Frames[I].CallSite << " @ ";
+  }
+  OS << "]";
+  return OS.str();
+}
+
 /// Print the sample record to the stream \p OS indented by \p Indent.
 void SampleRecord::print(raw_ostream &OS, unsigned Indent) const {
   OS << NumSamples;
@@ -166,20 +217,23 @@ unsigned FunctionSamples::getOffset(const DILocation *DIL) {
       0xffff;
 }
 
-const FunctionSamples *
-FunctionSamples::findFunctionSamples(const DILocation *DIL) const {
-  assert(DIL);
-  SmallVector<std::pair<LineLocation, StringRef>, 10> S;
-
+void FunctionSamples::getInlineStack(
+    const DILocation *DIL,
+    SmallVectorImpl<std::pair<LineLocation, StringRef>> &Stack) {
   const DILocation *PrevDIL = DIL;
   for (DIL = DIL->getInlinedAt(); DIL; DIL = DIL->getInlinedAt()) {
-    S.push_back(std::make_pair(
+    Stack.push_back(std::make_pair(
         LineLocation(getOffset(DIL), DIL->getBaseDiscriminator()),
         PrevDIL->getScope()->getSubprogram()->getLinkageName()));
     PrevDIL = DIL;
   }
-  if (S.size() == 0)
-    return this;
+}
+
+const FunctionSamples *
+FunctionSamples::findFunctionSamples(const DILocation *DIL) const {
+  assert(DIL);
+  SmallVector<std::pair<LineLocation, StringRef>, 10> S;
+  getInlineStack(DIL, S);
   const FunctionSamples *FS = this;
   for (int i = S.size() - 1; i >= 0 && FS != nullptr; i--) {
     FS = FS->findFunctionSamplesAt(S[i].first, S[i].second);
@@ -190,3 +244,277 @@ FunctionSamples::findFunctionSamples(const DILocation *DIL) const {
 #if !defined(NDEBUG) || defined(LLVM_ENABLE_DUMP)
 LLVM_DUMP_METHOD void FunctionSamples::dump() const { print(dbgs(), 0); }
 #endif
+
+uint64_t FlatFunctionSamples::getEntrySamples() const {
+  // Use either BodySamples or CallsiteSamples which ever has the smaller
+  // lineno.
+  if (!BodySamples.empty() &&
+      (CallsiteSamples.empty() ||
+       BodySamples.front().Loc < CallsiteSamples.front().Loc))
+    return BodySamples.front().NumSamples;
+  if (!CallsiteSamples.empty()) {
+    uint64_t T = 0;
+    // An indirect callsite may be promoted to several inlined direct calls.
+    // We need to get the sum of them.
+    for (const auto &CS : findCallsiteSamplesAt(CallsiteSamples.front().Loc))
+      T += CS.Callee->getEntrySamples();
+    return T;
+  }
+  return 0;
+}
+
+const FlatBodySample *
+FlatFunctionSamples::findBodySampleAt(uint32_t LineOffset,
+                                      uint32_t Discriminator) const {
+  LineLocation Loc(LineOffset, Discriminator);
+  auto I = llvm::lower_bound(BodySamples, Loc,
+                             [](const FlatBodySample &BS,
+                                const LineLocation &Loc) {
+                               return BS.Loc < Loc;
+                             });
+  if (I == BodySamples.end() || I->Loc != Loc)
+    return nullptr;
+  return &*I;
+}
+
+ArrayRef<FlatCallsiteSample>
+FlatFunctionSamples::findCallsiteSamplesAt(const LineLocation &Loc) const {
+  auto Begin = llvm::lower_bound(CallsiteSamples, Loc,
+                                 [](const FlatCallsiteSample &CS,
+                                    const LineLocation &Loc) {
+                                   return CS.Loc < Loc;
+                                 });
+  auto End = Begin;
+  while (End != CallsiteSamples.end() && End->Loc == Loc)
+    ++End;
+  return makeArrayRef(Begin, End);
+}
+
+const FlatFunctionSamples *
+FlatFunctionSamples::findFunctionSamplesAt(const LineLocation &Loc,
+                                           StringRef CalleeName) const {
+  std::string CalleeGUID;
+  CalleeName = getRepInFormat(CalleeName, FunctionSamples::Format, CalleeGUID);
+
+  ArrayRef<FlatCallsiteSample> Callees = findCallsiteSamplesAt(Loc);
+  if (Callees.empty())
+    return nullptr;
+  auto I = llvm::lower_bound(Callees, CalleeName,
+                             [](const FlatCallsiteSample &CS, StringRef Name) {
+                               return CS.Name < Name;
+                             });
+  if (I != Callees.end() && I->Name == CalleeName)
+    return I->Callee;
+  // If we cannot find exact match of the callee name, return the FS with
+  // the max total count.
+  uint64_t MaxTotalSamples = 0;
+  const FlatFunctionSamples *R = nullptr;
+  for (const auto &CS : Callees)
+    if (CS.Callee->getTotalSamples() >= MaxTotalSamples) {
+      MaxTotalSamples = CS.Callee->getTotalSamples();
+      R = CS.Callee;
+    }
+  return R;
+}
+
+const FlatFunctionSamples *
+FlatFunctionSamples::findFunctionSamples(const DILocation *DIL) const {
+  assert(DIL);
+  SmallVector<std::pair<LineLocation, StringRef>, 10> S;
+  FunctionSamples::getInlineStack(DIL, S);
+  const FlatFunctionSamples *FS = this;
+  for (int i = S.size() - 1; i >= 0 && FS != nullptr; i--)
+    FS = FS->findFunctionSamplesAt(S[i].first, S[i].second);
+  return FS;
+}
+
+void FlatFunctionSamples::findInlinedFunctions(DenseSet<GlobalValue::GUID> &S,
+                                               const Module *M,
+                                               uint64_t Threshold) const {
+  if (TotalSamples <= Threshold)
+    return;
+  S.insert(FunctionSamples::getGUID(Name));
+  // Import hot CallTargets, which may not be available in IR because full
+  // profile annotation cannot be done until backend compilation in ThinLTO.
+  for (const auto &BS : BodySamples)
+    for (const auto &TS : BS.CallTargets)
+      if (TS.Samples > Threshold) {
+        const Function *Callee =
+            M->getFunction(FunctionSamples::getNameInModule(TS.Name, M));
+        if (!Callee || !Callee->getSubprogram())
+          S.insert(FunctionSamples::getGUID(TS.Name));
+      }
+  for (const auto &CS : CallsiteSamples)
+    CS.Callee->findInlinedFunctions(S, M, Threshold);
+}
+
+const FlatFunctionSamples *
+FlatSampleProfileMap::add(StringRef Name, const FunctionSamples &FS) {
+  const FlatFunctionSamples *Flat = flatten(FS);
+  Profiles[Names.save(Name)] = Flat;
+  return Flat;
+}
+
+const FlatFunctionSamples *
+FlatSampleProfileMap::flatten(const FunctionSamples &FS) {
+  FlatFunctionSamples *Flat = new (Alloc) FlatFunctionSamples();
+  Flat->Name = Names.save(FS.getName());
+  Flat->TotalSamples = FS.getTotalSamples();
+  Flat->TotalHeadSamples = FS.getHeadSamples();
+
+  // Both maps are already ordered by location, so the arrays come out sorted.
+  const BodySampleMap &Body = FS.getBodySamples();
+  FlatBodySample *BodySamples = Alloc.Allocate<FlatBodySample>(Body.size());
+  FlatBodySample *BS = BodySamples;
+  for (const auto &I : Body) {
+    const SampleRecord::CallTargetMap &Targets = I.second.getCallTargets();
+    FlatCallTarget *CallTargets =
+        Alloc.Allocate<FlatCallTarget>(Targets.size());
+    FlatCallTarget *CT = CallTargets;
+    for (const auto &T : Targets)
+      new (CT++) FlatCallTarget{Names.save(T.getKey()), T.getValue()};
+    // StringMap iteration order is unspecified; sort the targets by name so
+    // that consumers see a deterministic order.
+    std::sort(CallTargets, CT,
+              [](const FlatCallTarget &L, const FlatCallTarget &R) {
+                return L.Name < R.Name;
+              });
+    new (BS++) FlatBodySample{I.first, I.second.getSamples(),
+                              makeArrayRef(CallTargets, CT)};
+  }
+  Flat->BodySamples = makeArrayRef(BodySamples, BS);
+
+  size_t NumCallsites = 0;
+  for (const auto &I : FS.getCallsiteSamples())
+    NumCallsites += I.second.size();
+  FlatCallsiteSample *CallsiteSamples =
+      Alloc.Allocate<FlatCallsiteSample>(NumCallsites);
+  FlatCallsiteSample *CS = CallsiteSamples;
+  for (const auto &I : FS.getCallsiteSamples())
+    for (const auto &J : I.second)
+      new (CS++)
+          FlatCallsiteSample{I.first, Names.save(J.first), flatten(J.second)};
+  Flat->CallsiteSamples = makeArrayRef(CallsiteSamples, CS);
+  return Flat;
+}
+
+std::error_code ProfileSymbolList::read(const uint8_t *Data, uint64_t Size) {
+  StringRef Contents(reinterpret_cast<const char *>(Data), Size);
+  while (!Contents.empty()) {
+    size_t End = Contents.find('\0');
+    if (End == StringRef::npos)
+      return sampleprof_error::malformed;
+    add(Contents.substr(0, End));
+    Contents = Contents.substr(End + 1);
+  }
+  return sampleprof_error::success;
+}
+
+std::error_code ProfileSymbolList::write(raw_ostream &OS) const {
+  std::vector<StringRef> SortedSyms(Syms.begin(), Syms.end());
+  llvm::sort(SortedSyms);
+  for (StringRef Sym : SortedSyms)
+    OS << Sym << '\0';
+  return sampleprof_error::success;
+}
+
+void ProfileSymbolList::dump(raw_ostream &OS) const {
+  std::vector<StringRef> SortedSyms(Syms.begin(), Syms.end());
+  llvm::sort(SortedSyms);
+  for (StringRef Sym : SortedSyms)
+    OS << Sym << "\n";
+}
+
+// Turn the cold inlined callees of FS, at any depth, back into calls and move
+// their samples to Outlined, along with the names of the callees.
+static sampleprof_error
+flattenColdCallsites(FunctionSamples &FS, uint64_t ColdCountThreshold,
+                     std::vector<std::pair<std::string, FunctionSamples>>
+                         &Outlined) {
+  sampleprof_error Result = sampleprof_error::success;
+  CallsiteSampleMap &CallsiteSamples = FS.getCallsiteSamples();
+  for (auto I = CallsiteSamples.begin(); I != CallsiteSamples.end();) {
+    const LineLocation &Loc = I->first;
+    FunctionSamplesMap &Callees = I->second;
+    for (auto J = Callees.begin(); J != Callees.end();) {
+      FunctionSamples &Callee = J->second;
+      uint64_t Calls = Callee.getEntrySamples();
+      MergeResult(Result,
+                  flattenColdCallsites(Callee, ColdCountThreshold, Outlined));
+      if (Callee.getTotalSamples() > ColdCountThreshold) {
+        ++J;
+        continue;
+      }
+
+      // The call is at least as frequent as the entry of the callee.
+      auto SamplesOrErr = FS.findSamplesAt(Loc.LineOffset, Loc.Discriminator);
+      uint64_t Samples = SamplesOrErr ? *SamplesOrErr : 0;
+      uint64_t Added = Calls > Samples ? Calls - Samples : 0;
+      MergeResult(Result, FS.addBodySamples(Loc.LineOffset, Loc.Discriminator,
+                                            Added));
+      MergeResult(Result, FS.addCalledTargetSamples(
+                              Loc.LineOffset, Loc.Discriminator, J->first,
+                              Calls));
+      FS.removeTotalSamples(Callee.getTotalSamples());
+      MergeResult(Result, FS.addTotalSamples(Added));
+
+      MergeResult(Result, Callee.addHeadSamples(Calls));
+      Outlined.emplace_back(J->first, std::move(Callee));
+      J = Callees.erase(J);
+    }
+    if (Callees.empty())
+      I = CallsiteSamples.erase(I);
+    else
+      ++I;
+  }
+  return Result;
+}
+
+// Name FS and its inlined callees, at any depth, after the keys of the maps
+// that own them, since merging leaves them naming the profiles they were
+// merged from.
+static void setNamesFromKeys(FunctionSamples &FS, StringRef Name) {
+  FS.setName(Name);
+  for (auto &I : FS.getCallsiteSamples())
+    for (auto &J : I.second)
+      setNamesFromKeys(J.second, J.first);
+}
+
+sampleprof_error
+SampleProfileTrimmer::flattenColdCallsites(uint64_t ColdCountThreshold) {
+  sampleprof_error Result = sampleprof_error::success;
+  std::vector<std::pair<std::string, FunctionSamples>> Outlined;
+  std::vector<std::string> ColdContexts;
+  SmallVector<SampleContextFrame, 8> Frames;
+  for (auto &I : Profiles) {
+    MergeResult(Result, ::flattenColdCallsites(I.second, ColdCountThreshold,
+                                               Outlined));
+    if (I.second.getTotalSamples() > ColdCountThreshold ||
+        !SampleContext::isContext(I.getKey()))
+      continue;
+    Frames.clear();
+    if (!SampleContext::parse(I.getKey(), Frames) || Frames.size() < 2)
+      continue;
+    Outlined.emplace_back(Frames.back().FuncName, std::move(I.second));
+    ColdContexts.push_back(I.getKey());
+  }
+  for (const std::string &Context : ColdContexts)
+    Profiles.erase(Context);
+
+  // The profiles are only added once the map is no longer being walked.
+  for (auto &I : Outlined) {
+    auto &Entry = *Profiles.try_emplace(I.first).first;
+    MergeResult(Result, Entry.second.merge(I.second));
+    setNamesFromKeys(Entry.second, Entry.getKey());
+  }
+  return Result;
+}
+
+void SampleProfileTrimmer::trimColdProfiles(uint64_t ColdCountThreshold) {
+  std::vector<std::string> ColdProfiles;
+  for (const auto &I : Profiles)
+    if (I.second.getTotalSamples() <= ColdCountThreshold)
+      ColdProfiles.push_back(I.getKey());
+  for (const std::string &Name : ColdProfiles)
+    Profiles.erase(Name);
+}
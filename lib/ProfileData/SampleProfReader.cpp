@@ -22,10 +22,12 @@
 #include "llvm/ProfileData/SampleProfReader.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/IR/ProfileSummary.h"
 #include "llvm/ProfileData/ProfileCommon.h"
 #include "llvm/ProfileData/SampleProf.h"
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/ErrorOr.h"
 #include "llvm/Support/LEB128.h"
 #include "llvm/Support/LineIterator.h"
@@ -219,6 +221,17 @@ std::error_code SampleProfileReaderText::read() {
                     "Expected 'mangled_name:NUM:NUM', found " + *LineIt);
         return sampleprof_error::malformed;
       }
+      if (SampleContext::isContext(FName)) {
+        SmallVector<SampleContextFrame, 8> Frames;
+        if (!SampleContext::parse(FName, Frames)) {
+          reportError(LineIt.line_number(),
+                      "Expected '[mangled_name:NUM[.NUM] @ ... "
+                      "@ mangled_name]' as the calling context, found " +
+                          FName);
+          return sampleprof_error::malformed;
+        }
+        ProfileIsCS = true;
+      }
       Profiles[FName] = FunctionSamples();
       FunctionSamples &FProfile = Profiles[FName];
       FProfile.setName(FName);
@@ -286,6 +299,10 @@ bool SampleProfileReaderText::hasFormat(const MemoryBuffer &Buffer) {
 }
 
 template <typename T> ErrorOr<T> SampleProfileReaderBinary::readNumber() {
+  // Most numbers of a profile are small.
+  if (LLVM_LIKELY(Data < End && *Data < 128))
+    return static_cast<T>(*Data++);
+
   unsigned NumBytesRead = 0;
   std::error_code EC;
   uint64_t Val = decodeULEB128(Data, &NumBytesRead);
@@ -306,6 +323,53 @@ template <typename T> ErrorOr<T> SampleProfileReaderBinary::readNumber() {
   return static_cast<T>(Val);
 }
 
+// The maximum size of a ULEB128-encoded 64-bit number.
+static const size_t MaxULEB128Size = 10;
+
+// Decode the ULEB128-encoded number at P, followed by at least MaxULEB128Size
+// readable bytes, into Val. \returns false if the number is longer than
+// MaxULEB128Size bytes or does not fit in 64 bits.
+static inline bool decodeULEB128Unchecked(const uint8_t *&P, uint64_t &Val) {
+  uint64_t Byte = *P++;
+  Val = Byte & 0x7f;
+  for (unsigned Shift = 7; Byte >= 128; Shift += 7) {
+    if (Shift >= 64)
+      return false;
+    Byte = *P++;
+    uint64_t Slice = Byte & 0x7f;
+    if (Slice << Shift >> Shift != Slice)
+      return false;
+    Val |= Slice << Shift;
+  }
+  return true;
+}
+
+template <size_t N>
+std::error_code SampleProfileReaderBinary::readNumbers(uint64_t (&Vals)[N]) {
+  if (size_t(End - Data) < N * MaxULEB128Size) {
+    for (size_t I = 0; I < N; ++I) {
+      auto Val = readNumber<uint64_t>();
+      if (std::error_code EC = Val.getError())
+        return EC;
+      Vals[I] = *Val;
+    }
+    return sampleprof_error::success;
+  }
+
+  for (size_t I = 0; I < N; ++I) {
+    if (LLVM_LIKELY(*Data < 128)) {
+      Vals[I] = *Data++;
+      continue;
+    }
+    if (!decodeULEB128Unchecked(Data, Vals[I])) {
+      std::error_code EC = sampleprof_error::malformed;
+      reportError(0, EC.message());
+      return EC;
+    }
+  }
+  return sampleprof_error::success;
+}
+
 ErrorOr<StringRef> SampleProfileReaderBinary::readString() {
   std::error_code EC;
   StringRef Str(reinterpret_cast<const char *>(Data));
@@ -361,40 +425,42 @@ ErrorOr<StringRef> SampleProfileReaderCompactBinary::readStringFromTable() {
   return StringRef(NameTable[*Idx]);
 }
 
+// Check that a count read by readNumbers fits in 32 bits, like readNumber
+// does for uint32_t.
+static std::error_code checkUInt32(SampleProfileReader &Reader, uint64_t Val) {
+  if (Val <= std::numeric_limits<uint32_t>::max())
+    return sampleprof_error::success;
+  std::error_code EC = sampleprof_error::malformed;
+  Reader.reportError(0, EC.message());
+  return EC;
+}
+
 std::error_code
 SampleProfileReaderBinary::readProfile(FunctionSamples &FProfile) {
-  auto NumSamples = readNumber<uint64_t>();
-  if (std::error_code EC = NumSamples.getError())
+  // The numbers of every record are read at once: the total samples and the
+  // number of body records first.
+  uint64_t Header[2];
+  if (std::error_code EC = readNumbers(Header))
     return EC;
-  FProfile.addTotalSamples(*NumSamples);
-
-  // Read the samples in the body.
-  auto NumRecords = readNumber<uint32_t>();
-  if (std::error_code EC = NumRecords.getError())
+  if (std::error_code EC = checkUInt32(*this, Header[1]))
     return EC;
+  FProfile.addTotalSamples(Header[0]);
 
-  for (uint32_t I = 0; I < *NumRecords; ++I) {
-    auto LineOffset = readNumber<uint64_t>();
-    if (std::error_code EC = LineOffset.getError())
+  // Read the samples in the body.
+  for (uint64_t I = 0, NumRecords = Header[1]; I < NumRecords; ++I) {
+    // The line offset, discriminator, samples and number of calls.
+    uint64_t Record[4];
+    if (std::error_code EC = readNumbers(Record))
       return EC;
-
-    if (!isOffsetLegal(*LineOffset)) {
+    uint64_t LineOffset = Record[0];
+    if (!isOffsetLegal(LineOffset)) {
       return std::error_code();
     }
-
-    auto Discriminator = readNumber<uint64_t>();
-    if (std::error_code EC = Discriminator.getError())
-      return EC;
-
-    auto NumSamples = readNumber<uint64_t>();
-    if (std::error_code EC = NumSamples.getError())
-      return EC;
-
-    auto NumCalls = readNumber<uint32_t>();
-    if (std::error_code EC = NumCalls.getError())
+    if (std::error_code EC = checkUInt32(*this, Record[3]))
       return EC;
+    uint64_t Discriminator = Record[1];
 
-    for (uint32_t J = 0; J < *NumCalls; ++J) {
+    for (uint64_t J = 0, NumCalls = Record[3]; J < NumCalls; ++J) {
       auto CalledFunction(readStringFromTable());
       if (std::error_code EC = CalledFunction.getError())
         return EC;
@@ -403,11 +469,11 @@ SampleProfileReaderBinary::readProfile(FunctionSamples &FProfile) {
       if (std::error_code EC = CalledFunctionSamples.getError())
         return EC;
 
-      FProfile.addCalledTargetSamples(*LineOffset, *Discriminator,
+      FProfile.addCalledTargetSamples(LineOffset, Discriminator,
                                       *CalledFunction, *CalledFunctionSamples);
     }
 
-    FProfile.addBodySamples(*LineOffset, *Discriminator, *NumSamples);
+    FProfile.addBodySamples(LineOffset, Discriminator, Record[2]);
   }
 
   // Read all the samples for inlined function calls.
@@ -416,12 +482,9 @@ SampleProfileReaderBinary::readProfile(FunctionSamples &FProfile) {
     return EC;
 
   for (uint32_t J = 0; J < *NumCallsites; ++J) {
-    auto LineOffset = readNumber<uint64_t>();
-    if (std::error_code EC = LineOffset.getError())
-      return EC;
-
-    auto Discriminator = readNumber<uint64_t>();
-    if (std::error_code EC = Discriminator.getError())
+    // The line offset and discriminator of the callsite.
+    uint64_t Callsite[2];
+    if (std::error_code EC = readNumbers(Callsite))
       return EC;
 
     auto FName(readStringFromTable());
@@ -429,7 +492,7 @@ SampleProfileReaderBinary::readProfile(FunctionSamples &FProfile) {
       return EC;
 
     FunctionSamples &CalleeProfile = FProfile.functionSamplesAt(
-        LineLocation(*LineOffset, *Discriminator))[*FName];
+        LineLocation(Callsite[0], Callsite[1]))[*FName];
     CalleeProfile.setName(*FName);
     if (std::error_code EC = readProfile(CalleeProfile))
       return EC;
@@ -446,6 +509,12 @@ std::error_code SampleProfileReaderBinary::readFuncProfile() {
   auto FName(readStringFromTable());
   if (std::error_code EC = FName.getError())
     return EC;
+  if (SampleContext::isContext(*FName)) {
+    SmallVector<SampleContextFrame, 8> Frames;
+    if (!SampleContext::parse(*FName, Frames))
+      return sampleprof_error::malformed;
+    ProfileIsCS = true;
+  }
 
   Profiles[*FName] = FunctionSamples();
   FunctionSamples &FProfile = Profiles[*FName];
@@ -458,28 +527,111 @@ std::error_code SampleProfileReaderBinary::readFuncProfile() {
   return sampleprof_error::success;
 }
 
-std::error_code SampleProfileReaderBinary::read() {
-  while (!at_eof()) {
-    if (std::error_code EC = readFuncProfile())
-      return EC;
+std::error_code
+SampleProfileReaderBinary::readFuncProfiles(const uint8_t *Base) {
+  if (UseAllFuncs || !HasFuncOffsetTable) {
+    while (!at_eof()) {
+      if (std::error_code EC = readFuncProfile())
+        return EC;
+    }
+    return sampleprof_error::success;
   }
 
-  return sampleprof_error::success;
-}
-
-std::error_code SampleProfileReaderCompactBinary::read() {
+  // Only read the profiles of the functions that will be used.
   for (auto Name : FuncsToUse) {
-    auto GUID = std::to_string(MD5Hash(Name));
-    auto iter = FuncOffsetTable.find(StringRef(GUID));
+    std::string FGUID;
+    auto iter = FuncOffsetTable.find(getRepInFormat(Name, getFormat(), FGUID));
     if (iter == FuncOffsetTable.end())
       continue;
+    if (iter->second >= static_cast<uint64_t>(End - Base))
+      return sampleprof_error::malformed;
     const uint8_t *SavedData = Data;
-    Data = reinterpret_cast<const uint8_t *>(Buffer->getBufferStart()) +
-           iter->second;
+    Data = Base + iter->second;
     if (std::error_code EC = readFuncProfile())
       return EC;
     Data = SavedData;
   }
+
+  // The samples of a context end up in the profile of any of its functions,
+  // depending on what gets inlined, so read the contexts that involve a
+  // function of the module too.
+  if (FuncContextOffsets.empty())
+    return sampleprof_error::success;
+  DenseSet<uint64_t> ContextsRead;
+  for (auto Name : FuncsToUse) {
+    auto iter = FuncContextOffsets.find(Name);
+    if (iter == FuncContextOffsets.end())
+      continue;
+    for (uint64_t Offset : iter->second) {
+      if (!ContextsRead.insert(Offset).second)
+        continue;
+      if (Offset >= static_cast<uint64_t>(End - Base))
+        return sampleprof_error::malformed;
+      const uint8_t *SavedData = Data;
+      Data = Base + Offset;
+      if (std::error_code EC = readFuncProfile())
+        return EC;
+      Data = SavedData;
+    }
+  }
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileReaderBinary::read() {
+  return readFuncProfiles(
+      reinterpret_cast<const uint8_t *>(Buffer->getBufferStart()));
+}
+
+std::error_code SampleProfileReaderExtBinary::decompressProfileSection() {
+  if (!ProfileSecCompressed)
+    return sampleprof_error::success;
+  Data = ProfileSecStart;
+  End = ProfileSecEnd;
+  if (std::error_code EC = decompressSection())
+    return EC;
+  ProfileSecStart = Data;
+  ProfileSecEnd = End;
+  ProfileSecCompressed = false;
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileReaderExtBinary::read() {
+  // A profile without a function profile section has no profiles.
+  if (!ProfileSecStart)
+    return sampleprof_error::success;
+  if (std::error_code EC = decompressProfileSection())
+    return EC;
+  Data = ProfileSecStart;
+  End = ProfileSecEnd;
+  return readFuncProfiles(ProfileSecStart);
+}
+
+std::error_code SampleProfileReaderExtBinary::getEncodedFuncProfiles(
+    std::vector<EncodedFuncProfile> &FuncProfiles) {
+  FuncProfiles.clear();
+  if (!ProfileSecStart)
+    return sampleprof_error::success;
+  if (std::error_code EC = decompressProfileSection())
+    return EC;
+  uint64_t SecSize = ProfileSecEnd - ProfileSecStart;
+  if (SecSize && !HasFuncOffsetTable)
+    return sampleprof_error::malformed;
+
+  // Every function profile ends where the next one in the section starts.
+  std::vector<std::pair<uint64_t, StringRef>> Offsets;
+  Offsets.reserve(FuncOffsetTable.size());
+  for (const auto &Entry : FuncOffsetTable)
+    Offsets.emplace_back(Entry.second, Entry.first);
+  llvm::sort(Offsets);
+  for (size_t I = 0, E = Offsets.size(); I < E; ++I) {
+    uint64_t Begin = Offsets[I].first;
+    uint64_t Next = I + 1 < E ? Offsets[I + 1].first : SecSize;
+    if (Begin >= Next || Next > SecSize)
+      return sampleprof_error::malformed;
+    StringRef Bytes(reinterpret_cast<const char *>(ProfileSecStart) + Begin,
+                    Next - Begin);
+    FuncProfiles.push_back({Offsets[I].second, Bytes});
+  }
   return sampleprof_error::success;
 }
 
@@ -489,6 +641,12 @@ std::error_code SampleProfileReaderRawBinary::verifySPMagic(uint64_t Magic) {
   return sampleprof_error::bad_magic;
 }
 
+std::error_code SampleProfileReaderExtBinary::verifySPMagic(uint64_t Magic) {
+  if (Magic == SPMagic(SPF_Ext_Binary))
+    return sampleprof_error::success;
+  return sampleprof_error::bad_magic;
+}
+
 std::error_code
 SampleProfileReaderCompactBinary::verifySPMagic(uint64_t Magic) {
   if (Magic == SPMagic(SPF_Compact_Binary))
@@ -540,8 +698,9 @@ std::error_code SampleProfileReaderBinary::readHeader() {
   auto Version = readNumber<uint64_t>();
   if (std::error_code EC = Version.getError())
     return EC;
-  else if (*Version != SPVersion())
+  else if (*Version != SPVersion() && *Version != SPVersionNoFuncOffsetTable())
     return sampleprof_error::unsupported_version;
+  this->Version = *Version;
 
   if (std::error_code EC = readSummary())
     return EC;
@@ -551,22 +710,400 @@ std::error_code SampleProfileReaderBinary::readHeader() {
   return sampleprof_error::success;
 }
 
-std::error_code SampleProfileReaderCompactBinary::readHeader() {
-  SampleProfileReaderBinary::readHeader();
-  if (std::error_code EC = readFuncOffsetTable())
+std::error_code SampleProfileReaderRawBinary::readHeader() {
+  if (std::error_code EC = SampleProfileReaderBinary::readHeader())
+    return EC;
+  if (Version == SPVersionNoFuncOffsetTable())
+    return sampleprof_error::success;
+
+  // The offset of the function offset table is stored in the last 8 bytes of
+  // the file.
+  if (End - Data < static_cast<ptrdiff_t>(sizeof(uint64_t)))
+    return sampleprof_error::truncated;
+  const uint8_t *SavedData = Data;
+  Data = End - sizeof(uint64_t);
+  auto TableOffset = readUnencodedNumber<uint64_t>();
+  if (std::error_code EC = TableOffset.getError())
+    return EC;
+  End -= sizeof(uint64_t);
+  Data = SavedData;
+
+  const uint8_t *Start =
+      reinterpret_cast<const uint8_t *>(Buffer->getBufferStart());
+  if (*TableOffset < static_cast<uint64_t>(Data - Start) ||
+      *TableOffset > static_cast<uint64_t>(End - Start))
+    return sampleprof_error::malformed;
+  return readFuncOffsetTable(Start + *TableOffset);
+}
+
+std::error_code SampleProfileReaderExtBinary::readSecHdrTableEntry() {
+  SecHdrTableEntry Entry;
+  auto Type = readUnencodedNumber<uint64_t>();
+  if (std::error_code EC = Type.getError())
+    return EC;
+  Entry.Type = static_cast<SecType>(*Type);
+
+  auto Flags = readUnencodedNumber<uint64_t>();
+  if (std::error_code EC = Flags.getError())
+    return EC;
+  Entry.Flags = *Flags;
+
+  auto Offset = readUnencodedNumber<uint64_t>();
+  if (std::error_code EC = Offset.getError())
+    return EC;
+  Entry.Offset = *Offset;
+
+  auto Size = readUnencodedNumber<uint64_t>();
+  if (std::error_code EC = Size.getError())
+    return EC;
+  Entry.Size = *Size;
+
+  SecHdrTable.push_back(std::move(Entry));
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileReaderExtBinary::readSecHdrTable() {
+  auto EntryNum = readUnencodedNumber<uint64_t>();
+  if (std::error_code EC = EntryNum.getError())
+    return EC;
+
+  // Every entry is made of four unencoded 64-bit numbers.
+  if (*EntryNum > uint64_t(End - Data) / (4 * sizeof(uint64_t)))
+    return sampleprof_error::truncated;
+
+  SecHdrTable.reserve(*EntryNum);
+  for (uint64_t i = 0; i < (*EntryNum); i++)
+    if (std::error_code EC = readSecHdrTableEntry())
+      return EC;
+
+  return sampleprof_error::success;
+}
+
+std::error_code
+SampleProfileReaderExtBinary::readOneSection(const SecHdrTableEntry &Entry) {
+  const uint8_t *Start =
+      reinterpret_cast<const uint8_t *>(Buffer->getBufferStart());
+  uint64_t BufSize = Buffer->getBufferSize();
+  if (Entry.Offset > BufSize || Entry.Size > BufSize - Entry.Offset)
+    return sampleprof_error::truncated;
+  Data = Start + Entry.Offset;
+  End = Data + Entry.Size;
+
+  switch (Entry.Type) {
+  case SecProfSummary:
+  case SecNameTable:
+  case SecLBRProfile:
+  case SecFuncOffsetTable:
+  case SecProfileSymbolList:
+  case SecCountHistogram:
+  case SecDecayEpoch:
+    break;
+  default:
+    // Skip the sections this reader does not know about.
+    return sampleprof_error::success;
+  }
+  // A known section carrying a flag this reader does not know was written by
+  // a newer version of the format.
+  uint64_t KnownFlags = SecFlagCompress;
+  if (Entry.Type == SecNameTable)
+    KnownFlags |= SecFlagIndexed;
+  if (Entry.Flags & ~KnownFlags)
+    return sampleprof_error::unsupported_version;
+  bool Compressed = Entry.Flags & SecFlagCompress;
+
+  if (Entry.Type == SecLBRProfile) {
+    // The function profiles are only decompressed and decoded by read(), once
+    // it is known which functions are needed.
+    ProfileSecStart = Data;
+    ProfileSecEnd = End;
+    ProfileSecCompressed = Compressed;
+    return sampleprof_error::success;
+  }
+
+  if (Compressed)
+    if (std::error_code EC = decompressSection())
+      return EC;
+
+  switch (Entry.Type) {
+  case SecProfSummary:
+    return readSummary();
+  case SecNameTable:
+    if (Entry.Flags & SecFlagIndexed)
+      return readIndexedNameTable();
+    return readNameTable();
+  case SecFuncOffsetTable:
+    return readFuncOffsetTable(Data);
+  case SecProfileSymbolList:
+    if (!ProfSymList)
+      ProfSymList = llvm::make_unique<ProfileSymbolList>();
+    return ProfSymList->read(Data, End - Data);
+  case SecCountHistogram:
+    return readCountHistogram();
+  case SecDecayEpoch:
+    return readDecayEpoch();
+  default:
+    llvm_unreachable("Unexpected section type");
+  }
+}
+
+std::error_code SampleProfileReaderExtBinary::decompressSection() {
+  if (!llvm::zlib::isAvailable())
+    return sampleprof_error::zlib_unavailable;
+
+  auto UncompressSize = readNumber<uint64_t>();
+  if (std::error_code EC = UncompressSize.getError())
+    return EC;
+
+  auto CompressSize = readNumber<uint64_t>();
+  if (std::error_code EC = CompressSize.getError())
+    return EC;
+  if (*CompressSize > static_cast<uint64_t>(End - Data))
+    return sampleprof_error::truncated;
+  // zlib cannot compress by more than a factor of about 1032, so a larger
+  // uncompressed size is corrupt and must not be allocated.
+  const uint64_t MaxCompressionRatio = 1032;
+  if (*UncompressSize / MaxCompressionRatio > *CompressSize)
+    return sampleprof_error::malformed;
+
+  StringRef CompressedStrings(reinterpret_cast<const char *>(Data),
+                              *CompressSize);
+  std::unique_ptr<uint8_t[]> DecompressBuf(new uint8_t[*UncompressSize]);
+  size_t UCSize = *UncompressSize;
+  if (Error E = zlib::uncompress(CompressedStrings,
+                                 reinterpret_cast<char *>(DecompressBuf.get()),
+                                 UCSize)) {
+    consumeError(std::move(E));
+    return sampleprof_error::uncompress_failed;
+  }
+  if (UCSize != *UncompressSize)
+    return sampleprof_error::uncompress_failed;
+
+  Data = DecompressBuf.get();
+  End = Data + UCSize;
+  DecompressBufs.push_back(std::move(DecompressBuf));
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileReaderExtBinary::readIndexedNameTable() {
+  auto Size = readUnencodedNumber<uint64_t>();
+  if (std::error_code EC = Size.getError())
+    return EC;
+
+  // The offsets are only decoded when a name is looked up.
+  uint64_t OffsetsSize = (*Size + 1) * sizeof(uint64_t);
+  if (*Size >= static_cast<uint64_t>(End - Data) / sizeof(uint64_t))
+    return sampleprof_error::truncated_name_table;
+  IndexedNameTableSize = *Size;
+  IndexedNameTableOffsets = Data;
+  IndexedNameTableNames = reinterpret_cast<const char *>(Data + OffsetsSize);
+  IndexedNameTableNamesSize = End - Data - OffsetsSize;
+  Data = End;
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileReaderExtBinary::readCountHistogram() {
+  auto Size = readNumber<uint64_t>();
+  if (std::error_code EC = Size.getError())
     return EC;
+  CountHistogram.clear();
+  CountHistogram.reserve(std::min<uint64_t>(*Size, End - Data));
+  for (uint64_t I = 0; I < *Size; ++I) {
+    auto Count = readNumber<uint64_t>();
+    if (std::error_code EC = Count.getError())
+      return EC;
+    auto Freq = readNumber<uint32_t>();
+    if (std::error_code EC = Freq.getError())
+      return EC;
+    CountHistogram.emplace_back(*Count, *Freq);
+  }
+  HasCountHistogram = true;
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileReaderExtBinary::readDecayEpoch() {
+  auto Decay = readNumber<uint64_t>();
+  if (std::error_code EC = Decay.getError())
+    return EC;
+  auto Epoch = readNumber<uint64_t>();
+  if (std::error_code EC = Epoch.getError())
+    return EC;
+  if (*Decay < 2)
+    return sampleprof_error::malformed;
+  this->Decay = *Decay;
+  this->Epoch = *Epoch;
+  return sampleprof_error::success;
+}
+
+ErrorOr<StringRef> SampleProfileReaderExtBinary::readStringFromTable() {
+  if (!IndexedNameTableOffsets)
+    return SampleProfileReaderRawBinary::readStringFromTable();
+
+  auto Idx = readNumber<uint32_t>();
+  if (std::error_code EC = Idx.getError())
+    return EC;
+  return getIndexedName(*Idx);
+}
+
+ErrorOr<StringRef> SampleProfileReaderExtBinary::getIndexedName(uint64_t Idx) {
+  if (Idx >= IndexedNameTableSize)
+    return sampleprof_error::truncated_name_table;
+
+  using namespace support;
+  const uint8_t *Entry = IndexedNameTableOffsets + Idx * sizeof(uint64_t);
+  uint64_t Begin = endian::read<uint64_t, little, unaligned>(Entry);
+  uint64_t Next =
+      endian::read<uint64_t, little, unaligned>(Entry + sizeof(uint64_t));
+  // Each name is followed by a NUL terminator.
+  if (Begin >= Next || Next > IndexedNameTableNamesSize)
+    return sampleprof_error::truncated_name_table;
+  return StringRef(IndexedNameTableNames + Begin, Next - Begin - 1);
+}
+
+std::error_code
+SampleProfileReaderExtBinary::getNameTable(std::vector<StringRef> &Names) {
+  if (!IndexedNameTableOffsets) {
+    Names = NameTable;
+    return sampleprof_error::success;
+  }
+  Names.clear();
+  Names.reserve(IndexedNameTableSize);
+  for (uint64_t I = 0; I < IndexedNameTableSize; ++I) {
+    auto Name = getIndexedName(I);
+    if (std::error_code EC = Name.getError())
+      return EC;
+    Names.push_back(*Name);
+  }
   return sampleprof_error::success;
 }
 
-std::error_code SampleProfileReaderCompactBinary::readFuncOffsetTable() {
+bool SampleProfileReaderExtBinary::dumpSectionInfo(raw_ostream &OS) {
+  const uint8_t *Start =
+      reinterpret_cast<const uint8_t *>(Buffer->getBufferStart());
+  uint64_t TotalSecsSize = 0;
+  uint64_t TotalUncompressedSize = 0;
+  for (const auto &Entry : SecHdrTable) {
+    OS << getSecName(Entry.Type) << " - Offset: " << Entry.Offset
+       << ", Size: " << Entry.Size;
+    uint64_t UncompressedSize = Entry.Size;
+    SmallVector<StringRef, 2> Flags;
+    if (Entry.Flags & SecFlagCompress) {
+      // The uncompressed size leads the contents of a compressed section.
+      UncompressedSize = decodeULEB128(Start + Entry.Offset, nullptr,
+                                       Start + Entry.Offset + Entry.Size);
+      OS << ", Uncompressed Size: " << UncompressedSize;
+      Flags.push_back("compressed");
+    }
+    if (Entry.Flags & SecFlagIndexed)
+      Flags.push_back("indexed");
+    if (!Flags.empty())
+      OS << ", Flags: {" << join(Flags, ",") << "}";
+    OS << "\n";
+    TotalSecsSize += Entry.Size;
+    TotalUncompressedSize += UncompressedSize;
+  }
+  uint64_t HeaderSize = SecHdrTable.empty() ? Buffer->getBufferSize()
+                                            : SecHdrTable.front().Offset;
+  OS << "Header Size: " << HeaderSize << "\n";
+  OS << "Total Sections Size: " << TotalSecsSize << "\n";
+  OS << "Total Uncompressed Sections Size: " << TotalUncompressedSize << "\n";
+  OS << "File Size: " << Buffer->getBufferSize() << "\n";
+  return true;
+}
+
+std::error_code SampleProfileReaderExtBinary::readHeader() {
+  Data = reinterpret_cast<const uint8_t *>(Buffer->getBufferStart());
+  End = Data + Buffer->getBufferSize();
+
+  // Read and check the magic identifier.
+  auto Magic = readNumber<uint64_t>();
+  if (std::error_code EC = Magic.getError())
+    return EC;
+  else if (std::error_code EC = verifySPMagic(*Magic))
+    return EC;
+
+  // Read the version number.
+  auto Version = readNumber<uint64_t>();
+  if (std::error_code EC = Version.getError())
+    return EC;
+  else if (*Version != SPVersion())
+    return sampleprof_error::unsupported_version;
+  this->Version = *Version;
+
+  if (std::error_code EC = readSecHdrTable())
+    return EC;
+
+  // The name table has to be read before the sections that refer to it.
+  auto ReadSections = [&](bool NameTable) -> std::error_code {
+    for (const auto &Entry : SecHdrTable) {
+      if ((Entry.Type == SecNameTable) != NameTable)
+        continue;
+      if (std::error_code EC = readOneSection(Entry))
+        return EC;
+    }
+    return sampleprof_error::success;
+  };
+  if (std::error_code EC = ReadSections(true))
+    return EC;
+  if (std::error_code EC = ReadSections(false))
+    return EC;
+
+  if (!Summary)
+    return sampleprof_error::malformed;
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileReaderCompactBinary::readHeader() {
+  if (std::error_code EC = SampleProfileReaderBinary::readHeader())
+    return EC;
+
   auto TableOffset = readUnencodedNumber<uint64_t>();
   if (std::error_code EC = TableOffset.getError())
     return EC;
 
+  const uint8_t *Start =
+      reinterpret_cast<const uint8_t *>(Buffer->getBufferStart());
+  if (*TableOffset < static_cast<uint64_t>(Data - Start) ||
+      *TableOffset > static_cast<uint64_t>(End - Start))
+    return sampleprof_error::malformed;
+  const uint8_t *FileEnd = End;
+  const uint8_t *TableEnd;
+  if (std::error_code EC =
+          readFuncOffsetTable(Start + *TableOffset, &TableEnd))
+    return EC;
+  if (TableEnd == FileEnd)
+    return sampleprof_error::success;
+
+  // The original names, if any, follow the function offset table.
+  const uint8_t *SavedData = Data;
+  const uint8_t *SavedEnd = End;
+  Data = TableEnd;
+  End = FileEnd;
+  std::error_code EC = readOriginalNames();
+  Data = SavedData;
+  End = SavedEnd;
+  return EC;
+}
+
+std::error_code SampleProfileReaderCompactBinary::readOriginalNames() {
+  auto Size = readNumber<uint64_t>();
+  if (std::error_code EC = Size.getError())
+    return EC;
+  if (*Size > static_cast<uint64_t>(End - Data))
+    return sampleprof_error::truncated_name_table;
+  OriginalNames.reserve(*Size);
+  for (uint64_t I = 0; I < *Size; ++I) {
+    auto Name(readString());
+    if (std::error_code EC = Name.getError())
+      return EC;
+    OriginalNames.push_back(*Name);
+  }
+  return sampleprof_error::success;
+}
+
+std::error_code
+SampleProfileReaderBinary::readFuncOffsetTable(const uint8_t *TableStart,
+                                               const uint8_t **TableEnd) {
   const uint8_t *SavedData = Data;
-  const uint8_t *TableStart =
-      reinterpret_cast<const uint8_t *>(Buffer->getBufferStart()) +
-      *TableOffset;
   Data = TableStart;
 
   auto Size = readNumber<uint64_t>();
@@ -574,7 +1111,8 @@ std::error_code SampleProfileReaderCompactBinary::readFuncOffsetTable() {
     return EC;
 
   FuncOffsetTable.reserve(*Size);
-  for (uint32_t I = 0; I < *Size; ++I) {
+  SmallVector<SampleContextFrame, 8> Frames;
+  for (uint64_t I = 0; I < *Size; ++I) {
     auto FName(readStringFromTable());
     if (std::error_code EC = FName.getError())
       return EC;
@@ -584,13 +1122,36 @@ std::error_code SampleProfileReaderCompactBinary::readFuncOffsetTable() {
       return EC;
 
     FuncOffsetTable[*FName] = *Offset;
+
+    // Index the contexts by the functions they involve, so that selective
+    // reading does not have to parse every name of the table.
+    if (!SampleContext::parse(*FName, Frames))
+      continue;
+    for (size_t J = 0; J < Frames.size(); ++J) {
+      StringRef FuncName = Frames[J].FuncName;
+      bool Seen = llvm::any_of(
+          makeArrayRef(Frames).take_front(J),
+          [&](const SampleContextFrame &F) { return F.FuncName == FuncName; });
+      if (!Seen)
+        FuncContextOffsets[FuncName].push_back(*Offset);
+    }
   }
+  HasFuncOffsetTable = true;
+  if (TableEnd)
+    *TableEnd = Data;
   End = TableStart;
   Data = SavedData;
   return sampleprof_error::success;
 }
 
-void SampleProfileReaderCompactBinary::collectFuncsToUse(const Module &M) {
+void SampleProfileReaderBinary::setFuncsToUse(ArrayRef<StringRef> Names) {
+  UseAllFuncs = false;
+  FuncsToUse.clear();
+  FuncsToUse.insert(Names.begin(), Names.end());
+}
+
+void SampleProfileReaderBinary::collectFuncsToUse(const Module &M) {
+  UseAllFuncs = false;
   FuncsToUse.clear();
   for (auto &F : M) {
     StringRef CanonName = FunctionSamples::getCanonicalFnName(F);
@@ -661,6 +1222,13 @@ bool SampleProfileReaderRawBinary::hasFormat(const MemoryBuffer &Buffer) {
   return Magic == SPMagic();
 }
 
+bool SampleProfileReaderExtBinary::hasFormat(const MemoryBuffer &Buffer) {
+  const uint8_t *Data =
+      reinterpret_cast<const uint8_t *>(Buffer.getBufferStart());
+  uint64_t Magic = decodeULEB128(Data);
+  return Magic == SPMagic(SPF_Ext_Binary);
+}
+
 bool SampleProfileReaderCompactBinary::hasFormat(const MemoryBuffer &Buffer) {
   const uint8_t *Data =
       reinterpret_cast<const uint8_t *>(Buffer.getBufferStart());
@@ -912,9 +1480,10 @@ bool SampleProfileReaderGCC::hasFormat(const MemoryBuffer &Buffer) {
 }
 
 std::error_code SampleProfileReaderItaniumRemapper::read() {
-  // If the underlying data is in compact format, we can't remap it because
-  // we don't know what the original function names were.
-  if (getFormat() == SPF_Compact_Binary) {
+  // If the underlying data is in compact format, we can only remap it if it
+  // carries the original function names.
+  ArrayRef<StringRef> OriginalNames = UnderlyingReader->getOriginalNames();
+  if (getFormat() == SPF_Compact_Binary && OriginalNames.empty()) {
     Ctx.diagnose(DiagnosticInfoSampleProfile(
         Buffer->getBufferIdentifier(),
         "Profile data remapping cannot be applied to profile data "
@@ -931,18 +1500,108 @@ std::error_code SampleProfileReaderItaniumRemapper::read() {
     return sampleprof_error::malformed;
   }
 
-  for (auto &Sample : getProfiles())
-    if (auto Key = Remappings.insert(Sample.first()))
-      SampleMap.insert({Key, &Sample.second});
+  if (getFormat() == SPF_Compact_Binary) {
+    // The original names include those of callees and call targets, which
+    // need not have a profile of their own.
+    std::string GUID;
+    for (StringRef Name : OriginalNames)
+      if (Profiles.count(getRepInFormat(Name, SPF_Compact_Binary, GUID)))
+        ProfileNames.push_back(Name);
+  } else {
+    ProfileNames.reserve(Profiles.size());
+    for (const auto &I : Profiles)
+      if (!SampleContext::isContext(I.getKey()))
+        ProfileNames.push_back(I.second.getName());
+  }
 
+  if (!FuncsToRemap.empty())
+    remapNames(FuncsToRemap);
   return sampleprof_error::success;
 }
 
+void SampleProfileReaderItaniumRemapper::collectFuncsToUse(const Module &M) {
+  FuncsToRemap.clear();
+  for (const auto &F : M)
+    FuncsToRemap.push_back(FunctionSamples::getCanonicalFnName(F));
+}
+
+bool SampleProfileReaderItaniumRemapper::isInProfile(StringRef Fname) {
+  return SampleProfileReader::getSamplesFor(Fname) ||
+         SampleProfileReader::getFlatSamplesFor(Fname);
+}
+
+void SampleProfileReaderItaniumRemapper::remapNames(ArrayRef<StringRef> Names) {
+  // Canonicalize the names that are not in the profile, then only look the
+  // names of the profile up: the canonicalizer gives up on a name as soon as
+  // it meets a component that none of the inserted names has, so the names
+  // that cannot match are cheap to rule out.
+  DenseMap<SymbolRemappingReader::Key, SmallVector<StringRef, 1>> Pending;
+  for (StringRef Name : Names) {
+    if (Name.empty() || RemappedNames.count(Name) || isInProfile(Name))
+      continue;
+    RemappedNames[Name] = StringRef();
+    if (auto Key = Remappings.insert(Name))
+      Pending[Key].push_back(Name);
+  }
+  if (Pending.empty())
+    return;
+
+  for (StringRef ProfileName : ProfileNames) {
+    auto Key = Remappings.lookup(ProfileName);
+    if (!Key)
+      continue;
+    auto I = Pending.find(Key);
+    if (I == Pending.end())
+      continue;
+    // The first name of the profile equivalent to a function wins.
+    for (StringRef Name : I->second)
+      RemappedNames[Name] = ProfileName;
+    Pending.erase(I);
+    if (Pending.empty())
+      break;
+  }
+}
+
+void SampleProfileReaderItaniumRemapper::canonicalizeProfileNames() {
+  for (StringRef ProfileName : ProfileNames)
+    if (auto Key = Remappings.insert(ProfileName))
+      ProfileNameMap.insert({Key, ProfileName});
+  ProfileNamesCanonicalized = true;
+}
+
+StringRef
+SampleProfileReaderItaniumRemapper::lookUpNameInProfile(StringRef Fname) {
+  if (isInProfile(Fname))
+    return Fname;
+  auto I = RemappedNames.find(Fname);
+  if (I != RemappedNames.end())
+    return I->second;
+
+  // A function that was not collected beforehand: without knowing the other
+  // names to look up, canonicalizing the whole profile once is cheaper than
+  // going over it for every such name.
+  if (!ProfileNamesCanonicalized)
+    canonicalizeProfileNames();
+  StringRef ProfileName;
+  if (auto Key = Remappings.lookup(Fname))
+    ProfileName = ProfileNameMap.lookup(Key);
+  return RemappedNames[Fname] = ProfileName;
+}
+
 FunctionSamples *
 SampleProfileReaderItaniumRemapper::getSamplesFor(StringRef Fname) {
-  if (auto Key = Remappings.lookup(Fname))
-    return SampleMap.lookup(Key);
-  return SampleProfileReader::getSamplesFor(Fname);
+  StringRef ProfileName = lookUpNameInProfile(Fname);
+  if (ProfileName.empty())
+    return nullptr;
+  return SampleProfileReader::getSamplesFor(ProfileName);
+}
+
+const FlatFunctionSamples *
+SampleProfileReaderItaniumRemapper::getFlatSamplesFor(StringRef Fname) {
+  StringRef ProfileName = lookUpNameInProfile(Fname);
+  if (ProfileName.empty())
+    return nullptr;
+  return SampleProfileReader::getFlatSamplesFor(ProfileName);
 }
 
 /// Prepare a memory buffer for the contents of \p Filename.
@@ -1010,6 +1669,8 @@ SampleProfileReader::create(std::unique_ptr<MemoryBuffer> &B, LLVMContext &C) {
   std::unique_ptr<SampleProfileReader> Reader;
   if (SampleProfileReaderRawBinary::hasFormat(*B))
     Reader.reset(new SampleProfileReaderRawBinary(std::move(B), C));
+  else if (SampleProfileReaderExtBinary::hasFormat(*B))
+    Reader.reset(new SampleProfileReaderExtBinary(std::move(B), C));
   else if (SampleProfileReaderCompactBinary::hasFormat(*B))
     Reader.reset(new SampleProfileReaderCompactBinary(std::move(B), C));
   else if (SampleProfileReaderGCC::hasFormat(*B))
@@ -1026,6 +1687,14 @@ SampleProfileReader::create(std::unique_ptr<MemoryBuffer> &B, LLVMContext &C) {
   return std::move(Reader);
 }
 
+void SampleProfileReader::flattenProfiles() {
+  for (auto I = Profiles.begin(), E = Profiles.end(); I != E;) {
+    auto Cur = I++;
+    FlatProfiles.add(Cur->first(), Cur->second);
+    Profiles.erase(Cur);
+  }
+}
+
 // For text and GCC file formats, we compute the summary after reading the
 // profile. Binary format has the profile summary in its header.
 void SampleProfileReader::computeSummary() {
@@ -21,8 +21,11 @@
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ProfileData/ProfileCommon.h"
 #include "llvm/ProfileData/SampleProf.h"
+#include "llvm/ProfileData/SampleProfReader.h"
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/Endian.h"
 #include "llvm/Support/EndianStream.h"
+#include "llvm/Support/Error.h"
 #include "llvm/Support/ErrorOr.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/LEB128.h"
@@ -43,7 +46,11 @@ std::error_code
 SampleProfileWriter::write(const StringMap<FunctionSamples> &ProfileMap) {
   if (std::error_code EC = writeHeader(ProfileMap))
     return EC;
+  return writeFuncProfiles(ProfileMap);
+}
 
+std::error_code SampleProfileWriter::writeFuncProfiles(
+    const StringMap<FunctionSamples> &ProfileMap) {
   // Sort the ProfileMap by total samples.
   typedef std::pair<StringRef, const FunctionSamples *> NameFunctionSamples;
   std::vector<NameFunctionSamples> V;
@@ -65,12 +72,247 @@ SampleProfileWriter::write(const StringMap<FunctionSamples> &ProfileMap) {
   return sampleprof_error::success;
 }
 
+std::error_code SampleProfileWriterRawBinary::write(
+    const StringMap<FunctionSamples> &ProfileMap) {
+  if (std::error_code EC = SampleProfileWriter::write(ProfileMap))
+    return EC;
+  uint64_t FuncOffsetTableStart = OutputStream->tell();
+  if (std::error_code EC = writeFuncOffsetTable())
+    return EC;
+
+  // Finish with the offset of FuncOffsetTable, so that the reader can find it
+  // from the end of the file.
+  support::endian::Writer Writer(*OutputStream, support::little);
+  Writer.write(FuncOffsetTableStart);
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileWriterExtBinary::writeSection(
+    SecType Type, uint64_t Flags,
+    function_ref<std::error_code()> WriteContents) {
+  SecBuffers.emplace_back();
+
+  // Redirect the output to the buffer of this section while it is written.
+  std::unique_ptr<raw_ostream> SavedStream = std::move(OutputStream);
+  OutputStream = llvm::make_unique<raw_svector_ostream>(SecBuffers.back());
+  std::error_code EC = WriteContents();
+  OutputStream = std::move(SavedStream);
+  if (EC)
+    return EC;
+
+  if (SecsToCompress.count(Type)) {
+    if (std::error_code EC = compressSection(SecBuffers.back()))
+      return EC;
+    Flags |= SecFlagCompress;
+  }
+  SecHdrTable.push_back({Type, Flags, 0, (uint64_t)SecBuffers.back().size()});
+  return sampleprof_error::success;
+}
+
+std::error_code
+SampleProfileWriterExtBinary::compressSection(SmallString<0> &Buf) {
+  if (!llvm::zlib::isAvailable())
+    return sampleprof_error::zlib_unavailable;
+
+  SmallString<128> CompressedStrings;
+  if (Error E = zlib::compress(Buf, CompressedStrings,
+                               zlib::BestSizeCompression)) {
+    consumeError(std::move(E));
+    return sampleprof_error::compress_failed;
+  }
+
+  SmallString<0> Compressed;
+  raw_svector_ostream OS(Compressed);
+  encodeULEB128(Buf.size(), OS);
+  encodeULEB128(CompressedStrings.size(), OS);
+  OS << CompressedStrings;
+  Buf = std::move(Compressed);
+  return sampleprof_error::success;
+}
+
+void SampleProfileWriterExtBinary::setToCompressAllSections() {
+  for (SecType Type :
+       {SecProfSummary, SecNameTable, SecLBRProfile, SecFuncOffsetTable,
+        SecCountHistogram, SecDecayEpoch, SecProfileSymbolList})
+    setToCompressSection(Type);
+}
+
+std::error_code SampleProfileWriterExtBinary::write(
+    const StringMap<FunctionSamples> &ProfileMap) {
+  computeSummary(ProfileMap);
+
+  // Generate the name table for all the functions referenced in the profile.
+  for (const auto &I : ProfileMap) {
+    addName(I.first());
+    addNames(I.second);
+  }
+
+  return writeSections([&]() { return writeFuncProfiles(ProfileMap); });
+}
+
+std::error_code SampleProfileWriterExtBinary::append(
+    SampleProfileReader &Base, const StringMap<FunctionSamples> &ProfileMap) {
+  if (Base.getFormat() != SPF_Ext_Binary)
+    return sampleprof_error::unsupported_writing_format;
+  auto &ExtBase = static_cast<SampleProfileReaderExtBinary &>(Base);
+  std::vector<StringRef> BaseNames;
+  if (std::error_code EC = ExtBase.getNameTable(BaseNames))
+    return EC;
+  std::vector<SampleProfileReaderExtBinary::EncodedFuncProfile> BaseFuncs;
+  if (std::error_code EC = ExtBase.getEncodedFuncProfiles(BaseFuncs))
+    return EC;
+
+  // Replace the counts of the profiles of Base that ProfileMap replaces. The
+  // count histogram of Base makes this exact without looking at the other
+  // profiles; a profile without one needs Base to have read all of them.
+  SampleProfileSummaryBuilder Builder(ProfileSummaryBuilder::DefaultCutoffs);
+  const StringMap<FunctionSamples> &BaseProfiles = Base.getProfiles();
+  if (ExtBase.hasCountHistogram()) {
+    Builder.addSummary(Base.getSummary(), ExtBase.getCountHistogram());
+    for (const auto &I : ProfileMap) {
+      auto It = BaseProfiles.find(I.getKey());
+      if (It != BaseProfiles.end())
+        Builder.removeRecord(It->second);
+    }
+  } else {
+    for (const auto &I : BaseProfiles)
+      if (!ProfileMap.count(I.getKey()))
+        Builder.addRecord(I.second);
+  }
+  for (const auto &I : ProfileMap)
+    Builder.addRecord(I.second);
+  setSummary(Builder);
+
+  // The copied profiles refer to the names by their index in Base.
+  KeepNameTableOrder = true;
+  for (StringRef Name : BaseNames)
+    addName(Name);
+  if (NameTable.size() != BaseNames.size())
+    return sampleprof_error::malformed;
+  for (const auto &I : ProfileMap) {
+    addName(I.first());
+    addNames(I.second);
+  }
+  uint32_t Index = 0;
+  for (auto &I : NameTable)
+    I.second = Index++;
+
+  return writeSections([&]() {
+    for (const auto &F : BaseFuncs) {
+      if (ProfileMap.count(F.Name))
+        continue;
+      FuncOffsetTable[F.Name] = OutputStream->tell();
+      *OutputStream << F.Data;
+    }
+    return writeFuncProfiles(ProfileMap);
+  });
+}
+
+std::error_code SampleProfileWriterExtBinary::writeSections(
+    function_ref<std::error_code()> WriteFuncProfiles) {
+  if (std::error_code EC = writeSection(SecProfSummary, SecFlagInValid,
+                                        [&]() { return writeSummary(); }))
+    return EC;
+  if (std::error_code EC = writeSection(SecNameTable, SecFlagIndexed,
+                                        [&]() { return writeNameTable(); }))
+    return EC;
+  if (std::error_code EC =
+          writeSection(SecLBRProfile, SecFlagInValid, WriteFuncProfiles))
+    return EC;
+  if (std::error_code EC =
+          writeSection(SecFuncOffsetTable, SecFlagInValid,
+                       [&]() { return writeFuncOffsetTable(); }))
+    return EC;
+  if (std::error_code EC =
+          writeSection(SecCountHistogram, SecFlagInValid,
+                       [&]() { return writeCountHistogram(); }))
+    return EC;
+  if (Epoch)
+    if (std::error_code EC =
+            writeSection(SecDecayEpoch, SecFlagInValid, [&]() {
+              encodeULEB128(Decay, *OutputStream);
+              encodeULEB128(Epoch, *OutputStream);
+              return sampleprof_error::success;
+            }))
+      return EC;
+  if (ProfSymList && ProfSymList->size())
+    if (std::error_code EC = writeSection(
+            SecProfileSymbolList, SecFlagInValid,
+            [&]() { return ProfSymList->write(*OutputStream); }))
+      return EC;
+
+  // Now that the size of every section is known, emit the header, the section
+  // header table and the sections themselves.
+  auto &OS = *OutputStream;
+  if (std::error_code EC = writeMagicIdent())
+    return EC;
+  support::endian::Writer Writer(OS, support::little);
+  uint64_t Offset =
+      OS.tell() + sizeof(uint64_t) * (1 + 4 * SecHdrTable.size());
+  Writer.write(static_cast<uint64_t>(SecHdrTable.size()));
+  for (SecHdrTableEntry &Entry : SecHdrTable) {
+    Entry.Offset = Offset;
+    Offset += Entry.Size;
+    Writer.write(static_cast<uint64_t>(Entry.Type));
+    Writer.write(Entry.Flags);
+    Writer.write(Entry.Offset);
+    Writer.write(Entry.Size);
+  }
+  for (const auto &Buf : SecBuffers)
+    OS << Buf;
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileWriterExtBinary::writeCountHistogram() {
+  auto &OS = *OutputStream;
+  encodeULEB128(CountHistogram.size(), OS);
+  for (const auto &I : CountHistogram) {
+    encodeULEB128(I.first, OS);
+    encodeULEB128(I.second, OS);
+  }
+  return sampleprof_error::success;
+}
+
 std::error_code SampleProfileWriterCompactBinary::write(
     const StringMap<FunctionSamples> &ProfileMap) {
+  // Names are only stored as MD5 hashes, which would lose the calling
+  // contexts.
+  for (const auto &I : ProfileMap)
+    if (SampleContext::isContext(I.getKey()))
+      return sampleprof_error::unsupported_writing_format;
+
   if (std::error_code EC = SampleProfileWriter::write(ProfileMap))
     return EC;
+
+  // Fill the slot remembered by TableOffset with the offset of FuncOffsetTable.
+  auto &OFS = static_cast<raw_fd_ostream &>(*OutputStream);
+  uint64_t FuncOffsetTableStart = OutputStream->tell();
+  if (OFS.seek(TableOffset) == (uint64_t)-1)
+    return sampleprof_error::ostream_seek_unsupported;
+  support::endian::Writer Writer(*OutputStream, support::little);
+  Writer.write(FuncOffsetTableStart);
+  if (OFS.seek(FuncOffsetTableStart) == (uint64_t)-1)
+    return sampleprof_error::ostream_seek_unsupported;
+
   if (std::error_code EC = writeFuncOffsetTable())
     return EC;
+  if (WriteOriginalNames)
+    return writeOriginalNames();
+  return sampleprof_error::success;
+}
+
+std::error_code SampleProfileWriterCompactBinary::writeOriginalNames() {
+  auto &OS = *OutputStream;
+  // Callees and call targets are written too, so that merging the profile
+  // again can restore every name it hashes.
+  std::vector<StringRef> Names;
+  Names.reserve(NameTable.size());
+  for (const auto &I : NameTable)
+    Names.push_back(I.first);
+  llvm::sort(Names);
+  encodeULEB128(Names.size(), OS);
+  for (StringRef Name : Names)
+    OS << Name << '\0';
   return sampleprof_error::success;
 }
 
@@ -178,30 +420,49 @@ std::error_code SampleProfileWriterRawBinary::writeNameTable() {
   return sampleprof_error::success;
 }
 
-std::error_code SampleProfileWriterCompactBinary::writeFuncOffsetTable() {
+std::error_code SampleProfileWriterBinary::writeFuncOffsetTable() {
   auto &OS = *OutputStream;
 
-  // Fill the slot remembered by TableOffset with the offset of FuncOffsetTable.
-  auto &OFS = static_cast<raw_fd_ostream &>(OS);
-  uint64_t FuncOffsetTableStart = OS.tell();
-  if (OFS.seek(TableOffset) == (uint64_t)-1)
-    return sampleprof_error::ostream_seek_unsupported;
-  support::endian::Writer Writer(*OutputStream, support::little);
-  Writer.write(FuncOffsetTableStart);
-  if (OFS.seek(FuncOffsetTableStart) == (uint64_t)-1)
-    return sampleprof_error::ostream_seek_unsupported;
-
   // Write out the table size.
   encodeULEB128(FuncOffsetTable.size(), OS);
 
   // Write out FuncOffsetTable.
   for (auto entry : FuncOffsetTable) {
-    writeNameIdx(entry.first);
+    if (std::error_code EC = writeNameIdx(entry.first))
+      return EC;
     encodeULEB128(entry.second, OS);
   }
   return sampleprof_error::success;
 }
 
+std::error_code SampleProfileWriterExtBinary::writeNameTable() {
+  auto &OS = *OutputStream;
+  std::vector<StringRef> V;
+  if (KeepNameTableOrder) {
+    for (const auto &I : NameTable)
+      V.push_back(I.first);
+  } else {
+    std::set<StringRef> Sorted;
+    stablizeNameTable(Sorted);
+    V.assign(Sorted.begin(), Sorted.end());
+  }
+
+  // Write out the offsets of the names, followed by the names themselves.
+  support::endian::Writer Writer(OS, support::little);
+  Writer.write(static_cast<uint64_t>(V.size()));
+  uint64_t Offset = 0;
+  for (auto N : V) {
+    Writer.write(Offset);
+    Offset += N.size() + 1;
+  }
+  Writer.write(Offset);
+  for (auto N : V) {
+    OS << N;
+    encodeULEB128(0, OS);
+  }
+  return sampleprof_error::success;
+}
+
 std::error_code SampleProfileWriterCompactBinary::writeNameTable() {
   auto &OS = *OutputStream;
   std::set<StringRef> V;
@@ -223,6 +484,14 @@ std::error_code SampleProfileWriterRawBinary::writeMagicIdent() {
   return sampleprof_error::success;
 }
 
+std::error_code SampleProfileWriterExtBinary::writeMagicIdent() {
+  auto &OS = *OutputStream;
+  // Write file magic identifier.
+  encodeULEB128(SPMagic(SPF_Ext_Binary), OS);
+  encodeULEB128(SPVersion(), OS);
+  return sampleprof_error::success;
+}
+
 std::error_code SampleProfileWriterCompactBinary::writeMagicIdent() {
   auto &OS = *OutputStream;
   // Write file magic identifier.
@@ -326,15 +595,8 @@ std::error_code SampleProfileWriterBinary::writeBody(const FunctionSamples &S) {
 ///
 /// \returns true if the samples were written successfully, false otherwise.
 std::error_code SampleProfileWriterBinary::write(const FunctionSamples &S) {
-  encodeULEB128(S.getHeadSamples(), *OutputStream);
-  return writeBody(S);
-}
-
-std::error_code
-SampleProfileWriterCompactBinary::write(const FunctionSamples &S) {
-  uint64_t Offset = OutputStream->tell();
-  StringRef Name = S.getName();
-  FuncOffsetTable[Name] = Offset;
+  // Remember where the profile starts for the function offset table.
+  FuncOffsetTable[S.getName()] = OutputStream->tell();
   encodeULEB128(S.getHeadSamples(), *OutputStream);
   return writeBody(S);
 }
@@ -350,7 +612,8 @@ ErrorOr<std::unique_ptr<SampleProfileWriter>>
 SampleProfileWriter::create(StringRef Filename, SampleProfileFormat Format) {
   std::error_code EC;
   std::unique_ptr<raw_ostream> OS;
-  if (Format == SPF_Binary || Format == SPF_Compact_Binary)
+  if (Format == SPF_Binary || Format == SPF_Ext_Binary ||
+      Format == SPF_Compact_Binary)
     OS.reset(new raw_fd_ostream(Filename, EC, sys::fs::F_None));
   else
     OS.reset(new raw_fd_ostream(Filename, EC, sys::fs::F_Text));
@@ -375,6 +638,8 @@ SampleProfileWriter::create(std::unique_ptr<raw_ostream> &OS,
 
   if (Format == SPF_Binary)
     Writer.reset(new SampleProfileWriterRawBinary(OS));
+  else if (Format == SPF_Ext_Binary)
+    Writer.reset(new SampleProfileWriterExtBinary(OS));
   else if (Format == SPF_Compact_Binary)
     Writer.reset(new SampleProfileWriterCompactBinary(OS));
   else if (Format == SPF_Text)
@@ -397,5 +662,11 @@ void SampleProfileWriter::computeSummary(
     const FunctionSamples &Profile = I.second;
     Builder.addRecord(Profile);
   }
+  setSummary(Builder);
+}
+
+void SampleProfileWriter::setSummary(SampleProfileSummaryBuilder &Builder) {
   Summary = Builder.getSummary();
+  const auto &Frequencies = Builder.getCountFrequencies();
+  CountHistogram.assign(Frequencies.begin(), Frequencies.end());
 }
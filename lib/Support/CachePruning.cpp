@@ -12,16 +12,20 @@
 
 #include "llvm/Support/CachePruning.h"
 
+#include "llvm/ADT/StringMap.h"
 #include "llvm/Support/Debug.h"
 #include "llvm/Support/Errc.h"
 #include "llvm/Support/Error.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/LockFileManager.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/raw_ostream.h"
 
 #define DEBUG_TYPE "cache-pruning"
 
 #include <set>
+#include <tuple>
 #include <system_error>
 
 using namespace llvm;
@@ -147,6 +151,225 @@ llvm::parseCachePruningPolicy(StringRef PolicyStr) {
   return Policy;
 }
 
+/// Compute the size the cache directory \p Path, whose files take
+/// \p TotalSize bytes, must be pruned to, or return None if \p Policy does not
+/// limit the size.
+static Optional<uint64_t> getTotalSizeTarget(StringRef Path,
+                                             CachePruningPolicy &Policy,
+                                             uint64_t TotalSize) {
+  if (Policy.MaxSizePercentageOfAvailableSpace == 0 && Policy.MaxSizeBytes == 0)
+    return None;
+
+  auto ErrOrSpaceInfo = sys::fs::disk_space(Path);
+  if (!ErrOrSpaceInfo) {
+    report_fatal_error("Can't get available size");
+  }
+  sys::fs::space_info SpaceInfo = ErrOrSpaceInfo.get();
+  auto AvailableSpace = TotalSize + SpaceInfo.free;
+
+  if (Policy.MaxSizePercentageOfAvailableSpace == 0)
+    Policy.MaxSizePercentageOfAvailableSpace = 100;
+  if (Policy.MaxSizeBytes == 0)
+    Policy.MaxSizeBytes = AvailableSpace;
+  auto TotalSizeTarget = std::min<uint64_t>(
+      AvailableSpace * Policy.MaxSizePercentageOfAvailableSpace / 100ull,
+      Policy.MaxSizeBytes);
+
+  LLVM_DEBUG(dbgs() << "Occupancy: " << ((100 * TotalSize) / AvailableSpace)
+                    << "% target is: "
+                    << Policy.MaxSizePercentageOfAvailableSpace << "%, "
+                    << Policy.MaxSizeBytes << " bytes\n");
+  return TotalSizeTarget;
+}
+
+static const char *const IndexJournalName = "llvmcache.index";
+static const char *const IndexSnapshotName = "llvmcache.snapshot";
+
+static uint64_t getIndexTime(sys::TimePoint<> Time) {
+  using namespace std::chrono;
+  return duration_cast<seconds>(Time.time_since_epoch()).count();
+}
+
+/// Append \p Record to the journal of the index of the cache directory
+/// \p Path. The record is written by a single write to the end of the file.
+static void appendIndexRecord(StringRef Path, const Twine &Record) {
+  SmallString<128> JournalPath(Path);
+  sys::path::append(JournalPath, IndexJournalName);
+  std::string Line = Record.str();
+  std::error_code EC;
+  raw_fd_ostream OS(JournalPath, EC, sys::fs::OF_Append);
+  if (EC)
+    return;
+  OS.SetBufferSize(Line.size());
+  OS << Line;
+}
+
+void llvm::addCacheIndexEntry(StringRef Path, StringRef EntryName,
+                              StringRef ContentName, uint64_t Size) {
+  uint64_t Time = getIndexTime(std::chrono::system_clock::now());
+  appendIndexRecord(Path, "A " + EntryName + " " + ContentName + " " +
+                              Twine(Size) + " " + Twine(Time) + "\n");
+}
+
+void llvm::touchCacheIndexEntry(StringRef Path, StringRef EntryName) {
+  uint64_t Time = getIndexTime(std::chrono::system_clock::now());
+  appendIndexRecord(Path, "U " + EntryName + " " + Twine(Time) + "\n");
+}
+
+namespace {
+struct IndexEntry {
+  std::string ContentName;
+  uint64_t Size;
+  uint64_t Time;
+};
+} // anonymous namespace
+
+/// Apply the complete records of \p Records to \p Entries, and return the
+/// number of bytes they take. A record being written by another process is
+/// left for later.
+static size_t readIndexRecords(StringRef Records,
+                               StringMap<IndexEntry> &Entries) {
+  size_t Read = 0;
+  while (true) {
+    size_t End = Records.find('\n', Read);
+    if (End == StringRef::npos)
+      return Read;
+    StringRef Record = Records.slice(Read, End);
+    SmallVector<StringRef, 5> Fields;
+    Record.split(Fields, ' ');
+    Read = End + 1;
+
+    uint64_t Size, Time;
+    if (Fields.size() == 5 && Fields[0] == "A" &&
+        !Fields[3].getAsInteger(10, Size) &&
+        !Fields[4].getAsInteger(10, Time)) {
+      auto Inserted = Entries.try_emplace(Fields[1]);
+      IndexEntry &Entry = Inserted.first->second;
+      if (!Inserted.second)
+        Time = std::max(Time, Entry.Time);
+      Entry = {Fields[2], Size, Time};
+    } else if (Fields.size() == 3 && Fields[0] == "U" &&
+               !Fields[2].getAsInteger(10, Time)) {
+      auto I = Entries.find(Fields[1]);
+      if (I != Entries.end())
+        I->second.Time = std::max(I->second.Time, Time);
+    } else {
+      LLVM_DEBUG(dbgs() << "Ignore malformed index record: " << Record
+                        << "\n");
+    }
+  }
+}
+
+/// Whether \p Name is a file the index of a cache directory may remove.
+static bool isCacheFileName(StringRef Name) {
+  return Name.startswith("llvmcache-") && sys::path::filename(Name) == Name;
+}
+
+/// Prune the cache directory \p Path according to its index. The journal is
+/// moved aside and merged into a new snapshot of the entries left, so other
+/// processes keep appending to a new journal meanwhile.
+static bool pruneCacheWithIndex(StringRef Path, CachePruningPolicy &Policy,
+                                sys::TimePoint<> CurrentTime) {
+  using namespace std::chrono;
+
+  SmallString<128> SnapshotPath(Path), JournalPath(Path), PrunedJournalPath;
+  sys::path::append(SnapshotPath, IndexSnapshotName);
+  sys::path::append(JournalPath, IndexJournalName);
+  PrunedJournalPath = JournalPath;
+  PrunedJournalPath += ".pruned";
+
+  // Only one process at a time moves the journal and writes the snapshot.
+  LockFileManager Lock(SnapshotPath);
+  if (Lock != LockFileManager::LFS_Owned) {
+    LLVM_DEBUG(dbgs() << "Index locked by another process, do not prune.\n");
+    return false;
+  }
+
+  // A previous pruner may have stopped before removing the journal it moved.
+  StringMap<IndexEntry> Entries;
+  for (StringRef IndexFile : {SnapshotPath, PrunedJournalPath}) {
+    if (ErrorOr<std::unique_ptr<MemoryBuffer>> MBOrErr =
+            MemoryBuffer::getFile(IndexFile))
+      readIndexRecords((*MBOrErr)->getBuffer(), Entries);
+  }
+  sys::fs::remove(PrunedJournalPath);
+  size_t JournalRead = 0;
+  if (!sys::fs::rename(JournalPath, PrunedJournalPath))
+    if (ErrorOr<std::unique_ptr<MemoryBuffer>> MBOrErr =
+            MemoryBuffer::getFile(PrunedJournalPath))
+      JournalRead = readIndexRecords((*MBOrErr)->getBuffer(), Entries);
+
+  StringMap<unsigned> ContentUses;
+  uint64_t TotalSize = 0;
+  for (auto &Entry : Entries)
+    if (ContentUses[Entry.second.ContentName]++ == 0)
+      TotalSize += Entry.second.Size;
+
+  auto RemoveEntry = [&](StringRef Name) {
+    auto I = Entries.find(Name);
+    IndexEntry &Entry = I->second;
+    SmallString<128> FilePath(Path);
+    if (isCacheFileName(Name)) {
+      sys::path::append(FilePath, Name);
+      sys::fs::remove(FilePath);
+    }
+    if (--ContentUses[Entry.ContentName] == 0) {
+      TotalSize -= Entry.Size;
+      if (isCacheFileName(Entry.ContentName)) {
+        FilePath = Path;
+        sys::path::append(FilePath, Entry.ContentName);
+        sys::fs::remove(FilePath);
+      }
+    }
+    LLVM_DEBUG(dbgs() << " - Remove " << Name << " (size " << Entry.Size
+                      << "), new occupancy is " << TotalSize << "\n");
+    Entries.erase(I);
+  };
+
+  // Remove the entries that haven't been used recently enough, then the least
+  // recently used ones.
+  uint64_t Now = getIndexTime(CurrentTime);
+  std::vector<std::tuple<bool, uint64_t, StringRef>> ByTime;
+  for (auto &Entry : Entries) {
+    uint64_t Age = Now - std::min(Now, Entry.second.Time);
+    bool Expired = Policy.Expiration != seconds(0) &&
+                   Age > uint64_t(Policy.Expiration.count());
+    ByTime.emplace_back(!Expired, Entry.second.Time, Entry.first());
+  }
+  std::sort(ByTime.begin(), ByTime.end());
+  auto Next = ByTime.begin();
+  while (Next != ByTime.end() && !std::get<0>(*Next))
+    RemoveEntry(std::get<2>(*Next++));
+  if (Policy.MaxSizeFiles)
+    while (Entries.size() > Policy.MaxSizeFiles)
+      RemoveEntry(std::get<2>(*Next++));
+  if (Optional<uint64_t> TotalSizeTarget =
+          getTotalSizeTarget(Path, Policy, TotalSize))
+    while (TotalSize > *TotalSizeTarget && Next != ByTime.end())
+      RemoveEntry(std::get<2>(*Next++));
+
+  // Take the records another process appended to the moved journal after it
+  // was read, then replace the snapshot.
+  if (ErrorOr<std::unique_ptr<MemoryBuffer>> MBOrErr =
+          MemoryBuffer::getFile(PrunedJournalPath))
+    readIndexRecords((*MBOrErr)->getBuffer().drop_front(JournalRead),
+                     Entries);
+  SmallString<128> TempSnapshotPath(SnapshotPath);
+  TempSnapshotPath += ".tmp";
+  {
+    std::error_code EC;
+    raw_fd_ostream OS(TempSnapshotPath, EC, sys::fs::F_None);
+    if (EC)
+      return true;
+    for (auto &Entry : Entries)
+      OS << "A " << Entry.first() << ' ' << Entry.second.ContentName << ' '
+         << Entry.second.Size << ' ' << Entry.second.Time << '\n';
+  }
+  if (!sys::fs::rename(TempSnapshotPath, SnapshotPath))
+    sys::fs::remove(PrunedJournalPath);
+  return true;
+}
+
 /// Prune the cache of files that haven't been accessed in a long time.
 bool llvm::pruneCache(StringRef Path, CachePruningPolicy Policy) {
   using namespace std::chrono;
@@ -206,6 +429,12 @@ bool llvm::pruneCache(StringRef Path, CachePruningPolicy Policy) {
     writeTimestampFile(TimestampFile);
   }
 
+  SmallString<128> SnapshotPath(Path), JournalPath(Path);
+  sys::path::append(SnapshotPath, IndexSnapshotName);
+  sys::path::append(JournalPath, IndexJournalName);
+  if (sys::fs::exists(SnapshotPath) || sys::fs::exists(JournalPath))
+    return pruneCacheWithIndex(Path, Policy, CurrentTime);
+
   // Keep track of files to delete to get below the size limit.
   // Order by time of last use so that recently used files are preserved.
   std::set<FileInfo> FileInfos;
@@ -270,29 +499,10 @@ bool llvm::pruneCache(StringRef Path, CachePruningPolicy Policy) {
       RemoveCacheFile();
 
   // Prune for size now if needed
-  if (Policy.MaxSizePercentageOfAvailableSpace > 0 || Policy.MaxSizeBytes > 0) {
-    auto ErrOrSpaceInfo = sys::fs::disk_space(Path);
-    if (!ErrOrSpaceInfo) {
-      report_fatal_error("Can't get available size");
-    }
-    sys::fs::space_info SpaceInfo = ErrOrSpaceInfo.get();
-    auto AvailableSpace = TotalSize + SpaceInfo.free;
-
-    if (Policy.MaxSizePercentageOfAvailableSpace == 0)
-      Policy.MaxSizePercentageOfAvailableSpace = 100;
-    if (Policy.MaxSizeBytes == 0)
-      Policy.MaxSizeBytes = AvailableSpace;
-    auto TotalSizeTarget = std::min<uint64_t>(
-        AvailableSpace * Policy.MaxSizePercentageOfAvailableSpace / 100ull,
-        Policy.MaxSizeBytes);
-
-    LLVM_DEBUG(dbgs() << "Occupancy: " << ((100 * TotalSize) / AvailableSpace)
-                      << "% target is: "
-                      << Policy.MaxSizePercentageOfAvailableSpace << "%, "
-                      << Policy.MaxSizeBytes << " bytes\n");
-
+  if (Optional<uint64_t> TotalSizeTarget =
+          getTotalSizeTarget(Path, Policy, TotalSize)) {
     // Remove the oldest accessed files first, till we get below the threshold.
-    while (TotalSize > TotalSizeTarget && FileInfo != FileInfos.end())
+    while (TotalSize > *TotalSizeTarget && FileInfo != FileInfos.end())
       RemoveCacheFile();
   }
   return true;
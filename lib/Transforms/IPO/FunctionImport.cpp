@@ -42,6 +42,7 @@
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO/Internalize.h"
 #include "llvm/Transforms/Utils/Cloning.h"
@@ -262,6 +263,34 @@ namespace {
 using EdgeInfo = std::tuple<const FunctionSummary *, unsigned /* Threshold */,
                             GlobalValue::GUID>;
 
+/// The GUIDs the imports into a module add to the export lists of the modules
+/// they are imported from, in order. This lets the imports of several modules
+/// be computed concurrently, then their exports be added to the export lists
+/// in the order of the modules, leaving the lists as computing the imports of
+/// one module after the other would.
+class ModuleExports {
+  StringMap<unsigned> ExporterIndices;
+  std::vector<std::pair<StringRef, std::vector<GlobalValue::GUID>>> Exporters;
+
+public:
+  /// Return the GUIDs to add to the export list of module \p ModulePath.
+  std::vector<GlobalValue::GUID> &operator[](StringRef ModulePath) {
+    auto Inserted =
+        ExporterIndices.insert(std::make_pair(ModulePath, Exporters.size()));
+    if (Inserted.second)
+      Exporters.emplace_back(ModulePath, std::vector<GlobalValue::GUID>());
+    return Exporters[Inserted.first->second].second;
+  }
+
+  void addTo(StringMap<FunctionImporter::ExportSetTy> &ExportLists) const {
+    for (auto &Exporter : Exporters) {
+      auto &ExportList = ExportLists[Exporter.first];
+      for (GlobalValue::GUID GUID : Exporter.second)
+        ExportList.insert(GUID);
+    }
+  }
+};
+
 } // anonymous namespace
 
 static ValueInfo
@@ -281,8 +310,7 @@ updateValueInfoForIndirectCalls(const ModuleSummaryIndex &Index, ValueInfo VI) {
 
 static void computeImportForReferencedGlobals(
     const FunctionSummary &Summary, const GVSummaryMapTy &DefinedGVSummaries,
-    FunctionImporter::ImportMapTy &ImportList,
-    StringMap<FunctionImporter::ExportSetTy> *ExportLists) {
+    FunctionImporter::ImportMapTy &ImportList, ModuleExports *ExportLists) {
   for (auto &VI : Summary.refs()) {
     if (DefinedGVSummaries.count(VI.getGUID())) {
       LLVM_DEBUG(
@@ -312,7 +340,7 @@ static void computeImportForReferencedGlobals(
         if (ILI.second)
           NumImportedGlobalVarsThinLink++;
         if (ExportLists)
-          (*ExportLists)[RefSummary->modulePath()].insert(VI.getGUID());
+          (*ExportLists)[RefSummary->modulePath()].push_back(VI.getGUID());
         break;
       }
   }
@@ -348,8 +376,7 @@ static void computeImportForFunction(
     const FunctionSummary &Summary, const ModuleSummaryIndex &Index,
     const unsigned Threshold, const GVSummaryMapTy &DefinedGVSummaries,
     SmallVectorImpl<EdgeInfo> &Worklist,
-    FunctionImporter::ImportMapTy &ImportList,
-    StringMap<FunctionImporter::ExportSetTy> *ExportLists,
+    FunctionImporter::ImportMapTy &ImportList, ModuleExports *ExportLists,
     FunctionImporter::ImportThresholdsTy &ImportThresholds) {
   computeImportForReferencedGlobals(Summary, DefinedGVSummaries, ImportList,
                                     ExportLists);
@@ -481,7 +508,7 @@ static void computeImportForFunction(
       // Make exports in the source module.
       if (ExportLists) {
         auto &ExportList = (*ExportLists)[ExportModulePath];
-        ExportList.insert(VI.getGUID());
+        ExportList.push_back(VI.getGUID());
         if (!PreviouslyImported) {
           // This is the first time this function was exported from its source
           // module, so mark all functions and globals it references as exported
@@ -491,11 +518,11 @@ static void computeImportForFunction(
           // defined in the module later in a single pass.
           for (auto &Edge : ResolvedCalleeSummary->calls()) {
             auto CalleeGUID = Edge.first.getGUID();
-            ExportList.insert(CalleeGUID);
+            ExportList.push_back(CalleeGUID);
           }
           for (auto &Ref : ResolvedCalleeSummary->refs()) {
             auto GUID = Ref.getGUID();
-            ExportList.insert(GUID);
+            ExportList.push_back(GUID);
           }
         }
       }
@@ -512,7 +539,10 @@ static void computeImportForFunction(
 
     const auto AdjThreshold = GetAdjustedThreshold(Threshold, IsHotCallsite);
 
-    ImportCount++;
+    // The count is only kept for the cutoff, which makes the modules be
+    // processed one after the other.
+    if (ImportCutoff >= 0)
+      ImportCount++;
 
     // Insert the newly imported function to the worklist.
     Worklist.emplace_back(ResolvedCalleeSummary, AdjThreshold, VI.getGUID());
@@ -525,7 +555,7 @@ static void computeImportForFunction(
 static void ComputeImportForModule(
     const GVSummaryMapTy &DefinedGVSummaries, const ModuleSummaryIndex &Index,
     StringRef ModName, FunctionImporter::ImportMapTy &ImportList,
-    StringMap<FunctionImporter::ExportSetTy> *ExportLists = nullptr) {
+    ModuleExports *ExportLists = nullptr) {
   // Worklist contains the list of function imported in this module, for which
   // we will analyse the callees and may import further down the callgraph.
   SmallVector<EdgeInfo, 128> Worklist;
@@ -619,15 +649,46 @@ void llvm::ComputeCrossModuleImport(
     const ModuleSummaryIndex &Index,
     const StringMap<GVSummaryMapTy> &ModuleToDefinedGVSummaries,
     StringMap<FunctionImporter::ImportMapTy> &ImportLists,
-    StringMap<FunctionImporter::ExportSetTy> &ExportLists) {
+    StringMap<FunctionImporter::ExportSetTy> &ExportLists,
+    unsigned ThreadCount) {
   // For each module that has function defined, compute the import/export lists.
-  for (auto &DefinedGVSummaries : ModuleToDefinedGVSummaries) {
-    auto &ImportList = ImportLists[DefinedGVSummaries.first()];
+  // The modules only share the exports, which are added to the export lists
+  // in the order of the modules.
+  std::vector<std::pair<const StringMapEntry<GVSummaryMapTy> *,
+                        FunctionImporter::ImportMapTy *>>
+      Modules;
+  for (auto &DefinedGVSummaries : ModuleToDefinedGVSummaries)
+    Modules.emplace_back(&DefinedGVSummaries,
+                         &ImportLists[DefinedGVSummaries.first()]);
+  std::vector<ModuleExports> Exports(Modules.size());
+  auto ComputeImports = [&](size_t I) {
+    const auto &DefinedGVSummaries = *Modules[I].first;
     LLVM_DEBUG(dbgs() << "Computing import for Module '"
                       << DefinedGVSummaries.first() << "'\n");
     ComputeImportForModule(DefinedGVSummaries.second, Index,
-                           DefinedGVSummaries.first(), ImportList,
-                           &ExportLists);
+                           DefinedGVSummaries.first(), *Modules[I].second,
+                           &Exports[I]);
+  };
+
+  // The import cutoff counts the imports of all modules in order, and the
+  // debug output of the modules must not interleave.
+  bool Concurrent = ThreadCount > 1 && ImportCutoff < 0 && !PrintImportFailures;
+#ifndef NDEBUG
+  Concurrent &= !DebugFlag;
+#endif
+  if (Concurrent) {
+    ThreadPool Pool(ThreadCount);
+    for (size_t I = 0; I != Modules.size(); ++I)
+      Pool.async(ComputeImports, I);
+    Pool.wait();
+    for (ModuleExports &ModExports : Exports)
+      ModExports.addTo(ExportLists);
+  } else {
+    for (size_t I = 0; I != Modules.size(); ++I) {
+      ComputeImports(I);
+      Exports[I].addTo(ExportLists);
+      Exports[I] = ModuleExports();
+    }
   }
 
   // When computing imports we added all GUIDs referenced by anything
@@ -0,0 +1,198 @@
+//===- SampleContextTracker.cpp - Context-sensitive profile tracker -------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements the SampleContextTracker, which hands out the samples
+// of context-sensitive profiles to the sample profile loader and promotes
+// the contexts it does not inline.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/IPO/SampleContextTracker.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+
+using namespace llvm;
+using namespace sampleprof;
+
+ContextTrieNode *ContextTrieNode::getChild(const LineLocation &CallSite,
+                                           StringRef CalleeName) const {
+  auto I = Children.find({CallSite, CalleeName});
+  return I == Children.end() ? nullptr : I->second.get();
+}
+
+ContextTrieNode &ContextTrieNode::getOrCreateChild(const LineLocation &CallSite,
+                                                   StringRef CalleeName) {
+  auto &Child = Children[{CallSite, CalleeName}];
+  if (!Child)
+    Child = llvm::make_unique<ContextTrieNode>(CalleeName, CallSite);
+  return *Child;
+}
+
+uint64_t ContextTrieNode::getContextTotalSamples() const {
+  uint64_t Total = Samples.getTotalSamples();
+  for (const auto &I : Children)
+    Total += I.second->getContextTotalSamples();
+  return Total;
+}
+
+SampleContextTracker::SampleContextTracker(
+    StringMap<FunctionSamples> &Profiles) {
+  SmallVector<SampleContextFrame, 8> Frames;
+  for (auto &I : Profiles) {
+    FunctionSamples &FS = I.second;
+    TotalSamples += FS.getTotalSamples();
+    if (!SampleContext::parse(I.getKey(), Frames)) {
+      Frames.clear();
+      Frames.emplace_back(I.getKey(), LineLocation(0, 0));
+    }
+    ContextTrieNode *Node = &getBaseContext(Frames.front().FuncName);
+    for (size_t J = 1; J < Frames.size(); ++J)
+      Node = &Node->getOrCreateChild(Frames[J - 1].CallSite,
+                                     Names.save(Frames[J].FuncName));
+    Node->getSamples().merge(FS);
+    Node->getSamples().setName(Node->getFuncName());
+  }
+  Profiles.clear();
+}
+
+ContextTrieNode &SampleContextTracker::getBaseContext(StringRef FuncName) {
+  return RootContext.getOrCreateChild(LineLocation(0, 0), Names.save(FuncName));
+}
+
+void SampleContextTracker::promoteContextsOfUnavailableFunctions(
+    function_ref<bool(StringRef)> IsAvailable) {
+  SmallVector<StringRef, 16> Worklist;
+  for (const auto &I : RootContext.getChildren())
+    if (!IsAvailable(I.second->getFuncName()))
+      Worklist.push_back(I.second->getFuncName());
+
+  // A promoted context may itself be called by an unavailable function.
+  // Every round takes a level off the promoted contexts, so this ends.
+  while (!Worklist.empty()) {
+    ContextTrieNode &Base = getBaseContext(Worklist.pop_back_val());
+    ContextTrieNode::ChildMap Callees = std::move(Base.getChildren());
+    Base.getChildren().clear();
+    for (auto &I : Callees) {
+      ContextTrieNode &Callee = *I.second;
+      promoteContext(Callee);
+      if (!IsAvailable(Callee.getFuncName()))
+        Worklist.push_back(Callee.getFuncName());
+    }
+  }
+}
+
+const FunctionSamples *
+SampleContextTracker::startFunction(StringRef FuncName) {
+  CurrentContext = RootContext.getChild(LineLocation(0, 0), FuncName);
+  if (!CurrentContext)
+    return nullptr;
+  CurrentProfile = FunctionSamples();
+  buildProfile(*CurrentContext, CurrentProfile);
+  return &CurrentProfile;
+}
+
+/// Return the context of the call to \p CalleeName at \p CallSite in
+/// \p Caller. Like FunctionSamples::findFunctionSamplesAt, fall back to the
+/// context with the most samples at \p CallSite if there is no such callee.
+static ContextTrieNode *findCalleeContext(const ContextTrieNode &Caller,
+                                          const LineLocation &CallSite,
+                                          StringRef CalleeName) {
+  if (ContextTrieNode *Callee = Caller.getChild(CallSite, CalleeName))
+    return Callee;
+  const auto &Children = Caller.getChildren();
+  uint64_t MaxTotalSamples = 0;
+  ContextTrieNode *R = nullptr;
+  for (auto I = Children.lower_bound({CallSite, StringRef()});
+       I != Children.end() && I->first.first == CallSite; ++I)
+    if (I->second->getContextTotalSamples() >= MaxTotalSamples) {
+      MaxTotalSamples = I->second->getContextTotalSamples();
+      R = I->second.get();
+    }
+  return R;
+}
+
+/// Return the context of the function \p DIL is in, following the inline
+/// stack of \p DIL from the function being annotated, the same way
+/// FunctionSamples::findFunctionSamples does.
+ContextTrieNode *SampleContextTracker::getContextFor(const DILocation *DIL) {
+  SmallVector<std::pair<LineLocation, StringRef>, 10> S;
+  FunctionSamples::getInlineStack(DIL, S);
+  ContextTrieNode *Node = CurrentContext;
+  for (int I = S.size() - 1; I >= 0 && Node; --I)
+    Node = findCalleeContext(*Node, S[I].first, S[I].second);
+  return Node;
+}
+
+void SampleContextTracker::markContextInlined(const DILocation *DIL,
+                                              StringRef CalleeName) {
+  if (!CurrentContext || !DIL)
+    return;
+  ContextTrieNode *Caller = getContextFor(DIL);
+  if (!Caller)
+    return;
+  LineLocation CallSite(FunctionSamples::getOffset(DIL),
+                        DIL->getBaseDiscriminator());
+  if (ContextTrieNode *Callee = Caller->getChild(CallSite, CalleeName))
+    Callee->setInlined();
+}
+
+void SampleContextTracker::finishFunction() {
+  if (!CurrentContext)
+    return;
+  // Take the context out of the trie first: a recursive call that was not
+  // inlined is promoted to the base context of the function itself.
+  auto &Children = RootContext.getChildren();
+  auto I = Children.find({LineLocation(0, 0), CurrentContext->getFuncName()});
+  std::unique_ptr<ContextTrieNode> Node = std::move(I->second);
+  Children.erase(I);
+  CurrentContext = nullptr;
+  promoteNotInlinedContexts(*Node);
+}
+
+void SampleContextTracker::promoteNotInlinedContexts(ContextTrieNode &Node) {
+  for (auto &I : Node.getChildren()) {
+    ContextTrieNode &Callee = *I.second;
+    if (Callee.isInlined())
+      promoteNotInlinedContexts(Callee);
+    else
+      promoteContext(Callee);
+  }
+}
+
+void SampleContextTracker::promoteContext(ContextTrieNode &Node) {
+  mergeContext(getBaseContext(Node.getFuncName()), Node);
+}
+
+void SampleContextTracker::mergeContext(ContextTrieNode &To,
+                                        ContextTrieNode &From) {
+  To.getSamples().merge(From.getSamples());
+  To.getSamples().setName(To.getFuncName());
+  for (auto &I : From.getChildren()) {
+    ContextTrieNode &Callee = *I.second;
+    mergeContext(To.getOrCreateChild(Callee.getCallSite(),
+                                     Callee.getFuncName()),
+                 Callee);
+  }
+}
+
+/// Build in \p Profile the profile of the function of \p Node, with the
+/// contexts below \p Node as inlined callsites. As in the profile of a
+/// function with inlined callsites, their samples count in the total
+/// samples of the function.
+void SampleContextTracker::buildProfile(const ContextTrieNode &Node,
+                                        FunctionSamples &Profile) {
+  Profile.merge(Node.getSamples());
+  Profile.setName(Node.getFuncName());
+  for (const auto &I : Node.getChildren()) {
+    const ContextTrieNode &Callee = *I.second;
+    FunctionSamples &CalleeProfile = Profile.functionSamplesAt(
+        Callee.getCallSite())[Callee.getFuncName().str()];
+    buildProfile(Callee, CalleeProfile);
+    Profile.addTotalSamples(CalleeProfile.getTotalSamples());
+  }
+}
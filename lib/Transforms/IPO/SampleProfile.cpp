@@ -23,16 +23,22 @@
 
 #include "llvm/Transforms/IPO/SampleProfile.h"
 #include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/BitVector.h"
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/DenseSet.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/None.h"
+#include "llvm/ADT/SCCIterator.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ADT/Twine.h"
 #include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/InlineCost.h"
 #include "llvm/Analysis/LoopInfo.h"
 #include "llvm/Analysis/OptimizationRemarkEmitter.h"
@@ -67,11 +73,14 @@
 #include "llvm/Support/ErrorHandling.h"
 #include "llvm/Support/ErrorOr.h"
 #include "llvm/Support/GenericDomTree.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/IPO/SampleContextTracker.h"
 #include "llvm/Transforms/Instrumentation.h"
 #include "llvm/Transforms/Utils/CallPromotionUtils.h"
 #include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/SampleProfileInference.h"
 #include <algorithm>
 #include <cassert>
 #include <cstdint>
@@ -89,6 +98,12 @@ using namespace sampleprof;
 using ProfileCount = Function::ProfileCount;
 #define DEBUG_TYPE "sample-profile"
 
+STATISTIC(NumPropagationBlockVisits,
+          "Number of blocks visited by the edge weight propagation");
+STATISTIC(MaxPropagationBlockVisits,
+          "Largest number of blocks visited by the edge weight propagation "
+          "of a single function");
+
 // Command line option to specify the file to read samples from. This is
 // mainly used for debugging.
 static cl::opt<std::string> SampleProfileFile(
@@ -107,6 +122,27 @@ static cl::opt<unsigned> SampleProfileMaxPropagateIterations(
     cl::desc("Maximum number of iterations to go through when propagating "
              "sample block/edge weights through the CFG."));
 
+static cl::opt<bool> SampleProfileUseFlowInference(
+    "sample-profile-use-flow-inference", cl::init(false), cl::Hidden,
+    cl::desc("Infer the block and edge weights of the annotated functions "
+             "with a minimum cost flow over their CFG, instead of propagating "
+             "the sampled block weights through equivalence classes and "
+             "edges."));
+
+static cl::opt<bool> SampleProfileFlattenAll(
+    "sample-profile-flatten-all", cl::init(true), cl::Hidden,
+    cl::desc("Convert the whole sample profile to its compact read-only "
+             "representation once it has been read, releasing the original "
+             "profiles. Otherwise the original profiles are kept and only "
+             "those of the annotated functions are converted."));
+
+static cl::opt<unsigned> SampleProfileAnnotationThreads(
+    "sample-profile-annotation-threads", cl::init(0), cl::value_desc("N"),
+    cl::desc("If non-zero, compute the dominator trees, equivalence classes "
+             "and edge weights of the annotated functions with N threads, "
+             "after all the functions have been inlined and assigned block "
+             "weights. The result does not depend on N."));
+
 static cl::opt<unsigned> SampleProfileRecordCoverage(
     "sample-profile-check-record-coverage", cl::init(0), cl::value_desc("N"),
     cl::desc("Emit a warning if less than N% of records in the input profile "
@@ -128,6 +164,12 @@ static cl::opt<bool> ProfileSampleAccurate(
              "callsite and function as having 0 samples. Otherwise, treat "
              "un-sampled callsites and functions conservatively as unknown. "));
 
+static cl::opt<bool> ProfileAccurateForSymsInList(
+    "profile-accurate-for-symsinlist", cl::Hidden, cl::ZeroOrMore,
+    cl::init(true),
+    cl::desc("For symbols in the profile symbol list, regard their profiles to "
+             "be accurate. It may be overridden by profile-sample-accurate. "));
+
 namespace {
 
 using BlockWeightMap = DenseMap<const BasicBlock *, uint64_t>;
@@ -141,15 +183,15 @@ class SampleCoverageTracker {
 public:
   SampleCoverageTracker() = default;
 
-  bool markSamplesUsed(const FunctionSamples *FS, uint32_t LineOffset,
+  bool markSamplesUsed(const FlatFunctionSamples *FS, uint32_t LineOffset,
                        uint32_t Discriminator, uint64_t Samples);
   unsigned computeCoverage(unsigned Used, unsigned Total) const;
-  unsigned countUsedRecords(const FunctionSamples *FS,
+  unsigned countUsedRecords(const FlatFunctionSamples *FS,
                             ProfileSummaryInfo *PSI) const;
-  unsigned countBodyRecords(const FunctionSamples *FS,
+  unsigned countBodyRecords(const FlatFunctionSamples *FS,
                             ProfileSummaryInfo *PSI) const;
   uint64_t getTotalUsedSamples() const { return TotalUsedSamples; }
-  uint64_t countBodySamples(const FunctionSamples *FS,
+  uint64_t countBodySamples(const FlatFunctionSamples *FS,
                             ProfileSummaryInfo *PSI) const;
 
   void clear() {
@@ -160,7 +202,7 @@ public:
 private:
   using BodySampleCoverageMap = std::map<LineLocation, unsigned>;
   using FunctionSamplesCoverageMap =
-      DenseMap<const FunctionSamples *, BodySampleCoverageMap>;
+      DenseMap<const FlatFunctionSamples *, BodySampleCoverageMap>;
 
   /// Coverage map for sampling records.
   ///
@@ -187,56 +229,46 @@ private:
   uint64_t TotalUsedSamples = 0;
 };
 
-/// Sample profile pass.
+/// Per-function state of the sample profile annotation.
 ///
-/// This pass reads profile data from the file specified by
-/// -sample-profile-file and annotates every affected function with the
-/// profile information found in that file.
-class SampleProfileLoader {
+/// This holds the block and edge weights of the function being annotated,
+/// and the analyses that derive the edge weights from the block weights.
+/// Those only read the IR of the function and its samples, so, once the
+/// block weights are known, several functions can be processed at the same
+/// time by moving their state out of the loader.
+class SampleProfileWeightPropagator {
 public:
-  SampleProfileLoader(
-      StringRef Name, StringRef RemapName, bool IsThinLTOPreLink,
-      std::function<AssumptionCache &(Function &)> GetAssumptionCache,
-      std::function<TargetTransformInfo &(Function &)> GetTargetTransformInfo)
-      : GetAC(std::move(GetAssumptionCache)),
-        GetTTI(std::move(GetTargetTransformInfo)), Filename(Name),
-        RemappingFilename(RemapName), IsThinLTOPreLink(IsThinLTOPreLink) {}
-
-  bool doInitialization(Module &M);
-  bool runOnModule(Module &M, ModuleAnalysisManager *AM,
-                   ProfileSummaryInfo *_PSI);
-
-  void dump() { Reader->dump(); }
+  /// Compute dominance and loop info, find the equivalence classes and
+  /// propagate the block weights to all the edges of \p F, or infer the
+  /// block and edge weights if -sample-profile-use-flow-inference is set.
+  void computeEdgeWeights(Function &F) {
+    if (SampleProfileUseFlowInference) {
+      inferWeights(F);
+      return;
+    }
+    computeDominanceAndLoopInfo(F);
+    findEquivalenceClasses(F);
+    propagateWeights(F);
+  }
 
 protected:
-  bool runOnFunction(Function &F, ModuleAnalysisManager *AM);
-  unsigned getFunctionLoc(Function &F);
-  bool emitAnnotations(Function &F);
-  ErrorOr<uint64_t> getInstWeight(const Instruction &I);
-  ErrorOr<uint64_t> getBlockWeight(const BasicBlock *BB);
-  const FunctionSamples *findCalleeFunctionSamples(const Instruction &I) const;
-  std::vector<const FunctionSamples *>
-  findIndirectCallFunctionSamples(const Instruction &I, uint64_t &Sum) const;
-  mutable DenseMap<const DILocation *, const FunctionSamples *> DILocation2SampleMap;
-  const FunctionSamples *findFunctionSamples(const Instruction &I) const;
-  bool inlineCallInstruction(Instruction *I);
-  bool inlineHotFunctions(Function &F,
-                          DenseSet<GlobalValue::GUID> &InlinedGUIDs);
   void printEdgeWeight(raw_ostream &OS, Edge E);
   void printBlockWeight(raw_ostream &OS, const BasicBlock *BB) const;
   void printBlockEquivalence(raw_ostream &OS, const BasicBlock *BB);
-  bool computeBlockWeights(Function &F);
   void findEquivalenceClasses(Function &F);
   template <bool IsPostDom>
   void findEquivalencesFor(BasicBlock *BB1, ArrayRef<BasicBlock *> Descendants,
                            DominatorTreeBase<BasicBlock, IsPostDom> *DomTree);
 
   void propagateWeights(Function &F);
+  void inferWeights(Function &F);
   uint64_t visitEdge(Edge E, unsigned *NumUnknownEdges, Edge *UnknownEdge);
   void buildEdges(Function &F);
-  bool propagateThroughEdges(Function &F, bool UpdateBlockCount);
+  bool propagateThroughBlock(const BasicBlock *BB, bool UpdateBlockCount);
+  bool propagateThroughEdges(bool UpdateBlockCount);
+  void requeueBlock(const BasicBlock *BB, unsigned Current);
+  void requeueAllBlocks();
   void computeDominanceAndLoopInfo(Function &F);
-  void clearFunctionData();
 
   /// Map basic blocks to their computed weights.
   ///
@@ -264,33 +296,126 @@ protected:
   /// the same number of times.
   EquivalenceClassMap EquivalenceClass;
 
-  /// Map from function name to Function *. Used to find the function from
-  /// the function name. If the function name contains suffix, additional
-  /// entry is added to map from the stripped name to the function if there
-  /// is one-to-one mapping.
-  StringMap<Function *> SymbolMap;
-
   /// Dominance, post-dominance and loop information.
   std::unique_ptr<DominatorTree> DT;
   std::unique_ptr<PostDominatorTree> PDT;
   std::unique_ptr<LoopInfo> LI;
 
-  std::function<AssumptionCache &(Function &)> GetAC;
-  std::function<TargetTransformInfo &(Function &)> GetTTI;
-
   /// Predecessors for each basic block in the CFG.
   BlockEdgeMap Predecessors;
 
   /// Successors for each basic block in the CFG.
   BlockEdgeMap Successors;
 
+  /// Blocks of the function in layout order, and the position of each one.
+  std::vector<const BasicBlock *> Blocks;
+  DenseMap<const BasicBlock *, unsigned> BlockIndex;
+
+  /// Blocks in each equivalence class, keyed by the class representative.
+  DenseMap<const BasicBlock *, SmallVector<const BasicBlock *, 4>>
+      ClassMembers;
+
+  /// Blocks to visit in the current and in the next propagation pass,
+  /// indexed by their position in Blocks.
+  BitVector Worklist;
+  BitVector NextWorklist;
+
+  /// Number of blocks visited by the propagation of this function.
+  unsigned NumBlockVisits = 0;
+
+  /// Samples collected for the body of this function.
+  const FlatFunctionSamples *Samples = nullptr;
+};
+
+/// Sample profile pass.
+///
+/// This pass reads profile data from the file specified by
+/// -sample-profile-file and annotates every affected function with the
+/// profile information found in that file.
+class SampleProfileLoader : public SampleProfileWeightPropagator {
+public:
+  SampleProfileLoader(
+      StringRef Name, StringRef RemapName, bool IsThinLTOPreLink,
+      std::function<AssumptionCache &(Function &)> GetAssumptionCache,
+      std::function<TargetTransformInfo &(Function &)> GetTargetTransformInfo)
+      : GetAC(std::move(GetAssumptionCache)),
+        GetTTI(std::move(GetTargetTransformInfo)), Filename(Name),
+        RemappingFilename(RemapName), IsThinLTOPreLink(IsThinLTOPreLink) {}
+
+  bool doInitialization(Module &M);
+  bool runOnModule(Module &M, ModuleAnalysisManager *AM,
+                   ProfileSummaryInfo *_PSI);
+
+  void dump() { Reader->dump(); }
+
+protected:
+  std::vector<Function *> buildFunctionOrder(Module &M);
+  const FlatFunctionSamples *getFlatSamplesFor(const Function &F);
+  bool runOnFunction(Function &F, ModuleAnalysisManager *AM);
+  bool runOnFunctionsInParallel(Module &M, ModuleAnalysisManager *AM);
+  void setUpRemarkEmitter(Function &F, ModuleAnalysisManager *AM,
+                          std::unique_ptr<OptimizationRemarkEmitter> &OwnedORE);
+  unsigned getFunctionLoc(Function &F);
+  bool emitAnnotations(Function &F);
+  ErrorOr<uint64_t> getInstWeight(const Instruction &I);
+  ErrorOr<uint64_t> getBlockWeight(const BasicBlock *BB);
+  const FlatFunctionSamples *
+  findCalleeFunctionSamples(const Instruction &I) const;
+  std::vector<const FlatFunctionSamples *>
+  findIndirectCallFunctionSamples(const Instruction &I, uint64_t &Sum) const;
+  mutable DenseMap<const DILocation *, const FlatFunctionSamples *>
+      DILocation2SampleMap;
+  const FlatFunctionSamples *findFunctionSamples(const Instruction &I) const;
+  bool inlineCallInstruction(Instruction *I);
+  void finishPendingFunction(Function &F);
+  bool inlineHotFunctions(Function &F,
+                          DenseSet<GlobalValue::GUID> &InlinedGUIDs);
+  bool computeBlockWeights(Function &F);
+  void emitBranchWeights(Function &F);
+  void clearFunctionData();
+
+  /// Map from function name to Function *. Used to find the function from
+  /// the function name. If the function name contains suffix, additional
+  /// entry is added to map from the stripped name to the function if there
+  /// is one-to-one mapping.
+  StringMap<Function *> SymbolMap;
+
+  std::function<AssumptionCache &(Function &)> GetAC;
+  std::function<TargetTransformInfo &(Function &)> GetTTI;
+
   SampleCoverageTracker CoverageTracker;
 
   /// Profile reader object.
   std::unique_ptr<SampleProfileReader> Reader;
 
-  /// Samples collected for the body of this function.
-  FunctionSamples *Samples = nullptr;
+  /// Tracker of the contexts of a context-sensitive profile, which replaces
+  /// the profiles of the reader.
+  std::unique_ptr<SampleContextTracker> ContextTracker;
+
+  /// The profiles of the annotated functions, when they are converted one
+  /// function at a time: those the context tracker gives out, or those of
+  /// the reader if the profile is not flattened as a whole.
+  FlatSampleProfileMap FlatProfiles;
+
+  /// The symbols of the profiled binary, and the names of the functions that
+  /// have samples in the profile, whether as outline functions, as inlined
+  /// callees or as call targets. A function in the symbol list but without
+  /// samples was cold when the profile was collected, rather than new. The
+  /// names are owned by the reader.
+  std::unique_ptr<ProfileSymbolList> PSL;
+  DenseSet<StringRef> NamesInProfile;
+
+  /// Functions whose edge weights are still to be computed, with the state
+  /// of their annotation. When this is set, emitAnnotations stops after the
+  /// block weights have been computed and queues the function here instead
+  /// of propagating the weights itself. The state of a function is reset
+  /// once it has been finished by finishPendingFunction.
+  using PendingFunctionMap =
+      MapVector<Function *, std::unique_ptr<SampleProfileWeightPropagator>>;
+  PendingFunctionMap *PendingFunctions = nullptr;
+
+  /// The analysis manager the pending functions are annotated with.
+  ModuleAnalysisManager *PendingAM = nullptr;
 
   /// Name of the profile file to load.
   std::string Filename;
@@ -381,7 +506,7 @@ private:
 /// To decide whether an inlined callsite is hot, we compare the callsite
 /// sample count with the hot cutoff computed by ProfileSummaryInfo, it is
 /// regarded as hot if the count is above the cutoff value.
-static bool callsiteIsHot(const FunctionSamples *CallsiteFS,
+static bool callsiteIsHot(const FlatFunctionSamples *CallsiteFS,
                           ProfileSummaryInfo *PSI) {
   if (!CallsiteFS)
     return false; // The callsite was not inlined in the original binary.
@@ -395,7 +520,7 @@ static bool callsiteIsHot(const FunctionSamples *CallsiteFS,
 /// (LineOffset, Discriminator).
 ///
 /// \returns true if this is the first time we mark the given record.
-bool SampleCoverageTracker::markSamplesUsed(const FunctionSamples *FS,
+bool SampleCoverageTracker::markSamplesUsed(const FlatFunctionSamples *FS,
                                             uint32_t LineOffset,
                                             uint32_t Discriminator,
                                             uint64_t Samples) {
@@ -411,7 +536,7 @@ bool SampleCoverageTracker::markSamplesUsed(const FunctionSamples *FS,
 ///
 /// This count does not include records from cold inlined callsites.
 unsigned
-SampleCoverageTracker::countUsedRecords(const FunctionSamples *FS,
+SampleCoverageTracker::countUsedRecords(const FlatFunctionSamples *FS,
                                         ProfileSummaryInfo *PSI) const {
   auto I = SampleCoverage.find(FS);
 
@@ -422,12 +547,11 @@ SampleCoverageTracker::countUsedRecords(const FunctionSamples *FS,
   // If there are inlined callsites in this function, count the samples found
   // in the respective bodies. However, do not bother counting callees with 0
   // total samples, these are callees that were never invoked at runtime.
-  for (const auto &I : FS->getCallsiteSamples())
-    for (const auto &J : I.second) {
-      const FunctionSamples *CalleeSamples = &J.second;
-      if (callsiteIsHot(CalleeSamples, PSI))
-        Count += countUsedRecords(CalleeSamples, PSI);
-    }
+  for (const auto &CS : FS->getCallsiteSamples()) {
+    const FlatFunctionSamples *CalleeSamples = CS.Callee;
+    if (callsiteIsHot(CalleeSamples, PSI))
+      Count += countUsedRecords(CalleeSamples, PSI);
+  }
 
   return Count;
 }
@@ -436,17 +560,16 @@ SampleCoverageTracker::countUsedRecords(const FunctionSamples *FS,
 ///
 /// This count does not include records from cold inlined callsites.
 unsigned
-SampleCoverageTracker::countBodyRecords(const FunctionSamples *FS,
+SampleCoverageTracker::countBodyRecords(const FlatFunctionSamples *FS,
                                         ProfileSummaryInfo *PSI) const {
   unsigned Count = FS->getBodySamples().size();
 
   // Only count records in hot callsites.
-  for (const auto &I : FS->getCallsiteSamples())
-    for (const auto &J : I.second) {
-      const FunctionSamples *CalleeSamples = &J.second;
-      if (callsiteIsHot(CalleeSamples, PSI))
-        Count += countBodyRecords(CalleeSamples, PSI);
-    }
+  for (const auto &CS : FS->getCallsiteSamples()) {
+    const FlatFunctionSamples *CalleeSamples = CS.Callee;
+    if (callsiteIsHot(CalleeSamples, PSI))
+      Count += countBodyRecords(CalleeSamples, PSI);
+  }
 
   return Count;
 }
@@ -455,19 +578,18 @@ SampleCoverageTracker::countBodyRecords(const FunctionSamples *FS,
 ///
 /// This count does not include samples from cold inlined callsites.
 uint64_t
-SampleCoverageTracker::countBodySamples(const FunctionSamples *FS,
+SampleCoverageTracker::countBodySamples(const FlatFunctionSamples *FS,
                                         ProfileSummaryInfo *PSI) const {
   uint64_t Total = 0;
   for (const auto &I : FS->getBodySamples())
-    Total += I.second.getSamples();
+    Total += I.NumSamples;
 
   // Only count samples in hot callsites.
-  for (const auto &I : FS->getCallsiteSamples())
-    for (const auto &J : I.second) {
-      const FunctionSamples *CalleeSamples = &J.second;
-      if (callsiteIsHot(CalleeSamples, PSI))
-        Total += countBodySamples(CalleeSamples, PSI);
-    }
+  for (const auto &CS : FS->getCallsiteSamples()) {
+    const FlatFunctionSamples *CalleeSamples = CS.Callee;
+    if (callsiteIsHot(CalleeSamples, PSI))
+      Total += countBodySamples(CalleeSamples, PSI);
+  }
 
   return Total;
 }
@@ -496,6 +618,11 @@ void SampleProfileLoader::clearFunctionData() {
   LI = nullptr;
   Predecessors.clear();
   Successors.clear();
+  Blocks.clear();
+  BlockIndex.clear();
+  ClassMembers.clear();
+  Worklist.clear();
+  NextWorklist.clear();
   CoverageTracker.clear();
 }
 
@@ -504,7 +631,7 @@ void SampleProfileLoader::clearFunctionData() {
 ///
 /// \param OS  Stream to emit the output to.
 /// \param E  Edge to print.
-void SampleProfileLoader::printEdgeWeight(raw_ostream &OS, Edge E) {
+void SampleProfileWeightPropagator::printEdgeWeight(raw_ostream &OS, Edge E) {
   OS << "weight[" << E.first->getName() << "->" << E.second->getName()
      << "]: " << EdgeWeights[E] << "\n";
 }
@@ -513,8 +640,8 @@ void SampleProfileLoader::printEdgeWeight(raw_ostream &OS, Edge E) {
 ///
 /// \param OS  Stream to emit the output to.
 /// \param BB  Block to print.
-void SampleProfileLoader::printBlockEquivalence(raw_ostream &OS,
-                                                const BasicBlock *BB) {
+void SampleProfileWeightPropagator::printBlockEquivalence(
+    raw_ostream &OS, const BasicBlock *BB) {
   const BasicBlock *Equiv = EquivalenceClass[BB];
   OS << "equivalence[" << BB->getName()
      << "]: " << ((Equiv) ? EquivalenceClass[BB]->getName() : "NONE") << "\n";
@@ -524,8 +651,8 @@ void SampleProfileLoader::printBlockEquivalence(raw_ostream &OS,
 ///
 /// \param OS  Stream to emit the output to.
 /// \param BB  Block to print.
-void SampleProfileLoader::printBlockWeight(raw_ostream &OS,
-                                           const BasicBlock *BB) const {
+void SampleProfileWeightPropagator::printBlockWeight(
+    raw_ostream &OS, const BasicBlock *BB) const {
   const auto &I = BlockWeights.find(BB);
   uint64_t W = (I == BlockWeights.end() ? 0 : I->second);
   OS << "weight[" << BB->getName() << "]: " << W << "\n";
@@ -548,7 +675,7 @@ ErrorOr<uint64_t> SampleProfileLoader::getInstWeight(const Instruction &Inst) {
   if (!DLoc)
     return std::error_code();
 
-  const FunctionSamples *FS = findFunctionSamples(Inst);
+  const FlatFunctionSamples *FS = findFunctionSamples(Inst);
   if (!FS)
     return std::error_code();
 
@@ -652,7 +779,7 @@ bool SampleProfileLoader::computeBlockWeights(Function &F) {
 /// \param Inst Call/Invoke instruction to query.
 ///
 /// \returns The FunctionSamples pointer to the inlined instance.
-const FunctionSamples *
+const FlatFunctionSamples *
 SampleProfileLoader::findCalleeFunctionSamples(const Instruction &Inst) const {
   const DILocation *DIL = Inst.getDebugLoc();
   if (!DIL) {
@@ -664,7 +791,7 @@ SampleProfileLoader::findCalleeFunctionSamples(const Instruction &Inst) const {
     if (Function *Callee = CI->getCalledFunction())
       CalleeName = Callee->getName();
 
-  const FunctionSamples *FS = findFunctionSamples(Inst);
+  const FlatFunctionSamples *FS = findFunctionSamples(Inst);
   if (FS == nullptr)
     return nullptr;
 
@@ -676,43 +803,43 @@ SampleProfileLoader::findCalleeFunctionSamples(const Instruction &Inst) const {
 /// Returns a vector of FunctionSamples that are the indirect call targets
 /// of \p Inst. The vector is sorted by the total number of samples. Stores
 /// the total call count of the indirect call in \p Sum.
-std::vector<const FunctionSamples *>
+std::vector<const FlatFunctionSamples *>
 SampleProfileLoader::findIndirectCallFunctionSamples(
     const Instruction &Inst, uint64_t &Sum) const {
   const DILocation *DIL = Inst.getDebugLoc();
-  std::vector<const FunctionSamples *> R;
+  std::vector<const FlatFunctionSamples *> R;
 
   if (!DIL) {
     return R;
   }
 
-  const FunctionSamples *FS = findFunctionSamples(Inst);
+  const FlatFunctionSamples *FS = findFunctionSamples(Inst);
   if (FS == nullptr)
     return R;
 
   uint32_t LineOffset = FunctionSamples::getOffset(DIL);
   uint32_t Discriminator = DIL->getBaseDiscriminator();
 
-  auto T = FS->findCallTargetMapAt(LineOffset, Discriminator);
+  auto T = FS->findCallTargetsAt(LineOffset, Discriminator);
   Sum = 0;
   if (T)
     for (const auto &T_C : T.get())
-      Sum += T_C.second;
-  if (const FunctionSamplesMap *M = FS->findFunctionSamplesMapAt(LineLocation(
-          FunctionSamples::getOffset(DIL), DIL->getBaseDiscriminator()))) {
-    if (M->empty())
-      return R;
-    for (const auto &NameFS : *M) {
-      Sum += NameFS.second.getEntrySamples();
-      R.push_back(&NameFS.second);
-    }
-    llvm::sort(R, [](const FunctionSamples *L, const FunctionSamples *R) {
-      if (L->getEntrySamples() != R->getEntrySamples())
-        return L->getEntrySamples() > R->getEntrySamples();
-      return FunctionSamples::getGUID(L->getName()) <
-             FunctionSamples::getGUID(R->getName());
-    });
+      Sum += T_C.Samples;
+  ArrayRef<FlatCallsiteSample> Callees =
+      FS->findCallsiteSamplesAt(LineLocation(LineOffset, Discriminator));
+  if (Callees.empty())
+    return R;
+  for (const auto &CS : Callees) {
+    Sum += CS.Callee->getEntrySamples();
+    R.push_back(CS.Callee);
   }
+  llvm::sort(R, [](const FlatFunctionSamples *L,
+                   const FlatFunctionSamples *R) {
+    if (L->getEntrySamples() != R->getEntrySamples())
+      return L->getEntrySamples() > R->getEntrySamples();
+    return FunctionSamples::getGUID(L->getName()) <
+           FunctionSamples::getGUID(R->getName());
+  });
   return R;
 }
 
@@ -725,7 +852,7 @@ SampleProfileLoader::findIndirectCallFunctionSamples(
 /// \param Inst Instruction to query.
 ///
 /// \returns the FunctionSamples pointer to the inlined instance.
-const FunctionSamples *
+const FlatFunctionSamples *
 SampleProfileLoader::findFunctionSamples(const Instruction &Inst) const {
   const DILocation *DIL = Inst.getDebugLoc();
   if (!DIL)
@@ -742,6 +869,9 @@ bool SampleProfileLoader::inlineCallInstruction(Instruction *I) {
   CallSite CS(I);
   Function *CalledFunction = CS.getCalledFunction();
   assert(CalledFunction);
+  // A callee that has been annotated before its caller is inlined with its
+  // branch weights, which the caller then keeps.
+  finishPendingFunction(*CalledFunction);
   DebugLoc DLoc = I->getDebugLoc();
   BasicBlock *BB = I->getParent();
   InlineParams Params = getInlineParams();
@@ -770,6 +900,36 @@ bool SampleProfileLoader::inlineCallInstruction(Instruction *I) {
   return false;
 }
 
+/// Compute and emit the branch weights of \p F now if they are pending.
+///
+/// When the functions are annotated one at a time, a function annotated
+/// before its callers is inlined into them with its branch weights, and
+/// emitBranchWeights leaves these in place. Pending functions are finished
+/// before they are inlined so that they are inlined the same way.
+void SampleProfileLoader::finishPendingFunction(Function &F) {
+  if (!PendingFunctions)
+    return;
+  auto It = PendingFunctions->find(&F);
+  if (It == PendingFunctions->end() || !It->second)
+    return;
+  std::unique_ptr<SampleProfileWeightPropagator> State = std::move(It->second);
+  State->computeEdgeWeights(F);
+
+  // Emit the weights with the state of F, then restore the state of the
+  // function being annotated.
+  auto &Current = static_cast<SampleProfileWeightPropagator &>(*this);
+  std::swap(Current, *State);
+  auto CurrentSampleMap = std::move(DILocation2SampleMap);
+  DILocation2SampleMap.clear();
+  OptimizationRemarkEmitter *CurrentORE = ORE;
+  std::unique_ptr<OptimizationRemarkEmitter> OwnedORE;
+  setUpRemarkEmitter(F, PendingAM, OwnedORE);
+  emitBranchWeights(F);
+  ORE = CurrentORE;
+  DILocation2SampleMap = std::move(CurrentSampleMap);
+  std::swap(Current, *State);
+}
+
 /// Iteratively inline hot callsites of a function.
 ///
 /// Iteratively traverse all callsites of the function \p F, and find if
@@ -787,7 +947,7 @@ bool SampleProfileLoader::inlineHotFunctions(
     Function &F, DenseSet<GlobalValue::GUID> &InlinedGUIDs) {
   DenseSet<Instruction *> PromotedInsns;
 
-  DenseMap<Instruction *, const FunctionSamples *> localNotInlinedCallSites;
+  DenseMap<Instruction *, const FlatFunctionSamples *> localNotInlinedCallSites;
   bool Changed = false;
   while (true) {
     bool LocalChanged = false;
@@ -796,7 +956,7 @@ bool SampleProfileLoader::inlineHotFunctions(
       bool Hot = false;
       SmallVector<Instruction *, 10> Candidates;
       for (auto &I : BB.getInstList()) {
-        const FunctionSamples *FS = nullptr;
+        const FlatFunctionSamples *FS = nullptr;
         if ((isa<CallInst>(I) || isa<InvokeInst>(I)) &&
             !isa<IntrinsicInst>(I) && (FS = findCalleeFunctionSamples(I))) {
           Candidates.push_back(&I);
@@ -846,8 +1006,11 @@ bool SampleProfileLoader::inlineHotFunctions(
             Sum -= C;
             PromotedInsns.insert(I);
             // If profile mismatches, we should not attempt to inline DI.
+            const DILocation *DIL = DI->getDebugLoc();
             if ((isa<CallInst>(DI) || isa<InvokeInst>(DI)) &&
                 inlineCallInstruction(DI)) {
+              if (ContextTracker)
+                ContextTracker->markContextInlined(DIL, FS->getName());
               localNotInlinedCallSites.erase(I);
               LocalChanged = true;
             }
@@ -859,7 +1022,11 @@ bool SampleProfileLoader::inlineHotFunctions(
         }
       } else if (CalledFunction && CalledFunction->getSubprogram() &&
                  !CalledFunction->isDeclaration()) {
+        const DILocation *DIL = I->getDebugLoc();
+        const FlatFunctionSamples *FS = findCalleeFunctionSamples(*I);
         if (inlineCallInstruction(I)) {
+          if (ContextTracker)
+            ContextTracker->markContextInlined(DIL, FS->getName());
           localNotInlinedCallSites.erase(I);
           LocalChanged = true;
         }
@@ -875,13 +1042,18 @@ bool SampleProfileLoader::inlineHotFunctions(
     }
   }
 
+  // The contexts that were not inlined are merged into the profiles of their
+  // callees by the context tracker instead.
+  if (ContextTracker)
+    return Changed;
+
   // Accumulate not inlined callsite information into notInlinedSamples
   for (const auto &Pair : localNotInlinedCallSites) {
     Instruction *I = Pair.getFirst();
     Function *Callee = CallSite(I).getCalledFunction();
     if (!Callee || Callee->isDeclaration())
       continue;
-    const FunctionSamples *FS = Pair.getSecond();
+    const FlatFunctionSamples *FS = Pair.getSecond();
     auto pair =
         notInlinedCallInfo.try_emplace(Callee, NotInlinedProfileInfo{0});
     pair.first->second.entryCount += FS->getEntrySamples();
@@ -913,7 +1085,7 @@ bool SampleProfileLoader::inlineHotFunctions(
 ///                 with blocks from \p BB1's dominator tree, then
 ///                 this is the post-dominator tree, and vice versa.
 template <bool IsPostDom>
-void SampleProfileLoader::findEquivalencesFor(
+void SampleProfileWeightPropagator::findEquivalencesFor(
     BasicBlock *BB1, ArrayRef<BasicBlock *> Descendants,
     DominatorTreeBase<BasicBlock, IsPostDom> *DomTree) {
   const BasicBlock *EC = EquivalenceClass[BB1];
@@ -955,7 +1127,7 @@ void SampleProfileLoader::findEquivalencesFor(
 /// dominates B2, B2 post-dominates B1 and both are in the same loop.
 ///
 /// \param F The function to query.
-void SampleProfileLoader::findEquivalenceClasses(Function &F) {
+void SampleProfileWeightPropagator::findEquivalenceClasses(Function &F) {
   SmallVector<BasicBlock *, 8> DominatedBBs;
   LLVM_DEBUG(dbgs() << "\nBlock equivalence classes\n");
   // Find equivalence sets based on dominance and post-dominance information.
@@ -1015,8 +1187,9 @@ void SampleProfileLoader::findEquivalenceClasses(Function &F) {
 /// \param UnknownEdge  Set if E has not been visited before.
 ///
 /// \returns E's weight, if known. Otherwise, return 0.
-uint64_t SampleProfileLoader::visitEdge(Edge E, unsigned *NumUnknownEdges,
-                                        Edge *UnknownEdge) {
+uint64_t SampleProfileWeightPropagator::visitEdge(Edge E,
+                                                  unsigned *NumUnknownEdges,
+                                                  Edge *UnknownEdge) {
   if (!VisitedEdges.count(E)) {
     (*NumUnknownEdges)++;
     *UnknownEdge = E;
@@ -1026,7 +1199,7 @@ uint64_t SampleProfileLoader::visitEdge(Edge E, unsigned *NumUnknownEdges,
   return EdgeWeights[E];
 }
 
-/// Propagate weights through incoming/outgoing edges.
+/// Propagate weights through the incoming/outgoing edges of \p BB.
 ///
 /// If the weight of a basic block is known, and there is only one edge
 /// with an unknown weight, we can calculate the weight of that edge.
@@ -1034,161 +1207,243 @@ uint64_t SampleProfileLoader::visitEdge(Edge E, unsigned *NumUnknownEdges,
 /// Similarly, if all the edges have a known count, we can calculate the
 /// count of the basic block, if needed.
 ///
-/// \param F  Function to process.
+/// \param BB  Block to process.
 /// \param UpdateBlockCount  Whether we should update basic block counts that
 ///                          has already been annotated.
 ///
 /// \returns  True if new weights were assigned to edges or blocks.
-bool SampleProfileLoader::propagateThroughEdges(Function &F,
-                                                bool UpdateBlockCount) {
+bool SampleProfileWeightPropagator::propagateThroughBlock(
+    const BasicBlock *BB, bool UpdateBlockCount) {
   bool Changed = false;
-  LLVM_DEBUG(dbgs() << "\nPropagation through edges\n");
-  for (const auto &BI : F) {
-    const BasicBlock *BB = &BI;
-    const BasicBlock *EC = EquivalenceClass[BB];
-
-    // Visit all the predecessor and successor edges to determine
-    // which ones have a weight assigned already. Note that it doesn't
-    // matter that we only keep track of a single unknown edge. The
-    // only case we are interested in handling is when only a single
-    // edge is unknown (see setEdgeOrBlockWeight).
-    for (unsigned i = 0; i < 2; i++) {
-      uint64_t TotalWeight = 0;
-      unsigned NumUnknownEdges = 0, NumTotalEdges = 0;
-      Edge UnknownEdge, SelfReferentialEdge, SingleEdge;
+  const BasicBlock *EC = EquivalenceClass[BB];
+
+  // Visit all the predecessor and successor edges to determine
+  // which ones have a weight assigned already. Note that it doesn't
+  // matter that we only keep track of a single unknown edge. The
+  // only case we are interested in handling is when only a single
+  // edge is unknown (see setEdgeOrBlockWeight).
+  for (unsigned i = 0; i < 2; i++) {
+    uint64_t TotalWeight = 0;
+    unsigned NumUnknownEdges = 0, NumTotalEdges = 0;
+    Edge UnknownEdge, SelfReferentialEdge, SingleEdge;
+
+    if (i == 0) {
+      // First, visit all predecessor edges.
+      NumTotalEdges = Predecessors[BB].size();
+      for (auto *Pred : Predecessors[BB]) {
+        Edge E = std::make_pair(Pred, BB);
+        TotalWeight += visitEdge(E, &NumUnknownEdges, &UnknownEdge);
+        if (E.first == E.second)
+          SelfReferentialEdge = E;
+      }
+      if (NumTotalEdges == 1) {
+        SingleEdge = std::make_pair(Predecessors[BB][0], BB);
+      }
+    } else {
+      // On the second round, visit all successor edges.
+      NumTotalEdges = Successors[BB].size();
+      for (auto *Succ : Successors[BB]) {
+        Edge E = std::make_pair(BB, Succ);
+        TotalWeight += visitEdge(E, &NumUnknownEdges, &UnknownEdge);
+      }
+      if (NumTotalEdges == 1) {
+        SingleEdge = std::make_pair(BB, Successors[BB][0]);
+      }
+    }
 
+    // After visiting all the edges, there are three cases that we
+    // can handle immediately:
+    //
+    // - All the edge weights are known (i.e., NumUnknownEdges == 0).
+    //   In this case, we simply check that the sum of all the edges
+    //   is the same as BB's weight. If not, we change BB's weight
+    //   to match. Additionally, if BB had not been visited before,
+    //   we mark it visited.
+    //
+    // - Only one edge is unknown and BB has already been visited.
+    //   In this case, we can compute the weight of the edge by
+    //   subtracting the total block weight from all the known
+    //   edge weights. If the edges weight more than BB, then the
+    //   edge of the last remaining edge is set to zero.
+    //
+    // - There exists a self-referential edge and the weight of BB is
+    //   known. In this case, this edge can be based on BB's weight.
+    //   We add up all the other known edges and set the weight on
+    //   the self-referential edge as we did in the previous case.
+    //
+    // In any other case, we must continue iterating. Eventually,
+    // all edges will get a weight, or iteration will stop when
+    // it reaches SampleProfileMaxPropagateIterations.
+    if (NumUnknownEdges <= 1) {
+      uint64_t &BBWeight = BlockWeights[EC];
+      if (NumUnknownEdges == 0) {
+        if (!VisitedBlocks.count(EC)) {
+          // If we already know the weight of all edges, the weight of the
+          // basic block can be computed. It should be no larger than the sum
+          // of all edge weights.
+          if (TotalWeight > BBWeight) {
+            BBWeight = TotalWeight;
+            Changed = true;
+            LLVM_DEBUG(dbgs() << "All edge weights for " << BB->getName()
+                              << " known. Set weight for block: ";
+                       printBlockWeight(dbgs(), BB););
+          }
+        } else if (NumTotalEdges == 1 &&
+                   EdgeWeights[SingleEdge] < BlockWeights[EC]) {
+          // If there is only one edge for the visited basic block, use the
+          // block weight to adjust edge weight if edge weight is smaller.
+          EdgeWeights[SingleEdge] = BlockWeights[EC];
+          Changed = true;
+        }
+      } else if (NumUnknownEdges == 1 && VisitedBlocks.count(EC)) {
+        // If there is a single unknown edge and the block has been
+        // visited, then we can compute E's weight.
+        if (BBWeight >= TotalWeight)
+          EdgeWeights[UnknownEdge] = BBWeight - TotalWeight;
+        else
+          EdgeWeights[UnknownEdge] = 0;
+        const BasicBlock *OtherEC;
+        if (i == 0)
+          OtherEC = EquivalenceClass[UnknownEdge.first];
+        else
+          OtherEC = EquivalenceClass[UnknownEdge.second];
+        // Edge weights should never exceed the BB weights it connects.
+        if (VisitedBlocks.count(OtherEC) &&
+            EdgeWeights[UnknownEdge] > BlockWeights[OtherEC])
+          EdgeWeights[UnknownEdge] = BlockWeights[OtherEC];
+        VisitedEdges.insert(UnknownEdge);
+        Changed = true;
+        LLVM_DEBUG(dbgs() << "Set weight for edge: ";
+                   printEdgeWeight(dbgs(), UnknownEdge));
+      }
+    } else if (VisitedBlocks.count(EC) && BlockWeights[EC] == 0) {
+      // If a block Weights 0, all its in/out edges should weight 0.
       if (i == 0) {
-        // First, visit all predecessor edges.
-        NumTotalEdges = Predecessors[BB].size();
         for (auto *Pred : Predecessors[BB]) {
           Edge E = std::make_pair(Pred, BB);
-          TotalWeight += visitEdge(E, &NumUnknownEdges, &UnknownEdge);
-          if (E.first == E.second)
-            SelfReferentialEdge = E;
-        }
-        if (NumTotalEdges == 1) {
-          SingleEdge = std::make_pair(Predecessors[BB][0], BB);
+          EdgeWeights[E] = 0;
+          VisitedEdges.insert(E);
         }
       } else {
-        // On the second round, visit all successor edges.
-        NumTotalEdges = Successors[BB].size();
         for (auto *Succ : Successors[BB]) {
           Edge E = std::make_pair(BB, Succ);
-          TotalWeight += visitEdge(E, &NumUnknownEdges, &UnknownEdge);
-        }
-        if (NumTotalEdges == 1) {
-          SingleEdge = std::make_pair(BB, Successors[BB][0]);
+          EdgeWeights[E] = 0;
+          VisitedEdges.insert(E);
         }
       }
+    } else if (SelfReferentialEdge.first && VisitedBlocks.count(EC)) {
+      uint64_t &BBWeight = BlockWeights[BB];
+      // We have a self-referential edge and the weight of BB is known.
+      if (BBWeight >= TotalWeight)
+        EdgeWeights[SelfReferentialEdge] = BBWeight - TotalWeight;
+      else
+        EdgeWeights[SelfReferentialEdge] = 0;
+      VisitedEdges.insert(SelfReferentialEdge);
+      Changed = true;
+      LLVM_DEBUG(dbgs() << "Set self-referential edge weight to: ";
+                 printEdgeWeight(dbgs(), SelfReferentialEdge));
+    }
+    if (UpdateBlockCount && !VisitedBlocks.count(EC) && TotalWeight > 0) {
+      BlockWeights[EC] = TotalWeight;
+      VisitedBlocks.insert(EC);
+      Changed = true;
+    }
+  }
 
-      // After visiting all the edges, there are three cases that we
-      // can handle immediately:
-      //
-      // - All the edge weights are known (i.e., NumUnknownEdges == 0).
-      //   In this case, we simply check that the sum of all the edges
-      //   is the same as BB's weight. If not, we change BB's weight
-      //   to match. Additionally, if BB had not been visited before,
-      //   we mark it visited.
-      //
-      // - Only one edge is unknown and BB has already been visited.
-      //   In this case, we can compute the weight of the edge by
-      //   subtracting the total block weight from all the known
-      //   edge weights. If the edges weight more than BB, then the
-      //   edge of the last remaining edge is set to zero.
-      //
-      // - There exists a self-referential edge and the weight of BB is
-      //   known. In this case, this edge can be based on BB's weight.
-      //   We add up all the other known edges and set the weight on
-      //   the self-referential edge as we did in the previous case.
-      //
-      // In any other case, we must continue iterating. Eventually,
-      // all edges will get a weight, or iteration will stop when
-      // it reaches SampleProfileMaxPropagateIterations.
-      if (NumUnknownEdges <= 1) {
-        uint64_t &BBWeight = BlockWeights[EC];
-        if (NumUnknownEdges == 0) {
-          if (!VisitedBlocks.count(EC)) {
-            // If we already know the weight of all edges, the weight of the
-            // basic block can be computed. It should be no larger than the sum
-            // of all edge weights.
-            if (TotalWeight > BBWeight) {
-              BBWeight = TotalWeight;
-              Changed = true;
-              LLVM_DEBUG(dbgs() << "All edge weights for " << BB->getName()
-                                << " known. Set weight for block: ";
-                         printBlockWeight(dbgs(), BB););
-            }
-          } else if (NumTotalEdges == 1 &&
-                     EdgeWeights[SingleEdge] < BlockWeights[EC]) {
-            // If there is only one edge for the visited basic block, use the
-            // block weight to adjust edge weight if edge weight is smaller.
-            EdgeWeights[SingleEdge] = BlockWeights[EC];
-            Changed = true;
-          }
-        } else if (NumUnknownEdges == 1 && VisitedBlocks.count(EC)) {
-          // If there is a single unknown edge and the block has been
-          // visited, then we can compute E's weight.
-          if (BBWeight >= TotalWeight)
-            EdgeWeights[UnknownEdge] = BBWeight - TotalWeight;
-          else
-            EdgeWeights[UnknownEdge] = 0;
-          const BasicBlock *OtherEC;
-          if (i == 0)
-            OtherEC = EquivalenceClass[UnknownEdge.first];
-          else
-            OtherEC = EquivalenceClass[UnknownEdge.second];
-          // Edge weights should never exceed the BB weights it connects.
-          if (VisitedBlocks.count(OtherEC) &&
-              EdgeWeights[UnknownEdge] > BlockWeights[OtherEC])
-            EdgeWeights[UnknownEdge] = BlockWeights[OtherEC];
-          VisitedEdges.insert(UnknownEdge);
-          Changed = true;
-          LLVM_DEBUG(dbgs() << "Set weight for edge: ";
-                     printEdgeWeight(dbgs(), UnknownEdge));
-        }
-      } else if (VisitedBlocks.count(EC) && BlockWeights[EC] == 0) {
-        // If a block Weights 0, all its in/out edges should weight 0.
-        if (i == 0) {
-          for (auto *Pred : Predecessors[BB]) {
-            Edge E = std::make_pair(Pred, BB);
-            EdgeWeights[E] = 0;
-            VisitedEdges.insert(E);
-          }
-        } else {
-          for (auto *Succ : Successors[BB]) {
-            Edge E = std::make_pair(BB, Succ);
-            EdgeWeights[E] = 0;
-            VisitedEdges.insert(E);
-          }
-        }
-      } else if (SelfReferentialEdge.first && VisitedBlocks.count(EC)) {
-        uint64_t &BBWeight = BlockWeights[BB];
-        // We have a self-referential edge and the weight of BB is known.
-        if (BBWeight >= TotalWeight)
-          EdgeWeights[SelfReferentialEdge] = BBWeight - TotalWeight;
-        else
-          EdgeWeights[SelfReferentialEdge] = 0;
-        VisitedEdges.insert(SelfReferentialEdge);
-        Changed = true;
-        LLVM_DEBUG(dbgs() << "Set self-referential edge weight to: ";
-                   printEdgeWeight(dbgs(), SelfReferentialEdge));
+  return Changed;
+}
+
+/// Queue \p BB to be visited again by propagateThroughEdges. The block is
+/// visited in the current pass if it comes after the block at \p Current in
+/// the function, and in the next pass otherwise.
+void SampleProfileWeightPropagator::requeueBlock(const BasicBlock *BB,
+                                                 unsigned Current) {
+  unsigned Index = BlockIndex.lookup(BB);
+  if (Index > Current)
+    Worklist.set(Index);
+  else
+    NextWorklist.set(Index);
+}
+
+/// Run one propagation pass over the blocks of the worklist, in function
+/// order, and fill the worklist of the next pass.
+///
+/// This gives the same result as visiting every block of the function on
+/// each pass: the blocks left out are those whose edges, equivalence class
+/// and neighbouring equivalence classes have not changed since their last
+/// visit, and whose last visit did not report a change, so visiting them
+/// again would neither change anything nor report a change.
+///
+/// \param UpdateBlockCount  Whether we should update basic block counts that
+///                          has already been annotated.
+///
+/// \returns  True if new weights were assigned to edges or blocks.
+bool SampleProfileWeightPropagator::propagateThroughEdges(
+    bool UpdateBlockCount) {
+  bool Changed = false;
+  LLVM_DEBUG(dbgs() << "\nPropagation through edges\n");
+  SmallVector<std::pair<Edge, std::pair<bool, uint64_t>>, 8> EdgesBefore;
+  for (int I = Worklist.find_first(); I != -1; I = Worklist.find_next(I)) {
+    const BasicBlock *BB = Blocks[I];
+    const BasicBlock *EC = EquivalenceClass[BB];
+    ++NumBlockVisits;
+
+    // Remember the state that visiting BB may change, to find out which
+    // blocks have to be visited again.
+    auto EdgeState = [&](const Edge &E) -> std::pair<bool, uint64_t> {
+      if (!VisitedEdges.count(E))
+        return {false, 0};
+      return {true, EdgeWeights.lookup(E)};
+    };
+    EdgesBefore.clear();
+    for (auto *Pred : Predecessors[BB]) {
+      Edge E = std::make_pair(Pred, BB);
+      EdgesBefore.push_back({E, EdgeState(E)});
+    }
+    for (auto *Succ : Successors[BB]) {
+      Edge E = std::make_pair(BB, Succ);
+      EdgesBefore.push_back({E, EdgeState(E)});
+    }
+    uint64_t WeightBefore = BlockWeights.lookup(EC);
+    bool VisitedBefore = VisitedBlocks.count(EC);
+
+    if (propagateThroughBlock(BB, UpdateBlockCount)) {
+      Changed = true;
+      NextWorklist.set(I);
+    }
+
+    for (const auto &EB : EdgesBefore)
+      if (EdgeState(EB.first) != EB.second) {
+        requeueBlock(EB.first.first, I);
+        requeueBlock(EB.first.second, I);
       }
-      if (UpdateBlockCount && !VisitedBlocks.count(EC) && TotalWeight > 0) {
-        BlockWeights[EC] = TotalWeight;
-        VisitedBlocks.insert(EC);
-        Changed = true;
+    if (BlockWeights.lookup(EC) != WeightBefore ||
+        VisitedBlocks.count(EC) != VisitedBefore)
+      for (const auto *Member : ClassMembers[EC]) {
+        requeueBlock(Member, I);
+        for (auto *Pred : Predecessors[Member])
+          requeueBlock(Pred, I);
+        for (auto *Succ : Successors[Member])
+          requeueBlock(Succ, I);
       }
-    }
   }
 
+  std::swap(Worklist, NextWorklist);
+  NextWorklist.reset();
   return Changed;
 }
 
+/// Queue every block of the function for the next propagation pass.
+void SampleProfileWeightPropagator::requeueAllBlocks() {
+  Worklist.set();
+  NextWorklist.reset();
+}
+
 /// Build in/out edge lists for each basic block in the CFG.
 ///
 /// We are interested in unique edges. If a block B1 has multiple
 /// edges to another block B2, we only add a single B1->B2 edge.
-void SampleProfileLoader::buildEdges(Function &F) {
+void SampleProfileWeightPropagator::buildEdges(Function &F) {
   for (auto &BI : F) {
     BasicBlock *B1 = &BI;
 
@@ -1214,12 +1469,12 @@ void SampleProfileLoader::buildEdges(Function &F) {
   }
 }
 
-/// Returns the sorted CallTargetMap \p M by count in descending order.
-static SmallVector<InstrProfValueData, 2> SortCallTargets(
-    const SampleRecord::CallTargetMap &M) {
+/// Returns the call targets \p Targets sorted by count in descending order.
+static SmallVector<InstrProfValueData, 2>
+SortCallTargets(ArrayRef<FlatCallTarget> Targets) {
   SmallVector<InstrProfValueData, 2> R;
-  for (auto I = M.begin(); I != M.end(); ++I)
-    R.push_back({FunctionSamples::getGUID(I->getKey()), I->getValue()});
+  for (const auto &T : Targets)
+    R.push_back({FunctionSamples::getGUID(T.Name), T.Samples});
   llvm::sort(R, [](const InstrProfValueData &L, const InstrProfValueData &R) {
     if (L.Count == R.Count)
       return L.Value > R.Value;
@@ -1246,7 +1501,7 @@ static SmallVector<InstrProfValueData, 2> SortCallTargets(
 ///   known, the weight for that edge is set to the weight of the block
 ///   minus the weight of the other incoming edges to that block (if
 ///   known).
-void SampleProfileLoader::propagateWeights(Function &F) {
+void SampleProfileWeightPropagator::propagateWeights(Function &F) {
   bool Changed = true;
   unsigned I = 0;
 
@@ -1271,9 +1526,22 @@ void SampleProfileLoader::propagateWeights(Function &F) {
   // of the pass.
   buildEdges(F);
 
+  // Index the blocks and the equivalence classes for the worklist of
+  // propagateThroughEdges.
+  for (auto &BI : F) {
+    const BasicBlock *BB = &BI;
+    BlockIndex[BB] = Blocks.size();
+    Blocks.push_back(BB);
+    ClassMembers[EquivalenceClass[BB]].push_back(BB);
+  }
+  Worklist.resize(Blocks.size());
+  NextWorklist.resize(Blocks.size());
+  NumBlockVisits = 0;
+
   // Propagate until we converge or we go past the iteration limit.
+  requeueAllBlocks();
   while (Changed && I++ < SampleProfileMaxPropagateIterations) {
-    Changed = propagateThroughEdges(F, false);
+    Changed = propagateThroughEdges(false);
   }
 
   // The first propagation propagates BB counts from annotated BBs to unknown
@@ -1281,19 +1549,81 @@ void SampleProfileLoader::propagateWeights(Function &F) {
   // to propagate edge weights.
   VisitedEdges.clear();
   Changed = true;
+  requeueAllBlocks();
   while (Changed && I++ < SampleProfileMaxPropagateIterations) {
-    Changed = propagateThroughEdges(F, false);
+    Changed = propagateThroughEdges(false);
   }
 
   // The 3rd propagation pass allows adjust annotated BB weights that are
   // obviously wrong.
   Changed = true;
+  requeueAllBlocks();
   while (Changed && I++ < SampleProfileMaxPropagateIterations) {
-    Changed = propagateThroughEdges(F, true);
+    Changed = propagateThroughEdges(true);
   }
 
-  // Generate MD_prof metadata for every branch instruction using the
-  // edge weights computed during propagation.
+  LLVM_DEBUG(dbgs() << "\nPropagation visited " << NumBlockVisits
+                    << " blocks\n");
+  NumPropagationBlockVisits += NumBlockVisits;
+  MaxPropagationBlockVisits.updateMax(NumBlockVisits);
+}
+
+/// Infer the weights of all the blocks and edges of \p F.
+///
+/// Unlike propagateWeights, this assigns a weight to every edge, even when
+/// the sampled block weights do not pin it down, and makes the weights
+/// consistent: the weight of a block is the sum of the weights of its
+/// incoming edges and of its outgoing edges. The sampled block weights
+/// are adjusted as little as possible to get there (see applyFlowInference).
+void SampleProfileWeightPropagator::inferWeights(Function &F) {
+  buildEdges(F);
+
+  FlowFunction Func;
+  for (auto &BI : F) {
+    const BasicBlock *BB = &BI;
+    BlockIndex[BB] = Blocks.size();
+    Blocks.push_back(BB);
+    FlowBlock Block;
+    if (VisitedBlocks.count(BB)) {
+      Block.HasWeight = true;
+      Block.Weight = BlockWeights[BB];
+    }
+    Func.Blocks.push_back(Block);
+  }
+  for (const BasicBlock *BB : Blocks) {
+    for (const BasicBlock *Succ : Successors[BB]) {
+      FlowJump Jump;
+      Jump.Source = BlockIndex[BB];
+      Jump.Target = BlockIndex[Succ];
+      Func.Jumps.push_back(Jump);
+    }
+  }
+  Func.Entry = BlockIndex[&F.getEntryBlock()];
+
+  applyFlowInference(Func);
+
+  for (unsigned I = 0, E = Blocks.size(); I < E; ++I) {
+    BlockWeights[Blocks[I]] = Func.Blocks[I].Flow;
+    VisitedBlocks.insert(Blocks[I]);
+  }
+  for (const FlowJump &Jump : Func.Jumps) {
+    Edge E = std::make_pair(Blocks[Jump.Source], Blocks[Jump.Target]);
+    EdgeWeights[E] = Jump.Flow;
+    VisitedEdges.insert(E);
+  }
+  LLVM_DEBUG({
+    dbgs() << "\nInferred weights\n";
+    for (const BasicBlock *BB : Blocks)
+      printBlockWeight(dbgs(), BB);
+    for (const FlowJump &Jump : Func.Jumps)
+      printEdgeWeight(dbgs(),
+                      std::make_pair(Blocks[Jump.Source], Blocks[Jump.Target]));
+  });
+}
+
+/// Generate MD_prof metadata for every branch instruction of \p F using the
+/// edge weights computed by propagateWeights.
+void SampleProfileLoader::emitBranchWeights(Function &F) {
   LLVM_DEBUG(dbgs() << "\nPropagation complete. Setting branch weights\n");
   LLVMContext &Ctx = F.getContext();
   MDBuilder MDB(Ctx);
@@ -1313,10 +1643,10 @@ void SampleProfileLoader::propagateWeights(Function &F) {
           uint32_t LineOffset = FunctionSamples::getOffset(DIL);
           uint32_t Discriminator = DIL->getBaseDiscriminator();
 
-          const FunctionSamples *FS = findFunctionSamples(I);
+          const FlatFunctionSamples *FS = findFunctionSamples(I);
           if (!FS)
             continue;
-          auto T = FS->findCallTargetMapAt(LineOffset, Discriminator);
+          auto T = FS->findCallTargetsAt(LineOffset, Discriminator);
           if (!T || T.get().empty())
             continue;
           SmallVector<InstrProfValueData, 2> SortedCallTargets =
@@ -1418,7 +1748,7 @@ unsigned SampleProfileLoader::getFunctionLoc(Function &F) {
   return 0;
 }
 
-void SampleProfileLoader::computeDominanceAndLoopInfo(Function &F) {
+void SampleProfileWeightPropagator::computeDominanceAndLoopInfo(Function &F) {
   DT.reset(new DominatorTree);
   DT->recalculate(F);
 
@@ -1466,10 +1796,11 @@ void SampleProfileLoader::computeDominanceAndLoopInfo(Function &F) {
 /// only allow it to proceed for a limited number of iterations (controlled
 /// by -sample-profile-max-propagate-iterations).
 ///
+/// Each iteration only revisits the blocks next to the edges and blocks
+/// whose weights changed in the previous one (see propagateThroughEdges).
+///
 /// FIXME: Try to replace this propagation heuristic with a scheme
-/// that is guaranteed to finalize. A work-list approach similar to
-/// the standard value propagation algorithm used by SSA-CCP might
-/// work here.
+/// that is guaranteed to finalize.
 ///
 /// Once all the branch weights are computed, we emit the MD_prof
 /// metadata on BB using the computed values for each of its branches.
@@ -1502,14 +1833,18 @@ bool SampleProfileLoader::emitAnnotations(Function &F) {
         ProfileCount(Samples->getHeadSamples() + 1, Function::PCT_Real),
         &InlinedGUIDs);
 
-    // Compute dominance and loop info needed for propagation.
-    computeDominanceAndLoopInfo(F);
-
-    // Find equivalence classes.
-    findEquivalenceClasses(F);
+    if (PendingFunctions) {
+      // Leave the propagation to runOnFunctionsInParallel.
+      PendingFunctions->insert(std::make_pair(
+          &F, make_unique<SampleProfileWeightPropagator>(std::move(
+                  static_cast<SampleProfileWeightPropagator &>(*this)))));
+    } else {
+      // Compute dominance and loop info, find equivalence classes and
+      // propagate weights to all edges.
+      computeEdgeWeights(F);
 
-    // Propagate weights to all edges.
-    propagateWeights(F);
+      emitBranchWeights(F);
+    }
   }
 
   // If coverage checking was requested, compute it now.
@@ -1551,6 +1886,17 @@ INITIALIZE_PASS_DEPENDENCY(ProfileSummaryInfoWrapperPass)
 INITIALIZE_PASS_END(SampleProfileLoaderLegacyPass, "sample-profile",
                     "Sample Profile loader", false, false)
 
+/// Add to \p Names the name \p Name of the profile, or every function of its
+/// calling context if it is context-sensitive.
+static void addNameInProfile(StringRef Name, DenseSet<StringRef> &Names) {
+  SmallVector<SampleContextFrame, 8> Frames;
+  if (SampleContext::parse(Name, Frames))
+    for (const SampleContextFrame &Frame : Frames)
+      Names.insert(Frame.FuncName);
+  else
+    Names.insert(Name);
+}
+
 bool SampleProfileLoader::doInitialization(Module &M) {
   auto &Ctx = M.getContext();
   auto ReaderOrErr = SampleProfileReader::create(Filename, Ctx);
@@ -1560,7 +1906,13 @@ bool SampleProfileLoader::doInitialization(Module &M) {
     return false;
   }
   Reader = std::move(ReaderOrErr.get());
-  Reader->collectFuncsToUse(M);
+  // Only decode the profiles of the functions defined in this module. The
+  // names in a remapped profile need not match the names in the module, so
+  // read the whole profile in that case, unless it cannot be remapped.
+  if (RemappingFilename.empty() ||
+      (Reader->getFormat() == SPF_Compact_Binary &&
+       Reader->getOriginalNames().empty()))
+    Reader->collectFuncsToUse(M);
   ProfileIsValid = (Reader->read() == sampleprof_error::success);
 
   if (!RemappingFilename.empty()) {
@@ -1575,8 +1927,31 @@ bool SampleProfileLoader::doInitialization(Module &M) {
       return false;
     }
     Reader = std::move(ReaderOrErr.get());
+    // Remap the names of the functions of this module all at once.
+    Reader->collectFuncsToUse(M);
     ProfileIsValid = (Reader->read() == sampleprof_error::success);
   }
+  if (ProfileAccurateForSymsInList) {
+    PSL = Reader->getProfileSymbolList();
+    // The profiles that were read need not include those in which the
+    // functions of this module are inlined, so take the names of the whole
+    // profile. Without them, no function can be told to be cold.
+    std::vector<StringRef> Names;
+    if (PSL && Reader->getNamesInProfile(Names))
+      for (StringRef Name : Names)
+        addNameInProfile(Name, NamesInProfile);
+    else
+      PSL.reset();
+  }
+  // The contexts of a context-sensitive profile are handed out by the
+  // tracker, as the functions they are inlined in get annotated.
+  if (Reader->profileIsCS())
+    ContextTracker = llvm::make_unique<SampleContextTracker>(
+        Reader->getProfiles());
+  // The profile is only queried from here on, switch it to the compact
+  // representation and release the FunctionSamples.
+  if (SampleProfileFlattenAll)
+    Reader->flattenProfiles();
   return true;
 }
 
@@ -1600,8 +1975,12 @@ bool SampleProfileLoader::runOnModule(Module &M, ModuleAnalysisManager *AM,
                         ProfileSummary::PSK_Sample);
 
   // Compute the total number of samples collected in this profile.
+  for (const auto &I : Reader->getFlatProfiles())
+    TotalCollectedSamples += I.second->getTotalSamples();
   for (const auto &I : Reader->getProfiles())
     TotalCollectedSamples += I.second.getTotalSamples();
+  if (ContextTracker)
+    TotalCollectedSamples += ContextTracker->getTotalSamples();
 
   // Populate the symbol map.
   for (const auto &N_F : M.getValueSymbolTable()) {
@@ -1624,10 +2003,12 @@ bool SampleProfileLoader::runOnModule(Module &M, ModuleAnalysisManager *AM,
   }
 
   bool retval = false;
-  for (auto &F : M)
-    if (!F.isDeclaration()) {
+  if (SampleProfileAnnotationThreads)
+    retval = runOnFunctionsInParallel(M, AM);
+  else
+    for (Function *F : buildFunctionOrder(M)) {
       clearFunctionData();
-      retval |= runOnFunction(F, AM);
+      retval |= runOnFunction(*F, AM);
     }
 
   // Account for cold calls not inlined....
@@ -1660,8 +2041,81 @@ bool SampleProfileLoader::runOnFunction(Function &F, ModuleAnalysisManager *AM)
       (ProfileSampleAccurate || F.hasFnAttribute("profile-sample-accurate"))
           ? 0
           : -1;
+  // A function of the profiled binary that has no samples was cold, unlike
+  // a function that is new, so it can be treated as such.
+  if (PSL) {
+    StringRef CanonName = FunctionSamples::getCanonicalFnName(F);
+    if (PSL->contains(CanonName) && !NamesInProfile.count(CanonName))
+      initialEntryCount = 0;
+  }
   F.setEntryCount(ProfileCount(initialEntryCount, Function::PCT_Real));
   std::unique_ptr<OptimizationRemarkEmitter> OwnedORE;
+  setUpRemarkEmitter(F, AM, OwnedORE);
+  Samples = getFlatSamplesFor(F);
+  bool Changed = false;
+  if (Samples && !Samples->empty())
+    Changed = emitAnnotations(F);
+  if (ContextTracker)
+    ContextTracker->finishFunction();
+  return Changed;
+}
+
+/// Return the functions of \p M to annotate, in the order to annotate them.
+///
+/// With a context-sensitive profile, callers are annotated before their
+/// callees, so that the contexts they do not inline have been merged into
+/// the profiles of the callees by the time these are annotated. Otherwise
+/// the functions are annotated in module order.
+std::vector<Function *> SampleProfileLoader::buildFunctionOrder(Module &M) {
+  std::vector<Function *> Order;
+  if (!ContextTracker) {
+    for (auto &F : M)
+      if (!F.isDeclaration())
+        Order.push_back(&F);
+    return Order;
+  }
+
+  // The contexts called by functions that are not annotated here would never
+  // be promoted.
+  StringSet<> Defined;
+  for (auto &F : M)
+    if (!F.isDeclaration())
+      Defined.insert(FunctionSamples::getCanonicalFnName(F));
+  ContextTracker->promoteContextsOfUnavailableFunctions(
+      [&](StringRef Name) { return Defined.count(Name); });
+
+  // The SCCs of the call graph come out bottom-up.
+  CallGraph CG(M);
+  for (scc_iterator<CallGraph *> I = scc_begin(&CG); !I.isAtEnd(); ++I)
+    for (CallGraphNode *Node : *I)
+      if (Function *F = Node->getFunction())
+        if (!F->isDeclaration())
+          Order.push_back(F);
+  std::reverse(Order.begin(), Order.end());
+  return Order;
+}
+
+/// Return the samples of \p F, from the context tracker if the profile is
+/// context-sensitive. Unless the reader has flattened the whole profile, the
+/// samples are converted here.
+const FlatFunctionSamples *
+SampleProfileLoader::getFlatSamplesFor(const Function &F) {
+  StringRef CanonName = FunctionSamples::getCanonicalFnName(F);
+  const FunctionSamples *FS;
+  if (ContextTracker)
+    FS = ContextTracker->startFunction(CanonName);
+  else if (SampleProfileFlattenAll)
+    return Reader->getFlatSamplesFor(CanonName);
+  else
+    FS = Reader->getSamplesFor(CanonName);
+  return FS ? FlatProfiles.add(CanonName, *FS) : nullptr;
+}
+
+/// Point ORE to the remark emitter of \p F. \p OwnedORE holds it if it is
+/// not managed by \p AM.
+void SampleProfileLoader::setUpRemarkEmitter(
+    Function &F, ModuleAnalysisManager *AM,
+    std::unique_ptr<OptimizationRemarkEmitter> &OwnedORE) {
   if (AM) {
     auto &FAM =
         AM->getResult<FunctionAnalysisManagerModuleProxy>(*F.getParent())
@@ -1671,10 +2125,68 @@ bool SampleProfileLoader::runOnFunction(Function &F, ModuleAnalysisManager *AM)
     OwnedORE = make_unique<OptimizationRemarkEmitter>(&F);
     ORE = OwnedORE.get();
   }
-  Samples = Reader->getSamplesFor(F);
-  if (Samples && !Samples->empty())
-    return emitAnnotations(F);
-  return false;
+}
+
+/// Annotate the functions of \p M, computing their edge weights in parallel.
+///
+/// This runs in three phases:
+///
+/// 1- Every function is inlined and assigned block weights, in the order of
+///    buildFunctionOrder, as runOnFunction does. The state of each annotated
+///    function is then queued instead of being propagated.
+///
+/// 2- The dominator trees, equivalence classes and edge weights of the
+///    queued functions are computed on a thread pool. This only reads the
+///    IR and the profile, and each task works on its own state.
+///
+/// 3- The branch weights of the queued functions are emitted, in the same
+///    order, so that the metadata and the remarks do not depend on the
+///    number of threads.
+///
+/// A queued function that is about to be inlined into a caller is finished
+/// serially first, as in the serial mode, so that the inlined code carries its
+/// branch weights; it is then left out of phases 2 and 3.
+bool SampleProfileLoader::runOnFunctionsInParallel(Module &M,
+                                                   ModuleAnalysisManager *AM) {
+  PendingFunctionMap Pending;
+  PendingFunctions = &Pending;
+  PendingAM = AM;
+  bool Changed = false;
+  for (Function *F : buildFunctionOrder(M)) {
+    clearFunctionData();
+    Changed |= runOnFunction(*F, AM);
+  }
+  PendingFunctions = nullptr;
+  PendingAM = nullptr;
+  // Drop the functions that were finished before being inlined.
+  Pending.remove_if(
+      [](const PendingFunctionMap::value_type &P) { return !P.second; });
+
+  unsigned NumThreads = SampleProfileAnnotationThreads;
+#ifndef NDEBUG
+  // Keep the debug output of the functions apart.
+  if (DebugFlag)
+    NumThreads = 1;
+#endif
+  ThreadPool Pool(std::min<unsigned>(NumThreads, Pending.size()));
+  for (auto &P : Pending) {
+    Function *F = P.first;
+    SampleProfileWeightPropagator *State = P.second.get();
+    Pool.async([F, State]() { State->computeEdgeWeights(*F); });
+  }
+  Pool.wait();
+
+  for (auto &P : Pending) {
+    Function &F = *P.first;
+    clearFunctionData();
+    static_cast<SampleProfileWeightPropagator &>(*this) = std::move(*P.second);
+    P.second.reset();
+    DILocation2SampleMap.clear();
+    std::unique_ptr<OptimizationRemarkEmitter> OwnedORE;
+    setUpRemarkEmitter(F, AM, OwnedORE);
+    emitBranchWeights(F);
+  }
+  return Changed;
 }
 
 PreservedAnalyses SampleProfileLoaderPass::run(Module &M,
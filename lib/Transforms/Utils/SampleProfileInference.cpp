@@ -0,0 +1,225 @@
+//===- SampleProfileInference.cpp - Infer block and edge counts -----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements applyFlowInference (see SampleProfileInference.h) as a
+// minimum cost maximum flow over a network built from the control-flow graph.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/SampleProfileInference.h"
+#include "llvm/Support/Debug.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <deque>
+#include <limits>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "sample-profile-inference"
+
+namespace {
+
+/// Cost, per sample, of increasing or decreasing the count of a sampled
+/// block. Decreasing is more expensive because the samples of a block are
+/// more often too few than too many. The other way around for the entry
+/// block, since extra flow through it raises the count of the whole
+/// function.
+const int64_t CostBlockInc = 10;
+const int64_t CostBlockDec = 20;
+const int64_t CostEntryInc = 40;
+const int64_t CostEntryDec = 10;
+
+/// Cost, per sample, of increasing the count of a block sampled with a zero
+/// weight. This is slightly more than for the other sampled blocks, so that
+/// extra flow goes through blocks known to be executed rather than through
+/// blocks known to be cold.
+const int64_t CostBlockZeroInc = 11;
+
+/// Capacity of the edges that do not limit the flow.
+const int64_t InfiniteCapacity = std::numeric_limits<int64_t>::max() / 4;
+
+/// Largest weight of a block. This keeps the total flow far from
+/// InfiniteCapacity for functions of any reasonable size.
+const uint64_t MaxBlockWeight = uint64_t(1) << 40;
+
+/// Minimum cost maximum flow solver.
+///
+/// This finds a maximum flow from the source to the sink of a network by
+/// augmenting the flow along shortest paths (in cost) of the residual
+/// network, which gives a flow of minimum cost as long as the network has
+/// no negative cycles.
+class MinCostMaxFlow {
+public:
+  MinCostMaxFlow(unsigned NumNodes, unsigned Source, unsigned Sink)
+      : Nodes(NumNodes), Source(Source), Sink(Sink) {}
+
+  /// Add an edge from \p Src to \p Dst and return its index.
+  unsigned addEdge(unsigned Src, unsigned Dst, int64_t Capacity,
+                   int64_t Cost) {
+    assert(Capacity >= 0 && Cost >= 0 && "Unexpected negative edge");
+    unsigned Index = Edges.size();
+    // The residual edge of edge I is edge I ^ 1.
+    Edges.push_back({Dst, Capacity, 0, Cost});
+    Nodes[Src].push_back(Index);
+    Edges.push_back({Src, 0, 0, -Cost});
+    Nodes[Dst].push_back(Index + 1);
+    return Index;
+  }
+
+  /// Flow through the edge returned by addEdge.
+  int64_t getFlow(unsigned Index) const { return Edges[Index].Flow; }
+
+  /// Compute the flow.
+  void run() {
+    Distance.resize(Nodes.size());
+    ParentEdge.resize(Nodes.size());
+    InQueue.resize(Nodes.size());
+    unsigned NumPaths = 0;
+    while (findShortestPath()) {
+      int64_t Delta = InfiniteCapacity;
+      for (unsigned V = Sink; V != Source; V = Edges[ParentEdge[V] ^ 1].Dst)
+        Delta = std::min(Delta, residualCapacity(ParentEdge[V]));
+      for (unsigned V = Sink; V != Source; V = Edges[ParentEdge[V] ^ 1].Dst) {
+        Edges[ParentEdge[V]].Flow += Delta;
+        Edges[ParentEdge[V] ^ 1].Flow -= Delta;
+      }
+      ++NumPaths;
+    }
+    LLVM_DEBUG(dbgs() << "Augmented the flow along " << NumPaths
+                      << " paths\n");
+  }
+
+private:
+  struct FlowEdge {
+    unsigned Dst;
+    int64_t Capacity;
+    int64_t Flow;
+    int64_t Cost;
+  };
+
+  int64_t residualCapacity(unsigned Index) const {
+    return Edges[Index].Capacity - Edges[Index].Flow;
+  }
+
+  /// Find a shortest path from the source to the sink in the residual
+  /// network with the queue-based Bellman-Ford algorithm, as the residual
+  /// edges have negative costs. \returns false if there is no such path.
+  bool findShortestPath() {
+    std::fill(Distance.begin(), Distance.end(),
+              std::numeric_limits<int64_t>::max());
+    std::deque<unsigned> Queue;
+    Distance[Source] = 0;
+    Queue.push_back(Source);
+    InQueue[Source] = true;
+    while (!Queue.empty()) {
+      unsigned U = Queue.front();
+      Queue.pop_front();
+      InQueue[U] = false;
+      for (unsigned Index : Nodes[U]) {
+        if (residualCapacity(Index) <= 0)
+          continue;
+        unsigned V = Edges[Index].Dst;
+        int64_t D = Distance[U] + Edges[Index].Cost;
+        if (D >= Distance[V])
+          continue;
+        Distance[V] = D;
+        ParentEdge[V] = Index;
+        if (!InQueue[V]) {
+          Queue.push_back(V);
+          InQueue[V] = true;
+        }
+      }
+    }
+    return Distance[Sink] != std::numeric_limits<int64_t>::max();
+  }
+
+  /// Outgoing edges of every node, including the residual ones.
+  std::vector<std::vector<unsigned>> Nodes;
+  std::vector<FlowEdge> Edges;
+  unsigned Source;
+  unsigned Sink;
+
+  /// State of findShortestPath.
+  std::vector<int64_t> Distance;
+  std::vector<unsigned> ParentEdge;
+  std::vector<bool> InQueue;
+};
+
+} // end anonymous namespace
+
+/// The network has two nodes for every block B, B.in (2 * B) and B.out
+/// (2 * B + 1), plus the nodes S and T, through which the function is
+/// entered and left, and the source S' and sink T' of the solver.
+///
+/// Every jump from B1 to B2 is an edge B1.out -> B2.in, S -> Entry.in and
+/// Exit.out -> T edges enter and leave the function, and T -> S closes the
+/// circulation. The count of a block B with weight W is W plus the flow of
+/// an edge B.in -> B.out, which increases the count, minus the flow of an
+/// edge B.out -> B.in of capacity W, which decreases it. The weight itself
+/// is injected by edges S' -> B.out and B.in -> T' of capacity W, which the
+/// maximum flow saturates. The solution is thus a flow through the jumps in
+/// which every block carries its count, and its cost is that of the changes
+/// to the sampled weights.
+void llvm::applyFlowInference(FlowFunction &Func) {
+  unsigned NumBlocks = Func.Blocks.size();
+  unsigned S = 2 * NumBlocks, T = S + 1;
+  MinCostMaxFlow Network(2 * NumBlocks + 4, S + 2, S + 3);
+
+  std::vector<bool> IsExit(NumBlocks, true);
+  std::vector<unsigned> JumpEdges;
+  JumpEdges.reserve(Func.Jumps.size());
+  for (const FlowJump &Jump : Func.Jumps) {
+    assert(Jump.Source < NumBlocks && Jump.Target < NumBlocks &&
+           "Jump to an unknown block");
+    IsExit[Jump.Source] = false;
+    JumpEdges.push_back(
+        Network.addEdge(2 * Jump.Source + 1, 2 * Jump.Target,
+                        InfiniteCapacity, 0));
+  }
+
+  std::vector<uint64_t> Weights(NumBlocks);
+  std::vector<unsigned> IncEdges(NumBlocks), DecEdges(NumBlocks);
+  for (unsigned B = 0; B < NumBlocks; ++B) {
+    const FlowBlock &Block = Func.Blocks[B];
+    unsigned In = 2 * B, Out = In + 1;
+    if (B == Func.Entry)
+      Network.addEdge(S, In, InfiniteCapacity, 0);
+    if (IsExit[B])
+      Network.addEdge(Out, T, InfiniteCapacity, 0);
+
+    int64_t CostInc = 0, CostDec = 0;
+    if (Block.HasWeight) {
+      Weights[B] = std::min(Block.Weight, MaxBlockWeight);
+      if (B == Func.Entry) {
+        CostInc = CostEntryInc;
+        CostDec = CostEntryDec;
+      } else {
+        CostInc = Weights[B] ? CostBlockInc : CostBlockZeroInc;
+        CostDec = CostBlockDec;
+      }
+    }
+    IncEdges[B] = Network.addEdge(In, Out, InfiniteCapacity, CostInc);
+    if (Weights[B]) {
+      DecEdges[B] = Network.addEdge(Out, In, Weights[B], CostDec);
+      Network.addEdge(S + 2, Out, Weights[B], 0);
+      Network.addEdge(In, S + 3, Weights[B], 0);
+    }
+  }
+  Network.addEdge(T, S, InfiniteCapacity, 0);
+
+  Network.run();
+
+  for (unsigned J = 0, E = Func.Jumps.size(); J < E; ++J)
+    Func.Jumps[J].Flow = Network.getFlow(JumpEdges[J]);
+  for (unsigned B = 0; B < NumBlocks; ++B) {
+    uint64_t Flow = Weights[B] + Network.getFlow(IncEdges[B]);
+    if (Weights[B])
+      Flow -= Network.getFlow(DecEdges[B]);
+    Func.Blocks[B].Flow = Flow;
+  }
+}
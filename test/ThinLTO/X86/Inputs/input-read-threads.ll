@@ -0,0 +1,14 @@
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@gv = global i32 42
+
+@bar = alias i32 (), i32 ()* @foo
+
+declare void @baz()
+
+define i32 @foo() {
+  call void @baz()
+  %1 = load i32, i32* @gv
+  ret i32 %1
+}
@@ -0,0 +1,20 @@
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@counter = internal global i32 0
+
+define i32 @foo() {
+  %1 = call i32 @helper()
+  %2 = call i32 @callback()
+  %3 = add i32 %1, %2
+  ret i32 %3
+}
+
+define internal i32 @helper() {
+  %1 = load i32, i32* @counter
+  %2 = add i32 %1, 1
+  store i32 %2, i32* @counter
+  ret i32 %2
+}
+
+declare i32 @callback()
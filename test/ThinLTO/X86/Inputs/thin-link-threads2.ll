@@ -0,0 +1,10 @@
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @bar() {
+  %1 = call i32 @foo()
+  %2 = mul i32 %1, 2
+  ret i32 %2
+}
+
+declare i32 @foo()
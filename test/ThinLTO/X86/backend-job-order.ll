@@ -0,0 +1,30 @@
+; Check that the backend jobs are started from the most expensive one, and
+; that they keep the task numbers of their input order.
+; RUN: opt -module-summary %s -o %t1.bc
+; RUN: opt -module-summary %p/Inputs/backend-job-order.ll -o %t2.bc
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.o -thinlto-threads=1 \
+; RUN:     -thinlto-job-trace=%t.json \
+; RUN:     -r=%t1.bc,small,plx \
+; RUN:     -r=%t2.bc,large,plx
+; RUN: FileCheck %s --input-file=%t.json
+; RUN: llvm-nm %t.o.1 | FileCheck %s --check-prefix=NM1
+; RUN: llvm-nm %t.o.2 | FileCheck %s --check-prefix=NM2
+
+; CHECK: "traceEvents": [
+; CHECK: "detail": "{{.*}}2.bc"
+; CHECK-NEXT: "task": 2
+; CHECK: "name": "ThinLTO backend"
+; CHECK: "ph": "X"
+; CHECK: "detail": "{{.*}}1.bc"
+; CHECK-NEXT: "task": 1
+; CHECK: "name": "ThinLTO backend"
+
+; NM1: T small
+; NM2: T large
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @small(i32 %x) {
+  ret i32 %x
+}
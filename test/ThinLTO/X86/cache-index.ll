@@ -0,0 +1,39 @@
+; RUN: rm -rf %t.cache
+; RUN: opt -module-hash -module-summary %s -o %t.bc
+
+; Both entries get the same object file, which the cache keeps once.
+; RUN: llvm-lto2 run -o %t.o %t.bc -cache-dir %t.cache -cache-index -O2 -r=%t.bc,globalfunc,plx
+; RUN: llvm-lto2 run -o %t.o %t.bc -cache-dir %t.cache -cache-index -O3 -r=%t.bc,globalfunc,plx
+; RUN: llvm-lto2 run -o %t.o %t.bc -cache-dir %t.cache -cache-index -O2 -r=%t.bc,globalfunc,plx
+; RUN: ls %t.cache | count 4
+; RUN: ls %t.cache | FileCheck %s --check-prefix=FILES
+; RUN: FileCheck %s --check-prefix=INDEX < %t.cache/llvmcache.index
+
+; FILES: llvmcache-content-[[HASH:[0-9a-f]+]]{{$}}
+; FILES: llvmcache.index
+
+; INDEX: A [[ENTRY:llvmcache-[0-9A-F]+]] [[CONTENT:llvmcache-content-[0-9a-f]+]] [[SIZE:[0-9]+]] {{[0-9]+$}}
+; INDEX-NEXT: A {{llvmcache-[0-9A-F]+}} [[CONTENT]] [[SIZE]] {{[0-9]+$}}
+; INDEX-NEXT: U [[ENTRY]] {{[0-9]+$}}
+; INDEX-NOT: {{.}}
+
+; Pruning reads the index and keeps the contents for the entry left.
+; RUN: llvm-lto2 run -o %t.o %t.bc -cache-dir %t.cache -cache-index -O1 -r=%t.bc,globalfunc,plx \
+; RUN:   -cache-policy=prune_interval=0s:cache_size_files=1
+; RUN: ls %t.cache | FileCheck %s --check-prefix=PRUNED
+; RUN: FileCheck %s --check-prefix=SNAPSHOT < %t.cache/llvmcache.snapshot
+
+; PRUNED-NOT: llvmcache.index
+; PRUNED: llvmcache.snapshot
+; PRUNED-NEXT: llvmcache.timestamp
+
+; SNAPSHOT: A {{llvmcache-[0-9A-F]+}} {{llvmcache-content-[0-9a-f]+}} {{[0-9]+}} {{[0-9]+$}}
+; SNAPSHOT-NOT: {{.}}
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define void @globalfunc() {
+entry:
+  ret void
+}
@@ -0,0 +1,48 @@
+; Check that reading the inputs on several threads links them as reading them
+; one after the other does.
+
+; RUN: opt -module-summary %s -o %t1.bc
+; RUN: opt -module-summary %p/Inputs/input-read-threads.ll -o %t2.bc
+; RUN: opt -module-summary %p/Inputs/input-read-threads-regular.ll -o %t3.bc
+
+; RUN: llvm-lto2 run %t1.bc %t2.bc %t3.bc -o %t.serial -save-temps \
+; RUN:   -r=%t1.bc,main,plx -r=%t1.bc,foo,l -r=%t1.bc,bar,l -r=%t1.bc,gv,l \
+; RUN:   -r=%t2.bc,foo,pl -r=%t2.bc,bar,pl -r=%t2.bc,gv,pl -r=%t2.bc,baz,l \
+; RUN:   -r=%t3.bc,baz,pl -r=%t3.bc,baz.alias,pl
+; RUN: llvm-lto2 run %t1.bc %t2.bc %t3.bc -o %t.parallel -save-temps \
+; RUN:   -input-read-threads=4 \
+; RUN:   -r=%t1.bc,main,plx -r=%t1.bc,foo,l -r=%t1.bc,bar,l -r=%t1.bc,gv,l \
+; RUN:   -r=%t2.bc,foo,pl -r=%t2.bc,bar,pl -r=%t2.bc,gv,pl -r=%t2.bc,baz,l \
+; RUN:   -r=%t3.bc,baz,pl -r=%t3.bc,baz.alias,pl
+; RUN: cmp %t.serial.index.bc %t.parallel.index.bc
+; RUN: cmp %t.serial.0 %t.parallel.0
+; RUN: cmp %t.serial.1 %t.parallel.1
+; RUN: cmp %t.serial.2 %t.parallel.2
+
+; The summaries read on other threads drive the import of foo.
+; RUN: llvm-dis %t.parallel.1.3.import.bc -o - | FileCheck %s
+; CHECK: define available_externally {{.*}}i32 @foo()
+
+; Errors name the input file that caused them.
+; RUN: not llvm-lto2 run %t1.bc %t1.bc -o %t.error -input-read-threads=2 \
+; RUN:   -r=%t1.bc,main,plx -r=%t1.bc,foo,l -r=%t1.bc,bar,l -r=%t1.bc,gv,l \
+; RUN:   -r=%t1.bc,main,lx -r=%t1.bc,foo,l -r=%t1.bc,bar,l -r=%t1.bc,gv,l \
+; RUN:   2>&1 | FileCheck %s --check-prefix=ERROR
+; ERROR: failed to add inputs: '{{.*}}1.bc': Expected at most one ThinLTO module per bitcode file
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+@gv = external global i32
+
+declare i32 @foo()
+declare i32 @bar()
+
+define i32 @main() {
+  %1 = call i32 @foo()
+  %2 = call i32 @bar()
+  %3 = load i32, i32* @gv
+  %4 = add i32 %1, %2
+  %5 = add i32 %4, %3
+  ret i32 %5
+}
@@ -0,0 +1,62 @@
+; Check that the out-of-process backend produces the same objects as the
+; in-process one, with and without a memory limit.
+; RUN: opt -module-summary %s -o %t1.bc
+; RUN: opt -module-summary %p/Inputs/out-of-process.ll -o %t2.bc
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.in \
+; RUN:     -r=%t1.bc,main,plx \
+; RUN:     -r=%t1.bc,callee, \
+; RUN:     -r=%t2.bc,callee,px
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.out -thinlto-out-of-process \
+; RUN:     -r=%t1.bc,main,plx \
+; RUN:     -r=%t1.bc,callee, \
+; RUN:     -r=%t2.bc,callee,px
+; RUN: cmp %t.in.1 %t.out.1
+; RUN: cmp %t.in.2 %t.out.2
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.limit -thinlto-out-of-process \
+; RUN:     -thinlto-memory-limit=1 \
+; RUN:     -r=%t1.bc,main,plx \
+; RUN:     -r=%t1.bc,callee, \
+; RUN:     -r=%t2.bc,callee,px
+; RUN: cmp %t.in.1 %t.limit.1
+; RUN: cmp %t.in.2 %t.limit.2
+
+; The backend processes get the codegen and remarks options of the link.
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.flags.in \
+; RUN:     -function-sections -data-sections -relocation-model pic \
+; RUN:     -pass-remarks-output=%t.flags.in.yaml \
+; RUN:     -r=%t1.bc,main,plx \
+; RUN:     -r=%t1.bc,callee, \
+; RUN:     -r=%t2.bc,callee,px
+; RUN: llvm-lto2 run %t1.bc %t2.bc -o %t.flags.out -thinlto-out-of-process \
+; RUN:     -function-sections -data-sections -relocation-model pic \
+; RUN:     -pass-remarks-output=%t.flags.out.yaml \
+; RUN:     -r=%t1.bc,main,plx \
+; RUN:     -r=%t1.bc,callee, \
+; RUN:     -r=%t2.bc,callee,px
+; RUN: cmp %t.flags.in.1 %t.flags.out.1
+; RUN: cmp %t.flags.in.2 %t.flags.out.2
+; RUN: diff %t.flags.in.yaml.thin.1.yaml %t.flags.out.yaml.thin.1.yaml
+; RUN: diff %t.flags.in.yaml.thin.2.yaml %t.flags.out.yaml.thin.2.yaml
+; RUN: llvm-readobj -sections %t.flags.out.1 | FileCheck %s --check-prefix=FLAGS
+; FLAGS: Name: .text.main
+
+; The call to callee is inlined after it is imported.
+; RUN: llvm-nm %t.out.1 | FileCheck %s
+; CHECK-NOT: callee
+; CHECK: T main
+
+; The backend process checks its list of modules.
+; RUN: echo %t1.bc > %t.modules
+; RUN: not llvm-lto2 backend -thinlto-index=%t1.bc -o %t.fail %t.modules 2>&1 \
+; RUN:     | FileCheck %s --check-prefix=FAIL
+; FAIL: ThinLTO backend failed: malformed module list {{.*}}.modules
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+declare i32 @callee(i32)
+
+define i32 @main(i32 %x) {
+  %r = call i32 @callee(i32 %x)
+  ret i32 %r
+}
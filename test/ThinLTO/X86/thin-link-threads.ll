@@ -0,0 +1,79 @@
+; Check that running the thin link on several threads computes the imports,
+; exports and linkages that running it on one thread does.
+
+; RUN: rm -rf %t.serial %t.parallel
+; RUN: mkdir -p %t.serial %t.parallel
+; RUN: opt -module-summary %s -o %t.serial/1.bc
+; RUN: opt -module-summary %p/Inputs/thin-link-threads1.ll -o %t.serial/2.bc
+; RUN: opt -module-summary %p/Inputs/thin-link-threads2.ll -o %t.serial/3.bc
+; RUN: cp %t.serial/1.bc %t.serial/2.bc %t.serial/3.bc %t.parallel
+
+; RUN: cd %t.serial && llvm-lto2 run 1.bc 2.bc 3.bc -o out \
+; RUN:   -thinlto-distributed-indexes \
+; RUN:   -r=1.bc,main,plx -r=1.bc,callback,pl -r=1.bc,foo,l -r=1.bc,bar,l \
+; RUN:   -r=2.bc,foo,pl -r=2.bc,callback,l \
+; RUN:   -r=3.bc,bar,pl -r=3.bc,foo,l
+; RUN: cd %t.parallel && llvm-lto2 run 1.bc 2.bc 3.bc -o out \
+; RUN:   -thinlto-distributed-indexes -thinlto-link-threads=4 \
+; RUN:   -r=1.bc,main,plx -r=1.bc,callback,pl -r=1.bc,foo,l -r=1.bc,bar,l \
+; RUN:   -r=2.bc,foo,pl -r=2.bc,callback,l \
+; RUN:   -r=3.bc,bar,pl -r=3.bc,foo,l
+; RUN: cmp %t.serial/1.bc.thinlto.bc %t.parallel/1.bc.thinlto.bc
+; RUN: cmp %t.serial/2.bc.thinlto.bc %t.parallel/2.bc.thinlto.bc
+; RUN: cmp %t.serial/3.bc.thinlto.bc %t.parallel/3.bc.thinlto.bc
+
+; Internalize a GUID per task, so that the small index is split between the
+; threads.
+; RUN: cd %t.parallel && llvm-lto2 run 1.bc 2.bc 3.bc -o out \
+; RUN:   -thinlto-distributed-indexes -thinlto-link-threads=4 \
+; RUN:   -thinlto-internalize-chunk-size=1 \
+; RUN:   -r=1.bc,main,plx -r=1.bc,callback,pl -r=1.bc,foo,l -r=1.bc,bar,l \
+; RUN:   -r=2.bc,foo,pl -r=2.bc,callback,l \
+; RUN:   -r=3.bc,bar,pl -r=3.bc,foo,l
+; RUN: cmp %t.serial/1.bc.thinlto.bc %t.parallel/1.bc.thinlto.bc
+; RUN: cmp %t.serial/2.bc.thinlto.bc %t.parallel/2.bc.thinlto.bc
+; RUN: cmp %t.serial/3.bc.thinlto.bc %t.parallel/3.bc.thinlto.bc
+
+; RUN: llvm-lto2 run %t.serial/1.bc %t.serial/2.bc %t.serial/3.bc \
+; RUN:   -o %t.serial/out -save-temps \
+; RUN:   -r=%t.serial/1.bc,main,plx -r=%t.serial/1.bc,callback,pl \
+; RUN:   -r=%t.serial/1.bc,foo,l -r=%t.serial/1.bc,bar,l \
+; RUN:   -r=%t.serial/2.bc,foo,pl -r=%t.serial/2.bc,callback,l \
+; RUN:   -r=%t.serial/3.bc,bar,pl -r=%t.serial/3.bc,foo,l
+; RUN: llvm-lto2 run %t.serial/1.bc %t.serial/2.bc %t.serial/3.bc \
+; RUN:   -o %t.parallel/out -thinlto-link-threads=4 \
+; RUN:   -r=%t.serial/1.bc,main,plx -r=%t.serial/1.bc,callback,pl \
+; RUN:   -r=%t.serial/1.bc,foo,l -r=%t.serial/1.bc,bar,l \
+; RUN:   -r=%t.serial/2.bc,foo,pl -r=%t.serial/2.bc,callback,l \
+; RUN:   -r=%t.serial/3.bc,bar,pl -r=%t.serial/3.bc,foo,l
+; RUN: cmp %t.serial/out.1 %t.parallel/out.1
+; RUN: cmp %t.serial/out.2 %t.parallel/out.2
+; RUN: cmp %t.serial/out.3 %t.parallel/out.3
+
+; foo is imported into both other modules, so the locals it uses are exported.
+; RUN: llvm-dis %t.serial/out.1.3.import.bc -o - | \
+; RUN:   FileCheck %s --check-prefix=IMPORT
+; RUN: llvm-dis %t.serial/out.2.3.import.bc -o - | \
+; RUN:   FileCheck %s --check-prefix=EXPORT
+; IMPORT: define available_externally {{.*}}i32 @foo()
+; IMPORT: define available_externally {{.*}}i32 @bar()
+; EXPORT: @counter.llvm.0 = hidden global i32 0
+; EXPORT: define hidden i32 @helper.llvm.0()
+; EXPORT: define available_externally {{.*}}i32 @callback()
+
+target datalayout = "e-m:e-i64:64-f80:128-n8:16:32:64-S128"
+target triple = "x86_64-unknown-linux-gnu"
+
+define i32 @main() {
+  %1 = call i32 @foo()
+  %2 = call i32 @bar()
+  %3 = add i32 %1, %2
+  ret i32 %3
+}
+
+define i32 @callback() {
+  ret i32 1
+}
+
+declare i32 @foo()
+declare i32 @bar()
@@ -0,0 +1,111 @@
+; RUN: opt < %s -sample-profile -sample-profile-file=%S/Inputs/context-sensitive.prof -profile-summary-hot-count=1000 -S | FileCheck %s
+; RUN: opt < %s -passes=sample-profile -sample-profile-file=%S/Inputs/context-sensitive.prof -profile-summary-hot-count=1000 -S | FileCheck %s
+; Only the profiles involving the functions of the module are read from an
+; extbinary profile, which includes the contexts they are inlined in.
+; RUN: llvm-profdata merge -sample -extbinary %S/Inputs/context-sensitive.prof -o %t.extbinary
+; RUN: opt < %s -passes=sample-profile -sample-profile-file=%t.extbinary -profile-summary-hot-count=1000 -S | FileCheck %s
+
+; Context-sensitive profile, where leaf is hot when called from foo but cold
+; when called from baz. The hot contexts of main are inlined with their own
+; samples, while the cold context of baz is not, and its samples, along with
+; those of its callee leaf, are merged into the profiles of baz and leaf.
+;
+; int leaf(int x) {
+;   if (x > 0)
+;     return x * 3;
+;   return 0;
+; }
+; int foo(int x) {
+;   return leaf(x) + 1;
+; }
+; int baz(int x) {
+;   return leaf(x) - 1;
+; }
+; int main(int n) {
+;   int a = foo(n);
+;   if (a > 0) a -= baz(n);
+;   return a;
+; }
+
+define i32 @leaf(i32 %x) !dbg !6 {
+; CHECK-LABEL: @leaf(
+; CHECK-SAME: !prof ![[LEAF_ENTRY:[0-9]+]]
+; CHECK: br i1 %cmp, label %if.then, label %return, {{.*}}!prof ![[LEAF_BASE:[0-9]+]]
+entry:
+  %cmp = icmp sgt i32 %x, 0, !dbg !9
+  br i1 %cmp, label %if.then, label %return, !dbg !9
+
+if.then:
+  %mul = mul nsw i32 %x, 3, !dbg !10
+  br label %return, !dbg !10
+
+return:
+  %r = phi i32 [ %mul, %if.then ], [ 0, %entry ]
+  ret i32 %r, !dbg !11
+}
+
+define i32 @foo(i32 %x) !dbg !12 {
+entry:
+  %call = call i32 @leaf(i32 %x), !dbg !13
+  %add = add nsw i32 %call, 1, !dbg !13
+  ret i32 %add, !dbg !13
+}
+
+define i32 @baz(i32 %x) !dbg !14 {
+; CHECK-LABEL: @baz(
+; CHECK-SAME: !prof ![[LEAF_ENTRY]]
+; CHECK: call i32 @leaf(
+entry:
+  %call = call i32 @leaf(i32 %x), !dbg !15
+  %sub = sub nsw i32 %call, 1, !dbg !15
+  ret i32 %sub, !dbg !15
+}
+
+define i32 @main(i32 %n) !dbg !16 {
+; CHECK-LABEL: @main(
+; CHECK-NOT: call i32 @foo(
+; CHECK-NOT: call i32 @leaf(
+; CHECK: br i1 {{.*}}!prof ![[LEAF_FOO:[0-9]+]]
+; CHECK: call i32 @baz(
+entry:
+  %a = call i32 @foo(i32 %n), !dbg !17
+  %cmp = icmp sgt i32 %a, 0, !dbg !18
+  br i1 %cmp, label %if.then, label %return, !dbg !18
+
+if.then:
+  %b = call i32 @baz(i32 %n), !dbg !18
+  %sub = sub nsw i32 %a, %b, !dbg !18
+  br label %return, !dbg !18
+
+return:
+  %r = phi i32 [ %sub, %if.then ], [ %a, %entry ]
+  ret i32 %r, !dbg !19
+}
+
+; CHECK-DAG: ![[LEAF_ENTRY]] = !{!"function_entry_count", i64 11}
+; CHECK-DAG: ![[LEAF_BASE]] = !{!"branch_weights", i32 2, i32 11}
+; CHECK-DAG: ![[LEAF_FOO]] = !{!"branch_weights", i32 1001, i32 1}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+!llvm.ident = !{!5}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang version 10.0.0", isOptimized: true, runtimeVersion: 0, emissionKind: LineTablesOnly, enums: !2)
+!1 = !DIFile(filename: "context-sensitive.c", directory: ".")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !{!"clang version 10.0.0"}
+!6 = distinct !DISubprogram(name: "leaf", scope: !1, file: !1, line: 1, type: !7, scopeLine: 1, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!7 = !DISubroutineType(types: !2)
+!9 = !DILocation(line: 2, column: 9, scope: !6)
+!10 = !DILocation(line: 3, column: 14, scope: !6)
+!11 = !DILocation(line: 4, column: 3, scope: !6)
+!12 = distinct !DISubprogram(name: "foo", scope: !1, file: !1, line: 6, type: !7, scopeLine: 6, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!13 = !DILocation(line: 7, column: 10, scope: !12)
+!14 = distinct !DISubprogram(name: "baz", scope: !1, file: !1, line: 9, type: !7, scopeLine: 9, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!15 = !DILocation(line: 10, column: 10, scope: !14)
+!16 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 12, type: !7, scopeLine: 12, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!17 = !DILocation(line: 13, column: 11, scope: !16)
+!18 = !DILocation(line: 14, column: 11, scope: !16)
+!19 = !DILocation(line: 15, column: 12, scope: !16)
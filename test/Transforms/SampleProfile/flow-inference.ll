@@ -0,0 +1,64 @@
+; RUN: opt < %s -sample-profile -sample-profile-file=%S/Inputs/flow-inference.prof -S | FileCheck %s --check-prefix=PROPAGATE
+; RUN: opt < %s -sample-profile -sample-profile-file=%S/Inputs/flow-inference.prof -sample-profile-use-flow-inference -S | FileCheck %s --check-prefix=FLOW
+; RUN: opt < %s -passes=sample-profile -sample-profile-file=%S/Inputs/flow-inference.prof -sample-profile-use-flow-inference -S | FileCheck %s --check-prefix=FLOW
+; RUN: opt < %s -passes=sample-profile -sample-profile-file=%S/Inputs/flow-inference.prof -sample-profile-use-flow-inference -sample-profile-annotation-threads=2 -S | FileCheck %s --check-prefix=FLOW
+
+; The blocks %a and %b have no samples, and both of them branch to %c and %d,
+; so every block has at least two edges of unknown weight and the propagation
+; cannot find any of them. The flow inference sends the samples of %c and %d
+; through %a, the cheapest way to balance the flow.
+
+define i32 @foo(i32 %x, i32 %y) !dbg !6 {
+entry:
+; PROPAGATE: br i1 %cmp, label %a, label %b, !dbg !{{[0-9]+}}{{$}}
+; FLOW: br i1 %cmp, label %a, label %b, !dbg !{{[0-9]+}}, !prof ![[ENTRY:[0-9]+]]
+  %cmp = icmp sgt i32 %x, 0, !dbg !9
+  br i1 %cmp, label %a, label %b, !dbg !9
+
+a:
+; PROPAGATE: br i1 %cmp1, label %c, label %d, !dbg !{{[0-9]+}}{{$}}
+; FLOW: br i1 %cmp1, label %c, label %d, !dbg !{{[0-9]+}}, !prof ![[A:[0-9]+]]
+  %cmp1 = icmp sgt i32 %y, 0, !dbg !10
+  br i1 %cmp1, label %c, label %d, !dbg !10
+
+b:
+; PROPAGATE: br i1 %cmp2, label %c, label %d, !dbg !{{[0-9]+}}{{$}}
+; FLOW: br i1 %cmp2, label %c, label %d, !dbg !{{[0-9]+}}{{$}}
+  %cmp2 = icmp slt i32 %y, 0, !dbg !12
+  br i1 %cmp2, label %c, label %d, !dbg !12
+
+c:
+  %add = add nsw i32 %x, %y, !dbg !11
+  br label %exit, !dbg !11
+
+d:
+  %sub = sub nsw i32 %x, %y, !dbg !13
+  br label %exit, !dbg !13
+
+exit:
+  %r = phi i32 [ %add, %c ], [ %sub, %d ]
+  ret i32 %r, !dbg !14
+}
+
+; PROPAGATE-NOT: branch_weights
+; FLOW-DAG: ![[ENTRY]] = !{!"branch_weights", i32 101, i32 1}
+; FLOW-DAG: ![[A]] = !{!"branch_weights", i32 61, i32 41}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+!llvm.ident = !{!5}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang version 10.0.0", isOptimized: true, runtimeVersion: 0, emissionKind: LineTablesOnly, enums: !2)
+!1 = !DIFile(filename: "flow-inference.c", directory: ".")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !{!"clang version 10.0.0"}
+!6 = distinct !DISubprogram(name: "foo", scope: !1, file: !1, line: 1, type: !7, scopeLine: 1, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!7 = !DISubroutineType(types: !2)
+!9 = !DILocation(line: 2, column: 9, scope: !6)
+!10 = !DILocation(line: 3, column: 11, scope: !6)
+!11 = !DILocation(line: 4, column: 16, scope: !6)
+!12 = !DILocation(line: 5, column: 16, scope: !6)
+!13 = !DILocation(line: 6, column: 14, scope: !6)
+!14 = !DILocation(line: 8, column: 3, scope: !6)
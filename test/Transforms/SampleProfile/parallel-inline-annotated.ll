@@ -0,0 +1,56 @@
+; A function that is annotated before it is inlined keeps its own branch
+; weights in the body of its caller. Annotating the functions in parallel
+; must not change this.
+; RUN: opt < %s -passes=sample-profile -sample-profile-file=%S/Inputs/parallel-inline-annotated.prof -S -o %t.serial.ll
+; RUN: opt < %s -passes=sample-profile -sample-profile-file=%S/Inputs/parallel-inline-annotated.prof -sample-profile-annotation-threads=2 -S -o %t.parallel.ll
+; RUN: diff %t.serial.ll %t.parallel.ll
+; RUN: FileCheck %s < %t.parallel.ll
+
+; CHECK-LABEL: define i32 @_Z3fooi(
+; CHECK: br i1 %cmp, label %if.then, label %if.else, !dbg !{{[0-9]+}}, !prof ![[FOO:[0-9]+]]
+; CHECK-LABEL: define i32 @main(
+; CHECK: br i1 %cmp.i, label %if.then.i, label %if.else.i, !dbg !{{[0-9]+}}, !prof ![[FOO]]
+; CHECK: ![[FOO]] = !{!"branch_weights", i32 91, i32 11}
+
+define i32 @_Z3fooi(i32 %x) !dbg !6 {
+entry:
+  %cmp = icmp sgt i32 %x, 0, !dbg !9
+  br i1 %cmp, label %if.then, label %if.else, !dbg !10
+
+if.then:
+  %a = add i32 %x, 1, !dbg !11
+  br label %if.end, !dbg !11
+
+if.else:
+  %b = sub i32 %x, 1, !dbg !12
+  br label %if.end, !dbg !12
+
+if.end:
+  %r = phi i32 [ %a, %if.then ], [ %b, %if.else ]
+  ret i32 %r, !dbg !13
+}
+
+define i32 @main(i32 %n) !dbg !14 {
+entry:
+  %c = call i32 @_Z3fooi(i32 %n), !dbg !15
+  ret i32 %c, !dbg !16
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C_plus_plus, file: !1, producer: "clang", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "parallel-inline-annotated.cc", directory: ".")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !DISubroutineType(types: !2)
+!6 = distinct !DISubprogram(name: "foo", linkageName: "_Z3fooi", scope: !1, file: !1, line: 1, type: !5, scopeLine: 1, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!9 = !DILocation(line: 1, column: 7, scope: !6)
+!10 = !DILocation(line: 2, column: 7, scope: !6)
+!11 = !DILocation(line: 3, column: 5, scope: !6)
+!12 = !DILocation(line: 4, column: 5, scope: !6)
+!13 = !DILocation(line: 5, column: 3, scope: !6)
+!14 = distinct !DISubprogram(name: "main", scope: !1, file: !1, line: 10, type: !5, scopeLine: 10, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!15 = !DILocation(line: 11, column: 10, scope: !14)
+!16 = !DILocation(line: 12, column: 3, scope: !14)
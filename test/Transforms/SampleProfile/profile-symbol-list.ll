@@ -0,0 +1,71 @@
+; RUN: llvm-profdata merge -sample -extbinary -prof-sym-list=%S/Inputs/profile-symbol-list.text %S/Inputs/profile-symbol-list.prof -o %t.profdata
+; RUN: opt < %s -sample-profile -sample-profile-file=%t.profdata -codegenprepare -S | FileCheck %s
+; RUN: opt < %s -sample-profile -sample-profile-file=%t.profdata -profile-accurate-for-symsinlist=false -codegenprepare -S | FileCheck %s --check-prefix=NOSYMLIST
+
+target triple = "x86_64-pc-linux-gnu"
+
+; The test checks that a function in the profile symbol list but without
+; samples is treated as cold, while a function that is not in the list may be
+; new and is treated conservatively as unknown.
+
+declare void @hot_func()
+
+; CHECK: cold_in_list{{.*}}!prof ![[ZERO_ID:[0-9]+]] !section_prefix ![[COLD_ID:[0-9]+]]
+; NOSYMLIST-NOT: cold_in_list{{.*}}!section_prefix
+; NOSYMLIST: cold_in_list{{.*}}!prof ![[UNKNOWN_ID:[0-9]+]]
+define void @cold_in_list() {
+  call void @hot_func()
+  ret void
+}
+
+; CHECK-NOT: new_func{{.*}}!section_prefix
+; CHECK: new_func{{.*}}!prof ![[UNKNOWN_ID:[0-9]+]]
+define void @new_func() {
+  call void @hot_func()
+  ret void
+}
+
+; _Z3sumii only has samples where it was inlined into main, which is not
+; defined in this module, so its profile is not read. _Z3mulii is inlined into
+; that inlined _Z3sumii, and _Z3subii is only a call target in it. Either is
+; enough to tell that a function is not cold.
+; CHECK-NOT: _Z3sumii{{.*}}!section_prefix
+; CHECK: _Z3sumii{{.*}}!prof ![[UNKNOWN_ID]]
+define i32 @_Z3sumii(i32 %x, i32 %y) {
+  %add = add i32 %x, %y
+  ret i32 %add
+}
+
+; CHECK-NOT: _Z3mulii{{.*}}!section_prefix
+; CHECK: _Z3mulii{{.*}}!prof ![[UNKNOWN_ID]]
+define i32 @_Z3mulii(i32 %x, i32 %y) {
+  %mul = mul i32 %x, %y
+  ret i32 %mul
+}
+
+; CHECK-NOT: _Z3subii{{.*}}!section_prefix
+; CHECK: _Z3subii{{.*}}!prof ![[UNKNOWN_ID]]
+define i32 @_Z3subii(i32 %x, i32 %y) {
+  %sub = sub i32 %x, %y
+  ret i32 %sub
+}
+
+; CHECK-DAG: ![[UNKNOWN_ID]] = !{!"function_entry_count", i64 -1}
+; CHECK-DAG: ![[ZERO_ID]] = !{!"function_entry_count", i64 0}
+; CHECK-DAG: ![[COLD_ID]] = !{!"function_section_prefix", !".unlikely"}
+; NOSYMLIST: ![[UNKNOWN_ID]] = !{!"function_entry_count", i64 -1}
+!llvm.module.flags = !{!1}
+!1 = !{i32 1, !"ProfileSummary", !2}
+!2 = !{!3, !4, !5, !6, !7, !8, !9, !10}
+!3 = !{!"ProfileFormat", !"SampleProfile"}
+!4 = !{!"TotalCount", i64 10000}
+!5 = !{!"MaxCount", i64 1000}
+!6 = !{!"MaxInternalCount", i64 1}
+!7 = !{!"MaxFunctionCount", i64 1000}
+!8 = !{!"NumCounts", i64 3}
+!9 = !{!"NumFunctions", i64 3}
+!10 = !{!"DetailedSummary", !11}
+!11 = !{!12, !13, !14}
+!12 = !{i32 10000, i64 100, i32 1}
+!13 = !{i32 999000, i64 100, i32 1}
+!14 = !{i32 999999, i64 1, i32 2}
@@ -0,0 +1,51 @@
+; REQUIRES: asserts
+; RUN: opt < %s -sample-profile -sample-profile-file=%S/Inputs/propagate-stats.prof -stats -disable-output 2>&1 | FileCheck %s
+; RUN: opt < %s -passes=sample-profile -sample-profile-file=%S/Inputs/propagate-stats.prof -stats -disable-output 2>&1 | FileCheck %s
+
+; Each of the three phases of the propagation visits all the blocks once. In
+; @foo, the first two phases set the weights of the edges, after which they
+; only visit 3 of the 4 blocks again: 3 * 4 + 2 * 3 = 18 visits. @bar has a
+; single block, visited once per phase.
+; CHECK: 18 sample-profile - Largest number of blocks visited by the edge weight propagation of a single function
+; CHECK: 21 sample-profile - Number of blocks visited by the edge weight propagation
+
+define i32 @foo(i32 %x) !dbg !6 {
+entry:
+  %cmp = icmp sgt i32 %x, 0, !dbg !9
+  br i1 %cmp, label %if.then, label %if.else, !dbg !10
+
+if.then:
+  %a = add i32 %x, 1, !dbg !11
+  br label %if.end, !dbg !11
+
+if.else:
+  %b = sub i32 %x, 1, !dbg !12
+  br label %if.end, !dbg !12
+
+if.end:
+  %r = phi i32 [ %a, %if.then ], [ %b, %if.else ]
+  ret i32 %r, !dbg !13
+}
+
+define i32 @bar(i32 %x) !dbg !14 {
+entry:
+  ret i32 %x, !dbg !15
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "propagate-stats.c", directory: ".")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !DISubroutineType(types: !2)
+!6 = distinct !DISubprogram(name: "foo", scope: !1, file: !1, line: 1, type: !5, scopeLine: 1, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!9 = !DILocation(line: 1, column: 7, scope: !6)
+!10 = !DILocation(line: 2, column: 7, scope: !6)
+!11 = !DILocation(line: 3, column: 5, scope: !6)
+!12 = !DILocation(line: 4, column: 5, scope: !6)
+!13 = !DILocation(line: 5, column: 3, scope: !6)
+!14 = distinct !DISubprogram(name: "bar", scope: !1, file: !1, line: 10, type: !5, scopeLine: 10, flags: DIFlagPrototyped, spFlags: DISPFlagDefinition | DISPFlagOptimized, unit: !0, retainedNodes: !2)
+!15 = !DILocation(line: 10, column: 3, scope: !14)
@@ -1,4 +1,9 @@
 ; RUN: opt %s -passes=sample-profile -sample-profile-file=%S/Inputs/remap.prof -sample-profile-remapping-file=%S/Inputs/remap.map | opt -analyze -branch-prob | FileCheck %s
+; RUN: opt %s -passes=sample-profile -sample-profile-file=%S/Inputs/remap.prof -sample-profile-remapping-file=%S/Inputs/remap.map -sample-profile-flatten-all=false | opt -analyze -branch-prob | FileCheck %s
+; Profiles that only store name hashes can be remapped if they keep the
+; original names.
+; RUN: llvm-profdata merge -sample -compbinary -keep-original-names %S/Inputs/remap.prof -o %t.compact.afdo
+; RUN: opt %s -passes=sample-profile -sample-profile-file=%t.compact.afdo -sample-profile-remapping-file=%S/Inputs/remap.map | opt -analyze -branch-prob | FileCheck %s
 
 ; Reduced from branch.ll
 
@@ -190,6 +190,9 @@ namespace options {
   static std::string cache_dir;
   // Optional pruning policy for ThinLTO caches.
   static std::string cache_policy;
+  // Deduplicate ThinLTO cache entries and record them in an index that the
+  // pruner reads instead of scanning the cache directory.
+  static bool cache_index = false;
   // Additional options to pass into the code generator.
   // Note: This array will contain all plugin options which are not claimed
   // as plugin exclusive to pass to the code generator.
@@ -204,6 +207,8 @@ namespace options {
   static std::string dwo_dir;
   /// Statistics output filename.
   static std::string stats_file;
+  /// ThinLTO backend job trace filename.
+  static std::string thinlto_job_trace;
 
   // Optimization remarks filename, accepted passes and hotness options
   static std::string OptRemarksFilename;
@@ -259,6 +264,8 @@ namespace options {
       cache_dir = opt.substr(strlen("cache-dir="));
     } else if (opt.startswith("cache-policy=")) {
       cache_policy = opt.substr(strlen("cache-policy="));
+    } else if (opt == "cache-index") {
+      cache_index = true;
     } else if (opt.size() == 2 && opt[0] == 'O') {
       if (opt[1] < '0' || opt[1] > '3')
         message(LDPL_FATAL, "Optimization level must be between 0 and 3");
@@ -292,6 +299,8 @@ namespace options {
       OptRemarksWithHotness = true;
     } else if (opt.startswith("stats-file=")) {
       stats_file = opt.substr(strlen("stats-file="));
+    } else if (opt.startswith("thinlto-job-trace=")) {
+      thinlto_job_trace = opt.substr(strlen("thinlto-job-trace="));
     } else {
       // Save this option to pass to the code generator.
       // ParseCommandLineOptions() expects argv[0] to be program name. Lazily
@@ -920,6 +929,7 @@ static std::unique_ptr<LTO> createLTO(IndexWriteCallback OnIndexWrite,
   Conf.DebugPassManager = options::debug_pass_manager;
 
   Conf.StatsFile = options::stats_file;
+  Conf.ThinLTOJobTraceFile = options::thinlto_job_trace;
   return llvm::make_unique<LTO>(std::move(Conf), Backend,
                                 options::ParallelCodeGenParallelismLevel);
 }
@@ -1052,7 +1062,8 @@ static std::vector<std::pair<SmallString<128>, bool>> runLTO() {
 
   NativeObjectCache Cache;
   if (!options::cache_dir.empty())
-    Cache = check(localCache(options::cache_dir, AddBuffer));
+    Cache = check(
+        localCache(options::cache_dir, AddBuffer, options::cache_index));
 
   check(Lto->run(AddStream, Cache));
 
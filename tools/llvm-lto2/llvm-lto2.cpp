@@ -20,6 +20,7 @@
 #include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/LTO/Caching.h"
 #include "llvm/LTO/LTO.h"
+#include "llvm/Support/CachePruning.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/InitLLVM.h"
@@ -49,6 +50,16 @@ static cl::opt<std::string> OutputFilename("o", cl::Required,
 static cl::opt<std::string> CacheDir("cache-dir", cl::desc("Cache Directory"),
                                      cl::value_desc("directory"));
 
+static cl::opt<bool>
+    CacheIndex("cache-index",
+               cl::desc("Deduplicate cache entries and record them in the "
+                        "cache index"));
+
+static cl::opt<std::string>
+    CachePolicy("cache-policy",
+                cl::desc("Prune the cache with this policy after linking"),
+                cl::value_desc("policy"));
+
 static cl::opt<std::string> OptPipeline("opt-pipeline",
                                         cl::desc("Optimizer Pipeline"),
                                         cl::value_desc("pipeline"));
@@ -68,6 +79,34 @@ static cl::opt<bool>
 static cl::opt<int> Threads("thinlto-threads",
                             cl::init(llvm::heavyweight_hardware_concurrency()));
 
+static cl::opt<unsigned> InputReadThreads(
+    "input-read-threads", cl::init(1),
+    cl::desc("Number of threads reading the symbol tables and summaries of the "
+             "input files, which are then added to the link together"));
+
+static cl::opt<unsigned> ThinLinkThreads(
+    "thinlto-link-threads", cl::init(1),
+    cl::desc("Number of threads computing the cross-module imports and "
+             "internalizing the combined index in the thin link"));
+
+static cl::opt<bool> ThinLTOOutOfProcess(
+    "thinlto-out-of-process", cl::init(false),
+    cl::desc("Run each ThinLTO backend job in a llvm-lto2 backend process"));
+
+static cl::opt<unsigned> ThinLTOMemoryLimit(
+    "thinlto-memory-limit", cl::init(0),
+    cl::desc("Estimated memory, in megabytes, that the ThinLTO backend "
+             "processes may use at the same time (0 = no limit)"));
+
+static cl::opt<std::string>
+    ThinLTOIndex("thinlto-index",
+                 cl::desc("The index of the module of a backend job"),
+                 cl::value_desc("filename"));
+
+static cl::opt<unsigned>
+    ThinLTOTask("thinlto-task", cl::init(0),
+                cl::desc("The task number of a backend job"));
+
 static cl::list<std::string> SymbolResolutions(
     "r",
     cl::desc("Specify a symbol resolution: filename,symbolname,resolution\n"
@@ -131,6 +170,11 @@ static cl::opt<bool>
 static cl::opt<std::string>
     StatsFile("stats-file", cl::desc("Filename to write statistics to"));
 
+static cl::opt<std::string> ThinLTOJobTrace(
+    "thinlto-job-trace",
+    cl::desc("Filename to write the wall time of the ThinLTO backend jobs to, "
+             "in the Chrome trace event format"));
+
 static void check(Error E, std::string Msg) {
   if (!E)
     return;
@@ -159,50 +203,11 @@ template <typename T> static T check(ErrorOr<T> E, std::string Msg) {
 }
 
 static int usage() {
-  errs() << "Available subcommands: dump-symtab run\n";
+  errs() << "Available subcommands: backend dump-symtab run\n";
   return 1;
 }
 
-static int run(int argc, char **argv) {
-  cl::ParseCommandLineOptions(argc, argv, "Resolution-based LTO test harness");
-
-  // FIXME: Workaround PR30396 which means that a symbol can appear
-  // more than once if it is defined in module-level assembly and
-  // has a GV declaration. We allow (file, symbol) pairs to have multiple
-  // resolutions and apply them in the order observed.
-  std::map<std::pair<std::string, std::string>, std::list<SymbolResolution>>
-      CommandLineResolutions;
-  for (std::string R : SymbolResolutions) {
-    StringRef Rest = R;
-    StringRef FileName, SymbolName;
-    std::tie(FileName, Rest) = Rest.split(',');
-    if (Rest.empty()) {
-      llvm::errs() << "invalid resolution: " << R << '\n';
-      return 1;
-    }
-    std::tie(SymbolName, Rest) = Rest.split(',');
-    SymbolResolution Res;
-    for (char C : Rest) {
-      if (C == 'p')
-        Res.Prevailing = true;
-      else if (C == 'l')
-        Res.FinalDefinitionInLinkageUnit = true;
-      else if (C == 'x')
-        Res.VisibleToRegularObj = true;
-      else if (C == 'r')
-        Res.LinkerRedefined = true;
-      else {
-        llvm::errs() << "invalid character " << C << " in resolution: " << R
-                     << '\n';
-        return 1;
-      }
-    }
-    CommandLineResolutions[{FileName, SymbolName}].push_back(Res);
-  }
-
-  std::vector<std::unique_ptr<MemoryBuffer>> MBs;
-
-  Config Conf;
+static void setConfigOptions(Config &Conf) {
   Conf.DiagHandler = [](const DiagnosticInfo &DI) {
     DiagnosticPrinterRawOStream DP(errs());
     DI.print(DP);
@@ -220,10 +225,6 @@ static int run(int argc, char **argv) {
 
   Conf.DebugPassManager = DebugPassManager;
 
-  if (SaveTemps)
-    check(Conf.addSaveTemps(OutputFilename + "."),
-          "Config::addSaveTemps failed");
-
   // Optimization remarks.
   Conf.RemarksFilename = OptRemarksOutput;
   Conf.RemarksPasses = OptRemarksPasses;
@@ -254,7 +255,7 @@ static int run(int argc, char **argv) {
     break;
   default:
     llvm::errs() << "invalid cg optimization level: " << CGOptLevel << '\n';
-    return 1;
+    exit(1);
   }
 
   if (FileType.getNumOccurrences())
@@ -262,7 +263,102 @@ static int run(int argc, char **argv) {
 
   Conf.OverrideTriple = OverrideTriple;
   Conf.DefaultTriple = DefaultTriple;
+}
+
+// The options of a backend process that configure the backend jobs the same
+// way as this process: all the options of \p Argv except the input files and
+// the options that only describe the link.
+static std::vector<std::string> getBackendArgs(int Argc, char **Argv) {
+  static const char *const LinkOptions[] = {
+      "o",
+      "r",
+      "cache-dir",
+      "cache-index",
+      "cache-policy",
+      "save-temps",
+      "stats-file",
+      "input-read-threads",
+      "thinlto-distributed-indexes",
+      "thinlto-index",
+      "thinlto-job-trace",
+      "thinlto-link-threads",
+      "thinlto-memory-limit",
+      "thinlto-out-of-process",
+      "thinlto-task",
+      "thinlto-threads"};
+  StringMap<cl::Option *> &Options = cl::getRegisteredOptions();
+  std::vector<std::string> Args = {"backend"};
+  for (int I = 1; I < Argc; ++I) {
+    StringRef Arg = Argv[I];
+    if (!Arg.startswith("-") || Arg == "-")
+      continue;
+    StringRef Name, Value;
+    std::tie(Name, Value) = Arg.ltrim('-').split('=');
+    // An option without a value may take the next argument as its value.
+    auto It = Options.find(Name);
+    bool TakesNext = !Arg.contains('=') && It != Options.end() &&
+                     It->second->getValueExpectedFlag() == cl::ValueRequired &&
+                     I + 1 < Argc;
+    if (!is_contained(LinkOptions, Name)) {
+      Args.push_back(Arg);
+      if (TakesNext)
+        Args.push_back(Argv[I + 1]);
+    }
+    if (TakesNext)
+      ++I;
+  }
+  return Args;
+}
+
+static int run(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "Resolution-based LTO test harness");
+
+  // FIXME: Workaround PR30396 which means that a symbol can appear
+  // more than once if it is defined in module-level assembly and
+  // has a GV declaration. We allow (file, symbol) pairs to have multiple
+  // resolutions and apply them in the order observed.
+  std::map<std::pair<std::string, std::string>, std::list<SymbolResolution>>
+      CommandLineResolutions;
+  for (std::string R : SymbolResolutions) {
+    StringRef Rest = R;
+    StringRef FileName, SymbolName;
+    std::tie(FileName, Rest) = Rest.split(',');
+    if (Rest.empty()) {
+      llvm::errs() << "invalid resolution: " << R << '\n';
+      return 1;
+    }
+    std::tie(SymbolName, Rest) = Rest.split(',');
+    SymbolResolution Res;
+    for (char C : Rest) {
+      if (C == 'p')
+        Res.Prevailing = true;
+      else if (C == 'l')
+        Res.FinalDefinitionInLinkageUnit = true;
+      else if (C == 'x')
+        Res.VisibleToRegularObj = true;
+      else if (C == 'r')
+        Res.LinkerRedefined = true;
+      else {
+        llvm::errs() << "invalid character " << C << " in resolution: " << R
+                     << '\n';
+        return 1;
+      }
+    }
+    CommandLineResolutions[{FileName, SymbolName}].push_back(Res);
+  }
+
+  std::vector<std::unique_ptr<MemoryBuffer>> MBs;
+
+  Config Conf;
+  setConfigOptions(Conf);
+
+  if (SaveTemps)
+    check(Conf.addSaveTemps(OutputFilename + "."),
+          "Config::addSaveTemps failed");
+
   Conf.StatsFile = StatsFile;
+  Conf.ThinLTOJobTraceFile = ThinLTOJobTrace;
+  Conf.ThinLinkThreads = ThinLinkThreads;
 
   ThinBackend Backend;
   if (ThinLTODistributedIndexes)
@@ -271,18 +367,19 @@ static int run(int argc, char **argv) {
                                             /* ShouldEmitImportsFiles */ true,
                                             /* LinkedObjectsFile */ nullptr,
                                             /* OnWrite */ {});
+  else if (ThinLTOOutOfProcess)
+    Backend = createOutOfProcessThinBackend(
+        sys::fs::getMainExecutable(argv[0], (void *)&usage),
+        getBackendArgs(argc, argv), Threads,
+        uint64_t(ThinLTOMemoryLimit) << 20);
   else
     Backend = createInProcessThinBackend(Threads);
   LTO Lto(std::move(Conf), std::move(Backend));
 
   bool HasErrors = false;
-  for (std::string F : InputFilenames) {
-    std::unique_ptr<MemoryBuffer> MB = check(MemoryBuffer::getFile(F), F);
-    std::unique_ptr<InputFile> Input =
-        check(InputFile::create(MB->getMemBufferRef()), F);
-
+  auto GetResolutions = [&](const std::string &F, InputFile &Input) {
     std::vector<SymbolResolution> Res;
-    for (const InputFile::Symbol &Sym : Input->symbols()) {
+    for (const InputFile::Symbol &Sym : Input.symbols()) {
       auto I = CommandLineResolutions.find({F, Sym.getName()});
       if (I == CommandLineResolutions.end()) {
         llvm::errs() << argv[0] << ": missing symbol resolution for " << F
@@ -295,12 +392,40 @@ static int run(int argc, char **argv) {
           CommandLineResolutions.erase(I);
       }
     }
+    return Res;
+  };
 
-    if (HasErrors)
-      continue;
+  if (InputReadThreads <= 1) {
+    for (std::string F : InputFilenames) {
+      std::unique_ptr<MemoryBuffer> MB = check(MemoryBuffer::getFile(F), F);
+      std::unique_ptr<InputFile> Input =
+          check(InputFile::create(MB->getMemBufferRef()), F);
+
+      std::vector<SymbolResolution> Res = GetResolutions(F, *Input);
+      if (HasErrors)
+        continue;
 
-    MBs.push_back(std::move(MB));
-    check(Lto.add(std::move(Input), Res), F);
+      MBs.push_back(std::move(MB));
+      check(Lto.add(std::move(Input), Res), F);
+    }
+  } else {
+    std::vector<MemoryBufferRef> Objects;
+    for (std::string F : InputFilenames) {
+      MBs.push_back(check(MemoryBuffer::getFile(F), F));
+      Objects.push_back(MBs.back()->getMemBufferRef());
+    }
+    std::vector<Expected<std::unique_ptr<InputFile>>> InputsOrErr =
+        InputFile::create(Objects, InputReadThreads);
+
+    std::vector<std::unique_ptr<InputFile>> Inputs;
+    std::vector<std::vector<SymbolResolution>> Res;
+    for (unsigned I = 0; I != InputFilenames.size(); ++I) {
+      Inputs.push_back(check(std::move(InputsOrErr[I]), InputFilenames[I]));
+      Res.push_back(GetResolutions(InputFilenames[I], *Inputs.back()));
+    }
+    if (!HasErrors)
+      check(Lto.add(std::move(Inputs), Res, InputReadThreads),
+            "failed to add inputs");
   }
 
   if (!CommandLineResolutions.empty()) {
@@ -329,9 +454,39 @@ static int run(int argc, char **argv) {
 
   NativeObjectCache Cache;
   if (!CacheDir.empty())
-    Cache = check(localCache(CacheDir, AddBuffer), "failed to create cache");
+    Cache = check(localCache(CacheDir, AddBuffer, CacheIndex),
+                  "failed to create cache");
 
   check(Lto.run(AddStream, Cache), "LTO::run failed");
+
+  if (!CacheDir.empty() && !CachePolicy.empty())
+    pruneCache(CacheDir, check(parseCachePruningPolicy(CachePolicy),
+                               "invalid cache policy"));
+  return 0;
+}
+
+static int backend(int argc, char **argv) {
+  cl::ParseCommandLineOptions(argc, argv, "ThinLTO backend process");
+
+  if (InputFilenames.size() != 1 || ThinLTOIndex.empty()) {
+    errs() << argv[0] << ": expected -thinlto-index and one module list\n";
+    return 1;
+  }
+
+  Config Conf;
+  setConfigOptions(Conf);
+
+  auto AddStream = [&](size_t Task) -> std::unique_ptr<NativeObjectStream> {
+    std::error_code EC;
+    auto S = llvm::make_unique<raw_fd_ostream>(OutputFilename, EC,
+                                               sys::fs::F_None);
+    check(EC, OutputFilename);
+    return llvm::make_unique<NativeObjectStream>(std::move(S));
+  };
+
+  check(runThinBackendWorker(Conf, ThinLTOTask, ThinLTOIndex,
+                             InputFilenames.front(), AddStream),
+        "ThinLTO backend failed");
   return 0;
 }
 
@@ -425,5 +580,7 @@ int main(int argc, char **argv) {
     return dumpSymtab(argc - 1, argv + 1);
   if (Subcommand == "run")
     return run(argc - 1, argv + 1);
+  if (Subcommand == "backend")
+    return backend(argc - 1, argv + 1);
   return usage();
 }
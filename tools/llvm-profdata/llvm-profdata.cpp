@@ -10,9 +10,11 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include "llvm/ADT/Hashing.h"
 #include "llvm/ADT/SmallSet.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/StringSet.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/ProfileData/InstrProfReader.h"
 #include "llvm/ProfileData/InstrProfWriter.h"
@@ -23,13 +25,19 @@
 #include "llvm/Support/Errc.h"
 #include "llvm/Support/FileSystem.h"
 #include "llvm/Support/Format.h"
+#include "llvm/Support/FormatVariadic.h"
 #include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/StringSaver.h"
 #include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/WithColor.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
 #include <algorithm>
+#include <tuple>
 
 using namespace llvm;
 
@@ -37,6 +45,7 @@ enum ProfileFormat {
   PF_None = 0,
   PF_Text,
   PF_Compact_Binary,
+  PF_Ext_Binary,
   PF_GCC,
   PF_Binary
 };
@@ -299,6 +308,10 @@ static void mergeInstrProfile(const WeightedFileVector &Inputs,
   std::mutex ErrorLock;
   SmallSet<instrprof_error, 4> WriterErrorCodes;
 
+  // Writing an indexed profile scales with the size of the merged profile
+  // rather than with the number of inputs.
+  unsigned WriterThreads = NumThreads ? NumThreads : hardware_concurrency();
+
   // If NumThreads is not specified, auto-detect a good default.
   if (NumThreads == 0)
     NumThreads =
@@ -363,17 +376,19 @@ static void mergeInstrProfile(const WeightedFileVector &Inputs,
     if (Error E = Writer.writeText(Output))
       exitWithError(std::move(E));
   } else {
+    Writer.setNumThreads(WriterThreads);
     Writer.write(Output);
   }
 }
 
-/// Make a copy of the given function samples with all symbol names remapped
-/// by the provided symbol remapper.
+/// Make a copy of the given function samples with all symbol names mapped
+/// through \p MapName.
 static sampleprof::FunctionSamples
 remapSamples(const sampleprof::FunctionSamples &Samples,
-             SymbolRemapper &Remapper, sampleprof_error &Error) {
+             function_ref<StringRef(StringRef)> MapName,
+             sampleprof_error &Error) {
   sampleprof::FunctionSamples Result;
-  Result.setName(Remapper(Samples.getName()));
+  Result.setName(MapName(Samples.getName()));
   Result.addTotalSamples(Samples.getTotalSamples());
   Result.addHeadSamples(Samples.getHeadSamples());
   for (const auto &BodySample : Samples.getBodySamples()) {
@@ -383,7 +398,7 @@ remapSamples(const sampleprof::FunctionSamples &Samples,
     for (const auto &Target : BodySample.second.getCallTargets()) {
       Result.addCalledTargetSamples(BodySample.first.LineOffset,
                                     BodySample.first.Discriminator,
-                                    Remapper(Target.first()), Target.second);
+                                    MapName(Target.first()), Target.second);
     }
   }
   for (const auto &CallsiteSamples : Samples.getCallsiteSamples()) {
@@ -391,63 +406,527 @@ remapSamples(const sampleprof::FunctionSamples &Samples,
         Result.functionSamplesAt(CallsiteSamples.first);
     for (const auto &Callsite : CallsiteSamples.second) {
       sampleprof::FunctionSamples Remapped =
-          remapSamples(Callsite.second, Remapper, Error);
+          remapSamples(Callsite.second, MapName, Error);
       MergeResult(Error, Target[Remapped.getName()].merge(Remapped));
     }
   }
   return Result;
 }
 
+/// Divide \p Count by \p Divisor, rounding to the nearest.
+static uint64_t divideRounded(uint64_t Count, uint64_t Divisor) {
+  return Count / Divisor + (Count % Divisor >= Divisor - Divisor / 2);
+}
+
+/// Return \p Base to the power of \p Exp, saturating at the largest uint64_t.
+static uint64_t saturatingPower(uint64_t Base, uint64_t Exp) {
+  uint64_t Result = 1;
+  bool Overflowed = false;
+  while (Exp-- && !Overflowed)
+    Result = SaturatingMultiply(Result, Base, &Overflowed);
+  return Result;
+}
+
+/// Make a copy of the given function samples with all sample counts divided
+/// by \p Divisor, rounded to the nearest. The records, call targets and
+/// inlined callees whose counts reach zero are dropped, and the total samples
+/// are recomputed from the records and callees that are left.
+static sampleprof::FunctionSamples
+decaySamples(const sampleprof::FunctionSamples &Samples, uint64_t Divisor) {
+  sampleprof::FunctionSamples Result;
+  Result.setName(Samples.getName());
+  Result.addHeadSamples(divideRounded(Samples.getHeadSamples(), Divisor));
+  for (const auto &BodySample : Samples.getBodySamples()) {
+    const sampleprof::LineLocation &Loc = BodySample.first;
+    for (const auto &Target : BodySample.second.getCallTargets()) {
+      if (uint64_t Count = divideRounded(Target.second, Divisor))
+        Result.addCalledTargetSamples(Loc.LineOffset, Loc.Discriminator,
+                                      Target.first(), Count);
+    }
+    if (uint64_t Count =
+            divideRounded(BodySample.second.getSamples(), Divisor)) {
+      Result.addBodySamples(Loc.LineOffset, Loc.Discriminator, Count);
+      Result.addTotalSamples(Count);
+    }
+  }
+  for (const auto &CallsiteSamples : Samples.getCallsiteSamples()) {
+    for (const auto &Callsite : CallsiteSamples.second) {
+      sampleprof::FunctionSamples Callee =
+          decaySamples(Callsite.second, Divisor);
+      if (!Callee.getTotalSamples())
+        continue;
+      Result.addTotalSamples(Callee.getTotalSamples());
+      Result.functionSamplesAt(CallsiteSamples.first)[Callsite.first] =
+          std::move(Callee);
+    }
+  }
+  return Result;
+}
+
 static sampleprof::SampleProfileFormat FormatMap[] = {
-    sampleprof::SPF_None, sampleprof::SPF_Text, sampleprof::SPF_Compact_Binary,
-    sampleprof::SPF_GCC, sampleprof::SPF_Binary};
+    sampleprof::SPF_None,
+    sampleprof::SPF_Text,
+    sampleprof::SPF_Compact_Binary,
+    sampleprof::SPF_Ext_Binary,
+    sampleprof::SPF_GCC,
+    sampleprof::SPF_Binary};
+
+/// A function of a sample profile input, with its position in the input.
+struct SampleInputFunction {
+  unsigned FuncIdx;
+  sampleprof::FunctionSamples *Samples;
+};
+
+/// A sample profile input that has been read but not yet merged.
+struct SampleInputContext {
+  LLVMContext Context;
+  std::unique_ptr<sampleprof::SampleProfileReader> Reader;
+  std::error_code EC;
+  /// The original names of a compact binary input, by their hash.
+  DenseMap<uint64_t, StringRef> OriginalNames;
+  /// The functions of the input, by the shard they are merged into.
+  std::vector<std::vector<SampleInputFunction>> ShardFunctions;
+};
+
+/// A merge error reported while folding one function of one input. Errors are
+/// tagged with their position in the input so that they can be reported in the
+/// same order as a serial merge would.
+struct SampleMergeError {
+  unsigned InputIdx;
+  unsigned FuncIdx;
+  StringRef FName;
+  sampleprof_error Result;
+};
+
+/// The position of the first input function merged into a profile of the
+/// merged map. The merged map is built in the order of these positions, which
+/// is the order in which a serial merge inserts the functions.
+struct SampleMergeEntry {
+  unsigned InputIdx;
+  unsigned FuncIdx;
+  StringMapEntry<sampleprof::FunctionSamples> *Entry;
+};
+
+/// The part of the merged sample profile holding the functions whose names
+/// hash to one shard. Shards are disjoint, so they can be built concurrently
+/// without locking.
+struct SampleMergeShard {
+  StringMap<sampleprof::FunctionSamples> ProfileMap;
+  /// The entries of ProfileMap, in the order they were inserted.
+  std::vector<SampleMergeEntry> Entries;
+  std::vector<SampleMergeError> Errors;
+  /// When set, every name stored in ProfileMap is interned here rather than
+  /// pointing into the reader it came from, so that readers can be released
+  /// as soon as they have been merged.
+  bool InternNames = false;
+  BumpPtrAllocator NameAlloc;
+  UniqueStringSaver Names{NameAlloc};
+};
+
+/// Return the original name of the function named \p Name in the input
+/// \p SC: the hashed names of a compact binary input are replaced with their
+/// original names if it has them.
+static StringRef getOriginalSampleName(const SampleInputContext &SC,
+                                       StringRef Name) {
+  uint64_t Hash;
+  if (SC.OriginalNames.empty() || Name.getAsInteger(10, Hash))
+    return Name;
+  auto It = SC.OriginalNames.find(Hash);
+  return It == SC.OriginalNames.end() ? Name : It->second;
+}
+
+/// Return the shard the function named \p FName is merged into.
+static unsigned getSampleMergeShard(StringRef FName, unsigned NumShards) {
+  if (NumShards == 1)
+    return 0;
+  return xxHash64(FName) % NumShards;
+}
+
+/// Load a sample profile input into \p SC, and split its functions between
+/// \p NumShards shards by their name once original and remapped.
+static void loadSampleInput(const WeightedFile &Input, SymbolRemapper *Remapper,
+                            unsigned NumShards, SampleInputContext *SC) {
+  auto ReaderOrErr =
+      sampleprof::SampleProfileReader::create(Input.Filename, SC->Context);
+  if ((SC->EC = ReaderOrErr.getError()))
+    return;
+  SC->Reader = std::move(ReaderOrErr.get());
+  if ((SC->EC = SC->Reader->read()))
+    return;
+  for (StringRef Name : SC->Reader->getOriginalNames())
+    SC->OriginalNames[MD5Hash(Name)] = Name;
+
+  SC->ShardFunctions.resize(NumShards);
+  unsigned FuncIdx = 0;
+  for (auto &I : SC->Reader->getProfiles()) {
+    unsigned Shard = 0;
+    if (NumShards > 1) {
+      StringRef Name = getOriginalSampleName(*SC, I.second.getName());
+      if (Remapper)
+        Name = (*Remapper)(Name);
+      Shard = getSampleMergeShard(Name, NumShards);
+    }
+    SC->ShardFunctions[Shard].push_back({FuncIdx++, &I.second});
+  }
+}
+
+/// Merge the functions of the \p InputIdx'th input \p SC that belong to
+/// \p ShardIdx into \p Shard.
+static void mergeSampleInputIntoShard(SampleInputContext &SC, uint64_t Weight,
+                                      unsigned InputIdx,
+                                      SymbolRemapper *Remapper,
+                                      unsigned ShardIdx,
+                                      SampleMergeShard &Shard) {
+  using namespace sampleprof;
+  auto MapName = [&](StringRef Name) {
+    Name = getOriginalSampleName(SC, Name);
+    if (Remapper)
+      Name = (*Remapper)(Name);
+    return Shard.InternNames ? Shard.Names.save(Name) : Name;
+  };
+  bool NeedsCopy =
+      Remapper || Shard.InternNames || !SC.OriginalNames.empty();
+
+  for (const SampleInputFunction &F : SC.ShardFunctions[ShardIdx]) {
+    unsigned Idx = F.FuncIdx;
+    sampleprof_error Result = sampleprof_error::success;
+    FunctionSamples Remapped =
+        NeedsCopy ? remapSamples(*F.Samples, MapName, Result)
+                  : FunctionSamples();
+    FunctionSamples &Samples = NeedsCopy ? Remapped : *F.Samples;
+    StringRef FName = Samples.getName();
+    auto Ins = Shard.ProfileMap.try_emplace(FName);
+    if (Ins.second)
+      Shard.Entries.push_back({InputIdx, Idx, &*Ins.first});
+    MergeResult(Result, Ins.first->second.merge(Samples, Weight));
+    if (Result != sampleprof_error::success)
+      Shard.Errors.push_back({InputIdx, Idx, FName, Result});
+  }
+}
+
+/// Merge the inputs [\p Begin, \p End) into the \p ShardIdx'th shard, in input
+/// order.
+static void mergeSampleShard(const WeightedFileVector *Inputs,
+                             ArrayRef<std::unique_ptr<SampleInputContext>> SCs,
+                             unsigned Begin, unsigned End,
+                             SymbolRemapper *Remapper, unsigned ShardIdx,
+                             SampleMergeShard *Shard) {
+  for (unsigned I = Begin; I < End; ++I)
+    mergeSampleInputIntoShard(*SCs[I], (*Inputs)[I].Weight, I, Remapper,
+                              ShardIdx, *Shard);
+}
+
+static void reportSampleMergeErrors(const WeightedFileVector &Inputs,
+                                    ArrayRef<SampleMergeError> Errors) {
+  for (const SampleMergeError &E : Errors)
+    handleMergeWriterError(errorCodeToError(make_error_code(E.Result)),
+                           Inputs[E.InputIdx].Filename, E.FName);
+}
+
+/// Add the symbols listed in \p ProfSymListFile, one per line, to \p PSL.
+static void readProfileSymbolList(StringRef ProfSymListFile,
+                                  sampleprof::ProfileSymbolList &PSL) {
+  auto BufOrError = MemoryBuffer::getFileOrSTDIN(ProfSymListFile);
+  if (!BufOrError)
+    exitWithErrorCode(BufOrError.getError(), ProfSymListFile);
+
+  for (line_iterator I(*BufOrError.get(), /*SkipBlanks=*/true), E; I != E;
+       ++I)
+    PSL.add(I->trim());
+}
 
 static void mergeSampleProfile(const WeightedFileVector &Inputs,
                                SymbolRemapper *Remapper,
                                StringRef OutputFilename,
-                               ProfileFormat OutputFormat) {
+                               ProfileFormat OutputFormat,
+                               unsigned NumThreads, bool StreamInputs,
+                               bool CompressAllSections,
+                               StringRef ProfSymListFile,
+                               bool CompressProfSymList,
+                               bool KeepOriginalNames, StringRef AppendTo,
+                               unsigned AppendDecay,
+                               bool FlattenColdCallsites, bool TrimColdProfile,
+                               uint32_t ColdCutoff) {
   using namespace sampleprof;
+  if (CompressAllSections && OutputFormat != PF_Ext_Binary)
+    exitWithError("-compress-all-sections is only supported for the "
+                  "extbinary format");
+  if ((!ProfSymListFile.empty() || CompressProfSymList) &&
+      OutputFormat != PF_Ext_Binary)
+    exitWithError("the profile symbol list is only supported for the "
+                  "extbinary format");
+  if (KeepOriginalNames && OutputFormat != PF_Compact_Binary)
+    exitWithError("-keep-original-names is only supported for the "
+                  "compbinary format");
+  if (!AppendTo.empty()) {
+    if (OutputFormat != PF_Ext_Binary)
+      exitWithError("-append-to is only supported for the extbinary format");
+    // The output is written while the base profile is still in use.
+    bool SameFile = false;
+    if (!sys::fs::equivalent(AppendTo, OutputFilename, SameFile) && SameFile)
+      exitWithError("the output must not overwrite the profile appended to",
+                    OutputFilename);
+    // The functions of the base profile are copied as they are.
+    if (FlattenColdCallsites || TrimColdProfile)
+      exitWithError("cold profiles cannot be trimmed with -append-to");
+  }
+
   auto WriterOrErr =
       SampleProfileWriter::create(OutputFilename, FormatMap[OutputFormat]);
   if (std::error_code EC = WriterOrErr.getError())
     exitWithErrorCode(EC, OutputFilename);
 
+  // If NumThreads is not specified, auto-detect a good default.
+  if (NumThreads == 0)
+    NumThreads =
+        std::min(hardware_concurrency(), unsigned((Inputs.size() + 1) / 2));
+  unsigned NumShards = std::max(NumThreads, 1U);
+
+  // Unless we are streaming the inputs, we need to keep the readers around
+  // until after all the files are read so that we do not lose the function
+  // names stored in each reader's memory. The function names are needed to
+  // write out the merged profile map. When streaming, the shards own copies
+  // of the names and each reader is released right after it is merged, so
+  // peak memory is bounded by the merged profile plus NumThreads inputs.
+  SmallVector<std::unique_ptr<SampleInputContext>, 5> SCs;
+  for (unsigned I = 0, E = Inputs.size(); I < E; ++I)
+    SCs.emplace_back(llvm::make_unique<SampleInputContext>());
+  std::vector<SampleMergeShard> Shards(NumShards);
+  for (SampleMergeShard &Shard : Shards)
+    Shard.InternNames = StreamInputs;
+
+  // The symbol list of the output is the union of the lists of the inputs
+  // and of the one given on the command line.
+  ProfileSymbolList WriterList;
+  if (!ProfSymListFile.empty())
+    readProfileSymbolList(ProfSymListFile, WriterList);
+
   auto Writer = std::move(WriterOrErr.get());
+  if (CompressAllSections)
+    Writer->setToCompressAllSections();
+  if (CompressProfSymList)
+    Writer->setToCompressSection(SecProfileSymbolList);
+  if (KeepOriginalNames)
+    Writer->setToWriteOriginalNames();
+
+  // Report the errors of a loaded input and collect its symbol list.
+  auto CheckSampleInput = [&](unsigned I) {
+    SampleInputContext &SC = *SCs[I];
+    if (SC.EC)
+      exitWithErrorCode(SC.EC, Inputs[I].Filename);
+    // Without its original names, a compact binary input only gives out the
+    // hashes of its names, which cannot be written as original names.
+    if (KeepOriginalNames && SC.Reader->getFormat() == SPF_Compact_Binary &&
+        SC.OriginalNames.empty() && !SC.Reader->getProfiles().empty())
+      exitWithError("-keep-original-names requires compbinary inputs to "
+                    "keep their original names",
+                    Inputs[I].Filename);
+    if (auto PSL = SC.Reader->getProfileSymbolList())
+      WriterList.merge(*PSL);
+  };
+  if (NumThreads <= 1) {
+    SampleMergeShard &Shard = Shards[0];
+    for (unsigned I = 0, E = Inputs.size(); I < E; ++I) {
+      loadSampleInput(Inputs[I], Remapper, 1, SCs[I].get());
+      CheckSampleInput(I);
+      mergeSampleInputIntoShard(*SCs[I], Inputs[I].Weight, I, Remapper, 0,
+                                Shard);
+      reportSampleMergeErrors(Inputs, Shard.Errors);
+      Shard.Errors.clear();
+      if (StreamInputs)
+        SCs[I].reset();
+    }
+  } else {
+    ThreadPool Pool(NumThreads);
+
+    // When streaming, only NumThreads inputs are in memory at a time;
+    // otherwise all inputs are read up front as a single batch.
+    unsigned BatchSize = StreamInputs ? NumThreads : Inputs.size();
+    for (unsigned Begin = 0, E = Inputs.size(); Begin < E; Begin += BatchSize) {
+      unsigned End = std::min(Begin + BatchSize, E);
+
+      // Read the inputs in parallel, and find the shard of each function.
+      for (unsigned I = Begin; I < End; ++I)
+        Pool.async(loadSampleInput, Inputs[I], Remapper, NumShards,
+                   SCs[I].get());
+      Pool.wait();
+      for (unsigned I = Begin; I < End; ++I)
+        CheckSampleInput(I);
+
+      // Merge the inputs shard by shard. Each shard folds the inputs in their
+      // original order, so every function sees exactly the sequence of merges
+      // the serial path performs.
+      for (unsigned S = 0; S < NumShards; ++S)
+        Pool.async(mergeSampleShard, &Inputs, makeArrayRef(SCs), Begin, End,
+                   Remapper, S, &Shards[S]);
+      Pool.wait();
+
+      std::vector<SampleMergeError> Errors;
+      for (SampleMergeShard &Shard : Shards) {
+        Errors.insert(Errors.end(), Shard.Errors.begin(), Shard.Errors.end());
+        Shard.Errors.clear();
+      }
+      std::sort(Errors.begin(), Errors.end(),
+                [](const SampleMergeError &L, const SampleMergeError &R) {
+                  return std::tie(L.InputIdx, L.FuncIdx) <
+                         std::tie(R.InputIdx, R.FuncIdx);
+                });
+      reportSampleMergeErrors(Inputs, Errors);
+
+      if (StreamInputs)
+        for (unsigned I = Begin; I < End; ++I)
+          SCs[I].reset();
+    }
+  }
+
+  // The writers emit the functions in the iteration order of the map, which
+  // depends on the order of the insertions. Insert the functions in the order
+  // the inputs first list them, whatever the number of shards, so that the
+  // output does not depend on the number of threads.
+  std::vector<SampleMergeEntry> Entries;
+  for (SampleMergeShard &Shard : Shards)
+    Entries.insert(Entries.end(), Shard.Entries.begin(), Shard.Entries.end());
+  std::sort(Entries.begin(), Entries.end(),
+            [](const SampleMergeEntry &L, const SampleMergeEntry &R) {
+              return std::tie(L.InputIdx, L.FuncIdx) <
+                     std::tie(R.InputIdx, R.FuncIdx);
+            });
   StringMap<FunctionSamples> ProfileMap;
-  SmallVector<std::unique_ptr<sampleprof::SampleProfileReader>, 5> Readers;
+  for (const SampleMergeEntry &E : Entries)
+    ProfileMap.try_emplace(E.Entry->getKey(), std::move(E.Entry->second));
+  Entries.clear();
+  for (SampleMergeShard &Shard : Shards) {
+    Shard.Entries.clear();
+    Shard.ProfileMap.clear();
+  }
+
+  if (FlattenColdCallsites || TrimColdProfile) {
+    // Use the threshold the compiler will derive from the summary of the
+    // merged profile.
+    SampleProfileSummaryBuilder Builder(ProfileSummaryBuilder::DefaultCutoffs);
+    for (const auto &I : ProfileMap)
+      Builder.addRecord(I.second);
+    std::unique_ptr<ProfileSummary> Summary = Builder.getSummary();
+    uint64_t ColdCountThreshold =
+        ProfileSummaryBuilder::getEntryForPercentile(
+            Summary->getDetailedSummary(), ColdCutoff)
+            .MinCount;
+    SampleProfileTrimmer Trimmer(ProfileMap);
+    if (FlattenColdCallsites) {
+      sampleprof_error Result =
+          Trimmer.flattenColdCallsites(ColdCountThreshold);
+      if (Result != sampleprof_error::success)
+        handleMergeWriterError(errorCodeToError(make_error_code(Result)),
+                               OutputFilename);
+    }
+    if (TrimColdProfile)
+      Trimmer.trimColdProfiles(ColdCountThreshold);
+  }
+
+  if (AppendTo.empty()) {
+    Writer->setProfileSymbolList(&WriterList);
+    if (std::error_code EC = Writer->write(ProfileMap))
+      exitWithErrorCode(EC, OutputFilename);
+    return;
+  }
+
+  // Only the functions of the inputs are read from the base profile and
+  // written again; the writer copies the others as they are.
   LLVMContext Context;
-  for (const auto &Input : Inputs) {
-    auto ReaderOrErr = SampleProfileReader::create(Input.Filename, Context);
-    if (std::error_code EC = ReaderOrErr.getError())
-      exitWithErrorCode(EC, Input.Filename);
-
-    // We need to keep the readers around until after all the files are
-    // read so that we do not lose the function names stored in each
-    // reader's memory. The function names are needed to write out the
-    // merged profile map.
-    Readers.push_back(std::move(ReaderOrErr.get()));
-    const auto Reader = Readers.back().get();
-    if (std::error_code EC = Reader->read())
-      exitWithErrorCode(EC, Input.Filename);
-
-    StringMap<FunctionSamples> &Profiles = Reader->getProfiles();
-    for (StringMap<FunctionSamples>::iterator I = Profiles.begin(),
-                                              E = Profiles.end();
-         I != E; ++I) {
-      sampleprof_error Result = sampleprof_error::success;
-      FunctionSamples Remapped =
-          Remapper ? remapSamples(I->second, *Remapper, Result)
-                   : FunctionSamples();
-      FunctionSamples &Samples = Remapper ? Remapped : I->second;
-      StringRef FName = Samples.getName();
-      MergeResult(Result, ProfileMap[FName].merge(Samples, Input.Weight));
-      if (Result != sampleprof_error::success) {
-        std::error_code EC = make_error_code(Result);
-        handleMergeWriterError(errorCodeToError(EC), Input.Filename, FName);
+  auto OpenBase = [&]() {
+    auto BaseOrErr = SampleProfileReader::create(AppendTo, Context);
+    if (std::error_code EC = BaseOrErr.getError())
+      exitWithErrorCode(EC, AppendTo);
+    std::unique_ptr<SampleProfileReader> Base = std::move(BaseOrErr.get());
+    if (Base->getFormat() != SPF_Ext_Binary)
+      exitWithError("-append-to requires an extbinary profile", AppendTo);
+    return Base;
+  };
+  std::unique_ptr<SampleProfileReader> Base = OpenBase();
+  auto &ExtBase = static_cast<SampleProfileReaderExtBinary &>(*Base);
+
+  // The samples of the profile fade by weighting the samples of every append
+  // by one more power of the decay than the previous one, so that the
+  // functions the inputs do not touch are left as they are. An append without
+  // a decay weights its samples like the latest ones.
+  uint64_t BaseDecay, Epoch;
+  std::tie(BaseDecay, Epoch) = ExtBase.getDecayEpoch();
+  uint64_t Decay = AppendDecay > 1 ? AppendDecay : BaseDecay;
+  uint64_t NewEpoch = AppendDecay > 1 ? Epoch + 1 : Epoch;
+  uint64_t Weight = saturatingPower(Decay, NewEpoch);
+
+  // The counts are brought back down, by dividing the whole profile by the
+  // weight of its latest samples, when they come close to overflowing or when
+  // the decay changes.
+  const uint64_t MaxAppendedCount = uint64_t(1) << 56;
+  bool Rescale = Epoch && BaseDecay != Decay;
+  StringMap<FunctionSamples> Appended;
+  if (!Rescale) {
+    // Without a count histogram, the summary can only be updated from all
+    // the profiles of the base.
+    if (ExtBase.hasCountHistogram()) {
+      std::vector<StringRef> Names;
+      for (const auto &I : ProfileMap)
+        Names.push_back(I.getKey());
+      ExtBase.setFuncsToUse(Names);
+    }
+    if (std::error_code EC = Base->read())
+      exitWithErrorCode(EC, AppendTo);
+
+    for (const auto &I : ProfileMap) {
+      FunctionSamples &Samples = Appended[I.getKey()];
+      sampleprof_error Result = Samples.merge(I.second, Weight);
+      auto It = Base->getProfiles().find(I.getKey());
+      if (It != Base->getProfiles().end())
+        MergeResult(Result, Samples.merge(It->second));
+      // The total samples bound the other counts of the function.
+      if (Result == sampleprof_error::counter_overflow ||
+          Samples.getTotalSamples() > MaxAppendedCount ||
+          Samples.getHeadSamples() > MaxAppendedCount) {
+        Rescale = true;
+        break;
       }
+      if (Result != sampleprof_error::success)
+        handleMergeWriterError(errorCodeToError(make_error_code(Result)),
+                               AppendTo, I.getKey());
     }
   }
-  Writer->write(ProfileMap);
+
+  if (!Rescale) {
+    if (auto PSL = Base->getProfileSymbolList())
+      WriterList.merge(*PSL);
+    Writer->setProfileSymbolList(&WriterList);
+    Writer->setDecayEpoch(Decay, NewEpoch);
+    if (std::error_code EC = Writer->append(*Base, Appended))
+      exitWithErrorCode(EC, OutputFilename);
+    return;
+  }
+
+  // Rescaling rewrites every function of the profile.
+  Appended.clear();
+  Base = OpenBase();
+  if (std::error_code EC = Base->read())
+    exitWithErrorCode(EC, AppendTo);
+  if (auto PSL = Base->getProfileSymbolList())
+    WriterList.merge(*PSL);
+  uint64_t Divisor = saturatingPower(BaseDecay, Epoch);
+  NewEpoch = AppendDecay > 1 ? 1 : 0;
+  Weight = saturatingPower(Decay, NewEpoch);
+  for (const auto &I : Base->getProfiles()) {
+    FunctionSamples Decayed = decaySamples(I.second, Divisor);
+    if (Decayed.getTotalSamples() || Decayed.getHeadSamples())
+      Appended[I.getKey()] = std::move(Decayed);
+  }
+  for (const auto &I : ProfileMap) {
+    sampleprof_error Result = Appended[I.getKey()].merge(I.second, Weight);
+    if (Result != sampleprof_error::success)
+      handleMergeWriterError(errorCodeToError(make_error_code(Result)),
+                             AppendTo, I.getKey());
+  }
+  Writer->setProfileSymbolList(&WriterList);
+  Writer->setDecayEpoch(Decay, NewEpoch);
+  if (std::error_code EC = Writer->write(Appended))
+    exitWithErrorCode(EC, OutputFilename);
 }
 
 static WeightedFile parseWeightedFile(const StringRef &WeightedFilename) {
@@ -560,6 +1039,8 @@ static int merge_main(int argc, const char *argv[]) {
       cl::values(clEnumValN(PF_Binary, "binary", "Binary encoding (default)"),
                  clEnumValN(PF_Compact_Binary, "compbinary",
                             "Compact binary encoding"),
+                 clEnumValN(PF_Ext_Binary, "extbinary",
+                            "Extensible binary encoding"),
                  clEnumValN(PF_Text, "text", "Text encoding"),
                  clEnumValN(PF_GCC, "gcc",
                             "GCC encoding (only meaningful for -sample)")));
@@ -570,6 +1051,55 @@ static int merge_main(int argc, const char *argv[]) {
       cl::desc("Number of merge threads to use (default: autodetect)"));
   cl::alias NumThreadsA("j", cl::desc("Alias for --num-threads"),
                         cl::aliasopt(NumThreads));
+  cl::opt<bool> StreamInputs(
+      "stream-inputs", cl::init(false),
+      cl::desc("Release each input as soon as it has been merged, keeping "
+               "only the merged profile in memory (only meaningful for "
+               "-sample)"));
+  cl::opt<bool> CompressAllSections(
+      "compress-all-sections", cl::init(false),
+      cl::desc("Compress all sections when writing the profile (only "
+               "meaningful for -extbinary)"));
+  cl::opt<std::string> ProfSymListFile(
+      "prof-sym-list", cl::init(""), cl::value_desc("file"),
+      cl::desc("Path to file containing the list of the symbols of the "
+               "profiled binary, one per line (only meaningful for "
+               "-extbinary)"));
+  cl::opt<bool> CompressProfSymList(
+      "compress-prof-sym-list", cl::init(false),
+      cl::desc("Compress the profile symbol list when writing the profile "
+               "(only meaningful for -extbinary)"));
+  cl::opt<bool> KeepOriginalNames(
+      "keep-original-names", cl::init(false),
+      cl::desc("Store the original function names along with their MD5 "
+               "hashes, so that the profile can be remapped (only meaningful "
+               "for -compbinary)"));
+  cl::opt<std::string> AppendTo(
+      "append-to", cl::init(""), cl::value_desc("file"),
+      cl::desc("Merge the inputs into this existing profile, only rewriting "
+               "the functions they have samples for (only meaningful for "
+               "-sample -extbinary)"));
+  cl::opt<unsigned> AppendDecay(
+      "append-decay", cl::init(1),
+      cl::desc("Weight the inputs by one more power of this factor than the "
+               "samples of the previous append when merging them with "
+               "-append-to, so that older samples fade by this factor at "
+               "every append"));
+  cl::opt<bool> FlattenColdCallsites(
+      "flatten-cold-callsites", cl::init(false),
+      cl::desc("Turn the cold inlined callees back into calls, moving their "
+               "samples to the profiles of the callees, and merge the cold "
+               "contexts into the profiles of their functions (only "
+               "meaningful for -sample)"));
+  cl::opt<bool> TrimColdProfile(
+      "trim-cold-profile", cl::init(false),
+      cl::desc("Remove the profiles of the cold functions (only meaningful "
+               "for -sample)"));
+  cl::opt<uint32_t> ColdCutoff(
+      "cold-cutoff", cl::init(999999),
+      cl::desc("Percentile of the profile summary, in parts per million, "
+               "whose minimum count is the cold count threshold of "
+               "-flatten-cold-callsites and -trim-cold-profile"));
 
   cl::ParseCommandLineOptions(argc, argv, "LLVM profile data merger\n");
 
@@ -594,6 +1124,16 @@ static int merge_main(int argc, const char *argv[]) {
     return 0;
   }
 
+  if (!AppendTo.empty() && ProfileKind != sample)
+    exitWithError("-append-to is only supported for sample profiles");
+  if (AppendDecay < 1)
+    exitWithError("-append-decay must be a positive integer");
+  if (AppendDecay > 1 && AppendTo.empty())
+    exitWithError("-append-decay is only meaningful with -append-to");
+  if ((FlattenColdCallsites || TrimColdProfile) && ProfileKind != sample)
+    exitWithError("cold profiles can only be trimmed for sample profiles");
+  if (ColdCutoff > 999999)
+    exitWithError("-cold-cutoff must be at most 999999");
   std::unique_ptr<SymbolRemapper> Remapper;
   if (!RemappingFile.empty())
     Remapper = SymbolRemapper::create(RemappingFile);
@@ -603,7 +1143,11 @@ static int merge_main(int argc, const char *argv[]) {
                       OutputFormat, OutputSparse, NumThreads);
   else
     mergeSampleProfile(WeightedInputs, Remapper.get(), OutputFilename,
-                       OutputFormat);
+                       OutputFormat, NumThreads, StreamInputs,
+                       CompressAllSections, ProfSymListFile,
+                       CompressProfSymList, KeepOriginalNames, AppendTo,
+                       AppendDecay, FlattenColdCallsites, TrimColdProfile,
+                       ColdCutoff);
 
   return 0;
 }
@@ -862,6 +1406,7 @@ static int showInstrProfile(const std::string &Filename, bool ShowCounts,
 static int showSampleProfile(const std::string &Filename, bool ShowCounts,
                              bool ShowAllFunctions,
                              const std::string &ShowFunction,
+                             bool ShowSecInfoOnly, bool ShowProfSymList,
                              raw_fd_ostream &OS) {
   using namespace sampleprof;
   LLVMContext Context;
@@ -870,6 +1415,15 @@ static int showSampleProfile(const std::string &Filename, bool ShowCounts,
     exitWithErrorCode(EC, Filename);
 
   auto Reader = std::move(ReaderOrErr.get());
+
+  if (ShowSecInfoOnly) {
+    if (!Reader->dumpSectionInfo(OS))
+      exitWithError("section information is only available for the "
+                    "extbinary format",
+                    Filename);
+    return 0;
+  }
+
   if (std::error_code EC = Reader->read())
     exitWithErrorCode(EC, Filename);
 
@@ -878,6 +1432,12 @@ static int showSampleProfile(const std::string &Filename, bool ShowCounts,
   else
     Reader->dumpFunctionProfile(ShowFunction, OS);
 
+  if (ShowProfSymList) {
+    std::unique_ptr<ProfileSymbolList> PSL = Reader->getProfileSymbolList();
+    if (PSL)
+      PSL->dump(OS);
+  }
+
   return 0;
 }
 
@@ -930,6 +1490,15 @@ static int show_main(int argc, const char *argv[]) {
       "list-below-cutoff", cl::init(false),
       cl::desc("Only output names of functions whose max count values are "
                "below the cutoff value"));
+  cl::opt<bool> ShowSecInfoOnly(
+      "show-sec-info-only", cl::init(false),
+      cl::desc("Show the offset and size of each section of the sample "
+               "profile, including the uncompressed size of compressed "
+               "sections (only meaningful for extbinary profiles)"));
+  cl::opt<bool> ShowProfSymList(
+      "show-prof-sym-list", cl::init(false),
+      cl::desc("Show the profile symbol list after the profiles (only "
+               "meaningful for extbinary profiles)"));
   cl::ParseCommandLineOptions(argc, argv, "LLVM profile data summary\n");
 
   if (OutputFilename.empty())
@@ -951,7 +1520,520 @@ static int show_main(int argc, const char *argv[]) {
                             OnlyListBelow, ShowFunction, TextFormat, OS);
   else
     return showSampleProfile(Filename, ShowCounts, ShowAllFunctions,
-                             ShowFunction, OS);
+                             ShowFunction, ShowSecInfoOnly, ShowProfSymList,
+                             OS);
+}
+
+/// The weights of one function profile compared by the overlap command: its
+/// block counts and the counts of its call targets, keyed by where they are
+/// in the function and sorted by key.
+struct OverlapFuncWeights {
+  /// The structural hash of an instrumentation profile, 0 for a sample one.
+  uint64_t Hash = 0;
+  std::vector<std::pair<uint64_t, uint64_t>> Blocks;
+  std::vector<std::pair<uint64_t, uint64_t>> CallTargets;
+  uint64_t BlockSum = 0;
+  uint64_t CallTargetSum = 0;
+  uint64_t MaxCount = 0;
+};
+
+/// A profile loaded by the overlap command. The records of a function are
+/// grouped by name; instrumentation profiles may have several of them.
+struct OverlapProfile {
+  StringMap<std::vector<OverlapFuncWeights>> Funcs;
+  uint64_t BlockSum = 0;
+  uint64_t CallTargetSum = 0;
+  /// The smallest count among the hottest blocks that make up the hot cutoff
+  /// of the profile. Functions with a block reaching it are hot.
+  uint64_t HotThreshold = 0;
+  Error Err = Error::success();
+};
+
+/// Sort \p Weights by key, fold the weights with the same key and return
+/// their sum.
+static uint64_t
+finalizeOverlapWeights(std::vector<std::pair<uint64_t, uint64_t>> &Weights) {
+  llvm::sort(Weights);
+  size_t Out = 0;
+  uint64_t Sum = 0;
+  for (const auto &W : Weights) {
+    if (Out && Weights[Out - 1].first == W.first)
+      Weights[Out - 1].second =
+          SaturatingAdd(Weights[Out - 1].second, W.second);
+    else
+      Weights[Out++] = W;
+    Sum = SaturatingAdd(Sum, W.second);
+  }
+  Weights.resize(Out);
+  return Sum;
+}
+
+static void addOverlapFunc(OverlapProfile &Profile, StringRef Name,
+                           OverlapFuncWeights FW) {
+  FW.BlockSum = finalizeOverlapWeights(FW.Blocks);
+  FW.CallTargetSum = finalizeOverlapWeights(FW.CallTargets);
+  for (const auto &B : FW.Blocks)
+    FW.MaxCount = std::max(FW.MaxCount, B.second);
+  Profile.BlockSum = SaturatingAdd(Profile.BlockSum, FW.BlockSum);
+  Profile.CallTargetSum =
+      SaturatingAdd(Profile.CallTargetSum, FW.CallTargetSum);
+  Profile.Funcs[Name].push_back(std::move(FW));
+}
+
+static uint64_t getOverlapHotThreshold(ProfileSummary &PS) {
+  const SummaryEntryVector &Entries = PS.getDetailedSummary();
+  return Entries.empty() ? 0 : Entries.front().MinCount;
+}
+
+static void loadInstrOverlapProfile(const std::string &Filename, bool IsCS,
+                                    uint32_t HotCutoff,
+                                    OverlapProfile *Profile) {
+  auto ReaderOrErr = InstrProfReader::create(Filename);
+  if (Error E = ReaderOrErr.takeError()) {
+    Profile->Err = std::move(E);
+    return;
+  }
+  auto Reader = std::move(ReaderOrErr.get());
+  InstrProfSummaryBuilder Builder({HotCutoff});
+  for (const auto &Func : *Reader) {
+    if (Reader->isIRLevelProfile() &&
+        NamedInstrProfRecord::hasCSFlagInHash(Func.Hash) != IsCS)
+      continue;
+    if (Func.Counts.empty())
+      continue;
+    Builder.addRecord(Func);
+
+    OverlapFuncWeights FW;
+    FW.Hash = Func.Hash;
+    for (size_t I = 0, E = Func.Counts.size(); I < E; ++I)
+      FW.Blocks.emplace_back(I, Func.Counts[I]);
+    uint32_t NumSites = Func.getNumValueSites(IPVK_IndirectCallTarget);
+    for (uint32_t Site = 0; Site < NumSites; ++Site) {
+      uint32_t NV = Func.getNumValueDataForSite(IPVK_IndirectCallTarget, Site);
+      std::unique_ptr<InstrProfValueData[]> VD =
+          Func.getValueForSite(IPVK_IndirectCallTarget, Site);
+      for (uint32_t V = 0; V < NV; ++V)
+        FW.CallTargets.emplace_back(hash_combine(Site, VD[V].Value),
+                                    VD[V].Count);
+    }
+    addOverlapFunc(*Profile, Func.Name, std::move(FW));
+  }
+  if (Reader->hasError()) {
+    Profile->Err = Reader->getError();
+    return;
+  }
+  Profile->HotThreshold = getOverlapHotThreshold(*Builder.getSummary());
+}
+
+/// Add the weights of \p FS, inlined at the callsite path hashed to \p Path,
+/// to \p FW.
+static void addOverlapSamples(const sampleprof::FunctionSamples &FS,
+                              uint64_t Path, OverlapFuncWeights &FW) {
+  for (const auto &I : FS.getBodySamples()) {
+    uint64_t Key =
+        hash_combine(Path, I.first.LineOffset, I.first.Discriminator);
+    FW.Blocks.emplace_back(Key, I.second.getSamples());
+    for (const auto &J : I.second.getCallTargets())
+      FW.CallTargets.emplace_back(hash_combine(Key, J.first()), J.second);
+  }
+  for (const auto &I : FS.getCallsiteSamples())
+    for (const auto &J : I.second)
+      addOverlapSamples(J.second,
+                        hash_combine(Path, I.first.LineOffset,
+                                     I.first.Discriminator, StringRef(J.first)),
+                        FW);
+}
+
+static void loadSampleOverlapProfile(const std::string &Filename,
+                                     uint32_t HotCutoff,
+                                     OverlapProfile *Profile) {
+  using namespace sampleprof;
+  LLVMContext Context;
+  auto ReaderOrErr = SampleProfileReader::create(Filename, Context);
+  if (std::error_code EC = ReaderOrErr.getError()) {
+    Profile->Err = errorCodeToError(EC);
+    return;
+  }
+  auto Reader = std::move(ReaderOrErr.get());
+  if (std::error_code EC = Reader->read()) {
+    Profile->Err = errorCodeToError(EC);
+    return;
+  }
+  SampleProfileSummaryBuilder Builder({HotCutoff});
+  for (const auto &I : Reader->getProfiles()) {
+    Builder.addRecord(I.second);
+    OverlapFuncWeights FW;
+    addOverlapSamples(I.second, 0, FW);
+    addOverlapFunc(*Profile, I.getKey(), std::move(FW));
+  }
+  Profile->HotThreshold = getOverlapHotThreshold(*Builder.getSummary());
+}
+
+/// How one function record of the base profile compares with the same
+/// function in the test profile.
+struct FuncOverlap {
+  enum OverlapStatus { Matched, Mismatched, BaseOnly, TestOnly };
+
+  StringRef Name;
+  OverlapStatus Status = Matched;
+  uint64_t BaseWeight = 0;
+  uint64_t TestWeight = 0;
+  /// The sum over the blocks of the smaller of their shares of the base and
+  /// of the test program.
+  double BlockOverlap = 0;
+  double CallTargetOverlap = 0;
+  /// The same, with the shares of the function rather than of the program.
+  double BlockSimilarity = 0;
+  double CallTargetSimilarity = 0;
+  /// Half the sum over the blocks of the difference of their shares of the
+  /// two programs, which is how much the function adds to the difference of
+  /// the profiles. The contributions of all the functions add up to one
+  /// minus the block overlap of the programs.
+  double Contribution = 0;
+  bool BaseHot = false;
+  bool TestHot = false;
+};
+
+static double getShare(uint64_t Count, uint64_t Sum) {
+  return Sum ? static_cast<double>(Count) / Sum : 0;
+}
+
+/// Return the sum over the keys of \p A and \p B of the smaller of their
+/// shares of \p ASum and \p BSum.
+static double overlapWeights(ArrayRef<std::pair<uint64_t, uint64_t>> A,
+                             uint64_t ASum,
+                             ArrayRef<std::pair<uint64_t, uint64_t>> B,
+                             uint64_t BSum) {
+  double Overlap = 0;
+  auto I = A.begin(), J = B.begin();
+  while (I != A.end() && J != B.end()) {
+    if (I->first < J->first) {
+      ++I;
+    } else if (J->first < I->first) {
+      ++J;
+    } else {
+      Overlap += std::min(getShare(I->second, ASum), getShare(J->second, BSum));
+      ++I;
+      ++J;
+    }
+  }
+  return Overlap;
+}
+
+/// Return the overlap of \p A and \p B as shares of their own sums. Two
+/// empty functions are identical.
+static double similarity(ArrayRef<std::pair<uint64_t, uint64_t>> A,
+                         uint64_t ASum,
+                         ArrayRef<std::pair<uint64_t, uint64_t>> B,
+                         uint64_t BSum) {
+  if (!ASum && !BSum)
+    return 1;
+  return overlapWeights(A, ASum, B, BSum);
+}
+
+/// Compare the records of the function \p Name in the base and in the test
+/// profile, appending the results to \p Results.
+static void overlapFunc(StringRef Name, const OverlapProfile &Base,
+                        const OverlapProfile &Test,
+                        std::vector<FuncOverlap> &Results) {
+  static const std::vector<OverlapFuncWeights> NoRecords;
+  auto BaseIt = Base.Funcs.find(Name);
+  auto TestIt = Test.Funcs.find(Name);
+  const auto &BaseRecords =
+      BaseIt == Base.Funcs.end() ? NoRecords : BaseIt->second;
+  const auto &TestRecords =
+      TestIt == Test.Funcs.end() ? NoRecords : TestIt->second;
+
+  auto MakeResult = [&](const OverlapFuncWeights *BW,
+                        const OverlapFuncWeights *TW,
+                        FuncOverlap::OverlapStatus Status) {
+    FuncOverlap R;
+    R.Name = Name;
+    R.Status = Status;
+    double BaseShare = 0, TestShare = 0;
+    if (BW) {
+      R.BaseWeight = BW->BlockSum;
+      R.BaseHot = Base.HotThreshold && BW->MaxCount >= Base.HotThreshold;
+      BaseShare = getShare(BW->BlockSum, Base.BlockSum);
+    }
+    if (TW) {
+      R.TestWeight = TW->BlockSum;
+      R.TestHot = Test.HotThreshold && TW->MaxCount >= Test.HotThreshold;
+      TestShare = getShare(TW->BlockSum, Test.BlockSum);
+    }
+    if (Status == FuncOverlap::Matched) {
+      R.BlockOverlap =
+          overlapWeights(BW->Blocks, Base.BlockSum, TW->Blocks, Test.BlockSum);
+      R.CallTargetOverlap =
+          overlapWeights(BW->CallTargets, Base.CallTargetSum, TW->CallTargets,
+                         Test.CallTargetSum);
+      R.BlockSimilarity =
+          similarity(BW->Blocks, BW->BlockSum, TW->Blocks, TW->BlockSum);
+      R.CallTargetSimilarity =
+          similarity(BW->CallTargets, BW->CallTargetSum, TW->CallTargets,
+                     TW->CallTargetSum);
+    }
+    R.Contribution =
+        std::max(0.0, (BaseShare + TestShare) / 2 - R.BlockOverlap);
+    Results.push_back(R);
+  };
+
+  // Records are matched by their hash; the ones left on both sides are
+  // mismatched, the ones left on a single side are unique to it.
+  std::vector<bool> TestMatched(TestRecords.size());
+  std::vector<const OverlapFuncWeights *> BaseLeft, TestLeft;
+  for (const auto &BW : BaseRecords) {
+    size_t I = 0, E = TestRecords.size();
+    while (I < E && (TestMatched[I] || TestRecords[I].Hash != BW.Hash))
+      ++I;
+    if (I == E) {
+      BaseLeft.push_back(&BW);
+      continue;
+    }
+    TestMatched[I] = true;
+    MakeResult(&BW, &TestRecords[I], FuncOverlap::Matched);
+  }
+  for (size_t I = 0, E = TestRecords.size(); I < E; ++I)
+    if (!TestMatched[I])
+      TestLeft.push_back(&TestRecords[I]);
+  bool Mismatched = !BaseLeft.empty() && !TestLeft.empty();
+  for (const auto *BW : BaseLeft)
+    MakeResult(BW, nullptr,
+               Mismatched ? FuncOverlap::Mismatched : FuncOverlap::BaseOnly);
+  for (const auto *TW : TestLeft)
+    MakeResult(nullptr, TW,
+               Mismatched ? FuncOverlap::Mismatched : FuncOverlap::TestOnly);
+}
+
+static void overlapFuncRange(ArrayRef<StringRef> Names,
+                             const OverlapProfile *Base,
+                             const OverlapProfile *Test,
+                             std::vector<FuncOverlap> *Results) {
+  for (StringRef Name : Names)
+    overlapFunc(Name, *Base, *Test, *Results);
+}
+
+static std::string formatShare(double Share) {
+  return formatv("{0:F2}%", Share * 100);
+}
+
+static const char *getOverlapStatusName(FuncOverlap::OverlapStatus Status) {
+  switch (Status) {
+  case FuncOverlap::Matched:
+    return "matched";
+  case FuncOverlap::Mismatched:
+    return "hash mismatch";
+  case FuncOverlap::BaseOnly:
+    return "only in the base profile";
+  case FuncOverlap::TestOnly:
+    return "only in the test profile";
+  }
+  llvm_unreachable("Unknown overlap status");
+}
+
+static void showFuncOverlap(const FuncOverlap &R, const OverlapProfile &Base,
+                            const OverlapProfile &Test, raw_ostream &OS) {
+  OS << "Function: " << R.Name << "\n";
+  OS << "  Status: " << getOverlapStatusName(R.Status) << "\n";
+  OS << "  Base weight: " << R.BaseWeight << " ("
+     << formatShare(getShare(R.BaseWeight, Base.BlockSum))
+     << " of the program)\n";
+  OS << "  Test weight: " << R.TestWeight << " ("
+     << formatShare(getShare(R.TestWeight, Test.BlockSum))
+     << " of the program)\n";
+  if (R.Status == FuncOverlap::Matched) {
+    OS << "  Block similarity: " << formatShare(R.BlockSimilarity) << "\n";
+    OS << "  Call target similarity: " << formatShare(R.CallTargetSimilarity)
+       << "\n";
+  }
+  OS << "  Contribution to the difference: " << formatShare(R.Contribution)
+     << "\n";
+  OS << "  Hot in base: " << (R.BaseHot ? "yes" : "no")
+     << ", hot in test: " << (R.TestHot ? "yes" : "no") << "\n";
+}
+
+static int overlapProfiles(const std::string &BaseFilename,
+                           const std::string &TestFilename,
+                           ProfileKinds ProfileKind, bool IsCS,
+                           uint32_t HotCutoff, uint32_t TopN,
+                           const std::string &ShowFunction,
+                           unsigned NumThreads, raw_fd_ostream &OS) {
+  if (NumThreads == 0)
+    NumThreads = hardware_concurrency();
+
+  OverlapProfile Base, Test;
+  auto Load = [&](const std::string &Filename, OverlapProfile *Profile) {
+    if (ProfileKind == instr)
+      loadInstrOverlapProfile(Filename, IsCS, HotCutoff, Profile);
+    else
+      loadSampleOverlapProfile(Filename, HotCutoff, Profile);
+  };
+  if (NumThreads > 1) {
+    ThreadPool Pool(std::min(NumThreads, 2U));
+    Pool.async(Load, BaseFilename, &Base);
+    Pool.async(Load, TestFilename, &Test);
+    Pool.wait();
+  } else {
+    Load(BaseFilename, &Base);
+    Load(TestFilename, &Test);
+  }
+  if (Base.Err)
+    exitWithError(std::move(Base.Err), BaseFilename);
+  if (Test.Err)
+    exitWithError(std::move(Test.Err), TestFilename);
+
+  std::vector<StringRef> Names;
+  Names.reserve(Base.Funcs.size() + Test.Funcs.size());
+  for (const auto &I : Base.Funcs)
+    Names.push_back(I.getKey());
+  for (const auto &I : Test.Funcs)
+    if (!Base.Funcs.count(I.getKey()))
+      Names.push_back(I.getKey());
+  llvm::sort(Names);
+
+  // Compare the functions in contiguous ranges of names, so that the results
+  // come out in the same order whatever the number of threads.
+  unsigned NumRanges = std::max(
+      1U, std::min<unsigned>(NumThreads, (Names.size() + 1023) / 1024));
+  std::vector<std::vector<FuncOverlap>> RangeResults(NumRanges);
+  size_t RangeSize = (Names.size() + NumRanges - 1) / NumRanges;
+  auto GetRange = [&](unsigned I) {
+    size_t Begin = std::min(Names.size(), I * RangeSize);
+    size_t End = std::min(Names.size(), Begin + RangeSize);
+    return makeArrayRef(Names).slice(Begin, End - Begin);
+  };
+  if (NumRanges > 1) {
+    ThreadPool Pool(NumThreads);
+    for (unsigned I = 0; I < NumRanges; ++I)
+      Pool.async(overlapFuncRange, GetRange(I), &Base, &Test,
+                 &RangeResults[I]);
+    Pool.wait();
+  } else {
+    overlapFuncRange(Names, &Base, &Test, &RangeResults[0]);
+  }
+  std::vector<FuncOverlap> Results;
+  for (auto &R : RangeResults)
+    Results.insert(Results.end(), R.begin(), R.end());
+
+  // The records of a function are next to each other in Results; a function
+  // with mismatched records is only counted once.
+  double BlockOverlap = 0, CallTargetOverlap = 0;
+  unsigned NumByStatus[4] = {0, 0, 0, 0};
+  StringRef LastMismatched;
+  StringSet<> HotInBase, HotInTest;
+  for (const FuncOverlap &R : Results) {
+    BlockOverlap += R.BlockOverlap;
+    CallTargetOverlap += R.CallTargetOverlap;
+    if (R.Status != FuncOverlap::Mismatched || R.Name != LastMismatched)
+      ++NumByStatus[R.Status];
+    if (R.Status == FuncOverlap::Mismatched)
+      LastMismatched = R.Name;
+    if (R.BaseHot)
+      HotInBase.insert(R.Name);
+    if (R.TestHot)
+      HotInTest.insert(R.Name);
+  }
+  unsigned HotInBoth = 0;
+  for (const auto &I : HotInBase)
+    HotInBoth += HotInTest.count(I.getKey());
+  unsigned HotInEither = HotInBase.size() + HotInTest.size() - HotInBoth;
+
+  if (!ShowFunction.empty())
+    for (const FuncOverlap &R : Results)
+      if (R.Name.find(ShowFunction) != StringRef::npos)
+        showFuncOverlap(R, Base, Test, OS);
+
+  OS << "Profile overlap information for base profile: " << BaseFilename
+     << " and test profile: " << TestFilename << "\n";
+  OS << "Program level:\n";
+  OS << "  Block overlap: " << formatShare(BlockOverlap) << "\n";
+  if (Base.CallTargetSum || Test.CallTargetSum)
+    OS << "  Call target overlap: " << formatShare(CallTargetOverlap) << "\n";
+  OS << "  Functions matched: " << NumByStatus[FuncOverlap::Matched] << "\n";
+  OS << "  Functions with a hash mismatch: "
+     << NumByStatus[FuncOverlap::Mismatched] << "\n";
+  OS << "  Functions only in the base profile: "
+     << NumByStatus[FuncOverlap::BaseOnly] << "\n";
+  OS << "  Functions only in the test profile: "
+     << NumByStatus[FuncOverlap::TestOnly] << "\n";
+  OS << "  Hot functions: " << HotInBase.size() << " in base, "
+     << HotInTest.size() << " in test, " << HotInBoth << " in both\n";
+  OS << "  Hot function Jaccard similarity: "
+     << formatShare(HotInEither ? static_cast<double>(HotInBoth) / HotInEither
+                                : 1)
+     << "\n";
+
+  // Stable, so that functions contributing as much keep the name order.
+  std::vector<const FuncOverlap *> Top;
+  for (const FuncOverlap &R : Results)
+    if (R.Contribution > 0)
+      Top.push_back(&R);
+  std::stable_sort(Top.begin(), Top.end(),
+                   [](const FuncOverlap *L, const FuncOverlap *R) {
+                     return L->Contribution > R->Contribution;
+                   });
+  if (Top.size() > TopN)
+    Top.resize(TopN);
+  if (Top.empty())
+    return 0;
+  OS << "Functions contributing most to the difference:\n";
+  for (const FuncOverlap *R : Top) {
+    OS << "  " << formatShare(R->Contribution) << " " << R->Name
+       << " (base " << formatShare(getShare(R->BaseWeight, Base.BlockSum))
+       << ", test " << formatShare(getShare(R->TestWeight, Test.BlockSum));
+    if (R->Status == FuncOverlap::Matched)
+      OS << ", similarity " << formatShare(R->BlockSimilarity);
+    else
+      OS << ", " << getOverlapStatusName(R->Status);
+    OS << ")\n";
+  }
+  return 0;
+}
+
+static int overlap_main(int argc, const char *argv[]) {
+  cl::opt<std::string> BaseFilename(cl::Positional, cl::Required,
+                                    cl::desc("<base profile file>"));
+  cl::opt<std::string> TestFilename(cl::Positional, cl::Required,
+                                    cl::desc("<test profile file>"));
+  cl::opt<std::string> OutputFilename("output", cl::value_desc("output"),
+                                      cl::init("-"), cl::desc("Output file"));
+  cl::alias OutputFilenameA("o", cl::desc("Alias for --output"),
+                            cl::aliasopt(OutputFilename));
+  cl::opt<ProfileKinds> ProfileKind(
+      cl::desc("Profile kind:"), cl::init(instr),
+      cl::values(clEnumVal(instr, "Instrumentation profile (default)"),
+                 clEnumVal(sample, "Sample profile")));
+  cl::opt<bool> IsCS("cs", cl::init(false),
+                     cl::desc("Compare the context sensitive counts (only "
+                              "meaningful for -instr)"));
+  cl::opt<uint32_t> HotCutoff(
+      "hot-cutoff", cl::init(990000),
+      cl::desc("The share of the total count, times 10000, that the hot "
+               "blocks make up. Functions with a hot block are hot."));
+  cl::opt<uint32_t> TopNFunctions(
+      "topn", cl::init(10),
+      cl::desc("Show this many of the functions contributing most to the "
+               "difference"));
+  cl::opt<std::string> ShowFunction(
+      "function", cl::desc("Details for matching functions"));
+  cl::opt<unsigned> NumThreads(
+      "num-threads", cl::init(0),
+      cl::desc("Number of threads to use (default: autodetect)"));
+  cl::alias NumThreadsA("j", cl::desc("Alias for --num-threads"),
+                        cl::aliasopt(NumThreads));
+  cl::ParseCommandLineOptions(argc, argv, "LLVM profile data overlap tool\n");
+
+  if (HotCutoff == 0 || HotCutoff >= ProfileSummary::Scale)
+    exitWithError("-hot-cutoff must be between 1 and 999999");
+
+  std::error_code EC;
+  raw_fd_ostream OS(OutputFilename.data(), EC, sys::fs::F_Text);
+  if (EC)
+    exitWithErrorCode(EC, OutputFilename);
+
+  return overlapProfiles(BaseFilename, TestFilename, ProfileKind, IsCS,
+                         HotCutoff, TopNFunctions, ShowFunction, NumThreads,
+                         OS);
 }
 
 int main(int argc, const char *argv[]) {
@@ -965,6 +2047,8 @@ int main(int argc, const char *argv[]) {
       func = merge_main;
     else if (strcmp(argv[1], "show") == 0)
       func = show_main;
+    else if (strcmp(argv[1], "overlap") == 0)
+      func = overlap_main;
 
     if (func) {
       std::string Invocation(ProgName.str() + " " + argv[1]);
@@ -979,7 +2063,7 @@ int main(int argc, const char *argv[]) {
              << "USAGE: " << ProgName << " <command> [args...]\n"
              << "USAGE: " << ProgName << " <command> -help\n\n"
              << "See each individual command --help for more details.\n"
-             << "Available commands: merge, show\n";
+             << "Available commands: merge, show, overlap\n";
       return 0;
     }
   }
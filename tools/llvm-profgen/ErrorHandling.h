@@ -0,0 +1,55 @@
+//===-- ErrorHandling.h - Error reporting for llvm-profgen ------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_LLVM_PROFGEN_ERRORHANDLING_H
+#define LLVM_TOOLS_LLVM_PROFGEN_ERRORHANDLING_H
+
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/Compiler.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/WithColor.h"
+#include "llvm/Support/raw_ostream.h"
+#include <system_error>
+
+namespace llvm {
+
+LLVM_ATTRIBUTE_NORETURN inline void exitWithError(const Twine &Message,
+                                                  StringRef Whence = "") {
+  WithColor::error();
+  if (!Whence.empty())
+    errs() << Whence << ": ";
+  errs() << Message << "\n";
+  ::exit(1);
+}
+
+LLVM_ATTRIBUTE_NORETURN inline void exitWithError(std::error_code EC,
+                                                  StringRef Whence = "") {
+  exitWithError(EC.message(), Whence);
+}
+
+LLVM_ATTRIBUTE_NORETURN inline void exitWithError(Error E,
+                                                  StringRef Whence = "") {
+  exitWithError(toString(std::move(E)), Whence);
+}
+
+inline void warn(const Twine &Message, StringRef Whence = "") {
+  WithColor::warning();
+  if (!Whence.empty())
+    errs() << Whence << ": ";
+  errs() << Message << "\n";
+}
+
+template <typename T> T unwrapOrError(Expected<T> EO, StringRef Whence) {
+  if (!EO)
+    exitWithError(EO.takeError(), Whence);
+  return std::move(*EO);
+}
+
+} // end namespace llvm
+
+#endif
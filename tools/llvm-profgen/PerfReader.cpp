@@ -0,0 +1,178 @@
+//===-- PerfReader.cpp - Aggregate the LBR samples of perf ----------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "PerfReader.h"
+#include "ErrorHandling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/Regex.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+using namespace llvm;
+using namespace sampleprof;
+
+void BranchSampleCounters::merge(const BranchSampleCounters &Other) {
+  for (const auto &I : Other.RangeCounts)
+    RangeCounts[I.first] += I.second;
+  for (const auto &I : Other.BranchCounts)
+    BranchCounts[I.first] += I.second;
+  NumSamples += Other.NumSamples;
+}
+
+/// What was found in one part of the perf script.
+struct PerfReader::ChunkResult {
+  BranchSampleCounters Counters;
+  Optional<MMapEvent> Mapping;
+};
+
+void PerfReader::parsePerfScript(StringRef Filename, unsigned NumThreads) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufOrError =
+      MemoryBuffer::getFileOrSTDIN(Filename);
+  if (std::error_code EC = BufOrError.getError())
+    exitWithError(EC, Filename);
+  StringRef Buffer = BufOrError.get()->getBuffer();
+
+  if (NumThreads == 0)
+    NumThreads = hardware_concurrency();
+
+  // Split the script into chunks of whole lines.
+  std::vector<StringRef> Chunks;
+  size_t ChunkSize = Buffer.size() / NumThreads + 1;
+  while (!Buffer.empty()) {
+    size_t End = Buffer.find('\n', std::min(ChunkSize, Buffer.size() - 1));
+    End = End == StringRef::npos ? Buffer.size() : End + 1;
+    Chunks.push_back(Buffer.take_front(End));
+    Buffer = Buffer.drop_front(End);
+  }
+
+  std::vector<ChunkResult> Results(Chunks.size());
+  if (Chunks.size() <= 1) {
+    for (size_t I = 0; I < Chunks.size(); ++I)
+      parseChunk(Chunks[I], Results[I]);
+  } else {
+    ThreadPool Pool(std::min<size_t>(NumThreads, Chunks.size()));
+    for (size_t I = 0; I < Chunks.size(); ++I)
+      Pool.async([this, &Chunks, &Results, I]() {
+        parseChunk(Chunks[I], Results[I]);
+      });
+    Pool.wait();
+  }
+
+  // Merge the chunks in order, so that the first mapping of the binary in
+  // the script wins.
+  for (ChunkResult &Result : Results) {
+    Counters.merge(Result.Counters);
+    if (!Mapping)
+      Mapping = Result.Mapping;
+  }
+}
+
+void PerfReader::parsePerfData(StringRef Filename, unsigned NumThreads) {
+  ErrorOr<std::string> Perf = sys::findProgramByName("perf");
+  if (!Perf)
+    exitWithError("cannot find perf, use --perfscript with the output of "
+                  "`perf script -F ip,brstack --show-mmap-events` instead",
+                  Filename);
+
+  SmallString<128> ScriptFile;
+  if (std::error_code EC =
+          sys::fs::createTemporaryFile("perf-script", "txt", ScriptFile))
+    exitWithError(EC, "perf script output");
+  FileRemover Remover(ScriptFile);
+
+  StringRef Args[] = {*Perf, "script", "-F", "ip,brstack",
+                      "--show-mmap-events", "-i", Filename};
+  Optional<StringRef> Redirects[] = {llvm::None, StringRef(ScriptFile),
+                                     llvm::None};
+  std::string ErrMsg;
+  if (sys::ExecuteAndWait(*Perf, Args, llvm::None, Redirects, 0, 0, &ErrMsg))
+    exitWithError("perf script failed" + (ErrMsg.empty() ? "" : ": " + ErrMsg),
+                  Filename);
+
+  parsePerfScript(ScriptFile, NumThreads);
+}
+
+void PerfReader::parseChunk(StringRef Chunk, ChunkResult &Result) const {
+  while (!Chunk.empty()) {
+    StringRef Line;
+    std::tie(Line, Chunk) = Chunk.split('\n');
+    if (Line.contains("PERF_RECORD_MMAP"))
+      parseMMapEvent(Line, Result);
+    else
+      parseSample(Line, Result.Counters);
+  }
+}
+
+/// Parse an event like
+///   PERF_RECORD_MMAP2 123/123: [0x400000(0x1000) @ 0 08:01 527 0]: r-xp /a.out
+/// and keep it if it maps the code of the profiled binary.
+void PerfReader::parseMMapEvent(StringRef Line, ChunkResult &Result) const {
+  if (Result.Mapping)
+    return;
+
+  Regex MMapRegex(
+      "PERF_RECORD_MMAP2? -?[0-9]+/-?[0-9]+: "
+      "\\[(0x[0-9a-f]+)\\((0x[0-9a-f]+)\\) @ (0x[0-9a-f]+|[0-9]+)[^]]*\\]: "
+      "([-a-z]+) (.*)$");
+  SmallVector<StringRef, 6> Fields;
+  if (!MMapRegex.match(Line, &Fields))
+    return;
+  if (!Fields[4].contains('x') ||
+      sys::path::filename(Fields[5].trim()) != sys::path::filename(BinaryPath))
+    return;
+
+  MMapEvent Event;
+  if (Fields[1].getAsInteger(0, Event.Address) ||
+      Fields[2].getAsInteger(0, Event.Size) ||
+      Fields[3].getAsInteger(0, Event.FileOffset))
+    return;
+  Result.Mapping = Event;
+}
+
+/// Parse a sample like
+///   4011b0 0x4011b4/0x401190/P/-/-/0 0x401072/0x401180/P/-/-/0
+/// The range of code between two consecutive branches ran sequentially.
+void PerfReader::parseSample(StringRef Line, BranchSampleCounters &Counters) {
+  SmallVector<AddressPair, 32> Branches;
+  SmallVector<StringRef, 32> Fields;
+  Line.split(Fields, ' ', -1, false);
+  for (StringRef Field : Fields) {
+    if (!Field.startswith("0x"))
+      continue;
+    StringRef Source, Target;
+    std::tie(Source, Target) = Field.split('/');
+    Target = Target.split('/').first;
+    AddressPair Branch;
+    if (Source.getAsInteger(0, Branch.first) ||
+        Target.getAsInteger(0, Branch.second))
+      continue;
+    Branches.push_back(Branch);
+  }
+  if (Branches.empty())
+    return;
+
+  ++Counters.NumSamples;
+  for (size_t I = 0, E = Branches.size(); I < E; ++I) {
+    ++Counters.BranchCounts[Branches[I]];
+    if (I + 1 == E)
+      break;
+    uint64_t Begin = Branches[I + 1].second;
+    uint64_t End = Branches[I].first;
+    if (Begin <= End)
+      ++Counters.RangeCounts[{Begin, End}];
+  }
+}
@@ -0,0 +1,88 @@
+//===-- PerfReader.h - Aggregate the LBR samples of perf -------*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_LLVM_PROFGEN_PERFREADER_H
+#define LLVM_TOOLS_LLVM_PROFGEN_PERFREADER_H
+
+#include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringRef.h"
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+
+namespace llvm {
+namespace sampleprof {
+
+/// Address range or branch, as a (begin, end) or (source, target) pair.
+using AddressPair = std::pair<uint64_t, uint64_t>;
+
+/// Counts aggregated from LBR samples.
+struct BranchSampleCounters {
+  /// Number of times each range of addresses was executed without taking a
+  /// branch. Both ends are inclusive: a range starts at the target of a
+  /// branch and ends at the source of the next branch.
+  std::map<AddressPair, uint64_t> RangeCounts;
+
+  /// Number of times each branch was taken, keyed by source and target.
+  std::map<AddressPair, uint64_t> BranchCounts;
+
+  /// Number of samples the counts come from.
+  uint64_t NumSamples = 0;
+
+  void merge(const BranchSampleCounters &Other);
+};
+
+/// Mapping of the profiled binary into the address space of a process, from
+/// a PERF_RECORD_MMAP event.
+struct MMapEvent {
+  uint64_t Address = 0;
+  uint64_t Size = 0;
+  uint64_t FileOffset = 0;
+};
+
+/// Reader of the LBR samples taken by `perf record -b`.
+///
+/// The samples are read from the output of
+/// `perf script -F ip,brstack --show-mmap-events`, where each sample is a
+/// line holding the taken branches as source/target/... fields, most recent
+/// first.
+class PerfReader {
+public:
+  /// \p BinaryPath is the binary to report the mappings of.
+  explicit PerfReader(StringRef BinaryPath) : BinaryPath(BinaryPath) {}
+
+  /// Aggregate the samples of the perf script \p Filename. The file is split
+  /// into \p NumThreads parts, which are parsed in parallel. The result does
+  /// not depend on \p NumThreads.
+  void parsePerfScript(StringRef Filename, unsigned NumThreads);
+
+  /// Run `perf script` on \p Filename and aggregate the samples it prints.
+  void parsePerfData(StringRef Filename, unsigned NumThreads);
+
+  const BranchSampleCounters &getCounters() const { return Counters; }
+
+  /// First mapping of the profiled binary found in the input, if any.
+  const Optional<MMapEvent> &getMapping() const { return Mapping; }
+
+private:
+  struct ChunkResult;
+
+  void parseChunk(StringRef Chunk, ChunkResult &Result) const;
+  void parseMMapEvent(StringRef Line, ChunkResult &Result) const;
+  static void parseSample(StringRef Line, BranchSampleCounters &Counters);
+
+  std::string BinaryPath;
+  BranchSampleCounters Counters;
+  Optional<MMapEvent> Mapping;
+};
+
+} // end namespace sampleprof
+} // end namespace llvm
+
+#endif
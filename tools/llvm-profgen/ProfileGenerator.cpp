@@ -0,0 +1,135 @@
+//===-- ProfileGenerator.cpp - Build sample profiles from LBR -------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "ProfileGenerator.h"
+#include "llvm/IR/DebugInfoMetadata.h"
+#include <algorithm>
+#include <map>
+#include <vector>
+
+using namespace llvm;
+using namespace sampleprof;
+
+/// Location of the code described by \p Frame in the body of its function,
+/// computed like FunctionSamples::getOffset.
+static LineLocation getLineLocation(const DILineInfo &Frame) {
+  return LineLocation(
+      (Frame.Line - Frame.StartLine) & 0xffff,
+      DILocation::getBaseDiscriminatorFromDiscriminator(Frame.Discriminator));
+}
+
+void ProfileGenerator::generateProfile() {
+  populateBodySamples();
+  populateCallSamples();
+  for (auto &I : Profiles)
+    computeTotalSamples(I.second);
+}
+
+/// Get the profile of the innermost function of \p InliningInfo, nested in
+/// the profiles of the functions it is inlined in. \returns nullptr if the
+/// code has no debug info.
+FunctionSamples *
+ProfileGenerator::getInlineContext(const DIInliningInfo &InliningInfo) {
+  unsigned NumFrames = InliningInfo.getNumberOfFrames();
+  if (NumFrames == 0)
+    return nullptr;
+  const DILineInfo &Outermost = InliningInfo.getFrame(NumFrames - 1);
+  if (Outermost.FunctionName == DILineInfo().FunctionName)
+    return nullptr;
+
+  auto &Entry = *Profiles.try_emplace(Outermost.FunctionName).first;
+  FunctionSamples *FS = &Entry.second;
+  FS->setName(Entry.first());
+  for (unsigned I = NumFrames - 1; I > 0; --I) {
+    FunctionSamplesMap &Callees =
+        FS->functionSamplesAt(getLineLocation(InliningInfo.getFrame(I)));
+    auto &Callee =
+        *Callees.emplace(InliningInfo.getFrame(I - 1).FunctionName,
+                         FunctionSamples())
+             .first;
+    FS = &Callee.second;
+    FS->setName(Callee.first);
+  }
+  return FS;
+}
+
+void ProfileGenerator::populateBodySamples() {
+  // Count how many times the code of every row ran, by adding the count of
+  // each range to the rows it overlaps.
+  ArrayRef<uint64_t> Rows = Binary.getRowAddresses();
+  std::vector<uint64_t> CountDeltas(Rows.size() + 1);
+  for (const auto &I : Counters.RangeCounts) {
+    uint64_t Begin = I.first.first + AddressDelta;
+    uint64_t End = I.first.second + AddressDelta;
+    auto First = std::upper_bound(Rows.begin(), Rows.end(), Begin);
+    if (First != Rows.begin())
+      --First;
+    auto Last = std::upper_bound(First, Rows.end(), End);
+    if (First == Last)
+      continue;
+    CountDeltas[First - Rows.begin()] += I.second;
+    CountDeltas[Last - Rows.begin()] -= I.second;
+  }
+
+  // A line gets the largest count of its rows.
+  std::map<std::pair<FunctionSamples *, LineLocation>, uint64_t> LineCounts;
+  uint64_t Count = 0;
+  for (size_t Row = 0; Row < Rows.size(); ++Row) {
+    Count += CountDeltas[Row];
+    if (!Count || Binary.isSequenceEnd(Row))
+      continue;
+    DIInliningInfo InliningInfo = Binary.getInliningInfo(Rows[Row]);
+    FunctionSamples *FS = getInlineContext(InliningInfo);
+    if (!FS || !InliningInfo.getFrame(0).Line)
+      continue;
+    uint64_t &LineCount =
+        LineCounts[{FS, getLineLocation(InliningInfo.getFrame(0))}];
+    LineCount = std::max(LineCount, Count);
+  }
+
+  for (const auto &I : LineCounts) {
+    const LineLocation &Loc = I.first.second;
+    I.first.first->addBodySamples(Loc.LineOffset, Loc.Discriminator,
+                                  I.second);
+  }
+}
+
+void ProfileGenerator::populateCallSamples() {
+  for (const auto &I : Counters.BranchCounts) {
+    uint64_t Source = I.first.first + AddressDelta;
+    uint64_t Target = I.first.second + AddressDelta;
+    StringRef Callee = Binary.getFuncNameAt(Target);
+    if (Callee.empty())
+      continue;
+
+    auto &Entry = *Profiles.try_emplace(Callee).first;
+    Entry.second.setName(Entry.first());
+    Entry.second.addHeadSamples(I.second);
+
+    DIInliningInfo InliningInfo = Binary.getInliningInfo(Source);
+    FunctionSamples *FS = getInlineContext(InliningInfo);
+    if (!FS || !InliningInfo.getFrame(0).Line)
+      continue;
+    LineLocation Loc = getLineLocation(InliningInfo.getFrame(0));
+    FS->addCalledTargetSamples(Loc.LineOffset, Loc.Discriminator, Callee,
+                               I.second);
+  }
+}
+
+/// Set the total samples of \p FS and of the profiles inlined in it to the
+/// sum of their body samples. \returns the total samples of \p FS.
+uint64_t ProfileGenerator::computeTotalSamples(FunctionSamples &FS) {
+  uint64_t Total = 0;
+  for (const auto &I : FS.getBodySamples())
+    Total += I.second.getSamples();
+  for (const auto &I : FS.getCallsiteSamples())
+    for (auto &Callee : FS.functionSamplesAt(I.first))
+      Total += computeTotalSamples(Callee.second);
+  FS.addTotalSamples(Total);
+  return Total;
+}
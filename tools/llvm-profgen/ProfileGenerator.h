@@ -0,0 +1,56 @@
+//===-- ProfileGenerator.h - Build sample profiles from LBR ----*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_LLVM_PROFGEN_PROFILEGENERATOR_H
+#define LLVM_TOOLS_LLVM_PROFGEN_PROFILEGENERATOR_H
+
+#include "PerfReader.h"
+#include "ProfiledBinary.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ProfileData/SampleProf.h"
+
+namespace llvm {
+namespace sampleprof {
+
+/// Builds the sample profile of a binary from the branch and range counts
+/// of its LBR samples.
+///
+/// Every address covered by a range gets the count of the range, and every
+/// source line, in the context of the functions it is inlined in, gets the
+/// largest count of its addresses, which is what the sample profile loader
+/// expects for the instructions of a line. Branches to the start of a
+/// function are calls: they give the call targets of the call sites and the
+/// head samples of the functions.
+class ProfileGenerator {
+public:
+  /// \p AddressDelta is added to the addresses of \p Counters to turn them
+  /// into addresses of \p Binary.
+  ProfileGenerator(ProfiledBinary &Binary, const BranchSampleCounters &Counters,
+                   uint64_t AddressDelta)
+      : Binary(Binary), Counters(Counters), AddressDelta(AddressDelta) {}
+
+  void generateProfile();
+
+  const StringMap<FunctionSamples> &getProfiles() const { return Profiles; }
+
+private:
+  void populateBodySamples();
+  void populateCallSamples();
+  FunctionSamples *getInlineContext(const DIInliningInfo &InliningInfo);
+  static uint64_t computeTotalSamples(FunctionSamples &FS);
+
+  ProfiledBinary &Binary;
+  const BranchSampleCounters &Counters;
+  uint64_t AddressDelta;
+  StringMap<FunctionSamples> Profiles;
+};
+
+} // end namespace sampleprof
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,115 @@
+//===-- ProfiledBinary.cpp - Binary the samples were taken from -----------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "ProfiledBinary.h"
+#include "ErrorHandling.h"
+#include "llvm/DebugInfo/DWARF/DWARFDebugLine.h"
+#include "llvm/Object/ELFObjectFile.h"
+#include <algorithm>
+#include <numeric>
+
+using namespace llvm;
+using namespace object;
+using namespace sampleprof;
+
+ProfiledBinary::ProfiledBinary(StringRef Path) : Path(Path) {
+  Binary = unwrapOrError(createBinary(Path), Path);
+  auto *Obj = dyn_cast<ELF64LEObjectFile>(Binary.getBinary());
+  if (!Obj)
+    exitWithError("unsupported binary format, only 64-bit little-endian ELF "
+                  "files are supported",
+                  Path);
+
+  for (const auto &Phdr :
+       unwrapOrError(Obj->getELFFile()->program_headers(), Path)) {
+    if (Phdr.p_type == ELF::PT_LOAD && (Phdr.p_flags & ELF::PF_X))
+      CodeSegments.emplace_back(Phdr.p_offset, Phdr.p_vaddr);
+  }
+  if (CodeSegments.empty())
+    exitWithError("no executable segment", Path);
+  llvm::sort(CodeSegments);
+
+  DICtx = DWARFContext::create(*Obj);
+  loadSymbols();
+  loadLineTables();
+}
+
+void ProfiledBinary::loadSymbols() {
+  const auto *Obj = cast<ObjectFile>(Binary.getBinary());
+  for (const SymbolRef &Sym : Obj->symbols()) {
+    Expected<SymbolRef::Type> Type = Sym.getType();
+    if (!Type) {
+      consumeError(Type.takeError());
+      continue;
+    }
+    if (*Type != SymbolRef::ST_Function)
+      continue;
+    Expected<uint64_t> Address = Sym.getAddress();
+    Expected<StringRef> Name = Sym.getName();
+    if (!Address || !Name || Name->empty()) {
+      if (!Address)
+        consumeError(Address.takeError());
+      if (!Name)
+        consumeError(Name.takeError());
+      continue;
+    }
+    FuncStarts.insert({*Address, *Name});
+  }
+}
+
+void ProfiledBinary::loadLineTables() {
+  // Collect the start of every row and sequence end, keeping a single entry
+  // per address, which starts a row if any does.
+  std::vector<std::pair<uint64_t, bool>> Rows;
+  for (const auto &CU : DICtx->compile_units()) {
+    const DWARFDebugLine::LineTable *LineTable =
+        DICtx->getLineTableForUnit(CU.get());
+    if (!LineTable)
+      continue;
+    for (const DWARFDebugLine::Row &Row : LineTable->Rows)
+      Rows.emplace_back(Row.Address.Address, Row.EndSequence);
+  }
+  llvm::sort(Rows);
+  Rows.erase(std::unique(Rows.begin(), Rows.end(),
+                         [](const std::pair<uint64_t, bool> &L,
+                            const std::pair<uint64_t, bool> &R) {
+                           return L.first == R.first;
+                         }),
+             Rows.end());
+
+  RowAddresses.reserve(Rows.size());
+  SequenceEnds.reserve(Rows.size());
+  for (const auto &Row : Rows) {
+    RowAddresses.push_back(Row.first);
+    SequenceEnds.push_back(Row.second);
+  }
+}
+
+StringRef ProfiledBinary::getFuncNameAt(uint64_t Address) const {
+  auto I = FuncStarts.find(Address);
+  return I == FuncStarts.end() ? StringRef() : I->second;
+}
+
+uint64_t ProfiledBinary::getAddressDelta(uint64_t MappedAddress,
+                                         uint64_t FileOffset) const {
+  // Find the segment the mapping starts in.
+  auto I = std::upper_bound(
+      CodeSegments.begin(), CodeSegments.end(), FileOffset,
+      [](uint64_t Offset, const std::pair<uint64_t, uint64_t> &Segment) {
+        return Offset < Segment.first;
+      });
+  const auto &Segment = I == CodeSegments.begin() ? *I : *std::prev(I);
+  return FileOffset - Segment.first + Segment.second - MappedAddress;
+}
+
+DIInliningInfo ProfiledBinary::getInliningInfo(uint64_t Address) {
+  DILineInfoSpecifier Spec(DILineInfoSpecifier::FileLineInfoKind::Default,
+                           DINameKind::LinkageName);
+  return DICtx->getInliningInfoForAddress(
+      {Address, SectionedAddress::UndefSection}, Spec);
+}
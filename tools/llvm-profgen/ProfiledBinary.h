@@ -0,0 +1,76 @@
+//===-- ProfiledBinary.h - Binary the samples were taken from --*- C++ -*-===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef LLVM_TOOLS_LLVM_PROFGEN_PROFILEDBINARY_H
+#define LLVM_TOOLS_LLVM_PROFGEN_PROFILEDBINARY_H
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/DebugInfo/DIContext.h"
+#include "llvm/DebugInfo/DWARF/DWARFContext.h"
+#include "llvm/Object/Binary.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace llvm {
+namespace sampleprof {
+
+/// The binary the samples were taken from, with its symbols and debug info.
+class ProfiledBinary {
+public:
+  /// Load the binary at \p Path. Only 64-bit little-endian ELF files are
+  /// supported, as are LBR samples.
+  explicit ProfiledBinary(StringRef Path);
+
+  StringRef getPath() const { return Path; }
+
+  /// Name of the function that starts at \p Address, or an empty string if
+  /// no function starts there.
+  StringRef getFuncNameAt(uint64_t Address) const;
+
+  /// Offset to add to the addresses of a process, in which the code of the
+  /// binary at \p FileOffset was mapped at \p MappedAddress, to get the
+  /// addresses of the binary.
+  uint64_t getAddressDelta(uint64_t MappedAddress, uint64_t FileOffset) const;
+
+  /// Start addresses of the rows of the line tables, sorted. A row spans the
+  /// addresses up to the next one. Rows that end a sequence, and thus start
+  /// a gap without line information, are flagged by isSequenceEnd.
+  ArrayRef<uint64_t> getRowAddresses() const { return RowAddresses; }
+  bool isSequenceEnd(size_t Row) const { return SequenceEnds[Row]; }
+
+  /// Source locations of the code at \p Address, from the innermost inlined
+  /// function to the function the code is in. Functions are named by their
+  /// linkage names.
+  DIInliningInfo getInliningInfo(uint64_t Address);
+
+private:
+  void loadSymbols();
+  void loadLineTables();
+
+  std::string Path;
+  object::OwningBinary<object::Binary> Binary;
+  std::unique_ptr<DWARFContext> DICtx;
+
+  /// Functions of the symbol table, by start address.
+  std::map<uint64_t, StringRef> FuncStarts;
+
+  /// File offset and address of the executable segments.
+  std::vector<std::pair<uint64_t, uint64_t>> CodeSegments;
+
+  std::vector<uint64_t> RowAddresses;
+  std::vector<bool> SequenceEnds;
+};
+
+} // end namespace sampleprof
+} // end namespace llvm
+
+#endif
@@ -0,0 +1,97 @@
+//===- llvm-profgen.cpp - LLVM sample profile generator -------------------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+//
+// llvm-profgen generates sample profiles from the LBR samples taken by perf.
+//
+//===----------------------------------------------------------------------===//
+
+#include "ErrorHandling.h"
+#include "PerfReader.h"
+#include "ProfileGenerator.h"
+#include "ProfiledBinary.h"
+#include "llvm/ProfileData/SampleProfWriter.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+
+using namespace llvm;
+using namespace sampleprof;
+
+static cl::opt<std::string>
+    PerfScriptFilename("perfscript", cl::value_desc("perfscript"),
+                       cl::desc("Output of `perf script -F ip,brstack "
+                                "--show-mmap-events` to read the samples "
+                                "from"));
+
+static cl::opt<std::string>
+    PerfDataFilename("perfdata", cl::value_desc("perfdata"),
+                     cl::desc("perf.data file to read the samples from, "
+                              "with perf script"));
+
+static cl::opt<std::string>
+    BinaryFilename("binary", cl::value_desc("binary"), cl::Required,
+                   cl::desc("Binary the samples were taken from"));
+
+static cl::opt<std::string> OutputFilename("output", cl::value_desc("output"),
+                                           cl::Required,
+                                           cl::desc("Output profile file"));
+static cl::alias OutputFilenameA("o", cl::desc("Alias for --output"),
+                                 cl::aliasopt(OutputFilename));
+
+static cl::opt<SampleProfileFormat> OutputFormat(
+    "format", cl::desc("Format of output profile"), cl::init(SPF_Binary),
+    cl::values(clEnumValN(SPF_Binary, "binary", "Binary encoding (default)"),
+               clEnumValN(SPF_Compact_Binary, "compbinary",
+                          "Compact binary encoding"),
+               clEnumValN(SPF_Ext_Binary, "extbinary",
+                          "Extensible binary encoding"),
+               clEnumValN(SPF_Text, "text", "Text encoding")));
+
+static cl::opt<unsigned>
+    NumThreads("num-threads", cl::init(0),
+               cl::desc("Number of threads to aggregate the samples with "
+                        "(default: autodetect)"));
+static cl::alias NumThreadsA("j", cl::desc("Alias for --num-threads"),
+                             cl::aliasopt(NumThreads));
+
+int main(int argc, const char *argv[]) {
+  InitLLVM X(argc, argv);
+
+  cl::ParseCommandLineOptions(argc, argv, "LLVM sample profile generator\n");
+
+  if (PerfScriptFilename.empty() == PerfDataFilename.empty())
+    exitWithError("specify exactly one of --perfscript and --perfdata");
+
+  ProfiledBinary Binary(BinaryFilename);
+
+  PerfReader Reader(BinaryFilename);
+  if (!PerfScriptFilename.empty())
+    Reader.parsePerfScript(PerfScriptFilename, NumThreads);
+  else
+    Reader.parsePerfData(PerfDataFilename, NumThreads);
+  if (!Reader.getCounters().NumSamples)
+    warn("no LBR samples found",
+         PerfScriptFilename.empty() ? PerfDataFilename : PerfScriptFilename);
+
+  // Without a mapping, assume the addresses are those of the binary, as for
+  // an executable that is not position-independent.
+  uint64_t AddressDelta = 0;
+  if (const auto &Mapping = Reader.getMapping())
+    AddressDelta = Binary.getAddressDelta(Mapping->Address,
+                                          Mapping->FileOffset);
+
+  ProfileGenerator Generator(Binary, Reader.getCounters(), AddressDelta);
+  Generator.generateProfile();
+
+  auto WriterOrErr = SampleProfileWriter::create(OutputFilename, OutputFormat);
+  if (std::error_code EC = WriterOrErr.getError())
+    exitWithError(EC, OutputFilename);
+  if (std::error_code EC = WriterOrErr.get()->write(Generator.getProfiles()))
+    exitWithError(EC, OutputFilename);
+
+  return 0;
+}
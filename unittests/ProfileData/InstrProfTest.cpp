@@ -221,6 +221,74 @@ TEST_F(InstrProfTest, test_writer_merge) {
   ASSERT_EQ(0U, R->Counts[1]);
 }
 
+TEST_F(InstrProfTest, test_writer_threads) {
+  // Enough functions for the hash table to be written in several ranges of
+  // buckets per thread, some of them with value profiles and some context
+  // sensitive.
+  for (unsigned I = 0; I < 5000; ++I) {
+    std::string Name = "func" + std::to_string(I);
+    uint64_t Hash = 0x1234;
+    if (I % 7 == 0)
+      NamedInstrProfRecord::setCSFlagInHash(Hash);
+    NamedInstrProfRecord Record(Name, Hash, {I, I * 3 % 101, I % 13});
+    if (I % 5 == 0) {
+      Record.reserveSites(IPVK_IndirectCallTarget, 1);
+      InstrProfValueData VD[] = {{(uint64_t)"callee1", I % 11 + 1}};
+      Record.addValueData(IPVK_IndirectCallTarget, 0, VD, 1, nullptr);
+    }
+    Writer.addRecord(std::move(Record), Err);
+  }
+  ASSERT_THAT_ERROR(Writer.setIsIRLevelProfile(true, true), Succeeded());
+  std::unique_ptr<MemoryBuffer> Serial = Writer.writeBuffer();
+
+  for (unsigned NumThreads : {2, 3, 8}) {
+    Writer.setNumThreads(NumThreads);
+    std::unique_ptr<MemoryBuffer> Parallel = Writer.writeBuffer();
+    ASSERT_EQ(Serial->getBuffer(), Parallel->getBuffer());
+  }
+
+  readProfile(std::move(Serial));
+  ASSERT_EQ(4285U, Reader->getSummary(/* IsCS */ false).getNumFunctions());
+  ASSERT_EQ(715U, Reader->getSummary(/* IsCS */ true).getNumFunctions());
+}
+
+TEST_P(MaybeSparseInstrProfTest, get_record_view) {
+  NamedInstrProfRecord Record("foo", 0x1234, {1, 2, 3});
+  Record.reserveSites(IPVK_IndirectCallTarget, 1);
+  InstrProfValueData VD[] = {{(uint64_t)"bar", 7}, {(uint64_t)"baz", 5}};
+  Record.addValueData(IPVK_IndirectCallTarget, 0, VD, 2, nullptr);
+  Writer.addRecord(std::move(Record), Err);
+  Writer.addRecord({"foo", 0x1235, {4, 5}}, Err);
+  readProfile(Writer.writeBuffer());
+
+  InstrProfRecordView View;
+  ASSERT_THAT_ERROR(Reader->getRecordView("foo", 0x1235, View), Succeeded());
+  ASSERT_EQ(0x1235U, View.getHash());
+  ASSERT_EQ(2U, View.getNumCounts());
+  ASSERT_EQ(4U, View.getCount(0));
+  ASSERT_EQ(5U, View.getCount(1));
+
+  ASSERT_THAT_ERROR(Reader->getRecordView("foo", 0x1234, View), Succeeded());
+  std::vector<uint64_t> Counts;
+  View.getCounts(Counts);
+  ASSERT_EQ(std::vector<uint64_t>({1, 2, 3}), Counts);
+  ASSERT_TRUE(View.hasValueProfData());
+  InstrProfRecord Decoded;
+  ASSERT_THAT_ERROR(View.getRecord(Decoded), Succeeded());
+  ASSERT_EQ(Counts, Decoded.Counts);
+  ASSERT_EQ(1U, Decoded.getNumValueSites(IPVK_IndirectCallTarget));
+  ASSERT_EQ(2U, Decoded.getNumValueDataForSite(IPVK_IndirectCallTarget, 0));
+  std::unique_ptr<InstrProfValueData[]> DecodedVD =
+      Decoded.getValueForSite(IPVK_IndirectCallTarget, 0);
+  ASSERT_EQ(7U, DecodedVD[0].Count);
+  ASSERT_EQ(5U, DecodedVD[1].Count);
+
+  ASSERT_TRUE(ErrorEquals(instrprof_error::hash_mismatch,
+                          Reader->getRecordView("foo", 0x1236, View)));
+  ASSERT_TRUE(ErrorEquals(instrprof_error::unknown_function,
+                          Reader->getRecordView("bar", 0x1234, View)));
+}
+
 static const char callee1[] = "callee1";
 static const char callee2[] = "callee2";
 static const char callee3[] = "callee3";
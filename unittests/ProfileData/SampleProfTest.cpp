@@ -15,6 +15,7 @@
 #include "llvm/ProfileData/SampleProfReader.h"
 #include "llvm/ProfileData/SampleProfWriter.h"
 #include "llvm/Support/Casting.h"
+#include "llvm/Support/Compression.h"
 #include "llvm/Support/ErrorOr.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/raw_ostream.h"
@@ -38,6 +39,9 @@ struct SampleProfTest : ::testing::Test {
   LLVMContext Context;
   std::unique_ptr<SampleProfileWriter> Writer;
   std::unique_ptr<SampleProfileReader> Reader;
+  bool CompressAllSections = false;
+  bool WriteOriginalNames = false;
+  bool RemapModuleFunctions = false;
 
   SampleProfTest() : Writer(), Reader() {}
 
@@ -48,6 +52,10 @@ struct SampleProfTest : ::testing::Test {
     auto WriterOrErr = SampleProfileWriter::create(OS, Format);
     ASSERT_TRUE(NoError(WriterOrErr.getError()));
     Writer = std::move(WriterOrErr.get());
+    if (CompressAllSections)
+      Writer->setToCompressAllSections();
+    if (WriteOriginalNames)
+      Writer->setToWriteOriginalNames();
   }
 
   void readProfile(const Module &M, StringRef Profile) {
@@ -87,6 +95,7 @@ struct SampleProfTest : ::testing::Test {
     BarSamples.addCalledTargetSamples(1, 0, StringviewName, 437);
 
     Module M("my_module", Context);
+    Module RemapM("my_remapped_module", Context);
     FunctionType *fn_type =
         FunctionType::get(Type::getVoidTy(Context), {}, false);
     M.getOrInsertFunction(FooName, fn_type);
@@ -118,6 +127,12 @@ struct SampleProfTest : ::testing::Test {
           std::move(MemBuffer), Context, std::move(Reader)));
       FooName = "_Z4fauxi";
       BarName = "_Z3barl";
+      // Remap the functions of a module up front rather than one by one.
+      if (RemapModuleFunctions) {
+        RemapM.getOrInsertFunction(FooName, fn_type);
+        RemapM.getOrInsertFunction(BarName, fn_type);
+        Reader->collectFuncsToUse(RemapM);
+      }
 
       EC = Reader->read();
       ASSERT_TRUE(NoError(EC));
@@ -198,6 +213,39 @@ struct SampleProfTest : ::testing::Test {
     ASSERT_TRUE(PS);
     VerifySummary(*PS);
     delete PS;
+
+    // Test that the profiles can still be looked up once they have been
+    // flattened.
+    Reader->flattenProfiles();
+    ASSERT_EQ(0u, Reader->getProfiles().size());
+    ASSERT_EQ(2u, Reader->getFlatProfiles().size());
+    ASSERT_TRUE(Reader->getSamplesFor(FooName) == nullptr);
+
+    const FlatFunctionSamples *FlatFooSamples =
+        Reader->getFlatSamplesFor(FooName);
+    ASSERT_TRUE(FlatFooSamples != nullptr);
+    ASSERT_EQ(7711u, FlatFooSamples->getTotalSamples());
+    ASSERT_EQ(610u, FlatFooSamples->getHeadSamples());
+    ASSERT_EQ(5u, FlatFooSamples->getBodySamples().size());
+    ASSERT_EQ(60351u, FlatFooSamples->findSamplesAt(8, 0).get());
+    ASSERT_FALSE(FlatFooSamples->findSamplesAt(3, 0));
+
+    const FlatFunctionSamples *FlatBarSamples =
+        Reader->getFlatSamplesFor(BarName);
+    ASSERT_TRUE(FlatBarSamples != nullptr);
+    if (Format != SampleProfileFormat::SPF_Compact_Binary) {
+      ASSERT_EQ("_Z3bari", FlatBarSamples->getName());
+    }
+    ErrorOr<ArrayRef<FlatCallTarget>> CallTargets =
+        FlatBarSamples->findCallTargetsAt(1, 0);
+    ASSERT_FALSE(CallTargets.getError());
+    ASSERT_EQ(2u, CallTargets.get().size());
+    for (const FlatCallTarget &CT : CallTargets.get()) {
+      if (CT.Name == MconstructRep)
+        ASSERT_EQ(1000u, CT.Samples);
+      else
+        ASSERT_EQ(StringviewRep, CT.Name);
+    }
   }
 
   void addFunctionSamples(StringMap<FunctionSamples> *Smap, const char *Fname,
@@ -271,6 +319,232 @@ struct SampleProfTest : ::testing::Test {
       ASSERT_EQ(I->getValue(), Esamples);
     }
   }
+
+  void testReadFuncsToUse(SampleProfileFormat Format) {
+    SmallVector<char, 128> ProfilePath;
+    std::error_code EC;
+    EC = llvm::sys::fs::createTemporaryFile("profile", "", ProfilePath);
+    ASSERT_TRUE(NoError(EC));
+    StringRef ProfileFile(ProfilePath.data(), ProfilePath.size());
+
+    StringMap<FunctionSamples> ProfMap;
+    addFunctionSamples(&ProfMap, "foo", uint64_t(20301), uint64_t(1437));
+    addFunctionSamples(&ProfMap, "bar", uint64_t(20303), uint64_t(1439));
+    addFunctionSamples(&ProfMap, "baz", uint64_t(20305), uint64_t(1441));
+
+    createWriter(Format, ProfileFile);
+    EC = Writer->write(ProfMap);
+    ASSERT_TRUE(NoError(EC));
+    Writer->getOutputStream().flush();
+
+    // Only the profiles of the functions in the module are read.
+    Module M("my_module", Context);
+    FunctionType *FnType =
+        FunctionType::get(Type::getVoidTy(Context), {}, false);
+    M.getOrInsertFunction("bar", FnType);
+    readProfile(M, ProfileFile);
+    EC = Reader->read();
+    ASSERT_TRUE(NoError(EC));
+    ASSERT_EQ(1u, Reader->getProfiles().size());
+    FunctionSamples *Samples = Reader->getSamplesFor("bar");
+    ASSERT_TRUE(Samples != nullptr);
+    ASSERT_EQ(20303u, Samples->getTotalSamples());
+    ASSERT_EQ(1439u, Samples->getHeadSamples());
+    ASSERT_TRUE(Reader->getSamplesFor("foo") == nullptr);
+
+    // Without a module, every profile is read.
+    auto ReaderOrErr = SampleProfileReader::create(ProfileFile, Context);
+    ASSERT_TRUE(NoError(ReaderOrErr.getError()));
+    Reader = std::move(ReaderOrErr.get());
+    EC = Reader->read();
+    ASSERT_TRUE(NoError(EC));
+    ASSERT_EQ(3u, Reader->getProfiles().size());
+    Samples = Reader->getSamplesFor("baz");
+    ASSERT_TRUE(Samples != nullptr);
+    ASSERT_EQ(20305u, Samples->getTotalSamples());
+  }
+
+  void testReadContexts(SampleProfileFormat Format) {
+    SmallVector<char, 128> ProfilePath;
+    std::error_code EC;
+    EC = llvm::sys::fs::createTemporaryFile("profile", "", ProfilePath);
+    ASSERT_TRUE(NoError(EC));
+    StringRef ProfileFile(ProfilePath.data(), ProfilePath.size());
+
+    StringMap<FunctionSamples> ProfMap;
+    addFunctionSamples(&ProfMap, "main", uint64_t(300), uint64_t(1));
+    addFunctionSamples(&ProfMap, "[main:3 @ foo]", uint64_t(200), uint64_t(10));
+    addFunctionSamples(&ProfMap, "[main:3 @ foo:2.1 @ bar]", uint64_t(100),
+                       uint64_t(20));
+    addFunctionSamples(&ProfMap, "[baz:1 @ qux]", uint64_t(50), uint64_t(5));
+
+    createWriter(Format, ProfileFile);
+    EC = Writer->write(ProfMap);
+    ASSERT_TRUE(NoError(EC));
+    Writer->getOutputStream().flush();
+
+    // The contexts that involve a function of the module are read, whichever
+    // frame it is in.
+    Module M("my_module", Context);
+    FunctionType *FnType =
+        FunctionType::get(Type::getVoidTy(Context), {}, false);
+    M.getOrInsertFunction("foo", FnType);
+    readProfile(M, ProfileFile);
+    EC = Reader->read();
+    ASSERT_TRUE(NoError(EC));
+    ASSERT_TRUE(Reader->profileIsCS());
+    ASSERT_EQ(2u, Reader->getProfiles().size());
+    FunctionSamples *Samples = Reader->getSamplesFor("[main:3 @ foo]");
+    ASSERT_TRUE(Samples != nullptr);
+    ASSERT_EQ(200u, Samples->getTotalSamples());
+    Samples = Reader->getSamplesFor("[main:3 @ foo:2.1 @ bar]");
+    ASSERT_TRUE(Samples != nullptr);
+    ASSERT_EQ(20u, Samples->getHeadSamples());
+    ASSERT_TRUE(Reader->getSamplesFor("main") == nullptr);
+    ASSERT_TRUE(Reader->getSamplesFor("[baz:1 @ qux]") == nullptr);
+  }
+
+  void testProfileSymbolList(SampleProfileFormat Format) {
+    SmallVector<char, 128> ProfilePath;
+    std::error_code EC;
+    EC = llvm::sys::fs::createTemporaryFile("profile", "", ProfilePath);
+    ASSERT_TRUE(NoError(EC));
+    StringRef ProfileFile(ProfilePath.data(), ProfilePath.size());
+
+    StringMap<FunctionSamples> ProfMap;
+    addFunctionSamples(&ProfMap, "foo", uint64_t(100), uint64_t(10));
+
+    ProfileSymbolList List;
+    List.add("foo");
+    List.add("cold");
+    List.add("foo");
+    ASSERT_EQ(2u, List.size());
+
+    createWriter(Format, ProfileFile);
+    Writer->setProfileSymbolList(&List);
+    EC = Writer->write(ProfMap);
+    ASSERT_TRUE(NoError(EC));
+    Writer->getOutputStream().flush();
+
+    Module M("my_module", Context);
+    FunctionType *FnType =
+        FunctionType::get(Type::getVoidTy(Context), {}, false);
+    M.getOrInsertFunction("foo", FnType);
+    readProfile(M, ProfileFile);
+    EC = Reader->read();
+    ASSERT_TRUE(NoError(EC));
+    ASSERT_TRUE(Reader->getSamplesFor("foo") != nullptr);
+    std::unique_ptr<ProfileSymbolList> ReadList =
+        Reader->getProfileSymbolList();
+    if (Format != SampleProfileFormat::SPF_Ext_Binary) {
+      ASSERT_TRUE(ReadList == nullptr);
+      return;
+    }
+    ASSERT_TRUE(ReadList != nullptr);
+    ASSERT_EQ(2u, ReadList->size());
+    ASSERT_TRUE(ReadList->contains("foo"));
+    ASSERT_TRUE(ReadList->contains("cold"));
+    ASSERT_FALSE(ReadList->contains("new"));
+  }
+
+  std::unique_ptr<SampleProfileReader> readAllProfiles(StringRef Profile) {
+    auto ReaderOrErr = SampleProfileReader::create(Profile, Context);
+    EXPECT_TRUE(NoError(ReaderOrErr.getError()));
+    if (!ReaderOrErr)
+      return nullptr;
+    std::unique_ptr<SampleProfileReader> R = std::move(ReaderOrErr.get());
+    EXPECT_TRUE(NoError(R->read()));
+    return R;
+  }
+
+  void testAppend(SampleProfileFormat Format) {
+    SmallVector<char, 128> BasePath, AppendedPath, MergedPath;
+    ASSERT_TRUE(NoError(
+        llvm::sys::fs::createTemporaryFile("profile", "", BasePath)));
+    ASSERT_TRUE(NoError(
+        llvm::sys::fs::createTemporaryFile("profile", "", AppendedPath)));
+    ASSERT_TRUE(NoError(
+        llvm::sys::fs::createTemporaryFile("profile", "", MergedPath)));
+    StringRef BaseFile(BasePath.data(), BasePath.size());
+    StringRef AppendedFile(AppendedPath.data(), AppendedPath.size());
+    StringRef MergedFile(MergedPath.data(), MergedPath.size());
+
+    StringMap<FunctionSamples> BaseMap;
+    addFunctionSamples(&BaseMap, "foo", uint64_t(20301), uint64_t(1437));
+    addFunctionSamples(&BaseMap, "bar", uint64_t(20303), uint64_t(1439));
+    addFunctionSamples(&BaseMap, "baz", uint64_t(20305), uint64_t(1441));
+    BaseMap["baz"].addCalledTargetSamples(1, 0, "foo", 100);
+    createWriter(Format, BaseFile);
+    ASSERT_TRUE(NoError(Writer->write(BaseMap)));
+    Writer->getOutputStream().flush();
+
+    StringMap<FunctionSamples> Delta;
+    addFunctionSamples(&Delta, "bar", uint64_t(500), uint64_t(50));
+    Delta["bar"].addBodySamples(2, 0, 7);
+    Delta["bar"].addCalledTargetSamples(2, 0, "qux", 7);
+    addFunctionSamples(&Delta, "qux", uint64_t(30000), uint64_t(2000));
+
+    // Only the base profiles of the functions of the delta are read.
+    auto ReaderOrErr = SampleProfileReader::create(BaseFile, Context);
+    ASSERT_TRUE(NoError(ReaderOrErr.getError()));
+    std::unique_ptr<SampleProfileReader> Base = std::move(ReaderOrErr.get());
+    auto &ExtBase = static_cast<SampleProfileReaderExtBinary &>(*Base);
+    ASSERT_TRUE(ExtBase.hasCountHistogram());
+    ExtBase.setFuncsToUse({"bar", "qux"});
+    ASSERT_TRUE(NoError(Base->read()));
+    ASSERT_EQ(1u, Base->getProfiles().size());
+    StringMap<FunctionSamples> Changed = Delta;
+    Changed["bar"].merge(Base->getProfiles().find("bar")->second);
+    createWriter(Format, AppendedFile);
+    ASSERT_TRUE(NoError(Writer->append(*Base, Changed)));
+    Writer->getOutputStream().flush();
+
+    StringMap<FunctionSamples> MergedMap = BaseMap;
+    for (const auto &I : Delta)
+      MergedMap[I.getKey()].merge(I.second);
+    createWriter(Format, MergedFile);
+    ASSERT_TRUE(NoError(Writer->write(MergedMap)));
+    Writer->getOutputStream().flush();
+
+    // The appended profile reads back as the merged one, summary included.
+    auto Appended = readAllProfiles(AppendedFile);
+    auto Merged = readAllProfiles(MergedFile);
+    ASSERT_TRUE(Appended && Merged);
+    ASSERT_EQ(4u, Appended->getProfiles().size());
+    for (const auto &I : MergedMap) {
+      FunctionSamples *Samples = Appended->getSamplesFor(I.getKey());
+      ASSERT_TRUE(Samples != nullptr);
+      ASSERT_EQ(I.second.getTotalSamples(), Samples->getTotalSamples());
+      ASSERT_EQ(I.second.getHeadSamples(), Samples->getHeadSamples());
+      ASSERT_EQ(I.second.getBodySamples().size(),
+                Samples->getBodySamples().size());
+    }
+    FunctionSamples *Bar = Appended->getSamplesFor("bar");
+    ASSERT_EQ(1489u, Bar->getBodySamples().find(LineLocation(1, 0))
+                         ->second.getSamples());
+    ASSERT_EQ(7u, Bar->findCallTargetMapAt(2, 0).get()["qux"]);
+    ASSERT_EQ(100u,
+              Appended->getSamplesFor("baz")->findCallTargetMapAt(1, 0).get()
+                  ["foo"]);
+
+    ProfileSummary &AppendedSummary = Appended->getSummary();
+    ProfileSummary &MergedSummary = Merged->getSummary();
+    ASSERT_EQ(MergedSummary.getTotalCount(), AppendedSummary.getTotalCount());
+    ASSERT_EQ(MergedSummary.getMaxCount(), AppendedSummary.getMaxCount());
+    ASSERT_EQ(MergedSummary.getMaxFunctionCount(),
+              AppendedSummary.getMaxFunctionCount());
+    ASSERT_EQ(MergedSummary.getNumCounts(), AppendedSummary.getNumCounts());
+    ASSERT_EQ(MergedSummary.getNumFunctions(),
+              AppendedSummary.getNumFunctions());
+    const auto &MergedEntries = MergedSummary.getDetailedSummary();
+    const auto &AppendedEntries = AppendedSummary.getDetailedSummary();
+    ASSERT_EQ(MergedEntries.size(), AppendedEntries.size());
+    for (size_t I = 0; I < MergedEntries.size(); ++I) {
+      ASSERT_EQ(MergedEntries[I].Cutoff, AppendedEntries[I].Cutoff);
+      ASSERT_EQ(MergedEntries[I].MinCount, AppendedEntries[I].MinCount);
+      ASSERT_EQ(MergedEntries[I].NumCounts, AppendedEntries[I].NumCounts);
+    }
+  }
 };
 
 TEST_F(SampleProfTest, roundtrip_text_profile) {
@@ -281,10 +555,120 @@ TEST_F(SampleProfTest, roundtrip_raw_binary_profile) {
   testRoundTrip(SampleProfileFormat::SPF_Binary, false);
 }
 
+TEST_F(SampleProfTest, roundtrip_ext_binary_profile) {
+  testRoundTrip(SampleProfileFormat::SPF_Ext_Binary, false);
+}
+
+TEST_F(SampleProfTest, roundtrip_compressed_ext_binary_profile) {
+  if (!zlib::isAvailable())
+    return;
+  CompressAllSections = true;
+  testRoundTrip(SampleProfileFormat::SPF_Ext_Binary, false);
+}
+
 TEST_F(SampleProfTest, roundtrip_compact_binary_profile) {
   testRoundTrip(SampleProfileFormat::SPF_Compact_Binary, false);
 }
 
+TEST_F(SampleProfTest, read_funcs_to_use_raw_binary_profile) {
+  testReadFuncsToUse(SampleProfileFormat::SPF_Binary);
+}
+
+TEST_F(SampleProfTest, read_funcs_to_use_ext_binary_profile) {
+  testReadFuncsToUse(SampleProfileFormat::SPF_Ext_Binary);
+}
+
+TEST_F(SampleProfTest, read_funcs_to_use_compressed_ext_binary_profile) {
+  if (!zlib::isAvailable())
+    return;
+  CompressAllSections = true;
+  testReadFuncsToUse(SampleProfileFormat::SPF_Ext_Binary);
+}
+
+TEST_F(SampleProfTest, read_funcs_to_use_compact_binary_profile) {
+  testReadFuncsToUse(SampleProfileFormat::SPF_Compact_Binary);
+}
+
+TEST_F(SampleProfTest, read_contexts_raw_binary_profile) {
+  testReadContexts(SampleProfileFormat::SPF_Binary);
+}
+
+TEST_F(SampleProfTest, read_contexts_ext_binary_profile) {
+  testReadContexts(SampleProfileFormat::SPF_Ext_Binary);
+}
+
+TEST_F(SampleProfTest, profile_symbol_list_ext_binary_profile) {
+  testProfileSymbolList(SampleProfileFormat::SPF_Ext_Binary);
+}
+
+TEST_F(SampleProfTest, profile_symbol_list_compressed_ext_binary_profile) {
+  if (!zlib::isAvailable())
+    return;
+  CompressAllSections = true;
+  testProfileSymbolList(SampleProfileFormat::SPF_Ext_Binary);
+}
+
+TEST_F(SampleProfTest, append_ext_binary_profile) {
+  testAppend(SampleProfileFormat::SPF_Ext_Binary);
+}
+
+TEST_F(SampleProfTest, append_compressed_ext_binary_profile) {
+  if (!zlib::isAvailable())
+    return;
+  CompressAllSections = true;
+  testAppend(SampleProfileFormat::SPF_Ext_Binary);
+}
+
+TEST_F(SampleProfTest, append_raw_binary_profile) {
+  SmallVector<char, 128> ProfilePath;
+  ASSERT_TRUE(NoError(
+      llvm::sys::fs::createTemporaryFile("profile", "", ProfilePath)));
+  StringRef ProfileFile(ProfilePath.data(), ProfilePath.size());
+  StringMap<FunctionSamples> ProfMap;
+  addFunctionSamples(&ProfMap, "foo", uint64_t(100), uint64_t(10));
+  createWriter(SampleProfileFormat::SPF_Binary, ProfileFile);
+  ASSERT_TRUE(NoError(Writer->write(ProfMap)));
+  Writer->getOutputStream().flush();
+  auto Base = readAllProfiles(ProfileFile);
+  ASSERT_TRUE(Base != nullptr);
+  createWriter(SampleProfileFormat::SPF_Binary, ProfileFile);
+  ASSERT_EQ(sampleprof_error::unsupported_writing_format,
+            Writer->append(*Base, ProfMap));
+}
+
+TEST_F(SampleProfTest, profile_symbol_list_raw_binary_profile) {
+  testProfileSymbolList(SampleProfileFormat::SPF_Binary);
+}
+
+TEST_F(SampleProfTest, context_names) {
+  SmallVector<SampleContextFrame, 4> Frames;
+  ASSERT_TRUE(SampleContext::parse("[main:3 @ _Z3fooi:2.1 @ _Z3bari]", Frames));
+  ASSERT_EQ(3u, Frames.size());
+  ASSERT_EQ("main", Frames[0].FuncName);
+  ASSERT_EQ(LineLocation(3, 0), Frames[0].CallSite);
+  ASSERT_EQ("_Z3fooi", Frames[1].FuncName);
+  ASSERT_EQ(LineLocation(2, 1), Frames[1].CallSite);
+  ASSERT_EQ("_Z3bari", Frames[2].FuncName);
+  ASSERT_EQ("[main:3 @ _Z3fooi:2.1 @ _Z3bari]", SampleContext::getName(Frames));
+
+  // A function name may contain colons, only the last one of a caller
+  // starts its callsite.
+  ASSERT_TRUE(SampleContext::parse("[a::b:1 @ c::d]", Frames));
+  ASSERT_EQ("a::b", Frames[0].FuncName);
+  ASSERT_EQ("c::d", Frames[1].FuncName);
+
+  ASSERT_TRUE(SampleContext::parse("[main]", Frames));
+  ASSERT_EQ(1u, Frames.size());
+
+  ASSERT_FALSE(SampleContext::isContext("main"));
+  ASSERT_FALSE(SampleContext::parse("main:3 @ foo", Frames));
+  ASSERT_FALSE(SampleContext::parse("[]", Frames));
+  ASSERT_FALSE(SampleContext::parse("[main @ foo]", Frames));
+  ASSERT_FALSE(SampleContext::parse("[main:x @ foo]", Frames));
+  ASSERT_FALSE(SampleContext::parse("[main:70000 @ foo]", Frames));
+  ASSERT_FALSE(SampleContext::parse("[main:3 @ ]", Frames));
+}
+
 TEST_F(SampleProfTest, remap_text_profile) {
   testRoundTrip(SampleProfileFormat::SPF_Text, true);
 }
@@ -293,6 +677,90 @@ TEST_F(SampleProfTest, remap_raw_binary_profile) {
   testRoundTrip(SampleProfileFormat::SPF_Binary, true);
 }
 
+TEST_F(SampleProfTest, remap_module_functions_text_profile) {
+  RemapModuleFunctions = true;
+  testRoundTrip(SampleProfileFormat::SPF_Text, true);
+}
+
+TEST_F(SampleProfTest, remap_compact_binary_profile) {
+  WriteOriginalNames = true;
+  testRoundTrip(SampleProfileFormat::SPF_Compact_Binary, true);
+}
+
+TEST_F(SampleProfTest, remap_module_functions_compact_binary_profile) {
+  WriteOriginalNames = true;
+  RemapModuleFunctions = true;
+  testRoundTrip(SampleProfileFormat::SPF_Compact_Binary, true);
+}
+
+TEST_F(SampleProfTest, remap_ext_binary_profile) {
+  testRoundTrip(SampleProfileFormat::SPF_Ext_Binary, true);
+}
+
+TEST_F(SampleProfTest, flat_profile_lookups) {
+  FunctionSamples FooSamples;
+  FooSamples.setName("foo");
+  FooSamples.addTotalSamples(1000);
+  FooSamples.addHeadSamples(10);
+  FooSamples.addBodySamples(2, 0, 10);
+  FooSamples.addBodySamples(2, 1, 20);
+  FooSamples.addCalledTargetSamples(5, 0, "zoo", 7);
+  FooSamples.addCalledTargetSamples(5, 0, "bar", 3);
+
+  // Two callees inlined at 1, one at 3.
+  FunctionSamples &BarSamples =
+      FooSamples.functionSamplesAt(LineLocation(1, 0))["bar"];
+  BarSamples.setName("bar");
+  BarSamples.addTotalSamples(100);
+  BarSamples.addBodySamples(1, 0, 40);
+  FunctionSamples &BazSamples =
+      FooSamples.functionSamplesAt(LineLocation(1, 0))["baz"];
+  BazSamples.setName("baz");
+  BazSamples.addTotalSamples(200);
+  BazSamples.addBodySamples(1, 0, 60);
+  FunctionSamples &QuxSamples =
+      FooSamples.functionSamplesAt(LineLocation(3, 0))["qux"];
+  QuxSamples.setName("qux");
+  QuxSamples.addTotalSamples(50);
+  QuxSamples.addBodySamples(1, 0, 5);
+
+  FlatSampleProfileMap FlatProfiles;
+  const FlatFunctionSamples *Foo = FlatProfiles.add("foo", FooSamples);
+  ASSERT_EQ(Foo, FlatProfiles.find("foo"));
+  ASSERT_TRUE(FlatProfiles.find("bar") == nullptr);
+
+  ASSERT_EQ("foo", Foo->getName());
+  ASSERT_EQ(1000u, Foo->getTotalSamples());
+  ASSERT_EQ(10u, Foo->getHeadSamples());
+  ASSERT_EQ(3u, Foo->getBodySamples().size());
+  ASSERT_EQ(3u, Foo->getCallsiteSamples().size());
+  ASSERT_EQ(20u, Foo->findSamplesAt(2, 1).get());
+  ASSERT_FALSE(Foo->findSamplesAt(2, 2));
+
+  // Call targets come out sorted by name.
+  ArrayRef<FlatCallTarget> Targets = Foo->findCallTargetsAt(5, 0).get();
+  ASSERT_EQ(2u, Targets.size());
+  ASSERT_EQ("bar", Targets[0].Name);
+  ASSERT_EQ(3u, Targets[0].Samples);
+  ASSERT_EQ("zoo", Targets[1].Name);
+  ASSERT_EQ(7u, Targets[1].Samples);
+
+  // Same answers as FunctionSamples, including the fallback to the hottest
+  // callee when the name does not match.
+  ASSERT_EQ(FooSamples.getEntrySamples(), Foo->getEntrySamples());
+  ASSERT_EQ(100u, Foo->getEntrySamples());
+  ASSERT_EQ(2u, Foo->findCallsiteSamplesAt(LineLocation(1, 0)).size());
+  ASSERT_TRUE(Foo->findCallsiteSamplesAt(LineLocation(2, 0)).empty());
+  ASSERT_EQ("bar", Foo->findFunctionSamplesAt(LineLocation(1, 0), "bar")
+                       ->getName());
+  ASSERT_EQ("baz", Foo->findFunctionSamplesAt(LineLocation(1, 0), "other")
+                       ->getName());
+  ASSERT_EQ("qux", Foo->findFunctionSamplesAt(LineLocation(3, 0), "qux")
+                       ->getName());
+  ASSERT_TRUE(Foo->findFunctionSamplesAt(LineLocation(4, 0), "qux") ==
+              nullptr);
+}
+
 TEST_F(SampleProfTest, sample_overflow_saturation) {
   const uint64_t Max = std::numeric_limits<uint64_t>::max();
   sampleprof_error Result;
@@ -323,6 +791,66 @@ TEST_F(SampleProfTest, sample_overflow_saturation) {
   ASSERT_EQ(BodySamples.get(), Max);
 }
 
+TEST_F(SampleProfTest, read_numbers_of_every_size) {
+  // Counts and discriminators taking from one to ten ULEB128 bytes, in
+  // records read both in bulk and, near the end of the profile, one number at
+  // a time.
+  const uint64_t Max = std::numeric_limits<uint64_t>::max();
+  StringRef FooName("_Z3fooi");
+  StringRef BarName("_Z3bari");
+  FunctionSamples FooSamples;
+  FooSamples.setName(FooName);
+  FooSamples.addHeadSamples(Max);
+  for (uint32_t I = 0; I < 64; ++I) {
+    uint64_t Count = Max >> I;
+    FooSamples.addBodySamples(I << (I % 10), I << (I % 26), Count);
+    FooSamples.addTotalSamples(Count);
+    if (I % 4 == 0)
+      FooSamples.addCalledTargetSamples(I << (I % 10), I << (I % 26),
+                                        BarName, Count >> 1);
+  }
+  FunctionSamples &Inlined = FooSamples.functionSamplesAt(
+      LineLocation(1 << 15, 1 << 20))[BarName];
+  Inlined.setName(BarName);
+  Inlined.addBodySamples(1 << 14, 1 << 30, Max);
+
+  for (SampleProfileFormat Format :
+       {SPF_Binary, SPF_Compact_Binary, SPF_Ext_Binary}) {
+    SmallVector<char, 128> ProfilePath;
+    ASSERT_TRUE(NoError(
+        llvm::sys::fs::createTemporaryFile("profile", "", ProfilePath)));
+    StringRef Profile(ProfilePath.data(), ProfilePath.size());
+    createWriter(Format, Profile);
+    StringMap<FunctionSamples> Profiles;
+    Profiles[FooName] = FooSamples;
+    ASSERT_TRUE(NoError(Writer->write(Profiles)));
+    Writer.reset();
+
+    auto ReaderOrErr = SampleProfileReader::create(Profile, Context);
+    ASSERT_TRUE(NoError(ReaderOrErr.getError()));
+    Reader = std::move(ReaderOrErr.get());
+    ASSERT_TRUE(NoError(Reader->read()));
+    FunctionSamples *ReadFooSamples = Reader->getSamplesFor(FooName);
+    ASSERT_TRUE(ReadFooSamples != nullptr);
+    ASSERT_EQ(FooSamples.getTotalSamples(), ReadFooSamples->getTotalSamples());
+    ASSERT_EQ(Max, ReadFooSamples->getHeadSamples());
+    for (uint32_t I = 0; I < 64; ++I) {
+      ErrorOr<uint64_t> Count =
+          ReadFooSamples->findSamplesAt(I << (I % 10), I << (I % 26));
+      ASSERT_TRUE(bool(Count));
+      ASSERT_EQ(Max >> I, *Count);
+    }
+    const FunctionSamples *ReadInlined =
+        ReadFooSamples->findFunctionSamplesAt(LineLocation(1 << 15, 1 << 20),
+                                              BarName);
+    ASSERT_TRUE(ReadInlined != nullptr);
+    ErrorOr<uint64_t> Count = ReadInlined->findSamplesAt(1 << 14, 1 << 30);
+    ASSERT_TRUE(bool(Count));
+    ASSERT_EQ(Max, *Count);
+    sys::fs::remove(Profile);
+  }
+}
+
 TEST_F(SampleProfTest, default_suffix_elision_text) {
   // Default suffix elision policy: strip everything after first dot.
   // This implies that all suffix variants will map to "foo", so
@@ -396,4 +924,80 @@ TEST_F(SampleProfTest, none_suffix_elision_compact_binary) {
                           Expected);
 }
 
+TEST_F(SampleProfTest, trim_cold_profiles) {
+  StringMap<FunctionSamples> Profiles;
+  FunctionSamples &Main = Profiles["main"];
+  Main.setName("main");
+  Main.addTotalSamples(1100);
+  Main.addBodySamples(1, 0, 1000);
+  Main.addBodySamples(2, 0, 60);
+  FunctionSamples &Hot = Main.functionSamplesAt(LineLocation(1, 0))["hot"];
+  Hot.setName("hot");
+  Hot.addTotalSamples(30);
+  Hot.addBodySamples(1, 0, 30);
+  FunctionSamples &Cold = Main.functionSamplesAt(LineLocation(2, 0))["cold"];
+  Cold.setName("cold");
+  Cold.addTotalSamples(10);
+  Cold.addBodySamples(1, 0, 4);
+  Cold.addBodySamples(2, 0, 6);
+  FunctionSamples &Rare = Profiles["rare"];
+  Rare.setName("rare");
+  Rare.addTotalSamples(8);
+  Rare.addBodySamples(1, 0, 8);
+
+  SampleProfileTrimmer Trimmer(Profiles);
+  ASSERT_EQ(sampleprof_error::success, Trimmer.flattenColdCallsites(10));
+
+  // The cold callee is now called from main.
+  ASSERT_EQ(1090u, Main.getTotalSamples());
+  ASSERT_EQ(1u, Main.getCallsiteSamples().size());
+  ErrorOr<SampleRecord::CallTargetMap> Targets =
+      Main.findCallTargetMapAt(2, 0);
+  ASSERT_TRUE(bool(Targets));
+  ASSERT_EQ(4u, Targets->lookup("cold"));
+  ASSERT_EQ(4u, Profiles["cold"].getHeadSamples());
+  ASSERT_EQ(10u, Profiles["cold"].getTotalSamples());
+  ASSERT_EQ("cold", Profiles["cold"].getName());
+
+  Trimmer.trimColdProfiles(10);
+  ASSERT_EQ(1u, Profiles.size());
+  ASSERT_EQ(1u, Profiles.count("main"));
+}
+
+TEST_F(SampleProfTest, flatten_cold_callsite_with_hot_callee) {
+  StringMap<FunctionSamples> Profiles;
+  FunctionSamples &Main = Profiles["main"];
+  Main.setName("main");
+  Main.addTotalSamples(1000);
+  Main.addBodySamples(1, 0, 990);
+  auto &Callees = Main.functionSamplesAt(LineLocation(2, 0));
+  FunctionSamples &Cold = Callees["cold"];
+  Cold.setName(Callees.find("cold")->first);
+  Cold.addTotalSamples(10);
+  Cold.addHeadSamples(2);
+  Cold.addBodySamples(1, 0, 2);
+  auto &NestedCallees = Cold.functionSamplesAt(LineLocation(3, 0));
+  FunctionSamples &Warm = NestedCallees["warm"];
+  Warm.setName(NestedCallees.find("warm")->first);
+  Warm.addTotalSamples(40);
+  Warm.addBodySamples(1, 0, 40);
+
+  SampleProfileTrimmer Trimmer(Profiles);
+  ASSERT_EQ(sampleprof_error::success, Trimmer.flattenColdCallsites(10));
+
+  // The warm callee stays inlined into the outlined profile of the cold one,
+  // and is named after storage that the profiles own.
+  ASSERT_EQ(0u, Main.getCallsiteSamples().size());
+  const FunctionSamples &Outlined = Profiles["cold"];
+  ASSERT_EQ("cold", Outlined.getName());
+  const FunctionSamplesMap *Nested =
+      Outlined.findFunctionSamplesMapAt(LineLocation(3, 0));
+  ASSERT_TRUE(Nested != nullptr);
+  auto NestedIt = Nested->find("warm");
+  ASSERT_TRUE(NestedIt != Nested->end());
+  ASSERT_EQ("warm", NestedIt->second.getName());
+  ASSERT_EQ(NestedIt->first.data(), NestedIt->second.getName().data());
+  ASSERT_EQ(40u, NestedIt->second.getTotalSamples());
+}
+
 } // end anonymous namespace
@@ -8,6 +8,10 @@
 
 #include "llvm/Support/CachePruning.h"
 #include "llvm/Support/Error.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
 #include "gtest/gtest.h"
 
 using namespace llvm;
@@ -94,3 +98,90 @@ TEST(CachePruningPolicyParser, Errors) {
   EXPECT_EQ("Unknown key: 'foo'",
             toString(parseCachePruningPolicy("foo=bar").takeError()));
 }
+
+namespace {
+class CachePruningIndexTest : public testing::Test {
+protected:
+  SmallString<128> CacheDir;
+  uint64_t Now;
+
+  void SetUp() override {
+    ASSERT_FALSE(sys::fs::createUniqueDirectory("CachePruning-test", CacheDir));
+    Now = std::chrono::duration_cast<std::chrono::seconds>(
+              std::chrono::system_clock::now().time_since_epoch())
+              .count();
+  }
+
+  void TearDown() override { sys::fs::remove_directories(CacheDir); }
+
+  std::string getPath(StringRef Name) {
+    SmallString<128> Path(CacheDir);
+    sys::path::append(Path, Name);
+    return Path.str();
+  }
+
+  void writeFile(StringRef Name, StringRef Contents) {
+    std::error_code EC;
+    raw_fd_ostream OS(getPath(Name), EC, sys::fs::F_None);
+    ASSERT_FALSE(EC);
+    OS << Contents;
+  }
+
+  bool exists(StringRef Name) { return sys::fs::exists(getPath(Name)); }
+};
+} // anonymous namespace
+
+TEST_F(CachePruningIndexTest, PrunesIndexedEntries) {
+  // Entries a and b share their contents, c and old have their own.
+  writeFile("llvmcache-content-x", "0123456789");
+  writeFile("llvmcache-a", "0123456789");
+  writeFile("llvmcache-b", "0123456789");
+  writeFile("llvmcache-c", "0123456789");
+  writeFile("llvmcache-old", "0123456789");
+  writeFile("llvmcache-unindexed", "0123456789");
+  writeFile("llvmcache.index",
+            ("A llvmcache-old llvmcache-old 10 " + Twine(Now - 7200) + "\n" +
+             "A llvmcache-a llvmcache-content-x 10 " + Twine(Now - 100) +
+             "\n" + "A llvmcache-b llvmcache-content-x 10 " +
+             Twine(Now - 50) + "\n" + "A llvmcache-c llvmcache-c 10 " +
+             Twine(Now - 80) + "\n" + "U llvmcache-a " + Twine(Now - 10) +
+             "\n" + "U llvmcache-unknown " + Twine(Now) + "\n" +
+             "A llvmcache-partial llvmcache-partial 10")
+                .str());
+
+  CachePruningPolicy Policy;
+  Policy.Interval = std::chrono::seconds(0);
+  Policy.Expiration = std::chrono::hours(1);
+  Policy.MaxSizePercentageOfAvailableSpace = 0;
+  Policy.MaxSizeFiles = 2;
+  EXPECT_TRUE(pruneCache(CacheDir, Policy));
+  // The expired entry goes first, then the least recently used one.
+  EXPECT_FALSE(exists("llvmcache-old"));
+  EXPECT_FALSE(exists("llvmcache-c"));
+  EXPECT_TRUE(exists("llvmcache-a"));
+  EXPECT_TRUE(exists("llvmcache-b"));
+  EXPECT_TRUE(exists("llvmcache-content-x"));
+  EXPECT_TRUE(exists("llvmcache-unindexed"));
+  // The journal was merged into the snapshot.
+  EXPECT_FALSE(exists("llvmcache.index"));
+  auto Snapshot = MemoryBuffer::getFile(getPath("llvmcache.snapshot"));
+  ASSERT_TRUE(bool(Snapshot));
+  EXPECT_EQ(2u, (*Snapshot)->getBuffer().count('\n'));
+
+  // Shared contents are counted once, and removed with their last entry.
+  addCacheIndexEntry(CacheDir, "llvmcache-d", "llvmcache-d", 10);
+  writeFile("llvmcache-d", "0123456789");
+  Policy.MaxSizeFiles = 0;
+  Policy.MaxSizeBytes = 20;
+  EXPECT_TRUE(pruneCache(CacheDir, Policy));
+  EXPECT_TRUE(exists("llvmcache-a"));
+  EXPECT_TRUE(exists("llvmcache-b"));
+  EXPECT_TRUE(exists("llvmcache-d"));
+  Policy.MaxSizeBytes = 10;
+  EXPECT_TRUE(pruneCache(CacheDir, Policy));
+  EXPECT_FALSE(exists("llvmcache-a"));
+  EXPECT_FALSE(exists("llvmcache-b"));
+  EXPECT_FALSE(exists("llvmcache-content-x"));
+  EXPECT_TRUE(exists("llvmcache-d"));
+  EXPECT_TRUE(exists("llvmcache-unindexed"));
+}
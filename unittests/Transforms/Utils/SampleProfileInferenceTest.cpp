@@ -0,0 +1,114 @@
+//===- SampleProfileInferenceTest.cpp - Tests for applyFlowInference ------===//
+//
+// Part of the LLVM Project, under the Apache License v2.0 with LLVM Exceptions.
+// See https://llvm.org/LICENSE.txt for license information.
+// SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Transforms/Utils/SampleProfileInference.h"
+#include "llvm/ADT/ArrayRef.h"
+#include "gtest/gtest.h"
+#include <algorithm>
+
+using namespace llvm;
+
+namespace {
+
+// Build a function with the given blocks, where a negative weight stands for
+// a block without samples, and jumps.
+FlowFunction
+makeFunction(ArrayRef<int64_t> Weights,
+             ArrayRef<std::pair<unsigned, unsigned>> Jumps) {
+  FlowFunction Func;
+  for (int64_t W : Weights) {
+    FlowBlock Block;
+    if (W >= 0) {
+      Block.HasWeight = true;
+      Block.Weight = W;
+    }
+    Func.Blocks.push_back(Block);
+  }
+  for (const auto &J : Jumps) {
+    FlowJump Jump;
+    Jump.Source = J.first;
+    Jump.Target = J.second;
+    Func.Jumps.push_back(Jump);
+  }
+  return Func;
+}
+
+// Check that the counts of Func form a flow from its entry to its exits.
+void checkFlowIsConsistent(const FlowFunction &Func) {
+  std::vector<uint64_t> In(Func.Blocks.size()), Out(Func.Blocks.size());
+  for (const FlowJump &Jump : Func.Jumps) {
+    Out[Jump.Source] += Jump.Flow;
+    In[Jump.Target] += Jump.Flow;
+  }
+  for (unsigned B = 0; B < Func.Blocks.size(); ++B) {
+    if (B != Func.Entry) {
+      EXPECT_EQ(In[B], Func.Blocks[B].Flow) << "block " << B;
+    }
+    bool IsExit = std::none_of(
+        Func.Jumps.begin(), Func.Jumps.end(),
+        [&](const FlowJump &Jump) { return Jump.Source == B; });
+    if (!IsExit) {
+      EXPECT_EQ(Out[B], Func.Blocks[B].Flow) << "block " << B;
+    }
+  }
+}
+
+// The branches of 1 and 2 can only be resolved from the weights of 3 and 4,
+// two blocks further down.
+TEST(SampleProfileInferenceTest, UnknownBranches) {
+  FlowFunction Func = makeFunction(
+      {100, -1, -1, 60, 40, 100},
+      {{0, 1}, {0, 2}, {1, 3}, {1, 5}, {2, 4}, {2, 5}, {3, 5}, {4, 5}});
+  applyFlowInference(Func);
+  checkFlowIsConsistent(Func);
+
+  std::vector<uint64_t> BlockFlows;
+  for (const FlowBlock &Block : Func.Blocks)
+    BlockFlows.push_back(Block.Flow);
+  EXPECT_EQ(std::vector<uint64_t>({100, 60, 40, 60, 40, 100}), BlockFlows);
+  std::vector<uint64_t> JumpFlows;
+  for (const FlowJump &Jump : Func.Jumps)
+    JumpFlows.push_back(Jump.Flow);
+  EXPECT_EQ(std::vector<uint64_t>({60, 40, 60, 0, 40, 0, 60, 40}), JumpFlows);
+}
+
+// The weight of the middle block is too low: increasing it is cheaper than
+// decreasing the weights of the other two.
+TEST(SampleProfileInferenceTest, InconsistentWeights) {
+  FlowFunction Func = makeFunction({100, 50, 100}, {{0, 1}, {1, 2}});
+  applyFlowInference(Func);
+  checkFlowIsConsistent(Func);
+
+  for (const FlowBlock &Block : Func.Blocks)
+    EXPECT_EQ(100u, Block.Flow);
+}
+
+// A loop whose body runs ten times per entry into the function.
+TEST(SampleProfileInferenceTest, Loop) {
+  FlowFunction Func =
+      makeFunction({10, -1, 100, 10}, {{0, 1}, {1, 2}, {2, 1}, {1, 3}});
+  applyFlowInference(Func);
+  checkFlowIsConsistent(Func);
+
+  EXPECT_EQ(110u, Func.Blocks[1].Flow);
+  EXPECT_EQ(100u, Func.Jumps[2].Flow);
+  EXPECT_EQ(10u, Func.Jumps[3].Flow);
+}
+
+// The flow avoids the blocks that are known to be cold.
+TEST(SampleProfileInferenceTest, ColdBlocks) {
+  FlowFunction Func = makeFunction(
+      {50, 0, -1, 50}, {{0, 1}, {0, 2}, {1, 3}, {2, 3}});
+  applyFlowInference(Func);
+  checkFlowIsConsistent(Func);
+
+  EXPECT_EQ(0u, Func.Blocks[1].Flow);
+  EXPECT_EQ(50u, Func.Blocks[2].Flow);
+}
+
+} // end anonymous namespace